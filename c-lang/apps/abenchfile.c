@@ -0,0 +1,151 @@
+// abenchfile.c - Adept file reading benchmark
+//
+// Reads files line by line with each of the afile reading methods and prints
+// how fast each one went, to compare them on local disks.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+
+#include "astr.h"
+#include "afile.h"
+#include "afile_uring.h"
+
+int evict_flag = 0;
+size_t block_size = 256 * 1024;
+int depth = 8;
+
+typedef struct method {
+	char *name;
+	int io_backend;
+	int prefetch_depth;
+} method;
+
+static double wall_time(void) {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+// Drop the file's pages from the page cache, so it is read from the disk.
+static void evict_file(const char *filename) {
+	int fd = open(filename, O_RDONLY);
+	if (fd >= 0) {
+		fdatasync(fd);
+		posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+		close(fd);
+	}
+}
+
+// ----------
+
+int bench_file(astr *inputname, const method *m) {
+	afile *af;
+	afile_reader *reader;
+	astr_view line;
+	long nlines = 0;
+	double nbytes = 0;
+	double started;
+	double elapsed;
+	int result;
+
+	if (evict_flag) {
+		evict_file(inputname->string);
+	}
+
+	af = afile_create_explicit(inputname, NULL, block_size, _IOFBF);
+	afile_set_io_backend(af, m->io_backend);
+	afile_set_prefetch_depth(af, m->prefetch_depth);
+	result = afile_open(af);
+	if (result != 0) {
+		afile_free(af);
+		return result;
+	}
+
+	started = wall_time();
+	reader = afile_reader_create(af);
+	for (line = afile_reader_next(reader); line.string != NULL; line = afile_reader_next(reader)) {
+		nlines++;
+		nbytes += line.length;
+	}
+	result = reader->error;
+	afile_reader_free(reader);
+	elapsed = wall_time() - started;
+
+	printf("%-24s %-10s %12ld lines %10.1f MB/s %8ld stalls\n", inputname->string, m->name, nlines,
+		(elapsed > 0 ? nbytes / elapsed / 1e6 : 0.0), af->prefetch_stats.consumer_stalls);
+
+	afile_free(af);
+	return result;
+}
+
+// ----------
+
+int main(int argc, char *argv[]) {
+	method methods[] = {
+		{"read", AFILE_IO_READ, 0},
+		{"prefetch", AFILE_IO_READ, 0},
+		{"pread", AFILE_IO_PREAD, 0},
+		{"io_uring", AFILE_IO_URING, 0},
+	};
+	int nmethods = sizeof(methods) / sizeof(methods[0]);
+	astr *inputname;
+	int result;
+	int i;
+	int j;
+
+	for (i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "-h") == 0 || strcmp(argv[i], "--help") == 0) {
+			printf("Usage: abenchfile [-h | --help] [-e | --evict] [-b KB] [-d depth] filename [...]\n\n");
+			printf("-h or --help: Print this help message and exit without processing any files.\n");
+			printf("-e or --evict: Drop each file from the page cache before each read, so it is read from the disk.\n");
+			printf("-b KB: The block size in kilobytes.  The default is 256.\n");
+			printf("-d depth: The number of blocks read ahead, or reads in flight.  The default is 8.\n");
+			return 0;
+		}
+	}
+
+	for (i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "-e") == 0 || strcmp(argv[i], "--evict") == 0) {
+			evict_flag = 1;
+			continue;
+		}
+
+		if (strcmp(argv[i], "-b") == 0 && i + 1 < argc) {
+			block_size = (size_t)atol(argv[++i]) * 1024;
+			continue;
+		}
+
+		if (strcmp(argv[i], "-d") == 0 && i + 1 < argc) {
+			depth = atoi(argv[++i]);
+			continue;
+		}
+
+		if (strlen(argv[i]) > 0) {
+			methods[1].prefetch_depth = depth;
+			methods[2].prefetch_depth = depth;
+			methods[3].prefetch_depth = depth;
+			if (!afile_uring_available()) {
+				methods[3].name = "io_uring*";
+			}
+			inputname = astr_create(argv[i]);
+			for (j = 0; j < nmethods; j++) {
+				result = bench_file(inputname, &methods[j]);
+				if (result != 0) {
+					printf("abenchfile: %s: %s\n", argv[i], strerror(result));
+					break;
+				}
+			}
+			astr_free(inputname);
+		}
+	}
+
+	if (!afile_uring_available()) {
+		printf("* io_uring is not available here, so pread was used.\n");
+	}
+	return 0;
+}
@@ -14,8 +14,8 @@
 int verbose_flag = 0;
 int debug_flag = 0;
 
-int cat_file_line(astr *as) {
-	printf("%s\n", astr_right_trim(as)->string);
+int cat_file_line(astr_view line, void *ctx) {
+	return afile_write_line((afile_writer *)ctx, astr_view_right_trim(line));
 }
 
 // ----------
@@ -26,9 +26,9 @@ int cat_file_lines(astr *inputname) {
 	int buffermode = _IOLBF;
 	astr *open_mode;
 	afile *af;
+	afile_writer *writer;
 	int result;
-	int i;
-	int nlines;
+	long nlines;
 
 	open_mode = astr_create(read_mode);
 	af = afile_create_explicit(inputname, open_mode, buffersize, buffermode);
@@ -42,8 +42,17 @@ int cat_file_lines(astr *inputname) {
 		return 0;
 	}
 
-	// Process all lines.
-	nlines = afile_process_lines(af, cat_file_line);
+	// Process all lines, writing them to standard output with one thread.
+	fflush(stdout);
+	writer = afile_writer_create_fd(STDOUT_FILENO, 0, 1);
+	result = afile_process_views_ctx(af, NULL, cat_file_line, writer, &nlines);
+	if (result == 0) {
+		result = afile_writer_flush(writer);
+	}
+	writer = afile_writer_free(writer);
+	if (result != 0 && verbose_flag) {
+		fprintf(stderr, "acatfile: %s: %s\n", inputname->string, strerror(result));
+	}
 
 	result = afile_close(af);
 	if (result != 0) {
@@ -58,7 +67,7 @@ int cat_file_lines(astr *inputname) {
 	af = afile_free(af);
 	astr_free(open_mode);
 
-	return nlines;
+	return (int)nlines;
 }
 
 // ----------
@@ -8,14 +8,23 @@
 #include <string.h>
 #include <stdio.h>
 #include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
 
 #include "astr.h"
 #include "afile.h"
+#include "afile_decompress.h"
+#include "afile_uring.h"
 
 const char *default_open_modes = "r"; // readonly mode
 const size_t default_buffer_size = 16 * 1024; // 16KB buffer size
 const int default_buffering_mode = _IOLBF; // line buffering mode
 
+#define AFILE_IO_DEFAULT_DEPTH 4
+
 /*
  * afile_create
  *
@@ -34,6 +43,7 @@ afile *afile_create(astr *filespec, astr *open_modes) {
 	afile_set_open_modes(af, open_modes);
 	afile_set_buffer_size(af, default_buffer_size);
 	afile_set_buffering_mode(af, default_buffering_mode);
+	afile_set_separator(af, "\n", 1);
 
 	return af;
 }
@@ -59,6 +69,7 @@ afile *afile_create_explicit(astr *filespec, astr *open_modes, size_t buffer_siz
 	afile_set_open_modes(af, open_modes);
 	afile_set_buffer_size(af, buffer_size);
 	afile_set_buffering_mode(af, buffering_mode);
+	afile_set_separator(af, "\n", 1);
 
 	return af;
 }
@@ -144,6 +155,167 @@ void afile_set_buffer_size(afile *af, size_t size) {
 	}
 }
 
+/*
+ * afile_set_prefetch_depth
+ *
+ * Initialize the number of blocks a line reader reads ahead on its own
+ * thread.  The blocks are the size of the afile buffer, so the block size is
+ * the buffer size given to afile_create_explicit.  A depth of 2 is double
+ * buffering.  A depth of 0 or 1 reads on the calling thread, which is the
+ * default.
+ *
+ * This can only be set before the file is opened.
+ *
+ * Parameter: The afile instance
+ * Parameter: The number of blocks
+ */
+void afile_set_prefetch_depth(afile *af, int depth) {
+	if (af != NULL && af->file == NULL) {
+		af->prefetch_depth = (depth > 1 ? depth : 0);
+	}
+}
+
+/*
+ * afile_set_io_backend
+ *
+ * Initialize how a line reader reads the file and afile_write_buffer writes
+ * it: AFILE_IO_READ, the default, AFILE_IO_PREAD or AFILE_IO_URING.  The
+ * backend is chosen at run time; io_uring falls back to pread and pwrite
+ * where it is not available.
+ *
+ * This can only be set before the file is opened.
+ *
+ * Parameter: The afile instance
+ * Parameter: The backend
+ */
+void afile_set_io_backend(afile *af, int backend) {
+	if (af != NULL && af->file == NULL) {
+		if (backend == AFILE_IO_PREAD || backend == AFILE_IO_URING) {
+			af->io_backend = backend;
+		}
+		else {
+			af->io_backend = AFILE_IO_READ;
+		}
+	}
+}
+
+/*
+ * afile_set_compression
+ *
+ * Initialize the compression a line reader reads the file with:
+ * AFILE_COMPRESSION_AUTO, the default, finds it from the magic bytes at the
+ * start of the file; AFILE_COMPRESSION_NONE reads the file as it is; and
+ * AFILE_COMPRESSION_GZIP or AFILE_COMPRESSION_ZSTD decompresses it as that.
+ * With more than one thread, a regular file whose members say where they
+ * end is decompressed on that many threads at once.
+ *
+ * This can only be set before the file is opened.
+ *
+ * Parameter: The afile instance
+ * Parameter: The compression
+ * Parameter: The number of threads to decompress on
+ */
+void afile_set_compression(afile *af, int compression, int threads) {
+	if (af != NULL && af->file == NULL) {
+		if (compression >= AFILE_COMPRESSION_AUTO && compression <= AFILE_COMPRESSION_ZSTD) {
+			af->compression = compression;
+		}
+		else {
+			af->compression = AFILE_COMPRESSION_AUTO;
+		}
+		af->decompression_threads = (threads > 1 ? threads : 0);
+	}
+}
+
+/*
+ * afile_set_separator
+ *
+ * Set the separator that ends each record read by the processing functions,
+ * a byte or a string of up to AFILE_SEPARATOR_MAX bytes, which may be NULs.
+ * The default is a newline.  Setting a separator turns off fixed-length
+ * records.  It applies to the processing that starts after it is set.
+ *
+ * Parameter: The afile instance
+ * Parameter: The separator
+ * Parameter: Length of the separator
+ * Returns:   0 = success, EINVAL if the separator is empty or too long
+ */
+int afile_set_separator(afile *af, const char *separator, size_t length) {
+	if (af == NULL || separator == NULL || length == 0 || length > AFILE_SEPARATOR_MAX) {
+		return EINVAL;
+	}
+	memcpy(af->separator, separator, length);
+	af->separator_length = length;
+	af->record_length = 0;
+	return 0;
+}
+
+/*
+ * afile_set_record_length
+ *
+ * Set the processing functions to read records of a fixed length, with no
+ * separator; the last record of a file may be short.  A length of 0 goes
+ * back to records ended by the separator.  It applies to the processing that
+ * starts after it is set.
+ *
+ * Parameter: The afile instance
+ * Parameter: Length of each record
+ */
+void afile_set_record_length(afile *af, size_t length) {
+	if (af != NULL) {
+		af->record_length = length;
+	}
+}
+
+/*
+ * afile_set_checkpoint
+ *
+ * Set the file that afile_process_checkpointed keeps its checkpoint in, and
+ * how many lines it reads between checkpoints.  An interval of 0 or less is
+ * AFILE_CHECKPOINT_DEFAULT_INTERVAL.  A NULL path turns checkpoints off.
+ *
+ * Parameter: The afile instance
+ * Parameter: The path of the checkpoint file
+ * Parameter: The number of lines read between checkpoints
+ */
+void afile_set_checkpoint(afile *af, astr *path, long interval) {
+	if (af != NULL) {
+		if (af->checkpoint_path != NULL) {
+			af->checkpoint_path = astr_free(af->checkpoint_path);
+		}
+		if (path != NULL && path->string != NULL) {
+			af->checkpoint_path = astr_copy(path);
+		}
+		af->checkpoint_interval = (interval > 0 ? interval : AFILE_CHECKPOINT_DEFAULT_INTERVAL);
+	}
+}
+
+/*
+ * afile_set_edit_program
+ *
+ * Set the edit program that is run on each line read by the processing
+ * functions, before the line is passed to the match and process functions.
+ * The afile keeps its own copy of the program.  Pass NULL to stop editing
+ * the lines.
+ *
+ * Parameter: The afile instance
+ * Parameter: The edit program, or NULL
+ */
+void afile_set_edit_program(afile *af, const astr_edit_program *program) {
+	if (af != NULL) {
+		if (af->edit_program != NULL) {
+			af->edit_program = astr_edit_program_free(af->edit_program);
+		}
+
+		if (program != NULL) {
+			af->edit_program = (astr_edit_program *)malloc(sizeof(astr_edit_program));
+			if (af->edit_program != NULL) {
+				memcpy(af->edit_program, program, sizeof(astr_edit_program));
+			}
+		}
+	}
+}
+
 /*
  * afile_stat
  *
@@ -248,6 +420,9 @@ int afile_close(afile *af) {
 			free(af->buffer);
 			af->buffer = NULL;
 		}
+
+		af->write_ring = afile_uring_free(af->write_ring);
+		af->write_ring_error = 0;
 	}
 
 	return result;
@@ -281,6 +456,15 @@ afile *afile_free(afile *af) {
 			af->filespec = NULL;
 		}
 
+		if (af->edit_program != NULL) {
+			af->edit_program = astr_edit_program_free(af->edit_program);
+		}
+
+		if (af->checkpoint_path != NULL) {
+			astr_free(af->checkpoint_path);
+			af->checkpoint_path = NULL;
+		}
+
 		free(af);
 	}
 
@@ -288,72 +472,1897 @@ afile *afile_free(afile *af) {
 }
 
 /*
- * afile_process_lines
+ * afile_read_block
  *
- * Process all lines from a file.
+ * Read the next bytes of a file, through its decompressor if it has one.
  *
- * Read lines from a file and call the specified function to process each line.
+ * Parameter: The file descriptor
+ * Parameter: The decompressor, or NULL
+ * Parameter: The buffer
+ * Parameter: Size of the buffer
+ * Returns:   The number of bytes, 0 at the end, or -1 with errno set
+ */
+static ssize_t afile_read_block(int fd, afile_decompressor *decompressor, char *buffer, size_t size) {
+	ssize_t n;
+
+	do {
+		n = (decompressor != NULL ? afile_decompressor_read(decompressor, buffer, size) : read(fd, buffer, size));
+	} while (n < 0 && errno == EINTR);
+	return n;
+}
+
+/*
+ * The ring of blocks a prefetching reader thread fills while the consumer
+ * hands out the lines of the blocks filled before.  A block with a length of
+ * 0 marks the end of the file.
+ */
+typedef struct afile_prefetch {
+	int fd;
+	afile_decompressor *decompressor;
+	int depth;
+	size_t block_size;
+	char *blocks;
+	size_t *lengths;
+	int head;
+	int tail;
+	int count;
+	int stop;
+	int error;
+	pthread_t thread;
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+	afile_prefetch_stats stats;
+} afile_prefetch;
+
+/*
+ * afile_prefetch_run
  *
- * We have to use an intermediate buffer to read the bytes of the file into.
- * It is not possible to know the length of the strings being read, so the
- * intermediate buffer is allocated to be the size of the file buffer.  This
- * is much larger than necessary.  There is room here for adjustment.  Perhaps
- * 1/4th the size, or some other fraction, can be used.
+ * The reader thread: fill free blocks of the ring until the end of the file.
  *
- * Parameter: The afile instance, opened
- * Parameter: A pointer to a function that will process one line of text
- * Returns:   The number of lines processed
+ * Parameter: The ring
+ * Returns:   NULL
  */
-int afile_process_lines(afile *af, int (*process)(astr *as)) {
-	int result = 0;
-	int line_count = 0;
-	char *buffer = NULL;
-	astr *work = NULL;
+static void *afile_prefetch_run(void *arg) {
+	afile_prefetch *prefetch = (afile_prefetch *)arg;
+	ssize_t n;
+	int slot;
+
+	for (;;) {
+		pthread_mutex_lock(&prefetch->mutex);
+		if (prefetch->count == prefetch->depth && !prefetch->stop) {
+			prefetch->stats.reader_stalls++;
+			while (prefetch->count == prefetch->depth && !prefetch->stop) {
+				pthread_cond_wait(&prefetch->cond, &prefetch->mutex);
+			}
+		}
+		if (prefetch->stop) {
+			pthread_mutex_unlock(&prefetch->mutex);
+			break;
+		}
+		slot = prefetch->tail;
+		pthread_mutex_unlock(&prefetch->mutex);
+
+		n = afile_read_block(prefetch->fd, prefetch->decompressor, prefetch->blocks + slot * prefetch->block_size, prefetch->block_size);
+
+		pthread_mutex_lock(&prefetch->mutex);
+		if (n > 0) {
+			prefetch->lengths[slot] = n;
+			prefetch->stats.blocks++;
+		}
+		else {
+			prefetch->lengths[slot] = 0;
+			prefetch->error = (n < 0 ? errno : 0);
+		}
+		prefetch->tail = (prefetch->tail + 1) % prefetch->depth;
+		prefetch->count++;
+		pthread_cond_broadcast(&prefetch->cond);
+		pthread_mutex_unlock(&prefetch->mutex);
 
-	if (af != NULL && af->file != NULL && process != NULL) {
-		buffer = (char *)calloc(af->buffer_size, 1);
-		while (fgets(buffer, af->buffer_size, af->file)) {
-			work = astr_set(work, buffer);
-			line_count++;
-			process(work);
+		if (n <= 0) {
+			break;
 		}
 	}
-	return line_count;
+	return NULL;
 }
 
 /*
- * afile_process_matching_lines
+ * afile_prefetch_create
  *
- * Process matching lines from a file.
+ * Allocate a ring of blocks and start its reader thread.
  *
- * Read lines from a file and call the specified function to process each line.
+ * Parameter: The file descriptor to read
+ * Parameter: The decompressor to read the file through, or NULL
+ * Parameter: The number of blocks in the ring
+ * Parameter: The size of each block
+ * Returns:   Pointer to the ring, or NULL if it could not be started
+ */
+static afile_prefetch *afile_prefetch_create(int fd, afile_decompressor *decompressor, int depth, size_t block_size) {
+	afile_prefetch *prefetch;
+
+	prefetch = (afile_prefetch *)calloc(1, sizeof(afile_prefetch));
+	if (prefetch == NULL) {
+		return NULL;
+	}
+	prefetch->fd = fd;
+	prefetch->decompressor = decompressor;
+	prefetch->depth = depth;
+	prefetch->block_size = block_size;
+	prefetch->blocks = (char *)malloc(depth * block_size);
+	prefetch->lengths = (size_t *)calloc(depth, sizeof(size_t));
+	pthread_mutex_init(&prefetch->mutex, NULL);
+	pthread_cond_init(&prefetch->cond, NULL);
+
+	if (prefetch->blocks == NULL || prefetch->lengths == NULL || pthread_create(&prefetch->thread, NULL, afile_prefetch_run, prefetch) != 0) {
+		pthread_mutex_destroy(&prefetch->mutex);
+		pthread_cond_destroy(&prefetch->cond);
+		free(prefetch->blocks);
+		free(prefetch->lengths);
+		free(prefetch);
+		return NULL;
+	}
+	return prefetch;
+}
+
+/*
+ * afile_prefetch_free
  *
- * Parameter: The afile instance, opened
- * Parameter: A pointer to a function that will match one line of text
- * Parameter: A pointer to a function that will process one line of text
- * Returns:   The number of lines processed
+ * Stop the reader thread and free the ring, adding its counters to the
+ * afile's.  A reader thread blocked reading a pipe is waited for.
+ *
+ * Parameter: The ring
+ * Parameter: The afile instance
  */
-int afile_process_matching_lines(afile *af, int (*match)(astr *as), int (*process)(astr *as)) {
-	int result = 0;
-	int line_count = 0;
-	char *buffer = NULL;
-	astr *work = NULL;
+static void afile_prefetch_free(afile_prefetch *prefetch, afile *af) {
+	pthread_mutex_lock(&prefetch->mutex);
+	prefetch->stop = 1;
+	pthread_cond_broadcast(&prefetch->cond);
+	pthread_mutex_unlock(&prefetch->mutex);
+	pthread_join(prefetch->thread, NULL);
+
+	af->prefetch_stats.blocks += prefetch->stats.blocks;
+	af->prefetch_stats.consumer_stalls += prefetch->stats.consumer_stalls;
+	af->prefetch_stats.reader_stalls += prefetch->stats.reader_stalls;
+
+	pthread_mutex_destroy(&prefetch->mutex);
+	pthread_cond_destroy(&prefetch->cond);
+	free(prefetch->blocks);
+	free(prefetch->lengths);
+	free(prefetch);
+}
+
+/*
+ * afile_prefetch_take
+ *
+ * Give the consumer the next filled block, waiting for it if need be.
+ *
+ * Parameter: The reader
+ */
+static void afile_prefetch_take(afile_reader *reader) {
+	afile_prefetch *prefetch = reader->prefetch;
 
-	if (match == NULL) {
-		return afile_process_lines(af, process);
+	pthread_mutex_lock(&prefetch->mutex);
+	if (prefetch->count == 0) {
+		prefetch->stats.consumer_stalls++;
+		while (prefetch->count == 0) {
+			pthread_cond_wait(&prefetch->cond, &prefetch->mutex);
+		}
+	}
+	reader->block = prefetch->blocks + prefetch->head * prefetch->block_size;
+	reader->block_length = prefetch->lengths[prefetch->head];
+	reader->block_position = 0;
+	if (reader->block_length == 0) {
+		reader->at_end = 1;
+		reader->error = prefetch->error;
 	}
+	pthread_mutex_unlock(&prefetch->mutex);
+}
 
-	if (af != NULL && af->file != NULL) {
-		buffer = (char *)calloc(af->buffer_size, 1);
-		while (fgets(buffer, af->buffer_size, af->file)) {
-			work = astr_set(work, buffer);
-			if (match(work)) {
-				line_count++;
-				process(work);
+/*
+ * afile_prefetch_release
+ *
+ * Give the consumer's block back to the reader thread to fill again.
+ *
+ * Parameter: The reader
+ */
+static void afile_prefetch_release(afile_reader *reader) {
+	afile_prefetch *prefetch = reader->prefetch;
+
+	pthread_mutex_lock(&prefetch->mutex);
+	prefetch->head = (prefetch->head + 1) % prefetch->depth;
+	prefetch->count--;
+	pthread_cond_broadcast(&prefetch->cond);
+	pthread_mutex_unlock(&prefetch->mutex);
+	reader->block = NULL;
+}
+
+/*
+ * The blocks a line reader reads at explicit offsets of a regular file, with
+ * pread or with io_uring.  With io_uring a read is in flight for every block
+ * the consumer is not using; with pread each block is read when the consumer
+ * comes to it.  A block with an offset of -1 is past the end of the file.
+ */
+typedef struct afile_io {
+	int backend;
+	int fd;
+	afile_uring *ring;
+	int depth;
+	size_t block_size;
+	char *blocks;
+	off_t *offsets;
+	int *results;
+	int *ready;
+	off_t next_offset;
+	off_t size;
+	int head;
+	int error;
+	afile_prefetch_stats stats;
+} afile_io;
+
+/*
+ * afile_pread_all
+ *
+ * Read until a buffer is full or the file ends.
+ *
+ * Parameter: The file descriptor
+ * Parameter: The buffer
+ * Parameter: The number of bytes to read
+ * Parameter: The file offset
+ * Returns:   The number of bytes read, or -1 with errno set
+ */
+static ssize_t afile_pread_all(int fd, char *buffer, size_t length, off_t offset) {
+	size_t done = 0;
+	ssize_t n;
+
+	while (done < length) {
+		n = pread(fd, buffer + done, length - done, offset + done);
+		if (n < 0 && errno == EINTR) {
+			continue;
+		}
+		if (n < 0) {
+			return -1;
+		}
+		if (n == 0) {
+			break;
+		}
+		done += n;
+	}
+	return (ssize_t)done;
+}
+
+/*
+ * afile_pwrite_all
+ *
+ * Write all of a buffer.
+ *
+ * Parameter: The file descriptor
+ * Parameter: The buffer
+ * Parameter: The number of bytes to write
+ * Parameter: The file offset
+ * Returns:   0 = success, non-zero = errno value from the failed operation
+ */
+static int afile_pwrite_all(int fd, const char *buffer, size_t length, off_t offset) {
+	size_t done = 0;
+	ssize_t n;
+
+	while (done < length) {
+		n = pwrite(fd, buffer + done, length - done, offset + done);
+		if (n < 0 && errno == EINTR) {
+			continue;
+		}
+		if (n <= 0) {
+			return (n < 0 ? errno : EIO);
+		}
+		done += n;
+	}
+	return 0;
+}
+
+/*
+ * afile_io_queue
+ *
+ * Give a block the next part of the file, and with io_uring, queue its read.
+ *
+ * Parameter: The blocks
+ * Parameter: The index of the block
+ */
+static void afile_io_queue(afile_io *io, int slot) {
+	size_t length;
+
+	if (io->next_offset >= io->size) {
+		io->offsets[slot] = -1;
+		io->results[slot] = 0;
+		io->ready[slot] = 1;
+		return;
+	}
+
+	length = io->block_size;
+	if ((off_t)length > io->size - io->next_offset) {
+		length = io->size - io->next_offset;
+	}
+	io->offsets[slot] = io->next_offset;
+	io->ready[slot] = 0;
+	io->next_offset += length;
+
+	if (io->ring == NULL || afile_uring_read(io->ring, io->fd, io->blocks + slot * io->block_size, length, io->offsets[slot], slot, slot) != 0) {
+		// Read it with pread when the consumer comes to it.
+		io->results[slot] = -EAGAIN;
+		io->ready[slot] = 1;
+	}
+}
+
+/*
+ * afile_io_create
+ *
+ * Set up the blocks for a line reader of a regular file, and with io_uring,
+ * start a read into each of them.  If io_uring cannot be set up, pread is
+ * used.
+ *
+ * Parameter: The reader
+ * Parameter: The backend, AFILE_IO_PREAD or AFILE_IO_URING
+ * Parameter: The number of blocks
+ * Returns:   Pointer to the blocks, or NULL if the file is not a regular file
+ */
+static afile_io *afile_io_create(afile_reader *reader, int backend, int depth) {
+	struct stat stats;
+	afile_io *io;
+	void *blocks = NULL;
+	int i;
+
+	if (reader->offset < 0 || fstat(reader->fd, &stats) != 0 || !S_ISREG(stats.st_mode)) {
+		return NULL;
+	}
+
+	io = (afile_io *)calloc(1, sizeof(afile_io));
+	if (io == NULL) {
+		return NULL;
+	}
+	io->backend = backend;
+	io->fd = reader->fd;
+	io->depth = depth;
+	io->block_size = reader->af->buffer_size;
+	io->next_offset = reader->offset;
+	io->size = stats.st_size;
+	io->offsets = (off_t *)calloc(depth, sizeof(off_t));
+	io->results = (int *)calloc(depth, sizeof(int));
+	io->ready = (int *)calloc(depth, sizeof(int));
+	if (posix_memalign(&blocks, 4096, depth * io->block_size) == 0) {
+		io->blocks = (char *)blocks;
+	}
+	if (io->blocks == NULL || io->offsets == NULL || io->results == NULL || io->ready == NULL) {
+		free(io->blocks);
+		free(io->offsets);
+		free(io->results);
+		free(io->ready);
+		free(io);
+		return NULL;
+	}
+
+	if (backend == AFILE_IO_URING) {
+		io->ring = afile_uring_create(depth);
+		if (io->ring == NULL) {
+			io->backend = AFILE_IO_PREAD;
+		}
+		else {
+			// Reads go faster into registered buffers, but they work without.
+			afile_uring_register_buffers(io->ring, io->blocks, io->block_size, depth);
+		}
+	}
+
+	for (i = 0; i < depth; i++) {
+		afile_io_queue(io, i);
+	}
+	if (io->ring != NULL) {
+		afile_uring_submit(io->ring);
+	}
+	return io;
+}
+
+/*
+ * afile_io_free
+ *
+ * Free the blocks, once any reads still in flight are done, adding the
+ * counters to the afile's.
+ *
+ * Parameter: The blocks
+ * Parameter: The afile instance
+ */
+static void afile_io_free(afile_io *io, afile *af) {
+	afile_uring_free(io->ring);
+	af->prefetch_stats.blocks += io->stats.blocks;
+	af->prefetch_stats.consumer_stalls += io->stats.consumer_stalls;
+	free(io->blocks);
+	free(io->offsets);
+	free(io->results);
+	free(io->ready);
+	free(io);
+}
+
+/*
+ * afile_io_take
+ *
+ * Give the consumer the next block, waiting for its read if need be.  A read
+ * that comes back short, or fails to start, is finished with pread.
+ *
+ * Parameter: The reader
+ */
+static void afile_io_take(afile_reader *reader) {
+	afile_io *io = reader->io;
+	char *block = io->blocks + io->head * io->block_size;
+	size_t expected;
+	ssize_t n;
+	uint64_t tag;
+	int result;
+
+	if (!io->ready[io->head]) {
+		io->stats.consumer_stalls++;
+		while (!io->ready[io->head]) {
+			if (afile_uring_wait(io->ring, &tag, &result) != 0) {
+				io->results[io->head] = -EAGAIN;
+				break;
 			}
+			io->results[tag] = result;
+			io->ready[tag] = 1;
 		}
 	}
-	return line_count;
+
+	reader->block = block;
+	reader->block_position = 0;
+	if (io->offsets[io->head] < 0) {
+		reader->block_length = 0;
+		reader->at_end = 1;
+		return;
+	}
+
+	expected = io->block_size;
+	if ((off_t)expected > io->size - io->offsets[io->head]) {
+		expected = io->size - io->offsets[io->head];
+	}
+	n = io->results[io->head];
+	if (n < 0 && n != -EAGAIN) {
+		reader->error = -n;
+		n = 0;
+	}
+	else {
+		if (n < 0) {
+			n = 0;
+		}
+		if ((size_t)n < expected) {
+			result = afile_pread_all(io->fd, block + n, expected - n, io->offsets[io->head] + n);
+			if (result < 0) {
+				reader->error = errno;
+			}
+			else {
+				n += result;
+			}
+		}
+	}
+
+	reader->block_length = n;
+	if (n == 0) {
+		reader->at_end = 1;
+	}
+	else {
+		io->stats.blocks++;
+	}
+}
+
+/*
+ * afile_io_release
+ *
+ * Give the consumer's block the next part of the file to read.
+ *
+ * Parameter: The reader
+ */
+static void afile_io_release(afile_reader *reader) {
+	afile_io *io = reader->io;
+
+	afile_io_queue(io, io->head);
+	if (io->ring != NULL) {
+		afile_uring_submit(io->ring);
+	}
+	io->head = (io->head + 1) % io->depth;
+	reader->block = NULL;
+}
+
+/*
+ * afile_record_continues
+ *
+ * Find where the record that a run of bytes carries on ends in them.
+ *
+ * A separator of more than one byte may have started in the record so far,
+ * so that is looked at first.  After that, each place the first byte of the
+ * separator is found is compared with the rest of it.
+ *
+ * Parameter: The afile instance
+ * Parameter: The record so far
+ * Parameter: Length of the record so far
+ * Parameter: The bytes that carry on the record
+ * Parameter: The number of bytes
+ * Returns:   The number of the bytes up to the end of the record, or 0 if it
+ *            does not end in them
+ */
+static size_t afile_record_continues(const afile *af, const char *record, size_t before, const char *s, size_t length) {
+	const char *separator = af->separator;
+	size_t separator_length = af->separator_length;
+	const char *end = s + length;
+	const char *p;
+	size_t k;
+
+	if (af->record_length > 0) {
+		return (af->record_length - before <= length ? af->record_length - before : 0);
+	}
+
+	// glibc's memchr scans a vector at a time.
+	if (separator_length == 1) {
+		p = (const char *)memchr(s, separator[0], length);
+		return (p != NULL ? (size_t)(p + 1 - s) : 0);
+	}
+
+	for (k = (before < separator_length - 1 ? before : separator_length - 1); k > 0; k--) {
+		if (separator_length - k <= length && memcmp(record + before - k, separator, k) == 0 && memcmp(s, separator + k, separator_length - k) == 0) {
+			return separator_length - k;
+		}
+	}
+
+	p = s;
+	while (p + separator_length <= end) {
+		p = (const char *)memchr(p, separator[0], end - separator_length + 1 - p);
+		if (p == NULL) {
+			break;
+		}
+		if (memcmp(p, separator, separator_length) == 0) {
+			return p + separator_length - s;
+		}
+		p++;
+	}
+	return 0;
+}
+
+/*
+ * afile_record_end
+ *
+ * Find the end of the record that starts at some bytes: just after its
+ * separator, or its fixed length on.
+ *
+ * Parameter: The afile instance
+ * Parameter: The start of the record
+ * Parameter: The end of the bytes
+ * Returns:   The end of the record, or NULL if it does not end before the end
+ *            of the bytes
+ */
+const char *afile_record_end(const afile *af, const char *s, const char *end) {
+	size_t length;
+
+	length = afile_record_continues(af, NULL, 0, s, end - s);
+	return (length > 0 ? s + length : NULL);
+}
+
+/*
+ * afile_record_strip
+ *
+ * Take the separator off the end of a record, if it has one.  A record of
+ * fixed length has none.
+ *
+ * Parameter: The afile instance
+ * Parameter: The record
+ * Returns:   The record without its separator
+ */
+astr_view afile_record_strip(const afile *af, astr_view record) {
+	if (af->record_length == 0 && (size_t)record.length >= af->separator_length && memcmp(record.string + record.length - af->separator_length, af->separator, af->separator_length) == 0) {
+		record.length -= (int)af->separator_length;
+	}
+	return record;
+}
+
+/*
+ * afile_reader_reserve
+ *
+ * Make room in the reader's buffer for a number of bytes past its length.
+ *
+ * Parameter: The reader
+ * Parameter: The number of bytes
+ * Returns:   0 = success, non-zero = errno value from the failed operation
+ */
+static int afile_reader_reserve(afile_reader *reader, size_t length) {
+	size_t size = reader->size;
+	char *buffer;
+
+	while (reader->length + length > size) {
+		size *= 2;
+	}
+	if (size > reader->size) {
+		buffer = (char *)realloc(reader->buffer, size);
+		if (buffer == NULL) {
+			return ENOMEM;
+		}
+		reader->buffer = buffer;
+		reader->af->buffer = buffer;
+		reader->size = size;
+	}
+	return 0;
+}
+
+/*
+ * afile_reader_next_block
+ *
+ * Read the next line from the blocks read by a reader thread or at explicit
+ * offsets.  A line
+ * inside one block is handed out where it is; a line that crosses blocks is
+ * put together in the afile buffer.
+ *
+ * Parameter: The reader
+ * Returns:   A view of the line
+ */
+static astr_view afile_reader_next_block(afile_reader *reader) {
+	astr_view line = {NULL, 0};
+	const char *s;
+	int found;
+	size_t length;
+
+	// The afile buffer only ever holds the line handed out last time.
+	reader->length = 0;
+
+	for (;;) {
+		if (reader->block_position == reader->block_length) {
+			if (reader->at_end) {
+				if (reader->length == 0) {
+					return line;
+				}
+				break;
+			}
+			if (reader->io != NULL) {
+				if (reader->block != NULL) {
+					afile_io_release(reader);
+				}
+				afile_io_take(reader);
+			}
+			else {
+				if (reader->block != NULL) {
+					afile_prefetch_release(reader);
+				}
+				afile_prefetch_take(reader);
+			}
+			continue;
+		}
+
+		s = reader->block + reader->block_position;
+		length = afile_record_continues(reader->af, reader->buffer, reader->length, s, reader->block_length - reader->block_position);
+		found = (length > 0);
+		if (!found) {
+			length = reader->block_length - reader->block_position;
+		}
+		reader->block_position += length;
+
+		if (found && reader->length == 0) {
+			line.string = s;
+			line.length = (int)length;
+			break;
+		}
+
+		if (afile_reader_reserve(reader, length) != 0) {
+			reader->error = ENOMEM;
+			reader->at_end = 1;
+			reader->block_position = reader->block_length;
+			return line;
+		}
+		memcpy(reader->buffer + reader->length, s, length);
+		reader->length += length;
+		if (found) {
+			break;
+		}
+	}
+
+	if (line.string == NULL) {
+		line.string = reader->buffer;
+		line.length = (int)reader->length;
+	}
+	if (reader->offset >= 0) {
+		reader->offset += line.length;
+	}
+	return line;
+}
+
+/*
+ * afile_reader_decompress
+ *
+ * Find the compression of the file from its first bytes, and if it is
+ * compressed, set the reader to read it through a decompressor.  A file that
+ * cannot seek is read only as far as it takes to tell, and the bytes read
+ * are given to a decompressor to hand out again, even if the file is not
+ * compressed.  A compressed file has no offsets to leave the file at.
+ *
+ * Parameter: The reader
+ */
+static void afile_reader_decompress(afile_reader *reader) {
+	afile *af = reader->af;
+	unsigned char magic[4];
+	size_t length = 0;
+	size_t needed = 1;
+	ssize_t n;
+
+	if (reader->offset >= 0) {
+		n = afile_pread_all(reader->fd, (char *)magic, sizeof(magic), reader->offset);
+		length = (n > 0 ? n : 0);
+	}
+	else {
+		// Two bytes tell gzip and four tell zstd, so a line typed at a terminal is not waited on.
+		while (length < needed) {
+			n = afile_read_block(reader->fd, NULL, (char *)magic + length, needed - length);
+			if (n <= 0) {
+				break;
+			}
+			length += n;
+			needed = (magic[0] == 0x1f ? 2 : (magic[0] == 0x28 ? 4 : 1));
+		}
+	}
+
+	reader->compression = (af->compression == AFILE_COMPRESSION_AUTO ? afile_compression_detect(magic, length) : af->compression);
+	if (reader->compression != AFILE_COMPRESSION_NONE || (reader->offset < 0 && length > 0)) {
+		reader->decompressor = afile_decompressor_create(reader->fd, reader->compression, magic, (reader->offset < 0 ? length : 0), af->buffer_size, af->decompression_threads);
+		if (reader->decompressor == NULL) {
+			reader->error = errno;
+			reader->at_end = 1;
+		}
+		if (reader->compression != AFILE_COMPRESSION_NONE) {
+			reader->offset = -1;
+		}
+	}
+}
+
+/*
+ * afile_reader_create
+ *
+ * Create a line reader for an open afile.
+ *
+ * The reader reads the file a block at a time with read(2) into the afile
+ * buffer, so the buffer size set when the afile is created is the block
+ * size.  It starts at the current position of the file.  A line longer than
+ * the buffer grows the buffer rather than being split, and a line may hold
+ * any bytes, including NULs.
+ *
+ * If a prefetch depth is set, a reader thread reads blocks of the buffer
+ * size into a ring of that many blocks, while the lines of the blocks it has
+ * already read are handed out.  If the thread cannot be started, the file is
+ * read on the calling thread.
+ *
+ * If the afile's I/O backend is AFILE_IO_PREAD or AFILE_IO_URING and the file
+ * is a regular file, the blocks are read at explicit offsets instead.  With
+ * io_uring a read is kept in flight for each block of the prefetch depth, 4
+ * if none is set; if io_uring cannot be set up, pread is used.
+ *
+ * A file compressed with gzip or zstd, found from its first bytes unless the
+ * afile's compression is set, is decompressed as it is read, on the reader
+ * thread if there is one.  A compressed file is never read at explicit
+ * offsets.  If it cannot be decompressed, the reader has no lines and holds
+ * the errno value, ENOTSUP if the compression is not built in.
+ *
+ * Parameter: The afile instance, opened
+ * Returns:   Pointer to the reader, or NULL if the afile is not open
+ */
+afile_reader *afile_reader_create(afile *af) {
+	afile_reader *reader;
+
+	if (af == NULL || af->file == NULL || af->buffer == NULL) {
+		errno = EBADF;
+		return NULL;
+	}
+
+	reader = (afile_reader *)calloc(1, sizeof(afile_reader));
+	if (reader == NULL) {
+		return NULL;
+	}
+
+	reader->af = af;
+	reader->fd = fileno(af->file);
+	reader->buffer = af->buffer;
+	reader->size = af->buffer_size;
+
+	// Start where the stream is, not where stdio has read ahead to.
+	fflush(af->file);
+	reader->offset = ftello(af->file);
+	if (reader->offset < 0 || lseek(reader->fd, reader->offset, SEEK_SET) < 0) {
+		reader->offset = -1;
+	}
+
+	reader->compression = AFILE_COMPRESSION_NONE;
+	if (af->compression != AFILE_COMPRESSION_NONE) {
+		afile_reader_decompress(reader);
+		if (reader->error != 0) {
+			return reader;
+		}
+	}
+
+	reader->io_backend = AFILE_IO_READ;
+	if (af->io_backend == AFILE_IO_PREAD || af->io_backend == AFILE_IO_URING) {
+		reader->io = afile_io_create(reader, af->io_backend, (af->prefetch_depth > 1 ? af->prefetch_depth : AFILE_IO_DEFAULT_DEPTH));
+		if (reader->io != NULL) {
+			reader->io_backend = reader->io->backend;
+		}
+	}
+	if (reader->io == NULL && af->prefetch_depth > 1) {
+		reader->prefetch = afile_prefetch_create(reader->fd, reader->decompressor, af->prefetch_depth, af->buffer_size);
+	}
+
+	return reader;
+}
+
+/*
+ * afile_reader_next
+ *
+ * Read the next line.
+ *
+ * A line is a record ended by the separator of the afile, a newline unless
+ * another is set, or a record of its fixed length.  The view includes the
+ * separator, if the line has one; the last line of a file might not.  The
+ * view points into the afile buffer and is only good until the next call.
+ * At the end of the file, or if a read fails, the view has a NULL string; a
+ * failed read leaves its errno value in the reader.
+ *
+ * Parameter: The reader
+ * Returns:   A view of the line
+ */
+astr_view afile_reader_next(afile_reader *reader) {
+	astr_view line = {NULL, 0};
+	size_t scanned = 0;
+	size_t length;
+	ssize_t n;
+
+	if (reader == NULL) {
+		return line;
+	}
+	if (reader->prefetch != NULL || reader->io != NULL) {
+		return afile_reader_next_block(reader);
+	}
+
+	for (;;) {
+		length = afile_record_continues(reader->af, reader->buffer + reader->start, scanned, reader->buffer + reader->start + scanned, reader->length - reader->start - scanned);
+		if (length > 0) {
+			length += scanned;
+			break;
+		}
+
+		scanned = reader->length - reader->start;
+		if (reader->at_end) {
+			if (scanned == 0) {
+				return line;
+			}
+			length = scanned;
+			break;
+		}
+
+		// Carry the partial line to the front, and make room for more of it.
+		if (reader->start > 0) {
+			memmove(reader->buffer, reader->buffer + reader->start, scanned);
+			reader->length = scanned;
+			reader->start = 0;
+		}
+		if (reader->length == reader->size && afile_reader_reserve(reader, 1) != 0) {
+			reader->error = ENOMEM;
+			reader->at_end = 1;
+			return line;
+		}
+
+		n = afile_read_block(reader->fd, reader->decompressor, reader->buffer + reader->length, reader->size - reader->length);
+
+		if (n > 0) {
+			reader->length += n;
+		}
+		else {
+			if (n < 0) {
+				reader->error = errno;
+			}
+			reader->at_end = 1;
+		}
+	}
+
+	line.string = reader->buffer + reader->start;
+	line.length = (int)length;
+	reader->start += length;
+	if (reader->offset >= 0) {
+		reader->offset += length;
+	}
+	return line;
+}
+
+/*
+ * afile_reader_next_batch
+ *
+ * Read as many of the next lines as can be handed out together.
+ *
+ * The first line is read as afile_reader_next reads it.  The lines after it
+ * are added for as long as they are already in the buffer, or in the block,
+ * whole, so none of the views is spoiled by reading more.  All of the views
+ * are good until the next call.
+ *
+ * Parameter: The reader
+ * Parameter: Array of views for the lines
+ * Parameter: The most lines to read
+ * Returns:   The number of lines read, 0 at the end of the file
+ */
+int afile_reader_next_batch(afile_reader *reader, astr_view *lines, int max) {
+	const char *region;
+	const char *next;
+	size_t *position;
+	size_t end;
+	int count = 0;
+
+	if (reader == NULL || max < 1) {
+		return 0;
+	}
+
+	lines[0] = afile_reader_next(reader);
+	if (lines[0].string == NULL) {
+		return 0;
+	}
+	count = 1;
+
+	if (reader->prefetch != NULL || reader->io != NULL) {
+		// A line put together in the buffer is spoiled by the next one.
+		if (reader->length != 0 || reader->block == NULL) {
+			return count;
+		}
+		region = reader->block;
+		position = &reader->block_position;
+		end = reader->block_length;
+	}
+	else {
+		region = reader->buffer;
+		position = &reader->start;
+		end = reader->length;
+	}
+
+	while (count < max) {
+		next = afile_record_end(reader->af, region + *position, region + end);
+		if (next == NULL) {
+			break;
+		}
+		lines[count].string = region + *position;
+		lines[count].length = (int)(next - lines[count].string);
+		*position += lines[count].length;
+		if (reader->offset >= 0) {
+			reader->offset += lines[count].length;
+		}
+		count++;
+	}
+	return count;
+}
+
+/*
+ * afile_reader_free
+ *
+ * Free a line reader.
+ *
+ * The buffer belongs to the afile, and is kept.  If the file can seek, it is
+ * left just after the last line read, so the standard C library functions
+ * can carry on from there.
+ *
+ * Parameter: The reader
+ * Returns:   NULL
+ */
+afile_reader *afile_reader_free(afile_reader *reader) {
+	if (reader != NULL) {
+		if (reader->prefetch != NULL) {
+			afile_prefetch_free(reader->prefetch, reader->af);
+		}
+		if (reader->io != NULL) {
+			afile_io_free(reader->io, reader->af);
+		}
+		if (reader->decompressor != NULL) {
+			afile_decompressor_free(reader->decompressor);
+		}
+		if (reader->offset >= 0) {
+			fseeko(reader->af->file, reader->offset, SEEK_SET);
+		}
+		free(reader);
+	}
+	return NULL;
+}
+
+/*
+ * afile_process_lines
+ *
+ * Process all lines from a file.
+ *
+ * Read lines from a file and call the specified function to process each line.
+ * If an edit program is set, each line is edited before it is processed.
+ *
+ * The lines are read with a line reader, so a line is never split however
+ * long it is.  Each line keeps its separator.  A line is copied into an
+ * astr, which ends at a NUL, so records that hold NULs, such as binary
+ * records of a fixed length, are better processed as views.
+ *
+ * Parameter: The afile instance, opened
+ * Parameter: A pointer to a function that will process one line of text
+ * Returns:   The number of lines processed
+ */
+int afile_process_lines(afile *af, int (*process)(astr *as)) {
+	return afile_process_matching_lines(af, NULL, process);
+}
+
+/*
+ * afile_process_matching_lines
+ *
+ * Process matching lines from a file.
+ *
+ * Read lines from a file and call the specified function to process each line.
+ * If an edit program is set, each line is edited before it is matched.  A NULL
+ * match function matches every line.
+ *
+ * Parameter: The afile instance, opened
+ * Parameter: A pointer to a function that will match one line of text
+ * Parameter: A pointer to a function that will process one line of text
+ * Returns:   The number of lines processed
+ */
+int afile_process_matching_lines(afile *af, int (*match)(astr *as), int (*process)(astr *as)) {
+	int line_count = 0;
+	afile_reader *reader;
+	astr_view line;
+	astr *work = NULL;
+
+	if (process == NULL) {
+		return 0;
+	}
+
+	reader = afile_reader_create(af);
+	if (reader != NULL) {
+		for (line = afile_reader_next(reader); line.string != NULL; line = afile_reader_next(reader)) {
+			work = astr_set_from_view(work, line);
+			work = astr_edit(work, af->edit_program);
+			if (match == NULL || match(work)) {
+				line_count++;
+				process(work);
+			}
+		}
+		afile_reader_free(reader);
+		astr_free(work);
+	}
+	return line_count;
+}
+
+/*
+ * afile_process_view
+ *
+ * Edit, match and process one line for the view processing functions.  The
+ * line is only copied when there is an edit program to run on it.
+ *
+ * Parameter: The afile instance
+ * Parameter: The line
+ * Parameter: A pointer to a function that will match one line, or NULL
+ * Parameter: A pointer to a function that will process one line
+ * Parameter: The context for the functions
+ * Parameter: Pointer to the work astr, created the first time it is needed
+ * Parameter: Pointer to the count of lines processed
+ * Returns:   What the process function returned, or AFILE_CONTINUE
+ */
+static int afile_process_view(afile *af, astr_view line, int (*match)(astr_view line, void *ctx), int (*process)(astr_view line, void *ctx), void *ctx, astr **work, long *line_count) {
+	if (af->edit_program != NULL) {
+		*work = astr_set_from_view(*work, line);
+		*work = astr_edit(*work, af->edit_program);
+		line = astr_view_of(*work);
+	}
+
+	if (match != NULL && !match(line, ctx)) {
+		return AFILE_CONTINUE;
+	}
+	(*line_count)++;
+	return process(line, ctx);
+}
+
+/*
+ * afile_process_batch
+ *
+ * Edit and process a batch of lines for the batch processing function.  The
+ * lines are only copied when there is an edit program to run on them.
+ *
+ * Parameter: The afile instance
+ * Parameter: The lines
+ * Parameter: The number of lines
+ * Parameter: A pointer to a function that will process a batch of lines
+ * Parameter: The context for the function
+ * Parameter: A work astr for each line of a batch, created when needed
+ * Parameter: Pointer to the count of lines processed
+ * Returns:   What the process function returned
+ */
+static int afile_process_batch(afile *af, astr_view *lines, int count, int (*process)(const astr_view *lines, int count, void *ctx), void *ctx, astr **works, long *line_count) {
+	int i;
+
+	if (af->edit_program != NULL) {
+		for (i = 0; i < count; i++) {
+			works[i] = astr_set_from_view(works[i], lines[i]);
+			works[i] = astr_edit(works[i], af->edit_program);
+			lines[i] = astr_view_of(works[i]);
+		}
+	}
+
+	*line_count += count;
+	return process(lines, count, ctx);
+}
+
+/*
+ * afile_map_lines
+ *
+ * Map a regular file for the view processing functions, from the current
+ * position of the file to its end.  A compressed file is not mapped.
+ *
+ * Parameter: The afile instance, opened
+ * Parameter: Pointer to where to put the length of the mapping
+ * Parameter: Pointer to where to put the start of the lines in the mapping
+ * Returns:   The mapping, or MAP_FAILED if the file cannot be mapped
+ */
+static char *afile_map_lines(afile *af, size_t *length, off_t *position) {
+	struct stat stats;
+	char *mapping;
+
+	if (fstat(fileno(af->file), &stats) != 0 || !S_ISREG(stats.st_mode)) {
+		return MAP_FAILED;
+	}
+
+	*position = ftello(af->file);
+	if (*position < 0 || *position >= stats.st_size) {
+		return MAP_FAILED;
+	}
+
+	mapping = (char *)mmap(NULL, stats.st_size, PROT_READ, MAP_PRIVATE, fileno(af->file), 0);
+	if (mapping == MAP_FAILED) {
+		return MAP_FAILED;
+	}
+
+	// A compressed file is left to a line reader to decompress.
+	if (af->compression != AFILE_COMPRESSION_NONE && (af->compression != AFILE_COMPRESSION_AUTO || afile_compression_detect(mapping + *position, stats.st_size - *position) != AFILE_COMPRESSION_NONE)) {
+		munmap(mapping, stats.st_size);
+		return MAP_FAILED;
+	}
+	madvise(mapping, stats.st_size, MADV_SEQUENTIAL);
+	*length = stats.st_size;
+	return mapping;
+}
+
+/*
+ * afile_unmap_lines
+ *
+ * Unmap a file mapped by afile_map_lines, and leave the file where the
+ * processing stopped, as a line reader leaves it.
+ *
+ * Parameter: The afile instance
+ * Parameter: The mapping
+ * Parameter: The length of the mapping
+ * Parameter: The offset just after the last line processed
+ */
+static void afile_unmap_lines(afile *af, char *mapping, size_t length, off_t offset) {
+	munmap(mapping, length);
+	fseeko(af->file, offset, SEEK_SET);
+}
+
+/*
+ * afile_process_views_ctx
+ *
+ * Process matching lines from a file, without copying them, with a context
+ * for the match and process functions.
+ *
+ * Each line is passed to the match function, and if it matches, to the
+ * process function, as a view, as afile_process_views describes, along with
+ * the context.  A NULL match function matches every line.  The process
+ * function returns AFILE_CONTINUE to carry on, AFILE_STOP to stop, or an
+ * errno value to stop with.  A file that can seek is left just after the
+ * last line processed, at its end unless the processing stopped early, so
+ * the standard C library functions or another call can carry on from there.
+ *
+ * Parameter: The afile instance, opened
+ * Parameter: A pointer to a function that will match one line of text, or NULL
+ * Parameter: A pointer to a function that will process one line of text
+ * Parameter: The context passed to the functions
+ * Parameter: Pointer to where to put the number of lines processed, or NULL
+ * Returns:   0 = success, non-zero = errno value from the process function or the failed read
+ */
+int afile_process_views_ctx(afile *af, int (*match)(astr_view line, void *ctx), int (*process)(astr_view line, void *ctx), void *ctx, long *line_count) {
+	afile_reader *reader;
+	astr_view line;
+	char *mapping;
+	const char *s;
+	const char *end;
+	const char *next;
+	size_t length;
+	off_t position;
+	long count = 0;
+	astr *work = NULL;
+	int result = AFILE_CONTINUE;
+
+	if (af == NULL || af->file == NULL || af->buffer == NULL || process == NULL) {
+		return EBADF;
+	}
+
+	mapping = afile_map_lines(af, &length, &position);
+	if (mapping != MAP_FAILED) {
+		s = mapping + position;
+		end = mapping + length;
+		while (s < end && result == AFILE_CONTINUE) {
+			next = afile_record_end(af, s, end);
+			if (next == NULL) {
+				next = end;
+			}
+			result = afile_process_view(af, afile_record_strip(af, astr_view_from_buffer(s, (int)(next - s))), match, process, ctx, &work, &count);
+			s = next;
+		}
+		afile_unmap_lines(af, mapping, length, s - mapping);
+	}
+	else {
+		reader = afile_reader_create(af);
+		if (reader != NULL) {
+			// Stop without reading the next line, so the reader is left after the last one processed.
+			for (line = afile_reader_next(reader); line.string != NULL; line = afile_reader_next(reader)) {
+				result = afile_process_view(af, afile_record_strip(af, line), match, process, ctx, &work, &count);
+				if (result != AFILE_CONTINUE) {
+					break;
+				}
+			}
+			if (result == AFILE_CONTINUE) {
+				result = reader->error;
+			}
+			afile_reader_free(reader);
+		}
+	}
+
+	astr_free(work);
+	if (line_count != NULL) {
+		*line_count = count;
+	}
+	return (result == AFILE_STOP ? 0 : result);
+}
+
+/*
+ * afile_process_batches
+ *
+ * Process the lines from a file in batches, without copying them, with a
+ * context for the process function.
+ *
+ * The lines are passed to the process function as an array of views, without
+ * their separators, up to the batch size at a time, so the cost of the call is
+ * shared by the lines.  A regular file is mapped into memory, and every batch
+ * but maybe the last is full.  Anything else is read with a line reader, and
+ * a batch holds the lines that are in the afile buffer together.  The views
+ * are only good until the process function returns.  If an edit program is
+ * set, the lines are copied and edited.
+ *
+ * The process function returns AFILE_CONTINUE to carry on, AFILE_STOP to
+ * stop, or an errno value to stop with.  A file that can seek is left just
+ * after the last line of the last batch processed.
+ *
+ * Parameter: The afile instance, opened
+ * Parameter: The most lines in a batch
+ * Parameter: A pointer to a function that will process a batch of lines
+ * Parameter: The context passed to the function
+ * Parameter: Pointer to where to put the number of lines processed, or NULL
+ * Returns:   0 = success, non-zero = errno value from the process function or the failed read
+ */
+int afile_process_batches(afile *af, int batch_size, int (*process)(const astr_view *lines, int count, void *ctx), void *ctx, long *line_count) {
+	afile_reader *reader;
+	astr_view *lines;
+	astr **works = NULL;
+	char *mapping;
+	const char *s;
+	const char *end;
+	const char *next;
+	size_t length;
+	off_t position;
+	long total = 0;
+	int result = AFILE_CONTINUE;
+	int count;
+	int i;
+
+	if (af == NULL || af->file == NULL || af->buffer == NULL || process == NULL) {
+		return EBADF;
+	}
+	if (batch_size < 1) {
+		return EINVAL;
+	}
+
+	lines = (astr_view *)malloc(batch_size * sizeof(astr_view));
+	if (af->edit_program != NULL) {
+		works = (astr **)calloc(batch_size, sizeof(astr *));
+	}
+	if (lines == NULL || (af->edit_program != NULL && works == NULL)) {
+		free(lines);
+		free(works);
+		return ENOMEM;
+	}
+
+	mapping = afile_map_lines(af, &length, &position);
+	if (mapping != MAP_FAILED) {
+		s = mapping + position;
+		end = mapping + length;
+		while (s < end && result == AFILE_CONTINUE) {
+			for (count = 0; count < batch_size && s < end; count++) {
+				next = afile_record_end(af, s, end);
+				if (next == NULL) {
+					next = end;
+				}
+				lines[count] = afile_record_strip(af, astr_view_from_buffer(s, (int)(next - s)));
+				s = next;
+			}
+			result = afile_process_batch(af, lines, count, process, ctx, works, &total);
+		}
+		afile_unmap_lines(af, mapping, length, s - mapping);
+	}
+	else {
+		reader = afile_reader_create(af);
+		if (reader != NULL) {
+			while (result == AFILE_CONTINUE && (count = afile_reader_next_batch(reader, lines, batch_size)) > 0) {
+				for (i = 0; i < count; i++) {
+					lines[i] = afile_record_strip(af, lines[i]);
+				}
+				result = afile_process_batch(af, lines, count, process, ctx, works, &total);
+			}
+			if (result == AFILE_CONTINUE) {
+				result = reader->error;
+			}
+			afile_reader_free(reader);
+		}
+	}
+
+	if (works != NULL) {
+		for (i = 0; i < batch_size; i++) {
+			astr_free(works[i]);
+		}
+		free(works);
+	}
+	free(lines);
+	if (line_count != NULL) {
+		*line_count = total;
+	}
+	return (result == AFILE_STOP ? 0 : result);
+}
+
+// The functions of the view processing functions that take no context.
+typedef struct afile_view_functions {
+	int (*match)(astr_view line);
+	int (*process)(astr_view line);
+} afile_view_functions;
+
+static int afile_view_match(astr_view line, void *ctx) {
+	return ((afile_view_functions *)ctx)->match(line);
+}
+
+static int afile_view_process(astr_view line, void *ctx) {
+	((afile_view_functions *)ctx)->process(line);
+	return AFILE_CONTINUE;
+}
+
+/*
+ * afile_process_views
+ *
+ * Process all lines from a file, without copying them.
+ *
+ * Each line is passed to the process function as a view, without its
+ * separator.  A regular file is mapped into memory and each view points into
+ * the mapping, so the lines are never copied.  Anything else, such as a pipe,
+ * is read with a line reader and the views point into the afile buffer.
+ * Either way a view is only good until the process function returns.  If an
+ * edit program is set, each line is copied and edited, and the view is of
+ * the edited copy.
+ *
+ * Processing starts at the current position of the file and leaves the file
+ * at its end.
+ *
+ * Parameter: The afile instance, opened
+ * Parameter: A pointer to a function that will process one line of text
+ * Returns:   The number of lines processed
+ */
+int afile_process_views(afile *af, int (*process)(astr_view line)) {
+	return afile_process_matching_views(af, NULL, process);
+}
+
+/*
+ * afile_process_matching_views
+ *
+ * Process matching lines from a file, without copying them.
+ *
+ * Each line is passed to the match function, and if it matches, to the
+ * process function, as a view, as afile_process_views describes.  A NULL
+ * match function matches every line.
+ *
+ * Parameter: The afile instance, opened
+ * Parameter: A pointer to a function that will match one line of text
+ * Parameter: A pointer to a function that will process one line of text
+ * Returns:   The number of lines processed
+ */
+int afile_process_matching_views(afile *af, int (*match)(astr_view line), int (*process)(astr_view line)) {
+	afile_view_functions functions;
+	long line_count = 0;
+
+	if (process != NULL) {
+		functions.match = match;
+		functions.process = process;
+		afile_process_views_ctx(af, (match != NULL ? afile_view_match : NULL), afile_view_process, &functions, &line_count);
+	}
+	return (int)line_count;
+}
+
+/*
+ * afile_write_buffer
+ *
+ * Write a buffer to the file at its current position, through its I/O
+ * backend.  With AFILE_IO_READ the buffer goes through stdio.  With
+ * AFILE_IO_PREAD it is written with pwrite.  With AFILE_IO_URING it is cut
+ * into pieces of the buffer size and as many pieces as the prefetch depth, 4
+ * if none is set, are written at once.  Either way the file is left after
+ * the buffer.
+ *
+ * The io_uring is set up by the first write, and kept with the afile for
+ * the next ones until the file is closed.  If it cannot be set up, the file
+ * is written with pwrite, without trying to set it up again.
+ *
+ * Parameter: The afile instance, open for writing
+ * Parameter: The buffer
+ * Parameter: The length of the buffer
+ * Returns:   0 = success, non-zero = errno value from the failed operation
+ */
+int afile_write_buffer(afile *af, const void *buffer, size_t length) {
+	const char *s = (const char *)buffer;
+	afile_uring *ring;
+	off_t offset = -1;
+	size_t queued = 0;
+	size_t piece;
+	uint64_t tag;
+	int depth;
+	int fd;
+	int result = 0;
+	int n;
+
+	if (af == NULL || af->file == NULL) {
+		return EBADF;
+	}
+
+	if (af->io_backend != AFILE_IO_READ && fflush(af->file) == 0) {
+		offset = ftello(af->file);
+	}
+	if (offset < 0) {
+		if (length > 0 && fwrite(s, 1, length, af->file) != length) {
+			result = (errno != 0 ? errno : EIO);
+		}
+		return result;
+	}
+
+	fd = fileno(af->file);
+	if (af->io_backend == AFILE_IO_URING && af->write_ring == NULL && af->write_ring_error == 0) {
+		depth = (af->prefetch_depth > 1 ? af->prefetch_depth : AFILE_IO_DEFAULT_DEPTH);
+		af->write_ring = afile_uring_create(depth);
+		if (af->write_ring == NULL) {
+			af->write_ring_error = (errno != 0 ? errno : ENOSYS);
+		}
+	}
+	ring = (af->io_backend == AFILE_IO_URING ? af->write_ring : NULL);
+
+	if (ring == NULL) {
+		result = afile_pwrite_all(fd, s, length, offset);
+	}
+	else {
+		// The tag of a piece is its offset in the buffer, so a short write can be finished.
+		while (result == 0 && (queued < length || ring->in_flight > 0)) {
+			while (queued < length && ring->queued + ring->in_flight < ring->entries) {
+				piece = (length - queued < af->buffer_size ? length - queued : af->buffer_size);
+				if (afile_uring_write(ring, fd, s + queued, piece, offset + queued, -1, queued) != 0) {
+					break;
+				}
+				queued += piece;
+			}
+			if (ring->queued + ring->in_flight == 0) {
+				result = afile_pwrite_all(fd, s + queued, length - queued, offset + queued);
+				queued = length;
+				break;
+			}
+			result = afile_uring_wait(ring, &tag, &n);
+			if (result == 0 && n < 0) {
+				result = -n;
+			}
+			else if (result == 0) {
+				piece = (length - tag < af->buffer_size ? length - tag : af->buffer_size);
+				if ((size_t)n < piece) {
+					result = afile_pwrite_all(fd, s + tag + n, piece - n, offset + tag + n);
+				}
+			}
+		}
+		if (result != 0) {
+			// Freeing waits for what is still writing from the buffer, and the next write sets up a new ring.
+			af->write_ring = afile_uring_free(ring);
+		}
+	}
+
+	fseeko(af->file, offset + (result == 0 ? (off_t)length : 0), SEEK_SET);
+	return result;
+}
+
+/*
+ * afile_writev_all
+ *
+ * Write all of a list of pieces, where a write can be cut short anywhere.
+ *
+ * Parameter: The file descriptor
+ * Parameter: The pieces, which are changed as they are written
+ * Parameter: The number of pieces
+ * Returns:   0 = success, non-zero = errno value from the failed operation
+ */
+static int afile_writev_all(int fd, struct iovec *pieces, int count) {
+	ssize_t n;
+
+	while (count > 0) {
+		if (pieces->iov_len == 0) {
+			pieces++;
+			count--;
+			continue;
+		}
+		n = writev(fd, pieces, count);
+		if (n < 0 && errno == EINTR) {
+			continue;
+		}
+		if (n <= 0) {
+			return (n < 0 ? errno : EIO);
+		}
+		while (count > 0 && (size_t)n >= pieces->iov_len) {
+			n -= pieces->iov_len;
+			pieces++;
+			count--;
+		}
+		if (count > 0) {
+			pieces->iov_base = (char *)pieces->iov_base + n;
+			pieces->iov_len -= n;
+		}
+	}
+	return 0;
+}
+
+/*
+ * afile_writer_create_fd
+ *
+ * Create a writer on a file descriptor, such as standard output.
+ *
+ * The output is gathered in a buffer of the given size, and when a piece
+ * does not fit, the buffer and the piece are written together with one
+ * writev call, so a piece that is too big for the buffer is never copied.
+ * A writer takes a lock for every write, so several threads can share it;
+ * an unlocked writer takes none, and is only for one thread at a time.
+ *
+ * Parameter: The file descriptor, open for writing
+ * Parameter: Size of the buffer, or 0 for the default
+ * Parameter: Nonzero for a writer that takes no lock
+ * Returns:   Pointer to the writer, or NULL if it could not be created
+ */
+afile_writer *afile_writer_create_fd(int fd, size_t size, int unlocked) {
+	afile_writer *writer;
+
+	if (fd < 0) {
+		return NULL;
+	}
+
+	writer = (afile_writer *)calloc(1, sizeof(afile_writer));
+	if (writer == NULL) {
+		return NULL;
+	}
+
+	writer->fd = fd;
+	writer->size = (size > 0 ? size : AFILE_WRITER_DEFAULT_SIZE);
+	writer->buffer = (char *)malloc(writer->size);
+	if (writer->buffer == NULL) {
+		free(writer);
+		return NULL;
+	}
+	writer->unlocked = unlocked;
+	if (!unlocked) {
+		pthread_mutex_init(&writer->lock, NULL);
+	}
+	return writer;
+}
+
+/*
+ * afile_writer_create
+ *
+ * Create a writer on an afile.
+ *
+ * Anything waiting in the stdio buffer of the file is written first.  The
+ * writer writes to the file descriptor, so the file should not be written
+ * with stdio again until the writer is freed.
+ *
+ * Parameter: The afile instance, open for writing
+ * Parameter: Size of the buffer, or 0 for the default
+ * Parameter: Nonzero for a writer that takes no lock
+ * Returns:   Pointer to the writer, or NULL if it could not be created
+ */
+afile_writer *afile_writer_create(afile *af, size_t size, int unlocked) {
+	afile_writer *writer;
+
+	if (af == NULL || af->file == NULL || fflush(af->file) != 0) {
+		return NULL;
+	}
+
+	writer = afile_writer_create_fd(fileno(af->file), size, unlocked);
+	if (writer != NULL) {
+		writer->af = af;
+	}
+	return writer;
+}
+
+/*
+ * afile_writer_put
+ *
+ * Add a piece of output, and maybe a newline after it, to the buffer, or
+ * write them and the buffer out when they do not fit.
+ *
+ * Parameter: The writer
+ * Parameter: The piece
+ * Parameter: Length of the piece
+ * Parameter: Nonzero to add a newline after the piece
+ * Returns:   0 = success, non-zero = errno value from the failed operation
+ */
+static int afile_writer_put(afile_writer *writer, const char *s, size_t length, int newline) {
+	struct iovec pieces[3];
+	int result;
+
+	if (!writer->unlocked) {
+		pthread_mutex_lock(&writer->lock);
+	}
+
+	if (writer->error == 0) {
+		if (writer->length + length + newline <= writer->size) {
+			memcpy(writer->buffer + writer->length, s, length);
+			writer->length += length;
+			if (newline) {
+				writer->buffer[writer->length++] = '\n';
+			}
+		}
+		else {
+			pieces[0].iov_base = writer->buffer;
+			pieces[0].iov_len = writer->length;
+			pieces[1].iov_base = (void *)s;
+			pieces[1].iov_len = length;
+			pieces[2].iov_base = (void *)"\n";
+			pieces[2].iov_len = newline;
+			writer->error = afile_writev_all(writer->fd, pieces, 3);
+			writer->length = 0;
+			writer->writes++;
+		}
+	}
+	result = writer->error;
+
+	if (!writer->unlocked) {
+		pthread_mutex_unlock(&writer->lock);
+	}
+	return result;
+}
+
+/*
+ * afile_write_view
+ *
+ * Write a view with a writer.
+ *
+ * Parameter: The writer
+ * Parameter: The view
+ * Returns:   0 = success, non-zero = errno value from the failed operation
+ */
+int afile_write_view(afile_writer *writer, astr_view view) {
+	if (writer == NULL) {
+		return EBADF;
+	}
+	return afile_writer_put(writer, view.string, (view.string != NULL && view.length > 0 ? view.length : 0), 0);
+}
+
+/*
+ * afile_write_astr
+ *
+ * Write an astr with a writer.
+ *
+ * Parameter: The writer
+ * Parameter: The astr
+ * Returns:   0 = success, non-zero = errno value from the failed operation
+ */
+int afile_write_astr(afile_writer *writer, const astr *as) {
+	if (writer == NULL) {
+		return EBADF;
+	}
+	return afile_writer_put(writer, (as != NULL ? as->string : NULL), (as != NULL && as->string != NULL ? as->length : 0), 0);
+}
+
+/*
+ * afile_write_line
+ *
+ * Write a view and a newline with a writer.  The two are written together,
+ * so the lines of threads that share a writer are never mixed.
+ *
+ * Parameter: The writer
+ * Parameter: The line, without its newline
+ * Returns:   0 = success, non-zero = errno value from the failed operation
+ */
+int afile_write_line(afile_writer *writer, astr_view line) {
+	if (writer == NULL) {
+		return EBADF;
+	}
+	return afile_writer_put(writer, line.string, (line.string != NULL && line.length > 0 ? line.length : 0), 1);
+}
+
+/*
+ * afile_writer_flush
+ *
+ * Write out what is in the buffer of a writer.
+ *
+ * Parameter: The writer
+ * Returns:   0 = success, non-zero = errno value from the failed operation
+ */
+int afile_writer_flush(afile_writer *writer) {
+	struct iovec piece;
+	int result;
+
+	if (writer == NULL) {
+		return EBADF;
+	}
+
+	if (!writer->unlocked) {
+		pthread_mutex_lock(&writer->lock);
+	}
+
+	if (writer->error == 0 && writer->length > 0) {
+		piece.iov_base = writer->buffer;
+		piece.iov_len = writer->length;
+		writer->error = afile_writev_all(writer->fd, &piece, 1);
+		writer->length = 0;
+		writer->writes++;
+	}
+	result = writer->error;
+
+	if (!writer->unlocked) {
+		pthread_mutex_unlock(&writer->lock);
+	}
+	return result;
+}
+
+/*
+ * afile_writer_free
+ *
+ * Flush and free a writer.  The stdio position of the afile is moved to
+ * where the writer left the file, so stdio can carry on from there.
+ *
+ * Parameter: The writer
+ * Returns:   NULL
+ */
+afile_writer *afile_writer_free(afile_writer *writer) {
+	off_t offset;
+
+	if (writer != NULL) {
+		afile_writer_flush(writer);
+		if (writer->af != NULL && writer->af->file != NULL) {
+			offset = lseek(writer->fd, 0, SEEK_CUR);
+			if (offset >= 0) {
+				fseeko(writer->af->file, offset, SEEK_SET);
+			}
+		}
+		if (!writer->unlocked) {
+			pthread_mutex_destroy(&writer->lock);
+		}
+		free(writer->buffer);
+		free(writer);
+	}
+	return NULL;
+}
+
+/*
+ * afile_write_rope
+ *
+ * Write a rope to the file, one chunk at a time, so a very large string
+ * that was assembled in a rope never has to be flattened into one buffer.
+ *
+ * Parameter: The afile instance, open for writing
+ * Parameter: The rope
+ * Returns:   0 = success, non-zero = errno value from the failed operation
+ */
+int afile_write_rope(afile *af, const astr_rope *rope) {
+	if (af == NULL || af->file == NULL) {
+		return EBADF;
+	}
+	return astr_rope_write(rope, af->file);
+}
+
+/*
+ * afile_write_bloom
+ *
+ * Write a Bloom filter to the file, to be mapped back in later with
+ * afile_map_bloom.  The file should be opened in binary mode.
+ *
+ * Parameter: The afile instance, open for writing
+ * Parameter: The Bloom filter
+ * Returns:   0 = success, non-zero = errno value from the failed operation
+ */
+int afile_write_bloom(afile *af, const astr_bloom *bloom) {
+	if (af == NULL || af->file == NULL) {
+		return EBADF;
+	}
+	return astr_bloom_write(bloom, af->file);
+}
+
+/*
+ * afile_map_bloom
+ *
+ * Map a Bloom filter from the file named by the afile instance.
+ * The file does not need to be open; it is mapped, not read.
+ *
+ * Parameter: The afile instance
+ * Returns:   Pointer to the Bloom filter, or NULL with errno set if the file
+ *            could not be mapped or is not a Bloom filter
+ */
+astr_bloom *afile_map_bloom(const afile *af) {
+	if (af == NULL || af->filespec == NULL) {
+		errno = EINVAL;
+		return NULL;
+	}
+	return astr_bloom_map(af->filespec->string);
+}
+
+/*
+ * afile_write_packed
+ *
+ * Write a packed array to the file, to be mapped back in later with
+ * afile_map_packed.  The file should be opened in binary mode.
+ *
+ * Parameter: The afile instance, open for writing
+ * Parameter: The packed array
+ * Returns:   0 = success, non-zero = errno value from the failed operation
+ */
+int afile_write_packed(afile *af, const astr_packed *packed) {
+	if (af == NULL || af->file == NULL) {
+		return EBADF;
+	}
+	return astr_packed_write(packed, af->file);
+}
+
+/*
+ * afile_map_packed
+ *
+ * Map a packed array from the file named by the afile instance.
+ * The file does not need to be open; it is mapped, not read.
+ *
+ * Parameter: The afile instance
+ * Returns:   Pointer to the packed array, or NULL with errno set if the file
+ *            could not be mapped or is not a packed array
+ */
+astr_packed *afile_map_packed(const afile *af) {
+	if (af == NULL || af->filespec == NULL) {
+		errno = EINVAL;
+		return NULL;
+	}
+	return astr_packed_map(af->filespec->string);
+}
+
+/*
+ * afile_hexdump
+ *
+ * Write a hex dump of a buffer to the file.
+ * The dump is streamed a fixed number of lines at a time.
+ *
+ * Parameter: The afile instance, open for writing
+ * Parameter: The buffer to be dumped
+ * Parameter: The length of the buffer
+ * Returns:   0 = success, non-zero = errno value from the failed operation
+ */
+int afile_hexdump(afile *af, const void *buffer, size_t length) {
+	if (af == NULL || af->file == NULL) {
+		return EBADF;
+	}
+	return astr_hexdump_write(af->file, buffer, length);
+}
+
+/*
+ * afile_hexdump_diff
+ *
+ * Write a hex dump of the lines that differ between two buffers to the file.
+ *
+ * Parameter: The afile instance, open for writing
+ * Parameter: The first buffer
+ * Parameter: The length of the first buffer
+ * Parameter: The second buffer
+ * Parameter: The length of the second buffer
+ * Returns:   0 = success, non-zero = errno value from the failed operation
+ */
+int afile_hexdump_diff(afile *af, const void *buffer1, size_t length1, const void *buffer2, size_t length2) {
+	if (af == NULL || af->file == NULL) {
+		return EBADF;
+	}
+	return astr_hexdump_write_diff(af->file, buffer1, length1, buffer2, length2);
 }
 
 /*
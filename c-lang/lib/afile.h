@@ -4,9 +4,15 @@
 #define AFILE_H
 
 #include <stdio.h>
+#include <pthread.h>
 #include <sys/stat.h>
 
 #include "astr.h"
+#include "astr_bloom.h"
+#include "astr_packed.h"
+#include "astr_rope.h"
+#include "afile_decompress.h"
+#include "afile_uring.h"
 
 /*
  * The afile object provides storage of the attributes of a standard C file, as
@@ -19,11 +25,68 @@
  * optionally code the function that matches particular lines from the file.
  * The framework will handle reading the file and will call the specified
  * match and processing functions passing the current line from the file.
+ * The view processing functions pass each line as a view instead of an astr;
+ * a regular file is mapped into memory, so the lines are never copied.
+ * The parallel processing functions cut a regular file into chunks and
+ * process them on several threads.  The follow functions process a file as
+ * it grows, through truncation and rotation, the way tail -F follows it.
+ * Checkpointed processing records how far it has got in a checkpoint file,
+ * so a job that dies partway through a file carries on from there.
+ * An afile_set processes many files at once on a pool of threads.
+ * A file compressed with gzip or zstd is found from its magic bytes and
+ * decompressed as it is read, so the processing functions see its lines.
+ * A "line" is a record ended by a newline unless another separator is set,
+ * such as a NUL for the output of find -print0, or a fixed record length.
  *
- * There are no I/O functions defined here.  Use the standard C library
- * functions to perform I/O with the file inside the afile object.
+ * An afile_writer gathers output in a large buffer and writes it with writev,
+ * without the format parsing and locking of stdio.
+ *
+ * Apart from the writer, writing ropes and hex dumps, and writing and mapping
+ * Bloom filters and packed arrays, there are no I/O functions defined here.
+ * Use the standard C library functions to perform I/O with the file inside
+ * the afile object.
+ *
+ * Like an astr instance, an afile instance is owned by one thread at a time,
+ * and can be handed to another thread through anything that synchronizes the
+ * two.
  */
 
+// How a line reader reads and afile_write_buffer writes: with read and stdio,
+// with pread and pwrite at explicit offsets, or with io_uring, several
+// operations in flight at once, falling back to pread and pwrite.
+#define AFILE_IO_READ  0
+#define AFILE_IO_PREAD 1
+#define AFILE_IO_URING 2
+
+// What the process functions that take a context return: carry on, stop
+// early, or, any positive value, stop with that errno value.
+#define AFILE_CONTINUE 0
+#define AFILE_STOP     (-1)
+
+// The longest separator that can end the records of a file.
+#define AFILE_SEPARATOR_MAX 16
+
+// How often a followed file is looked at for being appended to, truncated or
+// rotated, in milliseconds, and the idle time to follow it with until stopped.
+#define AFILE_FOLLOW_POLL_MS 200
+#define AFILE_FOLLOW_FOREVER (-1)
+
+// How many lines are read between checkpoints unless another interval is set.
+#define AFILE_CHECKPOINT_DEFAULT_INTERVAL 100000
+
+/*
+ * Counters kept by a prefetching line reader.  A consumer stall is a wait for
+ * the reader thread to fill a block, so a job with many of them is I/O-bound.
+ * A reader stall is a wait for the consumer to be done with a block, so a job
+ * with many of them is CPU-bound.
+ */
+
+typedef struct afile_prefetch_stats {
+	long blocks;
+	long consumer_stalls;
+	long reader_stalls;
+} afile_prefetch_stats;
+
 typedef struct afile {
 	astr *filespec;
 	astr *open_modes;
@@ -32,8 +95,172 @@ typedef struct afile {
 	char *buffer;
 	FILE *file;
 	struct stat stats;
+	astr_edit_program *edit_program;
+	int prefetch_depth;
+	afile_prefetch_stats prefetch_stats;
+	int io_backend;
+	int compression;
+	int decompression_threads;
+	char separator[AFILE_SEPARATOR_MAX];
+	size_t separator_length;
+	size_t record_length;
+	astr *checkpoint_path;
+	long checkpoint_interval;
+	afile_uring *write_ring;
+	int write_ring_error;
 } afile;
 
+/*
+ * An afile_reader reads the lines of an afile a block at a time into the
+ * afile buffer, and hands each one out as a view into the buffer.
+ */
+
+typedef struct afile_reader {
+	// The afile being read
+	afile *af;
+
+	// The file descriptor of the afile
+	int fd;
+
+	// The buffer, which is the afile buffer, grown to fit the longest line
+	char *buffer;
+
+	// Size of the buffer
+	size_t size;
+
+	// Offset in the buffer of the first byte not yet handed out
+	size_t start;
+
+	// Number of bytes in the buffer
+	size_t length;
+
+	// Offset in the file of the first byte not yet handed out, or -1 if the file cannot seek
+	off_t offset;
+
+	// Nonzero once the end of the file has been read
+	int at_end;
+
+	// 0, or the errno value from a failed read
+	int error;
+
+	// The ring the reader thread fills, or NULL if the file is read on this thread
+	struct afile_prefetch *prefetch;
+
+	// The block lines are being handed out from, when prefetching
+	const char *block;
+
+	// Length of the block
+	size_t block_length;
+
+	// Offset in the block of the first byte not yet handed out
+	size_t block_position;
+
+	// The blocks read at explicit offsets, or NULL
+	struct afile_io *io;
+
+	// The backend the reader ended up with
+	int io_backend;
+
+	// The decompressor the file is read through, or NULL
+	afile_decompressor *decompressor;
+
+	// The compression the reader found
+	int compression;
+} afile_reader;
+
+/*
+ * An afile_writer gathers the output for a file descriptor in a buffer, and
+ * writes the buffer out with writev when the next piece does not fit.
+ */
+
+#define AFILE_WRITER_DEFAULT_SIZE (256 * 1024)
+
+typedef struct afile_writer {
+	// The afile being written, or NULL for a writer on a file descriptor
+	afile *af;
+
+	// The file descriptor written to
+	int fd;
+
+	// The buffer the output is gathered in
+	char *buffer;
+
+	// Size of the buffer
+	size_t size;
+
+	// Number of bytes in the buffer
+	size_t length;
+
+	// 0, or the errno value from the first failed write
+	int error;
+
+	// Number of times the buffer has been written out
+	long writes;
+
+	// Nonzero if the writer takes no lock, for one thread at a time
+	int unlocked;
+
+	// The lock taken for every write, unless the writer is unlocked
+	pthread_mutex_t lock;
+} afile_writer;
+
+/*
+ * An afile_checkpoint records how far checkpointed processing has got through
+ * a file, and which file it was, so the processing can carry on from there.
+ */
+
+typedef struct afile_checkpoint {
+	// Offset just after the last line read
+	off_t offset;
+
+	// Number of lines read up to the offset
+	long lines;
+
+	// Number of lines processed up to the offset
+	long processed;
+
+	// The inode, size and modification time of the file
+	ino_t inode;
+	off_t size;
+	struct timespec mtime;
+} afile_checkpoint;
+
+/*
+ * An afile_set is a list of files to be processed together on a pool of
+ * threads, with the result of processing each one.
+ */
+
+typedef struct afile_set_file {
+	// The path of the file
+	astr *path;
+
+	// Size of the file when it was added
+	off_t size;
+
+	// Number of lines of the file processed
+	long line_count;
+
+	// 0, or the errno value from adding or processing the file
+	int error;
+} afile_set_file;
+
+typedef struct afile_set {
+	// The files, in the order they were added
+	afile_set_file *files;
+
+	// Number of files
+	int count;
+
+	// Number of files there is room for
+	int size;
+
+	// Number of lines processed, from all the files
+	long line_count;
+
+	// Number of files that could not be processed
+	int failed;
+} afile_set;
+
 #ifdef	__cplusplus
 extern "C" {
 #endif
@@ -66,6 +293,27 @@ void afile_set_buffering_mode(afile *af, int buffering_mode);
 // Set the afile buffer size.
 void afile_set_buffer_size(afile *af, size_t size);
 
+// Set the number of blocks a line reader reads ahead on its own thread.
+void afile_set_prefetch_depth(afile *af, int depth);
+
+// Set the compression the afile is read with, and the threads to decompress it on.
+void afile_set_compression(afile *af, int compression, int threads);
+
+// Set the separator that ends the records of the afile.
+int afile_set_separator(afile *af, const char *separator, size_t length);
+
+// Set the afile to be read as records of a fixed length.
+void afile_set_record_length(afile *af, size_t length);
+
+// Set the file checkpointed processing keeps its checkpoint in, and how many lines are read between checkpoints.
+void afile_set_checkpoint(afile *af, astr *path, long interval);
+
+// Set how the afile is read by a line reader and written by afile_write_buffer.
+void afile_set_io_backend(afile *af, int backend);
+
+// Set the edit program run on each line before it is matched and processed.
+void afile_set_edit_program(afile *af, const astr_edit_program *program);
+
 // Stat the file.
 int afile_stat(afile *af);
 
@@ -84,12 +332,129 @@ afile *afile_free(afile *af);
 // ----------------------
 // Processing
 
+// Create a line reader for the afile.
+afile_reader *afile_reader_create(afile *af);
+
+// Read the next line.
+astr_view afile_reader_next(afile_reader *reader);
+
+// Read as many of the next lines as can be handed out together.
+int afile_reader_next_batch(afile_reader *reader, astr_view *lines, int max);
+
+// Free a line reader.
+afile_reader *afile_reader_free(afile_reader *reader);
+
+// Find the end of the record that starts at some bytes.
+const char *afile_record_end(const afile *af, const char *s, const char *end);
+
+// Take the separator off the end of a record.
+astr_view afile_record_strip(const afile *af, astr_view record);
+
 // Process all lines from the afile.
 int afile_process_lines(afile *af, int (*process)(astr *as));
 
 // Process the lines from the afile that satisfy the match function.
 int afile_process_matching_lines(afile *af, int (*match)(astr *as), int (*process)(astr *as));
 
+// Process all lines from the afile as views, without copying them.
+int afile_process_views(afile *af, int (*process)(astr_view line));
+
+// Process the lines from the afile that satisfy the match function as views.
+int afile_process_matching_views(afile *af, int (*match)(astr_view line), int (*process)(astr_view line));
+
+// Process the lines from the afile that satisfy the match function as views, with a context.
+int afile_process_views_ctx(afile *af, int (*match)(astr_view line, void *ctx), int (*process)(astr_view line, void *ctx), void *ctx, long *line_count);
+
+// Process all lines from the afile as views, a batch at a time, with a context.
+int afile_process_batches(afile *af, int batch_size, int (*process)(const astr_view *lines, int count, void *ctx), void *ctx, long *line_count);
+
+// Process all lines from the afile on several threads.
+long afile_process_lines_parallel(afile *af, int threads, int ordered, int (*process)(astr *as), long *line_counts);
+
+// Process the lines from the afile that satisfy the match function on several threads.
+long afile_process_matching_lines_parallel(afile *af, int threads, int ordered, int (*match)(astr *as), int (*process)(astr *as), long *line_counts);
+
+// Process the lines from the afile that satisfy the match function as views, with a context, from its checkpoint.
+int afile_process_checkpointed(afile *af, int (*match)(astr_view line, void *ctx), int (*process)(astr_view line, void *ctx), void *ctx, long *line_count);
+
+// Read a checkpoint from a file.
+int afile_checkpoint_read(const astr *path, afile_checkpoint *checkpoint);
+
+// Write a checkpoint to a file, replacing it all at once.
+int afile_checkpoint_write(const astr *path, const afile_checkpoint *checkpoint);
+
+// Follow the afile as it grows, processing the lines that satisfy the match function.
+int afile_follow_matching_lines(afile *af, int (*match)(astr *as), int (*process)(astr *as), int idle_ms, long *line_count);
+
+// Follow the afile as it grows, processing the lines that satisfy the match function as views, with a context.
+int afile_follow_views_ctx(afile *af, int (*match)(astr_view line, void *ctx), int (*process)(astr_view line, void *ctx), void *ctx, int idle_ms, long *line_count);
+
+// ----------------------
+// Sets of files
+
+// Create an empty set of files.
+afile_set *afile_set_create(void);
+
+// Add a file to a set.
+int afile_set_add(afile_set *set, const char *path);
+
+// Add the files in a directory whose names match a pattern to a set.
+int afile_set_add_directory(afile_set *set, const char *directory, const char *pattern, int recursive);
+
+// Process the lines of the files of a set that satisfy the match function as views, on several threads.
+int afile_set_process(afile_set *set, const afile *settings, int threads, int (*match)(astr_view line, void *ctx), int (*process)(astr_view line, void *ctx), void *ctx);
+
+// Free a set of files.
+afile_set *afile_set_free(afile_set *set);
+
+// ----------------------
+// Writing
+
+// Write a buffer to the afile through its I/O backend.
+int afile_write_buffer(afile *af, const void *buffer, size_t length);
+
+// Create a writer on an afile.
+afile_writer *afile_writer_create(afile *af, size_t size, int unlocked);
+
+// Create a writer on a file descriptor.
+afile_writer *afile_writer_create_fd(int fd, size_t size, int unlocked);
+
+// Write a view with a writer.
+int afile_write_view(afile_writer *writer, astr_view view);
+
+// Write an astr with a writer.
+int afile_write_astr(afile_writer *writer, const astr *as);
+
+// Write a view and a newline with a writer.
+int afile_write_line(afile_writer *writer, astr_view line);
+
+// Write out what is in the buffer of a writer.
+int afile_writer_flush(afile_writer *writer);
+
+// Flush and free a writer.
+afile_writer *afile_writer_free(afile_writer *writer);
+
+// Write a rope to the afile, one chunk at a time.
+int afile_write_rope(afile *af, const astr_rope *rope);
+
+// Write a Bloom filter to the afile.
+int afile_write_bloom(afile *af, const astr_bloom *bloom);
+
+// Map a Bloom filter from the file named by the afile.
+astr_bloom *afile_map_bloom(const afile *af);
+
+// Write a packed array to the afile.
+int afile_write_packed(afile *af, const astr_packed *packed);
+
+// Map a packed array from the file named by the afile.
+astr_packed *afile_map_packed(const afile *af);
+
+// Write a hex dump of a buffer to the afile.
+int afile_hexdump(afile *af, const void *buffer, size_t length);
+
+// Write a hex dump of the differences between two buffers to the afile.
+int afile_hexdump_diff(afile *af, const void *buffer1, size_t length1, const void *buffer2, size_t length2);
+
 // ----------------------
 // Utility
 
@@ -0,0 +1,280 @@
+// afile_checkpoint.c - Adept File Checkpointed Processing
+
+/*
+ * Process the lines of a file so that a job that dies partway through can
+ * carry on where it left off, instead of starting again from the first byte.
+ *
+ * Every so many lines, the offset just after the last line read, the number
+ * of lines read and processed, and the inode, size and modification time of
+ * the file are written to a checkpoint file.  The checkpoint is written to a
+ * temporary file beside it, synced, and renamed over it, so a checkpoint file
+ * is always whole: the last one, or the one before it.
+ *
+ * When processing starts, a checkpoint for the same file is carried on from;
+ * a checkpoint for any other file, or a file that has changed, is ignored and
+ * the file is processed from its start.  The lines processed after the last
+ * checkpoint written are processed again after a restart, so the process
+ * function should be able to see a line more than once.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "astr.h"
+#include "afile.h"
+
+#define AFILE_CHECKPOINT_FORMAT "afile checkpoint 1 %lld %ld %ld %llu %lld %lld %ld\n"
+
+/*
+ * afile_checkpoint_read
+ *
+ * Read a checkpoint from a file.
+ *
+ * Parameter: The path of the checkpoint file
+ * Parameter: The checkpoint read
+ * Returns:   0 = success, EINVAL if the file does not hold a checkpoint,
+ *            non-zero = errno value from the failed operation
+ */
+int afile_checkpoint_read(const astr *path, afile_checkpoint *checkpoint) {
+	long long offset;
+	unsigned long long inode;
+	long long size;
+	long long seconds;
+	FILE *file;
+	int fields;
+
+	if (path == NULL || path->string == NULL || checkpoint == NULL) {
+		return EINVAL;
+	}
+
+	file = fopen(path->string, "r");
+	if (file == NULL) {
+		return errno;
+	}
+	memset(checkpoint, 0, sizeof(*checkpoint));
+	fields = fscanf(file, AFILE_CHECKPOINT_FORMAT, &offset, &checkpoint->lines, &checkpoint->processed, &inode, &size, &seconds, &checkpoint->mtime.tv_nsec);
+	fclose(file);
+	if (fields != 7 || offset < 0) {
+		return EINVAL;
+	}
+
+	checkpoint->offset = (off_t)offset;
+	checkpoint->inode = (ino_t)inode;
+	checkpoint->size = (off_t)size;
+	checkpoint->mtime.tv_sec = (time_t)seconds;
+	return 0;
+}
+
+/*
+ * afile_checkpoint_write
+ *
+ * Write a checkpoint to a file, replacing it all at once.
+ *
+ * The checkpoint is written to the path with ".tmp" added, synced to disk,
+ * and renamed to the path, so the file at the path is never half written.
+ *
+ * Parameter: The path of the checkpoint file
+ * Parameter: The checkpoint
+ * Returns:   0 = success, non-zero = errno value from the failed operation
+ */
+int afile_checkpoint_write(const astr *path, const afile_checkpoint *checkpoint) {
+	astr *temp;
+	FILE *file;
+	int result = 0;
+
+	if (path == NULL || path->string == NULL || checkpoint == NULL) {
+		return EINVAL;
+	}
+
+	temp = astr_create(path->string);
+	temp = astr_append(temp, ".tmp");
+	file = fopen(temp->string, "w");
+	if (file == NULL) {
+		result = errno;
+	}
+	else {
+		if (fprintf(file, AFILE_CHECKPOINT_FORMAT, (long long)checkpoint->offset, checkpoint->lines, checkpoint->processed, (unsigned long long)checkpoint->inode, (long long)checkpoint->size, (long long)checkpoint->mtime.tv_sec, checkpoint->mtime.tv_nsec) < 0 || fflush(file) != 0 || fsync(fileno(file)) != 0) {
+			result = errno;
+		}
+		if (fclose(file) != 0 && result == 0) {
+			result = errno;
+		}
+		if (result == 0 && rename(temp->string, path->string) != 0) {
+			result = errno;
+		}
+		if (result != 0) {
+			unlink(temp->string);
+		}
+	}
+	astr_free(temp);
+	return result;
+}
+
+/*
+ * afile_checkpoint_same_file
+ *
+ * Determine if a checkpoint was written for the file as it is now.
+ *
+ * Parameter: The checkpoint read
+ * Parameter: The checkpoint of the file as it is now
+ * Returns:   1 if it is the same file, unchanged, otherwise 0
+ */
+static int afile_checkpoint_same_file(const afile_checkpoint *saved, const afile_checkpoint *now) {
+	return saved->inode == now->inode && saved->size == now->size && saved->mtime.tv_sec == now->mtime.tv_sec && saved->mtime.tv_nsec == now->mtime.tv_nsec;
+}
+
+/*
+ * afile_checkpoint_resume
+ *
+ * Create a line reader that carries on from a checkpoint.  A file that is
+ * read as it is is started at the offset.  A compressed file cannot be
+ * started partway, so its lines up to the offset are read and passed over.
+ *
+ * Parameter: The afile instance, opened
+ * Parameter: The offset to carry on from
+ * Returns:   Pointer to the reader, or NULL if it cannot be created
+ */
+static afile_reader *afile_checkpoint_resume(afile *af, off_t offset) {
+	afile_reader *reader;
+	astr_view line;
+	off_t skipped = 0;
+
+	fseeko(af->file, 0, SEEK_SET);
+	reader = afile_reader_create(af);
+	if (reader == NULL || offset == 0) {
+		return reader;
+	}
+
+	if (reader->compression == AFILE_COMPRESSION_NONE && reader->error == 0) {
+		afile_reader_free(reader);
+		fseeko(af->file, offset, SEEK_SET);
+		return afile_reader_create(af);
+	}
+
+	while (skipped < offset) {
+		line = afile_reader_next(reader);
+		if (line.string == NULL) {
+			break;
+		}
+		skipped += line.length;
+	}
+	return reader;
+}
+
+/*
+ * afile_process_checkpointed
+ *
+ * Process the lines from a file that satisfy the match function as views,
+ * with a context, keeping a checkpoint of how far it has got.
+ *
+ * The checkpoint path and interval are set with afile_set_checkpoint.  If the
+ * checkpoint file holds a checkpoint for the file, and the inode, size and
+ * modification time of the file are the same as when it was written, the
+ * processing carries on from it; otherwise the file is processed from its
+ * start.  Each line is passed to the match and process functions as
+ * afile_process_views_ctx passes it.
+ *
+ * A checkpoint is written after every interval of lines read, and when the
+ * processing ends.  If the process function returns an errno value, the
+ * checkpoint is of the line before, so that line is processed again on the
+ * next run; if it returns AFILE_STOP, the checkpoint is of that line.  A
+ * checkpoint at the end of the file is kept, so running again processes
+ * nothing until the file changes or the checkpoint file is removed.
+ *
+ * Parameter: The afile instance, opened
+ * Parameter: A pointer to a function that will match one line, or NULL
+ * Parameter: A pointer to a function that will process one line
+ * Parameter: The context for the functions
+ * Parameter: Pointer to the number of lines processed, counting those
+ *            processed before the checkpoint, or NULL
+ * Returns:   0 = success, non-zero = errno value from the failed operation or
+ *            returned by the process function
+ */
+int afile_process_checkpointed(afile *af, int (*match)(astr_view line, void *ctx), int (*process)(astr_view line, void *ctx), void *ctx, long *line_count) {
+	afile_checkpoint checkpoint;
+	afile_checkpoint saved;
+	afile_reader *reader;
+	astr_view line;
+	astr_view view;
+	astr *work = NULL;
+	long written_lines;
+	int result = AFILE_CONTINUE;
+	int write_result;
+
+	if (af == NULL || af->file == NULL) {
+		return EBADF;
+	}
+	if (process == NULL || af->checkpoint_path == NULL) {
+		return EINVAL;
+	}
+
+	// The file as it is now, to compare with the checkpoint.
+	result = afile_stat(af);
+	if (result != 0) {
+		return result;
+	}
+	memset(&checkpoint, 0, sizeof(checkpoint));
+	checkpoint.inode = af->stats.st_ino;
+	checkpoint.size = af->stats.st_size;
+	checkpoint.mtime = af->stats.st_mtim;
+	if (afile_checkpoint_read(af->checkpoint_path, &saved) == 0 && afile_checkpoint_same_file(&saved, &checkpoint)) {
+		checkpoint.offset = saved.offset;
+		checkpoint.lines = saved.lines;
+		checkpoint.processed = saved.processed;
+	}
+	written_lines = checkpoint.lines;
+
+	reader = afile_checkpoint_resume(af, checkpoint.offset);
+	if (reader == NULL) {
+		return (errno != 0 ? errno : ENOMEM);
+	}
+
+	for (line = afile_reader_next(reader); line.string != NULL; line = afile_reader_next(reader)) {
+		view = afile_record_strip(af, line);
+		if (af->edit_program != NULL) {
+			work = astr_set_from_view(work, view);
+			work = astr_edit(work, af->edit_program);
+			view = astr_view_of(work);
+		}
+
+		if (match == NULL || match(view, ctx)) {
+			result = process(view, ctx);
+			if (result > 0) {
+				break;
+			}
+			checkpoint.processed++;
+		}
+		checkpoint.offset += line.length;
+		checkpoint.lines++;
+		if (result != AFILE_CONTINUE) {
+			break;
+		}
+
+		if (checkpoint.lines - written_lines >= af->checkpoint_interval) {
+			result = afile_checkpoint_write(af->checkpoint_path, &checkpoint);
+			if (result != 0) {
+				break;
+			}
+			written_lines = checkpoint.lines;
+		}
+	}
+	if (result == AFILE_CONTINUE) {
+		result = reader->error;
+	}
+
+	write_result = afile_checkpoint_write(af->checkpoint_path, &checkpoint);
+	if (result == AFILE_CONTINUE) {
+		result = write_result;
+	}
+
+	afile_reader_free(reader);
+	astr_free(work);
+	if (line_count != NULL) {
+		*line_count = checkpoint.processed;
+	}
+	return (result == AFILE_STOP ? 0 : result);
+}
@@ -0,0 +1,744 @@
+// afile_decompress.c - Adept File Decompression
+
+/*
+ * Streaming decompression of gzip and zstd.
+ *
+ * On the calling thread, the compressed bytes are read into an input buffer
+ * and decompressed straight into the caller's buffer, one member or frame
+ * after another.  On several threads, the file is mapped and its members
+ * are found first; the workers take the members in turn and decompress each
+ * one whole into a slot of a window, and the caller copies the slots out in
+ * order.  A worker does not run more than the window ahead of the caller.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#ifdef HAVE_ZLIB_H
+#include <zlib.h>
+#endif
+
+#ifdef HAVE_ZSTD_H
+#include <zstd.h>
+#endif
+
+#include "afile_decompress.h"
+
+#define AFILE_DECOMPRESS_INPUT_SIZE (64 * 1024)
+#define AFILE_DECOMPRESS_SLOTS_PER_THREAD 4
+
+// A member or frame of a mapped file, and the size it decompresses to.
+typedef struct afile_decompress_member {
+	size_t offset;
+	size_t length;
+	size_t size;
+} afile_decompress_member;
+
+// The members of a mapped file, decompressed on several threads.
+typedef struct afile_decompress_job {
+	int format;
+	unsigned char *mapping;
+	size_t mapping_length;
+	afile_decompress_member *members;
+	size_t count;
+	pthread_t *workers;
+	int started;
+	int window;
+	char **outputs;
+	size_t *sizes;
+	size_t *lengths;
+	int *errors;
+	int *ready;
+	size_t next;
+	size_t current;
+	size_t position;
+	int stop;
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+} afile_decompress_job;
+
+/*
+ * afile_compression_detect
+ *
+ * Find the compression of a stream from its first bytes: 2 are enough to
+ * tell gzip, 4 to tell zstd.
+ *
+ * Parameter: The first bytes of the stream
+ * Parameter: The number of bytes
+ * Returns:   AFILE_COMPRESSION_GZIP, AFILE_COMPRESSION_ZSTD, or
+ *            AFILE_COMPRESSION_NONE
+ */
+int afile_compression_detect(const void *bytes, size_t length) {
+	const unsigned char *b = (const unsigned char *)bytes;
+
+	if (length >= 2 && b[0] == 0x1f && b[1] == 0x8b) {
+		return AFILE_COMPRESSION_GZIP;
+	}
+	if (length >= 4 && b[0] == 0x28 && b[1] == 0xb5 && b[2] == 0x2f && b[3] == 0xfd) {
+		return AFILE_COMPRESSION_ZSTD;
+	}
+	return AFILE_COMPRESSION_NONE;
+}
+
+/*
+ * afile_compression_available
+ *
+ * Determine if a compression can be decompressed, which depends on the
+ * libraries built in.
+ *
+ * Parameter: The compression
+ * Returns:   1 if it can be decompressed, 0 if not
+ */
+int afile_compression_available(int format) {
+	switch (format) {
+	case AFILE_COMPRESSION_NONE:
+		return 1;
+#ifdef HAVE_ZLIB_H
+	case AFILE_COMPRESSION_GZIP:
+		return 1;
+#endif
+#ifdef HAVE_ZSTD_H
+	case AFILE_COMPRESSION_ZSTD:
+		return 1;
+#endif
+	default:
+		return 0;
+	}
+}
+
+/*
+ * afile_decompress_find_member
+ *
+ * Find where a member or frame at the start of some bytes ends, and how big
+ * it is decompressed, without decompressing it.
+ *
+ * A gzip member only says where it ends in a "BC" extra field, which holds
+ * its length less one.  Its trailer ends with its size.
+ *
+ * Parameter: The compression
+ * Parameter: The bytes
+ * Parameter: The number of bytes
+ * Parameter: The member, whose length and size are set
+ * Returns:   0 = found, non-zero = the member does not say
+ */
+static int afile_decompress_find_member(int format, const unsigned char *s, size_t length, afile_decompress_member *member) {
+	const unsigned char *p;
+	const unsigned char *end;
+	size_t slen;
+	size_t total;
+
+	if (format == AFILE_COMPRESSION_GZIP) {
+		if (length < 18 || s[0] != 0x1f || s[1] != 0x8b || s[2] != 8 || (s[3] & 4) == 0) {
+			return EINVAL;
+		}
+		p = s + 12;
+		end = p + (s[10] | (s[11] << 8));
+		if ((size_t)(end - s) > length) {
+			return EINVAL;
+		}
+		while (p + 4 <= end) {
+			slen = p[2] | (p[3] << 8);
+			if (p[0] == 'B' && p[1] == 'C' && slen == 2 && p + 6 <= end) {
+				total = (p[4] | (p[5] << 8)) + 1;
+				if (total > length || total < (size_t)(end - s) + 8) {
+					return EINVAL;
+				}
+				member->length = total;
+				member->size = (size_t)s[total - 4] | ((size_t)s[total - 3] << 8) | ((size_t)s[total - 2] << 16) | ((size_t)s[total - 1] << 24);
+				return 0;
+			}
+			p += 4 + slen;
+		}
+		return EINVAL;
+	}
+
+#ifdef HAVE_ZSTD_H
+	if (format == AFILE_COMPRESSION_ZSTD) {
+		unsigned long long size;
+
+		total = ZSTD_findFrameCompressedSize(s, length);
+		if (ZSTD_isError(total)) {
+			return EINVAL;
+		}
+		size = ZSTD_getFrameContentSize(s, total);
+		if (size == ZSTD_CONTENTSIZE_UNKNOWN || size == ZSTD_CONTENTSIZE_ERROR) {
+			return EINVAL;
+		}
+		member->length = total;
+		member->size = (size_t)size;
+		return 0;
+	}
+#endif
+
+	return EINVAL;
+}
+
+/*
+ * afile_decompress_one
+ *
+ * Decompress a whole member or frame of a mapped file.
+ *
+ * Parameter: The job
+ * Parameter: The member
+ * Parameter: The buffer, the size of the decompressed member
+ * Returns:   0 = success, non-zero = errno value from the failed operation
+ */
+static int afile_decompress_one(afile_decompress_job *job, const afile_decompress_member *member, char *buffer) {
+#ifdef HAVE_ZLIB_H
+	if (job->format == AFILE_COMPRESSION_GZIP) {
+		z_stream z;
+		int status;
+
+		memset(&z, 0, sizeof(z));
+		if (inflateInit2(&z, 16 + MAX_WBITS) != Z_OK) {
+			return ENOMEM;
+		}
+		z.next_in = job->mapping + member->offset;
+		z.avail_in = member->length;
+		z.next_out = (unsigned char *)buffer;
+		z.avail_out = member->size;
+		status = inflate(&z, Z_FINISH);
+		inflateEnd(&z);
+		return (status == Z_STREAM_END && z.total_out == member->size && z.avail_in == 0 ? 0 : EIO);
+	}
+#endif
+
+#ifdef HAVE_ZSTD_H
+	if (job->format == AFILE_COMPRESSION_ZSTD) {
+		size_t size;
+
+		size = ZSTD_decompress(buffer, member->size, job->mapping + member->offset, member->length);
+		return (!ZSTD_isError(size) && size == member->size ? 0 : EIO);
+	}
+#endif
+
+	return ENOTSUP;
+}
+
+/*
+ * afile_decompress_run
+ *
+ * A worker: decompress the next member into its slot, until there are no
+ * more members.
+ *
+ * Parameter: The job
+ * Returns:   NULL
+ */
+static void *afile_decompress_run(void *arg) {
+	afile_decompress_job *job = (afile_decompress_job *)arg;
+	const afile_decompress_member *member;
+	char *output;
+	size_t m;
+	int slot;
+	int error;
+
+	for (;;) {
+		pthread_mutex_lock(&job->mutex);
+		while (!job->stop && job->next < job->count && job->next >= job->current + job->window) {
+			pthread_cond_wait(&job->cond, &job->mutex);
+		}
+		if (job->stop || job->next >= job->count) {
+			pthread_mutex_unlock(&job->mutex);
+			break;
+		}
+		m = job->next++;
+		pthread_mutex_unlock(&job->mutex);
+
+		// The slot's last member has been copied out, so the slot is this worker's.
+		member = &job->members[m];
+		slot = m % job->window;
+		error = 0;
+		if (job->sizes[slot] < member->size || job->outputs[slot] == NULL) {
+			output = (char *)realloc(job->outputs[slot], (member->size > 0 ? member->size : 1));
+			if (output != NULL) {
+				job->outputs[slot] = output;
+				job->sizes[slot] = member->size;
+			}
+			else {
+				error = ENOMEM;
+			}
+		}
+		if (error == 0) {
+			error = afile_decompress_one(job, member, job->outputs[slot]);
+		}
+
+		pthread_mutex_lock(&job->mutex);
+		job->lengths[slot] = (error == 0 ? member->size : 0);
+		job->errors[slot] = error;
+		job->ready[slot] = 1;
+		pthread_cond_broadcast(&job->cond);
+		pthread_mutex_unlock(&job->mutex);
+	}
+	return NULL;
+}
+
+/*
+ * afile_decompress_job_free
+ *
+ * Stop the workers of a job and free it.
+ *
+ * Parameter: The job
+ */
+static void afile_decompress_job_free(afile_decompress_job *job) {
+	int i;
+
+	pthread_mutex_lock(&job->mutex);
+	job->stop = 1;
+	pthread_cond_broadcast(&job->cond);
+	pthread_mutex_unlock(&job->mutex);
+	for (i = 0; i < job->started; i++) {
+		pthread_join(job->workers[i], NULL);
+	}
+
+	if (job->outputs != NULL) {
+		for (i = 0; i < job->window; i++) {
+			free(job->outputs[i]);
+		}
+	}
+	pthread_mutex_destroy(&job->mutex);
+	pthread_cond_destroy(&job->cond);
+	munmap(job->mapping, job->mapping_length);
+	free(job->members);
+	free(job->workers);
+	free(job->outputs);
+	free(job->sizes);
+	free(job->lengths);
+	free(job->errors);
+	free(job->ready);
+	free(job);
+}
+
+/*
+ * afile_decompress_job_create
+ *
+ * Map a regular file, find its members from the current position of the
+ * file descriptor to the end, and start the workers that decompress them.
+ *
+ * Parameter: The file descriptor
+ * Parameter: The compression
+ * Parameter: The number of worker threads
+ * Returns:   Pointer to the job, or NULL if the file is not a regular file,
+ *            or does not say where each of its members ends
+ */
+static afile_decompress_job *afile_decompress_job_create(int fd, int format, int threads) {
+	afile_decompress_job *job;
+	afile_decompress_member *members;
+	struct stat stats;
+	size_t capacity = 0;
+	size_t offset;
+	off_t position;
+	int i;
+
+	position = lseek(fd, 0, SEEK_CUR);
+	if (position < 0 || fstat(fd, &stats) != 0 || !S_ISREG(stats.st_mode) || position >= stats.st_size) {
+		return NULL;
+	}
+
+	job = (afile_decompress_job *)calloc(1, sizeof(afile_decompress_job));
+	if (job == NULL) {
+		return NULL;
+	}
+	job->format = format;
+	job->mapping_length = stats.st_size;
+	job->mapping = (unsigned char *)mmap(NULL, stats.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (job->mapping == MAP_FAILED) {
+		free(job);
+		return NULL;
+	}
+	madvise(job->mapping, stats.st_size, MADV_SEQUENTIAL);
+	pthread_mutex_init(&job->mutex, NULL);
+	pthread_cond_init(&job->cond, NULL);
+
+	for (offset = position; offset < job->mapping_length; offset += job->members[job->count++].length) {
+		if (job->count == capacity) {
+			capacity = (capacity > 0 ? capacity * 2 : 64);
+			members = (afile_decompress_member *)realloc(job->members, capacity * sizeof(afile_decompress_member));
+			if (members == NULL) {
+				afile_decompress_job_free(job);
+				return NULL;
+			}
+			job->members = members;
+		}
+		job->members[job->count].offset = offset;
+		if (afile_decompress_find_member(format, job->mapping + offset, job->mapping_length - offset, &job->members[job->count]) != 0) {
+			afile_decompress_job_free(job);
+			return NULL;
+		}
+	}
+
+	job->window = threads * AFILE_DECOMPRESS_SLOTS_PER_THREAD;
+	job->workers = (pthread_t *)calloc(threads, sizeof(pthread_t));
+	job->outputs = (char **)calloc(job->window, sizeof(char *));
+	job->sizes = (size_t *)calloc(job->window, sizeof(size_t));
+	job->lengths = (size_t *)calloc(job->window, sizeof(size_t));
+	job->errors = (int *)calloc(job->window, sizeof(int));
+	job->ready = (int *)calloc(job->window, sizeof(int));
+	if (job->workers == NULL || job->outputs == NULL || job->sizes == NULL || job->lengths == NULL || job->errors == NULL || job->ready == NULL) {
+		afile_decompress_job_free(job);
+		return NULL;
+	}
+
+	for (i = 0; i < threads; i++) {
+		if (pthread_create(&job->workers[i], NULL, afile_decompress_run, job) != 0) {
+			break;
+		}
+		job->started++;
+	}
+	if (job->started == 0) {
+		afile_decompress_job_free(job);
+		return NULL;
+	}
+	return job;
+}
+
+/*
+ * afile_decompress_job_read
+ *
+ * Copy out the decompressed members of a job, in order, waiting for the
+ * workers if need be.
+ *
+ * Parameter: The job
+ * Parameter: The buffer
+ * Parameter: Size of the buffer
+ * Returns:   The number of bytes, 0 at the end, or -1 with errno set
+ */
+static ssize_t afile_decompress_job_read(afile_decompress_job *job, char *buffer, size_t size) {
+	size_t n = 0;
+	int slot;
+	int error;
+
+	while (n == 0 && job->current < job->count) {
+		slot = job->current % job->window;
+		pthread_mutex_lock(&job->mutex);
+		while (!job->ready[slot]) {
+			pthread_cond_wait(&job->cond, &job->mutex);
+		}
+		error = job->errors[slot];
+		pthread_mutex_unlock(&job->mutex);
+		if (error != 0) {
+			errno = error;
+			return -1;
+		}
+
+		n = job->lengths[slot] - job->position;
+		if (n > size) {
+			n = size;
+		}
+		memcpy(buffer, job->outputs[slot] + job->position, n);
+		job->position += n;
+
+		if (job->position == job->lengths[slot]) {
+			pthread_mutex_lock(&job->mutex);
+			job->ready[slot] = 0;
+			job->current++;
+			pthread_cond_broadcast(&job->cond);
+			pthread_mutex_unlock(&job->mutex);
+			job->position = 0;
+		}
+	}
+	return n;
+}
+
+/*
+ * afile_decompressor_create
+ *
+ * Create a decompressor for the stream from the current position of a file
+ * descriptor.
+ *
+ * Bytes already read from the stream to find its compression are given
+ * back as the primed bytes, and are decompressed before anything else.  A
+ * stream with primed bytes is decompressed on the calling thread.
+ *
+ * Parameter: The file descriptor, open for reading
+ * Parameter: The compression, or AFILE_COMPRESSION_AUTO to find it from the
+ *            primed bytes
+ * Parameter: The bytes already read from the stream, or NULL
+ * Parameter: The number of bytes already read
+ * Parameter: Size of the input buffer, or 0 for the default
+ * Parameter: The number of threads to decompress members on
+ * Returns:   Pointer to the decompressor, or NULL with errno set, ENOTSUP if
+ *            the compression is not built in
+ */
+afile_decompressor *afile_decompressor_create(int fd, int format, const void *primed, size_t primed_length, size_t input_size, int threads) {
+	afile_decompressor *decompressor;
+
+	if (format == AFILE_COMPRESSION_AUTO) {
+		format = afile_compression_detect(primed, primed_length);
+	}
+	if (!afile_compression_available(format)) {
+		errno = ENOTSUP;
+		return NULL;
+	}
+
+	decompressor = (afile_decompressor *)calloc(1, sizeof(afile_decompressor));
+	if (decompressor == NULL) {
+		return NULL;
+	}
+	decompressor->fd = fd;
+	decompressor->format = format;
+
+	if (threads > 1 && format != AFILE_COMPRESSION_NONE && primed_length == 0) {
+		decompressor->job = afile_decompress_job_create(fd, format, threads);
+		if (decompressor->job != NULL) {
+			return decompressor;
+		}
+	}
+
+	decompressor->input_size = (input_size > 0 ? input_size : AFILE_DECOMPRESS_INPUT_SIZE);
+	if (decompressor->input_size < primed_length) {
+		decompressor->input_size = primed_length;
+	}
+	decompressor->input = (unsigned char *)malloc(decompressor->input_size);
+	if (decompressor->input == NULL) {
+		free(decompressor);
+		return NULL;
+	}
+	if (primed_length > 0) {
+		memcpy(decompressor->input, primed, primed_length);
+		decompressor->input_length = primed_length;
+	}
+
+#ifdef HAVE_ZLIB_H
+	if (format == AFILE_COMPRESSION_GZIP) {
+		z_stream *z = (z_stream *)calloc(1, sizeof(z_stream));
+
+		if (z == NULL || inflateInit2(z, 16 + MAX_WBITS) != Z_OK) {
+			free(z);
+			return afile_decompressor_free(decompressor);
+		}
+		decompressor->stream = z;
+	}
+#endif
+
+#ifdef HAVE_ZSTD_H
+	if (format == AFILE_COMPRESSION_ZSTD) {
+		decompressor->stream = ZSTD_createDStream();
+		if (decompressor->stream == NULL) {
+			return afile_decompressor_free(decompressor);
+		}
+		ZSTD_initDStream((ZSTD_DStream *)decompressor->stream);
+	}
+#endif
+
+	return decompressor;
+}
+
+/*
+ * afile_decompressor_fill
+ *
+ * Read more of the compressed stream into the input buffer, after what is
+ * left of it.
+ *
+ * Parameter: The decompressor
+ * Returns:   0 = success, non-zero = errno value from the failed read
+ */
+static int afile_decompressor_fill(afile_decompressor *decompressor) {
+	ssize_t n;
+
+	if (decompressor->input_start > 0) {
+		memmove(decompressor->input, decompressor->input + decompressor->input_start, decompressor->input_length - decompressor->input_start);
+		decompressor->input_length -= decompressor->input_start;
+		decompressor->input_start = 0;
+	}
+
+	do {
+		n = read(decompressor->fd, decompressor->input + decompressor->input_length, decompressor->input_size - decompressor->input_length);
+	} while (n < 0 && errno == EINTR);
+
+	if (n > 0) {
+		decompressor->input_length += n;
+	}
+	else if (n == 0) {
+		decompressor->input_at_end = 1;
+	}
+	else {
+		return errno;
+	}
+	return 0;
+}
+
+/*
+ * afile_decompressor_step
+ *
+ * Decompress what can be decompressed from the input buffer into a buffer.
+ *
+ * Parameter: The decompressor
+ * Parameter: The buffer
+ * Parameter: Size of the buffer
+ * Parameter: Pointer to where to put the number of bytes decompressed
+ * Returns:   0 = success, non-zero = errno value for corrupt input
+ */
+static int afile_decompressor_step(afile_decompressor *decompressor, char *buffer, size_t size, size_t *produced) {
+	*produced = 0;
+
+#ifdef HAVE_ZLIB_H
+	if (decompressor->format == AFILE_COMPRESSION_GZIP) {
+		z_stream *z = (z_stream *)decompressor->stream;
+		int status;
+
+		// Another member follows only if the next bytes start one.
+		if (decompressor->member_done) {
+			if (decompressor->input[decompressor->input_start] != 0x1f) {
+				decompressor->finished = 1;
+				return 0;
+			}
+			inflateReset(z);
+			decompressor->member_done = 0;
+		}
+
+		z->next_in = decompressor->input + decompressor->input_start;
+		z->avail_in = decompressor->input_length - decompressor->input_start;
+		z->next_out = (unsigned char *)buffer;
+		z->avail_out = size;
+		status = inflate(z, Z_NO_FLUSH);
+		decompressor->input_start = decompressor->input_length - z->avail_in;
+		*produced = size - z->avail_out;
+		if (status == Z_STREAM_END) {
+			decompressor->member_done = 1;
+		}
+		else if (status != Z_OK && status != Z_BUF_ERROR) {
+			return (status == Z_MEM_ERROR ? ENOMEM : EIO);
+		}
+		return 0;
+	}
+#endif
+
+#ifdef HAVE_ZSTD_H
+	if (decompressor->format == AFILE_COMPRESSION_ZSTD) {
+		ZSTD_inBuffer in;
+		ZSTD_outBuffer out;
+		size_t status;
+
+		in.src = decompressor->input + decompressor->input_start;
+		in.size = decompressor->input_length - decompressor->input_start;
+		in.pos = 0;
+		out.dst = buffer;
+		out.size = size;
+		out.pos = 0;
+		status = ZSTD_decompressStream((ZSTD_DStream *)decompressor->stream, &out, &in);
+		if (ZSTD_isError(status)) {
+			return EIO;
+		}
+		decompressor->input_start += in.pos;
+		*produced = out.pos;
+		decompressor->member_done = (status == 0);
+		return 0;
+	}
+#endif
+
+	return ENOTSUP;
+}
+
+/*
+ * afile_decompressor_read
+ *
+ * Read decompressed bytes, the way read(2) reads a file: up to the size of
+ * the buffer, at least one byte until the end of the stream.  A stream that
+ * ends in the middle of a member or frame, or is corrupt, fails with EIO.
+ *
+ * Parameter: The decompressor
+ * Parameter: The buffer
+ * Parameter: Size of the buffer
+ * Returns:   The number of bytes, 0 at the end, or -1 with errno set
+ */
+ssize_t afile_decompressor_read(afile_decompressor *decompressor, void *buffer, size_t size) {
+	size_t n;
+	ssize_t r;
+	int result;
+
+	if (decompressor == NULL) {
+		errno = EBADF;
+		return -1;
+	}
+	if (size == 0) {
+		return 0;
+	}
+	if (decompressor->job != NULL) {
+		return afile_decompress_job_read(decompressor->job, (char *)buffer, size);
+	}
+
+	for (;;) {
+		if (decompressor->finished) {
+			return 0;
+		}
+
+		// A stream that is not compressed hands out the primed bytes, then reads straight into the buffer.
+		if (decompressor->format == AFILE_COMPRESSION_NONE) {
+			n = decompressor->input_length - decompressor->input_start;
+			if (n == 0) {
+				do {
+					r = read(decompressor->fd, buffer, size);
+				} while (r < 0 && errno == EINTR);
+				decompressor->finished = (r == 0);
+				return r;
+			}
+			if (n > size) {
+				n = size;
+			}
+			memcpy(buffer, decompressor->input + decompressor->input_start, n);
+			decompressor->input_start += n;
+			return n;
+		}
+
+		if (decompressor->input_start == decompressor->input_length) {
+			if (decompressor->input_at_end) {
+				if (decompressor->member_done) {
+					decompressor->finished = 1;
+					return 0;
+				}
+				errno = EIO;
+				return -1;
+			}
+			result = afile_decompressor_fill(decompressor);
+			if (result != 0) {
+				errno = result;
+				return -1;
+			}
+			continue;
+		}
+
+		result = afile_decompressor_step(decompressor, (char *)buffer, size, &n);
+		if (result != 0) {
+			errno = result;
+			return -1;
+		}
+		if (n > 0) {
+			return n;
+		}
+	}
+}
+
+/*
+ * afile_decompressor_free
+ *
+ * Free a decompressor, stopping its workers.  The file descriptor is kept.
+ *
+ * Parameter: The decompressor
+ * Returns:   NULL
+ */
+afile_decompressor *afile_decompressor_free(afile_decompressor *decompressor) {
+	if (decompressor != NULL) {
+		if (decompressor->job != NULL) {
+			afile_decompress_job_free(decompressor->job);
+		}
+#ifdef HAVE_ZLIB_H
+		if (decompressor->format == AFILE_COMPRESSION_GZIP && decompressor->stream != NULL) {
+			inflateEnd((z_stream *)decompressor->stream);
+			free(decompressor->stream);
+		}
+#endif
+#ifdef HAVE_ZSTD_H
+		if (decompressor->format == AFILE_COMPRESSION_ZSTD && decompressor->stream != NULL) {
+			ZSTD_freeDStream((ZSTD_DStream *)decompressor->stream);
+		}
+#endif
+		free(decompressor->input);
+		free(decompressor);
+	}
+	return NULL;
+}
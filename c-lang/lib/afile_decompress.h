@@ -0,0 +1,93 @@
+// afile_decompress.h - Adept File Decompression
+
+#ifndef AFILE_DECOMPRESS_H
+#define AFILE_DECOMPRESS_H
+
+#include <stddef.h>
+#include <sys/types.h>
+
+/*
+ * An afile_decompressor reads a compressed stream from a file descriptor and
+ * hands out the decompressed bytes the way read(2) hands out the bytes of a
+ * file, so a line reader can read a compressed file without knowing it is
+ * compressed.
+ *
+ * The formats are gzip, with zlib, and zstd, with libzstd, each where its
+ * library is built in.  A stream of several gzip members or zstd frames, one
+ * after another, is read as one, the way zcat reads it.  A stream that is not
+ * compressed is handed out as it is.
+ *
+ * With more than one thread, the members of a regular file are decompressed
+ * on that many threads at once when where each one ends can be found without
+ * decompressing it: gzip members that record their size in a "BC" extra
+ * field, as bgzip writes them, and zstd frames that record their content
+ * size.  Any other stream is decompressed on the calling thread.
+ *
+ * An afile_decompressor is owned by one thread at a time.
+ */
+
+// The compression of a file: found from its magic bytes, none, gzip or zstd.
+#define AFILE_COMPRESSION_AUTO 0
+#define AFILE_COMPRESSION_NONE 1
+#define AFILE_COMPRESSION_GZIP 2
+#define AFILE_COMPRESSION_ZSTD 3
+
+typedef struct afile_decompressor {
+	// The file descriptor of the compressed stream
+	int fd;
+
+	// The compression of the stream
+	int format;
+
+	// The compressed bytes read and not yet decompressed
+	unsigned char *input;
+
+	// Size of the input buffer
+	size_t input_size;
+
+	// Offset in the input buffer of the first byte not yet decompressed
+	size_t input_start;
+
+	// Number of bytes in the input buffer
+	size_t input_length;
+
+	// Nonzero once the end of the compressed stream has been read
+	int input_at_end;
+
+	// Nonzero when the last member or frame decompressed is complete
+	int member_done;
+
+	// Nonzero once the end of the decompressed stream has been reached
+	int finished;
+
+	// The zlib or zstd stream, when decompressing on the calling thread
+	void *stream;
+
+	// The members decompressed on several threads, or NULL
+	struct afile_decompress_job *job;
+} afile_decompressor;
+
+#ifdef	__cplusplus
+extern "C" {
+#endif
+
+// Find the compression of a stream from its first bytes.
+int afile_compression_detect(const void *bytes, size_t length);
+
+// Determine if a compression can be decompressed.
+int afile_compression_available(int format);
+
+// Create a decompressor.
+afile_decompressor *afile_decompressor_create(int fd, int format, const void *primed, size_t primed_length, size_t input_size, int threads);
+
+// Read decompressed bytes.
+ssize_t afile_decompressor_read(afile_decompressor *decompressor, void *buffer, size_t size);
+
+// Free a decompressor.
+afile_decompressor *afile_decompressor_free(afile_decompressor *decompressor);
+
+#ifdef	__cplusplus
+}
+#endif
+
+#endif	// AFILE_DECOMPRESS_H
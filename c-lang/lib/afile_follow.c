@@ -0,0 +1,457 @@
+// afile_follow.c - Adept File Follow Mode
+
+/*
+ * Follow a file as it grows, the way tail -F follows a log.
+ *
+ * The file is read to its end with read(2), as many bytes as the buffer size
+ * at a time, and every whole line read is processed before the next read, so
+ * lines appended quickly are handled many to a system call.  A line without
+ * its separator yet is kept until the rest of it is appended.
+ *
+ * At the end of the file the follower waits.  With inotify it is woken as
+ * soon as the file is written to; without it, or as well as it, the file is
+ * looked at again every AFILE_FOLLOW_POLL_MS.  Each time, a file that has
+ * become shorter than what was read has been truncated, and is read again
+ * from its start; a file name that has come to name another file has been
+ * rotated, and once the old file is read to its end the new one is opened
+ * and read from its start.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/stat.h>
+
+#ifdef HAVE_SYS_INOTIFY_H
+#include <sys/inotify.h>
+#endif
+
+#include "astr.h"
+#include "afile.h"
+
+#define AFILE_FOLLOW_MIN_READ 4096
+
+// The state of a follower.
+typedef struct afile_follow {
+	afile *af;
+	int fd;
+	off_t offset;
+	char *pending;
+	size_t pending_length;
+	size_t pending_size;
+	int inotify_fd;
+	int watch;
+	int keep_separator;
+	int (*match)(astr_view line, void *ctx);
+	int (*process)(astr_view line, void *ctx);
+	void *ctx;
+	astr *work;
+	long line_count;
+} afile_follow;
+
+/*
+ * afile_follow_now
+ *
+ * Get the time on a clock that only goes forward.
+ *
+ * Returns:   The time in milliseconds
+ */
+static long long afile_follow_now(void) {
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (long long)now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
+
+/*
+ * afile_follow_watch
+ *
+ * Watch the file that is open for writes and for being moved or deleted, if
+ * inotify can watch it.
+ *
+ * Parameter: The follower
+ */
+static void afile_follow_watch(afile_follow *follow) {
+#ifdef HAVE_SYS_INOTIFY_H
+	if (follow->inotify_fd >= 0) {
+		if (follow->watch >= 0) {
+			inotify_rm_watch(follow->inotify_fd, follow->watch);
+		}
+		follow->watch = inotify_add_watch(follow->inotify_fd, follow->af->filespec->string, IN_MODIFY | IN_ATTRIB | IN_MOVE_SELF | IN_DELETE_SELF);
+	}
+#endif
+}
+
+/*
+ * afile_follow_line
+ *
+ * Edit, match and process one line.
+ *
+ * Parameter: The follower
+ * Parameter: The line, with its separator if it has one
+ * Returns:   What the process function returned, or AFILE_CONTINUE
+ */
+static int afile_follow_line(afile_follow *follow, astr_view line) {
+	afile *af = follow->af;
+
+	if (!follow->keep_separator) {
+		line = afile_record_strip(af, line);
+	}
+	if (af->edit_program != NULL) {
+		follow->work = astr_set_from_view(follow->work, line);
+		follow->work = astr_edit(follow->work, af->edit_program);
+		line = astr_view_of(follow->work);
+	}
+
+	if (follow->match != NULL && !follow->match(line, follow->ctx)) {
+		return AFILE_CONTINUE;
+	}
+	follow->line_count++;
+	return follow->process(line, follow->ctx);
+}
+
+/*
+ * afile_follow_drain
+ *
+ * Read the file to its end, and process every whole line read.
+ *
+ * Parameter: The follower
+ * Parameter: Pointer to a flag set if anything was read
+ * Returns:   AFILE_CONTINUE, AFILE_STOP, or an errno value
+ */
+static int afile_follow_drain(afile_follow *follow, int *read_any) {
+	afile *af = follow->af;
+	size_t block = (af->buffer_size > AFILE_FOLLOW_MIN_READ ? af->buffer_size : AFILE_FOLLOW_MIN_READ);
+	const char *s;
+	const char *end;
+	const char *next;
+	char *grown;
+	ssize_t n;
+	int result = AFILE_CONTINUE;
+
+	for (;;) {
+		if (follow->pending_size - follow->pending_length < block) {
+			grown = (char *)realloc(follow->pending, follow->pending_length + block);
+			if (grown == NULL) {
+				return ENOMEM;
+			}
+			follow->pending = grown;
+			follow->pending_size = follow->pending_length + block;
+		}
+
+		n = read(follow->fd, follow->pending + follow->pending_length, follow->pending_size - follow->pending_length);
+		if (n < 0 && errno == EINTR) {
+			continue;
+		}
+		if (n < 0) {
+			return errno;
+		}
+		if (n == 0) {
+			return AFILE_CONTINUE;
+		}
+		*read_any = 1;
+		follow->offset += n;
+		follow->pending_length += n;
+
+		// Every whole line read so far is processed before the next read.
+		s = follow->pending;
+		end = follow->pending + follow->pending_length;
+		while (result == AFILE_CONTINUE && (next = afile_record_end(af, s, end)) != NULL) {
+			result = afile_follow_line(follow, astr_view_from_buffer(s, (int)(next - s)));
+			s = next;
+		}
+		follow->pending_length = end - s;
+		memmove(follow->pending, s, follow->pending_length);
+		if (result != AFILE_CONTINUE) {
+			return result;
+		}
+	}
+}
+
+/*
+ * afile_follow_changed
+ *
+ * Look for the file having been truncated or rotated, and if it has, start
+ * reading it, or the file that now has its name, from the start.
+ *
+ * Parameter: The follower
+ * Parameter: Pointer to a flag set if the file is to be read from the start
+ * Returns:   AFILE_CONTINUE, AFILE_STOP, or an errno value
+ */
+static int afile_follow_changed(afile_follow *follow, int *restarted) {
+	afile *af = follow->af;
+	struct stat open_stats;
+	struct stat named_stats;
+	int read_any = 0;
+	int result;
+
+	if (fstat(follow->fd, &open_stats) != 0) {
+		return errno;
+	}
+
+	if (open_stats.st_size < follow->offset) {
+		// What is left of a line from before the truncation is dropped.
+		if (lseek(follow->fd, 0, SEEK_SET) < 0) {
+			return errno;
+		}
+		follow->offset = 0;
+		follow->pending_length = 0;
+		*restarted = 1;
+		return AFILE_CONTINUE;
+	}
+
+	// Until a new file is made with the name, the old one is kept open.
+	if (stat(af->filespec->string, &named_stats) != 0 || (named_stats.st_ino == open_stats.st_ino && named_stats.st_dev == open_stats.st_dev)) {
+		return AFILE_CONTINUE;
+	}
+
+	// Anything written to the old file before it was rotated is read first,
+	// and its last line is complete even without its separator.
+	result = afile_follow_drain(follow, &read_any);
+	if (result == AFILE_CONTINUE && follow->pending_length > 0) {
+		result = afile_follow_line(follow, astr_view_from_buffer(follow->pending, (int)follow->pending_length));
+		follow->pending_length = 0;
+	}
+	if (result != AFILE_CONTINUE) {
+		return result;
+	}
+
+	afile_close(af);
+	result = afile_open(af);
+	if (result != 0 || af->file == NULL) {
+		return (result != 0 ? result : EBADF);
+	}
+	follow->fd = fileno(af->file);
+	follow->offset = 0;
+	afile_follow_watch(follow);
+	*restarted = 1;
+	return AFILE_CONTINUE;
+}
+
+/*
+ * afile_follow_wait
+ *
+ * Wait for the file to be written to, for inotify to report a change, or for
+ * a time to pass.
+ *
+ * Parameter: The follower
+ * Parameter: The most milliseconds to wait
+ */
+static void afile_follow_wait(afile_follow *follow, int timeout) {
+	struct pollfd events;
+	char discard[4096];
+
+	if (follow->inotify_fd >= 0 && follow->watch >= 0) {
+		events.fd = follow->inotify_fd;
+		events.events = POLLIN;
+		events.revents = 0;
+		if (poll(&events, 1, timeout) > 0) {
+			// The events only say to look again, so all of them are read at once.
+			while (read(follow->inotify_fd, discard, sizeof(discard)) > 0) {
+			}
+		}
+	}
+	else {
+		poll(NULL, 0, timeout);
+	}
+}
+
+/*
+ * afile_follow_run
+ *
+ * Follow a file for the follow functions.
+ *
+ * Parameter: The afile instance, opened for reading by its filespec
+ * Parameter: Nonzero to pass the lines with their separators
+ * Parameter: A pointer to a function that will match one line, or NULL
+ * Parameter: A pointer to a function that will process one line
+ * Parameter: The context for the functions
+ * Parameter: Milliseconds with nothing appended to stop after, or
+ *            AFILE_FOLLOW_FOREVER
+ * Parameter: Pointer to the number of lines processed, or NULL
+ * Returns:   0 = success, non-zero = errno value from the failed operation or
+ *            returned by the process function
+ */
+static int afile_follow_run(afile *af, int keep_separator, int (*match)(astr_view line, void *ctx), int (*process)(astr_view line, void *ctx), void *ctx, int idle_ms, long *line_count) {
+	afile_follow follow;
+	long long idle_since;
+	long long idle;
+	int read_any;
+	int restarted;
+	int timeout;
+	int result;
+
+	if (af == NULL || af->file == NULL || astr_is_empty(af->filespec)) {
+		return EBADF;
+	}
+	if (process == NULL) {
+		return EINVAL;
+	}
+
+	memset(&follow, 0, sizeof(follow));
+	follow.af = af;
+	follow.match = match;
+	follow.process = process;
+	follow.ctx = ctx;
+	follow.keep_separator = keep_separator;
+	follow.inotify_fd = -1;
+	follow.watch = -1;
+#ifdef HAVE_SYS_INOTIFY_H
+	follow.inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+#endif
+	afile_follow_watch(&follow);
+
+	// Start where the stream is, not where stdio has read ahead to.
+	fflush(af->file);
+	follow.fd = fileno(af->file);
+	follow.offset = ftello(af->file);
+	if (follow.offset < 0 || lseek(follow.fd, follow.offset, SEEK_SET) < 0) {
+		follow.offset = lseek(follow.fd, 0, SEEK_CUR);
+	}
+
+	idle_since = afile_follow_now();
+	for (;;) {
+		read_any = 0;
+		restarted = 0;
+		result = afile_follow_drain(&follow, &read_any);
+		if (result == AFILE_CONTINUE) {
+			result = afile_follow_changed(&follow, &restarted);
+		}
+		if (result != AFILE_CONTINUE) {
+			break;
+		}
+
+		if (read_any || restarted) {
+			idle_since = afile_follow_now();
+		}
+		if (restarted) {
+			continue;
+		}
+		timeout = AFILE_FOLLOW_POLL_MS;
+		if (idle_ms >= 0) {
+			idle = afile_follow_now() - idle_since;
+			if (idle >= idle_ms) {
+				break;
+			}
+			if (idle_ms - idle < timeout) {
+				timeout = (int)(idle_ms - idle);
+			}
+		}
+		afile_follow_wait(&follow, timeout);
+	}
+
+	// The file is left at the first line not processed.
+	if (af->file != NULL) {
+		fseeko(af->file, follow.offset - (off_t)follow.pending_length, SEEK_SET);
+	}
+
+#ifdef HAVE_SYS_INOTIFY_H
+	if (follow.inotify_fd >= 0) {
+		close(follow.inotify_fd);
+	}
+#endif
+	free(follow.pending);
+	astr_free(follow.work);
+	if (line_count != NULL) {
+		*line_count = follow.line_count;
+	}
+	return (result == AFILE_STOP ? 0 : result);
+}
+
+/*
+ * afile_follow_views_ctx
+ *
+ * Follow a file as it grows, processing the lines that satisfy the match
+ * function as views, with a context.
+ *
+ * The lines already in the file are processed first, from the current
+ * position of the file, and then each line as it is appended.  Each line is
+ * passed to the match function, and if it matches, to the process function,
+ * as afile_process_views_ctx passes it: as a view without its separator,
+ * edited first if an edit program is set.  A line is only passed once its
+ * separator has been written, except the last line of a file that has been
+ * rotated.  A truncated file is read again from its start, and a rotated one
+ * is read to its end and then the file that has its name is read.  The file
+ * is read as it is, even if it is compressed.
+ *
+ * Following stops when the process function returns AFILE_STOP or an errno
+ * value, or once nothing has been appended for the idle time.  The file is
+ * left at the start of the first line not processed, so following it again
+ * carries on from there.
+ *
+ * Parameter: The afile instance, opened for reading by its filespec
+ * Parameter: A pointer to a function that will match one line, or NULL
+ * Parameter: A pointer to a function that will process one line
+ * Parameter: The context for the functions
+ * Parameter: Milliseconds with nothing appended to stop after, or
+ *            AFILE_FOLLOW_FOREVER
+ * Parameter: Pointer to the number of lines processed, or NULL
+ * Returns:   0 = success, non-zero = errno value from the failed operation or
+ *            returned by the process function
+ */
+int afile_follow_views_ctx(afile *af, int (*match)(astr_view line, void *ctx), int (*process)(astr_view line, void *ctx), void *ctx, int idle_ms, long *line_count) {
+	return afile_follow_run(af, 0, match, process, ctx, idle_ms, line_count);
+}
+
+// The functions of afile_follow_matching_lines, and the astr they are passed.
+typedef struct afile_follow_functions {
+	int (*match)(astr *as);
+	int (*process)(astr *as);
+	astr *line;
+} afile_follow_functions;
+
+static int afile_follow_match_line(astr_view line, void *ctx) {
+	afile_follow_functions *functions = (afile_follow_functions *)ctx;
+
+	functions->line = astr_set_from_view(functions->line, line);
+	return functions->match(functions->line);
+}
+
+static int afile_follow_process_line(astr_view line, void *ctx) {
+	afile_follow_functions *functions = (afile_follow_functions *)ctx;
+
+	// A matched line is already in the astr.
+	if (functions->match == NULL) {
+		functions->line = astr_set_from_view(functions->line, line);
+	}
+	functions->process(functions->line);
+	return AFILE_CONTINUE;
+}
+
+/*
+ * afile_follow_matching_lines
+ *
+ * Follow a file as it grows, processing the lines that satisfy the match
+ * function.
+ *
+ * The lines are passed to the match and process functions as
+ * afile_process_matching_lines passes them, with their separators, so the
+ * same functions can filter a whole file or follow it.  Otherwise the file is
+ * followed as afile_follow_views_ctx follows it, stopping once nothing has
+ * been appended for the idle time.
+ *
+ * Parameter: The afile instance, opened for reading by its filespec
+ * Parameter: A pointer to a function that will match one line, or NULL
+ * Parameter: A pointer to a function that will process one line
+ * Parameter: Milliseconds with nothing appended to stop after, or
+ *            AFILE_FOLLOW_FOREVER
+ * Parameter: Pointer to the number of lines processed, or NULL
+ * Returns:   0 = success, non-zero = errno value from the failed operation
+ */
+int afile_follow_matching_lines(afile *af, int (*match)(astr *as), int (*process)(astr *as), int idle_ms, long *line_count) {
+	afile_follow_functions functions;
+	int result;
+
+	if (process == NULL) {
+		return EINVAL;
+	}
+	functions.match = match;
+	functions.process = process;
+	functions.line = NULL;
+	result = afile_follow_run(af, 1, (match != NULL ? afile_follow_match_line : NULL), afile_follow_process_line, &functions, idle_ms, line_count);
+	astr_free(functions.line);
+	return result;
+}
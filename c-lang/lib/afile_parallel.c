@@ -0,0 +1,423 @@
+// afile_parallel.c - Adept File Parallel Processing
+
+/*
+ * Process the lines of a file on several threads.
+ *
+ * A regular file is mapped into memory and cut into chunks of about the same
+ * size.  A chunk boundary is moved forward to just after the next separator,
+ * or to the next multiple of a fixed record length, so no line is cut in
+ * two; each worker works that out for itself from the mapping, and the
+ * workers always agree.  The workers take the next chunk from a shared
+ * counter until there are none left.
+ *
+ * Unordered, each worker edits, matches and processes its lines itself.
+ * Ordered, each worker edits and matches its lines and keeps the matching
+ * ones with the chunk, and the calling thread processes the chunks in order
+ * of their sequence numbers as they are finished.  Only a window of chunks
+ * may be ahead of the one being processed, so the memory held is bounded.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "astr.h"
+#include "afile.h"
+
+#define AFILE_PARALLEL_MIN_CHUNK (64 * 1024)
+#define AFILE_PARALLEL_CHUNKS_PER_THREAD 16
+#define AFILE_PARALLEL_WINDOW_PER_THREAD 4
+
+// The matching lines of a chunk, kept until they are processed in order.
+typedef struct afile_parallel_chunk {
+	int done;
+	char *text;
+	size_t text_length;
+	size_t text_size;
+	int *lengths;
+	int line_count;
+	int lengths_size;
+} afile_parallel_chunk;
+
+typedef struct afile_parallel_job {
+	afile *af;
+	const char *data;
+	size_t length;
+	size_t chunk_size;
+	size_t chunk_count;
+	int ordered;
+	int (*match)(astr *as);
+	int (*process)(astr *as);
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+	size_t next_chunk;
+	size_t next_emit;
+	size_t window;
+	afile_parallel_chunk *chunks;
+	int error;
+} afile_parallel_job;
+
+typedef struct afile_parallel_worker {
+	afile_parallel_job *job;
+	pthread_t thread;
+	long line_count;
+} afile_parallel_worker;
+
+/*
+ * afile_parallel_boundary
+ *
+ * Find where a chunk starts: the start of the first line that starts at or
+ * after an offset.
+ *
+ * Parameter: The job
+ * Parameter: The offset
+ * Returns:   The offset of the start of the line
+ */
+static size_t afile_parallel_boundary(const afile_parallel_job *job, size_t offset) {
+	const afile *af = job->af;
+	const char *next;
+	size_t from;
+
+	if (offset == 0) {
+		return 0;
+	}
+	if (offset >= job->length) {
+		return job->length;
+	}
+	if (af->record_length > 0) {
+		offset += (af->record_length - offset % af->record_length) % af->record_length;
+		return (offset < job->length ? offset : job->length);
+	}
+
+	// A separator that ends right at the offset starts a line there.
+	from = (offset > af->separator_length ? offset - af->separator_length : 0);
+	next = afile_record_end(af, job->data + from, job->data + job->length);
+	return (next != NULL ? (size_t)(next - job->data) : job->length);
+}
+
+/*
+ * afile_parallel_keep
+ *
+ * Keep a matching line with its chunk.
+ *
+ * Parameter: The chunk
+ * Parameter: The line
+ * Returns:   0 = success, non-zero = errno value from the failed operation
+ */
+static int afile_parallel_keep(afile_parallel_chunk *chunk, const astr *as) {
+	char *text;
+	int *lengths;
+	size_t size;
+	int count;
+
+	if (chunk->text_length + as->length > chunk->text_size) {
+		size = (chunk->text_size > 0 ? chunk->text_size * 2 : 4096);
+		while (size < chunk->text_length + as->length) {
+			size *= 2;
+		}
+		text = (char *)realloc(chunk->text, size);
+		if (text == NULL) {
+			return ENOMEM;
+		}
+		chunk->text = text;
+		chunk->text_size = size;
+	}
+	if (chunk->line_count == chunk->lengths_size) {
+		count = (chunk->lengths_size > 0 ? chunk->lengths_size * 2 : 256);
+		lengths = (int *)realloc(chunk->lengths, count * sizeof(int));
+		if (lengths == NULL) {
+			return ENOMEM;
+		}
+		chunk->lengths = lengths;
+		chunk->lengths_size = count;
+	}
+
+	memcpy(chunk->text + chunk->text_length, as->string, as->length);
+	chunk->text_length += as->length;
+	chunk->lengths[chunk->line_count++] = as->length;
+	return 0;
+}
+
+/*
+ * afile_parallel_work
+ *
+ * The worker thread: take chunks and edit, match and process or keep their
+ * lines until there are no chunks left.
+ *
+ * Parameter: The worker
+ * Returns:   NULL
+ */
+static void *afile_parallel_work(void *arg) {
+	afile_parallel_worker *worker = (afile_parallel_worker *)arg;
+	afile_parallel_job *job = worker->job;
+	afile_parallel_chunk *chunk = NULL;
+	const char *s;
+	const char *end;
+	const char *next;
+	astr *work = NULL;
+	size_t index;
+	int result;
+
+	for (;;) {
+		pthread_mutex_lock(&job->mutex);
+		while (job->ordered && job->next_chunk < job->chunk_count && job->next_chunk >= job->next_emit + job->window) {
+			pthread_cond_wait(&job->cond, &job->mutex);
+		}
+		index = job->next_chunk;
+		if (index < job->chunk_count) {
+			job->next_chunk++;
+		}
+		pthread_mutex_unlock(&job->mutex);
+		if (index >= job->chunk_count) {
+			break;
+		}
+
+		if (job->ordered) {
+			chunk = &job->chunks[index % job->window];
+		}
+
+		s = job->data + afile_parallel_boundary(job, index * job->chunk_size);
+		end = job->data + afile_parallel_boundary(job, (index + 1) * job->chunk_size);
+		while (s < end) {
+			next = afile_record_end(job->af, s, end);
+			next = (next != NULL ? next : end);
+			work = astr_set_from_view(work, astr_view_from_buffer(s, (int)(next - s)));
+			work = astr_edit(work, job->af->edit_program);
+			if (job->match == NULL || job->match(work)) {
+				worker->line_count++;
+				if (job->ordered) {
+					result = afile_parallel_keep(chunk, work);
+					if (result != 0) {
+						pthread_mutex_lock(&job->mutex);
+						job->error = result;
+						pthread_mutex_unlock(&job->mutex);
+					}
+				}
+				else {
+					job->process(work);
+				}
+			}
+			s = next;
+		}
+
+		if (job->ordered) {
+			pthread_mutex_lock(&job->mutex);
+			chunk->done = 1;
+			pthread_cond_broadcast(&job->cond);
+			pthread_mutex_unlock(&job->mutex);
+		}
+	}
+
+	astr_free(work);
+	return NULL;
+}
+
+/*
+ * afile_parallel_emit
+ *
+ * Process the kept lines of each chunk in order, as the workers finish them.
+ *
+ * Parameter: The job
+ */
+static void afile_parallel_emit(afile_parallel_job *job) {
+	afile_parallel_chunk *chunk;
+	astr *work = NULL;
+	size_t offset;
+	int i;
+
+	while (job->next_emit < job->chunk_count) {
+		chunk = &job->chunks[job->next_emit % job->window];
+		pthread_mutex_lock(&job->mutex);
+		while (!chunk->done) {
+			pthread_cond_wait(&job->cond, &job->mutex);
+		}
+		pthread_mutex_unlock(&job->mutex);
+
+		offset = 0;
+		for (i = 0; i < chunk->line_count; i++) {
+			work = astr_set_from_view(work, astr_view_from_buffer(chunk->text + offset, chunk->lengths[i]));
+			job->process(work);
+			offset += chunk->lengths[i];
+		}
+
+		pthread_mutex_lock(&job->mutex);
+		chunk->done = 0;
+		chunk->text_length = 0;
+		chunk->line_count = 0;
+		job->next_emit++;
+		pthread_cond_broadcast(&job->cond);
+		pthread_mutex_unlock(&job->mutex);
+	}
+
+	astr_free(work);
+}
+
+/*
+ * afile_process_lines_parallel
+ *
+ * Process all lines from a file on several threads.
+ *
+ * Parameter: The afile instance, opened
+ * Parameter: The number of worker threads
+ * Parameter: Nonzero to process the lines in the order they are in the file
+ * Parameter: A pointer to a function that will process one line of text
+ * Parameter: Array of a line count for each worker, or NULL
+ * Returns:   The number of lines processed
+ */
+long afile_process_lines_parallel(afile *af, int threads, int ordered, int (*process)(astr *as), long *line_counts) {
+	return afile_process_matching_lines_parallel(af, threads, ordered, NULL, process, line_counts);
+}
+
+/*
+ * afile_process_matching_lines_parallel
+ *
+ * Process matching lines from a file on several threads.
+ *
+ * A regular file is cut into chunks at line boundaries and the chunks are
+ * shared out among the worker threads.  The lines are passed to the match
+ * and process functions as afile_process_matching_lines does, with their
+ * newlines, and edited first if an edit program is set.
+ *
+ * Unordered, the lines are matched and processed on the worker threads, in no
+ * particular order, so both functions must be safe to call from several
+ * threads at once.  Ordered, the lines are matched on the worker threads but
+ * processed on the calling thread, in the order they are in the file, so
+ * only the match function must be safe to call from several threads at once.
+ *
+ * If the line counts array is given, it must have an entry for each worker,
+ * and is set to the number of lines each worker matched.
+ *
+ * A file that cannot be mapped, such as a pipe, a compressed file, or a
+ * request for a single thread, is processed on the calling thread by
+ * afile_process_matching_lines, and all the lines are counted for the first
+ * worker.
+ *
+ * Parameter: The afile instance, opened
+ * Parameter: The number of worker threads
+ * Parameter: Nonzero to process the lines in the order they are in the file
+ * Parameter: A pointer to a function that will match one line of text, or NULL
+ * Parameter: A pointer to a function that will process one line of text
+ * Parameter: Array of a line count for each worker, or NULL
+ * Returns:   The number of lines processed
+ */
+long afile_process_matching_lines_parallel(afile *af, int threads, int ordered, int (*match)(astr *as), int (*process)(astr *as), long *line_counts) {
+	afile_parallel_job job;
+	afile_parallel_worker *workers;
+	struct stat stats;
+	char *mapping = MAP_FAILED;
+	off_t position = -1;
+	long line_count = 0;
+	size_t i;
+	int t;
+
+	if (af == NULL || af->file == NULL || process == NULL) {
+		return 0;
+	}
+	if (threads < 1) {
+		threads = 1;
+	}
+	if (line_counts != NULL) {
+		memset(line_counts, 0, threads * sizeof(long));
+	}
+
+	if (threads > 1 && fstat(fileno(af->file), &stats) == 0 && S_ISREG(stats.st_mode)) {
+		position = ftello(af->file);
+		if (position >= stats.st_size) {
+			return 0;
+		}
+		if (position >= 0) {
+			mapping = (char *)mmap(NULL, stats.st_size, PROT_READ, MAP_PRIVATE, fileno(af->file), 0);
+		}
+		// A compressed file is decompressed by the serial line reader.
+		if (mapping != MAP_FAILED && af->compression != AFILE_COMPRESSION_NONE && (af->compression != AFILE_COMPRESSION_AUTO || afile_compression_detect(mapping + position, stats.st_size - position) != AFILE_COMPRESSION_NONE)) {
+			munmap(mapping, stats.st_size);
+			mapping = MAP_FAILED;
+		}
+	}
+	if (mapping == MAP_FAILED) {
+		line_count = afile_process_matching_lines(af, match, process);
+		if (line_counts != NULL) {
+			line_counts[0] = line_count;
+		}
+		return line_count;
+	}
+	madvise(mapping, stats.st_size, MADV_SEQUENTIAL);
+
+	memset(&job, 0, sizeof(job));
+	job.af = af;
+	job.data = mapping + position;
+	job.length = stats.st_size - position;
+	job.chunk_size = job.length / ((size_t)threads * AFILE_PARALLEL_CHUNKS_PER_THREAD);
+	if (job.chunk_size < AFILE_PARALLEL_MIN_CHUNK) {
+		job.chunk_size = AFILE_PARALLEL_MIN_CHUNK;
+	}
+	job.chunk_count = (job.length + job.chunk_size - 1) / job.chunk_size;
+	job.ordered = ordered;
+	job.match = match;
+	job.process = process;
+	job.window = (size_t)threads * AFILE_PARALLEL_WINDOW_PER_THREAD;
+	pthread_mutex_init(&job.mutex, NULL);
+	pthread_cond_init(&job.cond, NULL);
+
+	workers = (afile_parallel_worker *)calloc(threads, sizeof(afile_parallel_worker));
+	if (ordered) {
+		job.chunks = (afile_parallel_chunk *)calloc(job.window, sizeof(afile_parallel_chunk));
+	}
+	if (workers == NULL || (ordered && job.chunks == NULL)) {
+		free(workers);
+		workers = NULL;
+		job.error = ENOMEM;
+		threads = 0;
+	}
+
+	for (t = 0; t < threads; t++) {
+		workers[t].job = &job;
+		if (pthread_create(&workers[t].thread, NULL, afile_parallel_work, &workers[t]) != 0) {
+			break;
+		}
+	}
+
+	if (t == 0 && workers != NULL) {
+		// No thread could be started; one worker on this thread keeps the lines in order anyway.
+		job.ordered = 0;
+		afile_parallel_work(&workers[0]);
+		line_count = workers[0].line_count;
+	}
+	else {
+		if (job.ordered && t > 0) {
+			afile_parallel_emit(&job);
+		}
+		threads = t;
+		for (t = 0; t < threads; t++) {
+			pthread_join(workers[t].thread, NULL);
+			line_count += workers[t].line_count;
+		}
+	}
+
+	if (line_counts != NULL && workers != NULL) {
+		for (t = 0; t < threads; t++) {
+			line_counts[t] = workers[t].line_count;
+		}
+	}
+
+	if (job.chunks != NULL) {
+		for (i = 0; i < job.window; i++) {
+			free(job.chunks[i].text);
+			free(job.chunks[i].lengths);
+		}
+		free(job.chunks);
+	}
+	free(workers);
+	pthread_mutex_destroy(&job.mutex);
+	pthread_cond_destroy(&job.cond);
+	munmap(mapping, stats.st_size);
+	fseeko(af->file, stats.st_size, SEEK_SET);
+
+	if (job.error != 0) {
+		errno = job.error;
+	}
+	return line_count;
+}
@@ -0,0 +1,366 @@
+// afile_set.c - Adept File Sets
+
+/*
+ * Process many files at once on a bounded pool of threads.
+ *
+ * The files of a set are added one at a time or from a directory, and each
+ * one's size is taken when it is added.  They are processed largest first:
+ * each worker takes the largest file no worker has taken yet, so a large
+ * file is not left to be started after the small ones are done, with the
+ * other workers idle while it is processed.  Each file is processed on its
+ * own with afile_process_views_ctx, and its line count, or the error that
+ * stopped it, is kept with it in the set.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <fnmatch.h>
+#include <dirent.h>
+#include <sys/stat.h>
+
+#include "astr.h"
+#include "afile.h"
+
+#define AFILE_SET_INITIAL_SIZE 16
+
+// What the workers share.
+typedef struct afile_set_job {
+	afile_set *set;
+	const afile *settings;
+	int (*match)(astr_view line, void *ctx);
+	int (*process)(astr_view line, void *ctx);
+	void *ctx;
+	afile_set_file **order;
+	int next;
+	pthread_mutex_t mutex;
+} afile_set_job;
+
+/*
+ * afile_set_create
+ *
+ * Create an empty set of files.
+ *
+ * Returns:   Pointer to the set, or NULL if it cannot be allocated
+ */
+afile_set *afile_set_create(void) {
+	return (afile_set *)calloc(1, sizeof(afile_set));
+}
+
+/*
+ * afile_set_append
+ *
+ * Add a file to the end of a set, with its size or the error from finding
+ * it.
+ *
+ * Parameter: The set
+ * Parameter: The path of the file
+ * Parameter: The stats of the file, or NULL
+ * Parameter: 0, or the errno value from finding the file
+ * Returns:   0 = success, ENOMEM if the set cannot grow
+ */
+static int afile_set_append(afile_set *set, const char *path, const struct stat *stats, int error) {
+	afile_set_file *files;
+	afile_set_file *file;
+	int size;
+
+	if (set->count == set->size) {
+		size = (set->size > 0 ? set->size * 2 : AFILE_SET_INITIAL_SIZE);
+		files = (afile_set_file *)realloc(set->files, size * sizeof(afile_set_file));
+		if (files == NULL) {
+			return ENOMEM;
+		}
+		set->files = files;
+		set->size = size;
+	}
+
+	file = &set->files[set->count++];
+	memset(file, 0, sizeof(*file));
+	file->path = astr_create(path);
+	file->size = (stats != NULL ? stats->st_size : 0);
+	file->error = error;
+	return 0;
+}
+
+/*
+ * afile_set_add
+ *
+ * Add a file to a set.  A file that cannot be found is added with the error,
+ * so it is reported with the results of the others, and is not processed.
+ *
+ * Parameter: The set
+ * Parameter: The path of the file
+ * Returns:   0 = success, non-zero = errno value from finding the file
+ */
+int afile_set_add(afile_set *set, const char *path) {
+	struct stat stats;
+	int error = 0;
+	int result;
+
+	if (set == NULL || path == NULL) {
+		return EINVAL;
+	}
+
+	if (stat(path, &stats) != 0) {
+		error = errno;
+	}
+	else if (S_ISDIR(stats.st_mode)) {
+		error = EISDIR;
+	}
+	result = afile_set_append(set, path, (error == 0 ? &stats : NULL), error);
+	return (result != 0 ? result : error);
+}
+
+/*
+ * afile_set_add_directory
+ *
+ * Add the regular files in a directory whose names match a pattern to a set,
+ * in order of their names.  Recursively, the directories in it are searched
+ * too, but not the ones that are symbolic links, so a link cannot make the
+ * search go round in a circle.
+ *
+ * Parameter: The set
+ * Parameter: The path of the directory
+ * Parameter: A glob pattern that the names must match, or NULL for all
+ * Parameter: Nonzero to search the directories in the directory too
+ * Returns:   0 = success, non-zero = errno value from the failed operation
+ */
+int afile_set_add_directory(afile_set *set, const char *directory, const char *pattern, int recursive) {
+	struct dirent **entries;
+	struct stat stats;
+	astr *path = NULL;
+	int count;
+	int result = 0;
+	int i;
+
+	if (set == NULL || directory == NULL) {
+		return EINVAL;
+	}
+
+	count = scandir(directory, &entries, NULL, alphasort);
+	if (count < 0) {
+		return errno;
+	}
+
+	for (i = 0; i < count; i++) {
+		if (result == 0 && strcmp(entries[i]->d_name, ".") != 0 && strcmp(entries[i]->d_name, "..") != 0) {
+			path = astr_set(path, directory);
+			path = astr_append(path, "/");
+			path = astr_append(path, entries[i]->d_name);
+			if (lstat(path->string, &stats) == 0 && S_ISDIR(stats.st_mode)) {
+				if (recursive) {
+					result = afile_set_add_directory(set, path->string, pattern, recursive);
+				}
+			}
+			else if (stat(path->string, &stats) == 0 && S_ISREG(stats.st_mode)) {
+				if (pattern == NULL || fnmatch(pattern, entries[i]->d_name, 0) == 0) {
+					result = afile_set_append(set, path->string, &stats, 0);
+				}
+			}
+		}
+		free(entries[i]);
+	}
+	free(entries);
+	astr_free(path);
+	return result;
+}
+
+/*
+ * afile_set_open
+ *
+ * Create and open an afile for a file of a set, with the settings given.
+ *
+ * Parameter: The file
+ * Parameter: The afile to take the settings from, or NULL
+ * Parameter: Pointer to the errno value if the file cannot be opened
+ * Returns:   Pointer to the afile, opened, or NULL
+ */
+static afile *afile_set_open(const afile_set_file *file, const afile *settings, int *error) {
+	afile *af;
+	astr *open_modes;
+
+	if (settings != NULL) {
+		open_modes = astr_create("r");
+		af = afile_create_explicit(file->path, open_modes, settings->buffer_size, settings->buffering_mode);
+		astr_free(open_modes);
+		afile_set_prefetch_depth(af, settings->prefetch_depth);
+		afile_set_compression(af, settings->compression, settings->decompression_threads);
+		afile_set_io_backend(af, settings->io_backend);
+		afile_set_edit_program(af, settings->edit_program);
+		afile_set_separator(af, settings->separator, settings->separator_length);
+		afile_set_record_length(af, settings->record_length);
+	}
+	else {
+		af = afile_create(file->path, NULL);
+	}
+
+	*error = afile_open(af);
+	if (*error != 0 || af->file == NULL) {
+		*error = (*error != 0 ? *error : EBADF);
+		return afile_free(af);
+	}
+	return af;
+}
+
+/*
+ * afile_set_work
+ *
+ * The worker thread: take the largest file not yet taken and process it,
+ * until there are none left.
+ *
+ * Parameter: The job
+ * Returns:   NULL
+ */
+static void *afile_set_work(void *arg) {
+	afile_set_job *job = (afile_set_job *)arg;
+	afile_set_file *file;
+	afile *af;
+
+	for (;;) {
+		pthread_mutex_lock(&job->mutex);
+		file = (job->next < job->set->count ? job->order[job->next++] : NULL);
+		pthread_mutex_unlock(&job->mutex);
+		if (file == NULL) {
+			break;
+		}
+
+		if (file->error != 0) {
+			continue;
+		}
+		af = afile_set_open(file, job->settings, &file->error);
+		if (af != NULL) {
+			file->error = afile_process_views_ctx(af, job->match, job->process, job->ctx, &file->line_count);
+			afile_free(af);
+		}
+	}
+	return NULL;
+}
+
+// Order files largest first, and files of the same size as they were added.
+static int afile_set_larger(const void *a, const void *b) {
+	const afile_set_file *file_a = *(afile_set_file * const *)a;
+	const afile_set_file *file_b = *(afile_set_file * const *)b;
+
+	if (file_a->size != file_b->size) {
+		return (file_a->size > file_b->size ? -1 : 1);
+	}
+	return (file_a < file_b ? -1 : (file_a > file_b ? 1 : 0));
+}
+
+/*
+ * afile_set_process
+ *
+ * Process the lines of the files of a set that satisfy the match function
+ * as views, on several threads.
+ *
+ * Each file is opened for reading with the settings of an afile, if one is
+ * given, and processed by afile_process_views_ctx; the settings are its
+ * buffer size and buffering mode, prefetch depth, compression, I/O backend,
+ * edit program, separator and record length.  The files are shared out among
+ * at most the number of threads given, largest first, so the match and
+ * process functions, and the context, must be safe to use from several
+ * threads at once.  A process function that returns AFILE_STOP stops the
+ * file it is processing, and one that returns an errno value fails it; the
+ * other files are carried on with.
+ *
+ * The line count and error of each file are kept with the file, and the
+ * total of the line counts and the number of files that failed are kept
+ * with the set.  A file with an error, from being added or processed, is
+ * passed over if the set is processed again.
+ *
+ * Parameter: The set
+ * Parameter: The afile to take the settings from, or NULL for the defaults
+ * Parameter: The most threads to process the files on
+ * Parameter: A pointer to a function that will match one line, or NULL
+ * Parameter: A pointer to a function that will process one line
+ * Parameter: The context for the functions
+ * Returns:   0 = success, non-zero = errno value of the first file, in the
+ *            order they were added, that failed
+ */
+int afile_set_process(afile_set *set, const afile *settings, int threads, int (*match)(astr_view line, void *ctx), int (*process)(astr_view line, void *ctx), void *ctx) {
+	afile_set_job job;
+	pthread_t *workers;
+	int started = 0;
+	int result = 0;
+	int i;
+
+	if (set == NULL || process == NULL) {
+		return EINVAL;
+	}
+	if (threads < 1) {
+		threads = 1;
+	}
+	if (threads > set->count) {
+		threads = (set->count > 0 ? set->count : 1);
+	}
+
+	memset(&job, 0, sizeof(job));
+	job.set = set;
+	job.settings = settings;
+	job.match = match;
+	job.process = process;
+	job.ctx = ctx;
+	job.order = (afile_set_file **)malloc((set->count > 0 ? set->count : 1) * sizeof(afile_set_file *));
+	workers = (pthread_t *)malloc(threads * sizeof(pthread_t));
+	if (job.order == NULL || workers == NULL) {
+		free(job.order);
+		free(workers);
+		return ENOMEM;
+	}
+	for (i = 0; i < set->count; i++) {
+		job.order[i] = &set->files[i];
+		set->files[i].line_count = 0;
+	}
+	qsort(job.order, set->count, sizeof(afile_set_file *), afile_set_larger);
+	pthread_mutex_init(&job.mutex, NULL);
+
+	// The calling thread is one of the workers.
+	for (i = 1; i < threads; i++) {
+		if (pthread_create(&workers[started], NULL, afile_set_work, &job) == 0) {
+			started++;
+		}
+	}
+	afile_set_work(&job);
+	for (i = 0; i < started; i++) {
+		pthread_join(workers[i], NULL);
+	}
+	pthread_mutex_destroy(&job.mutex);
+
+	set->line_count = 0;
+	set->failed = 0;
+	for (i = 0; i < set->count; i++) {
+		set->line_count += set->files[i].line_count;
+		if (set->files[i].error != 0) {
+			set->failed++;
+			if (result == 0) {
+				result = set->files[i].error;
+			}
+		}
+	}
+
+	free(job.order);
+	free(workers);
+	return result;
+}
+
+/*
+ * afile_set_free
+ *
+ * Free a set of files.
+ *
+ * Parameter: The set
+ * Returns:   NULL
+ */
+afile_set *afile_set_free(afile_set *set) {
+	int i;
+
+	if (set != NULL) {
+		for (i = 0; i < set->count; i++) {
+			astr_free(set->files[i].path);
+		}
+		free(set->files);
+		free(set);
+	}
+	return NULL;
+}
@@ -0,0 +1,359 @@
+// afile_uring.c - Adept File io_uring
+
+/*
+ * A minimal io_uring driven with the system calls.
+ *
+ * The submission queue, the completion queue and the submission entries are
+ * three mappings of the ring file descriptor.  An operation is queued by
+ * filling the next entry and putting its index in the submission array; the
+ * tail is only published to the kernel when the queue is submitted.  A
+ * completion is taken by reading the entry at the completion head, and the
+ * head is published when it is done with.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+
+#ifdef HAVE_LINUX_IO_URING_H
+#include <linux/io_uring.h>
+#endif
+
+#include "afile_uring.h"
+
+#ifdef HAVE_LINUX_IO_URING_H
+
+/*
+ * afile_uring_queue
+ *
+ * Queue one read or write.
+ *
+ * Parameter: The ring
+ * Parameter: The operation
+ * Parameter: The file descriptor
+ * Parameter: The buffer
+ * Parameter: The length
+ * Parameter: The file offset
+ * Parameter: The index of the registered buffer, or -1
+ * Parameter: The tag for the completion
+ * Returns:   0 = success, non-zero = errno value from the failed operation
+ */
+static int afile_uring_queue(afile_uring *ring, int opcode, int fd, const void *buffer, size_t length, off_t offset, int buffer_index, uint64_t tag) {
+	struct io_uring_sqe *sqe;
+	unsigned tail;
+	unsigned index;
+
+	if (ring->queued + ring->in_flight >= ring->entries) {
+		return EBUSY;
+	}
+
+	tail = *ring->sq_tail + ring->queued;
+	index = tail & *ring->sq_mask;
+	sqe = &((struct io_uring_sqe *)ring->sqes)[index];
+	memset(sqe, 0, sizeof(*sqe));
+	sqe->opcode = opcode;
+	sqe->fd = fd;
+	sqe->addr = (uint64_t)(uintptr_t)buffer;
+	sqe->len = (uint32_t)length;
+	sqe->off = (uint64_t)offset;
+	sqe->user_data = tag;
+	if (buffer_index >= 0) {
+		sqe->opcode = (opcode == IORING_OP_READ ? IORING_OP_READ_FIXED : IORING_OP_WRITE_FIXED);
+		sqe->buf_index = (uint16_t)buffer_index;
+	}
+	ring->sq_array[index] = index;
+	ring->queued++;
+	return 0;
+}
+
+#endif
+
+/*
+ * afile_uring_available
+ *
+ * Determine if io_uring can be used: if it was built in and the kernel
+ * allows a ring to be set up.
+ *
+ * Returns:   1 = io_uring can be used, 0 = it cannot
+ */
+int afile_uring_available(void) {
+	afile_uring *ring;
+
+	ring = afile_uring_create(2);
+	if (ring == NULL) {
+		return 0;
+	}
+	afile_uring_free(ring);
+	return 1;
+}
+
+/*
+ * afile_uring_create
+ *
+ * Create an io_uring.
+ *
+ * Parameter: The number of entries, the most operations queued or in flight
+ * Returns:   Pointer to the ring, or NULL with errno set if it cannot be set up
+ */
+afile_uring *afile_uring_create(unsigned entries) {
+#ifdef HAVE_LINUX_IO_URING_H
+	struct io_uring_params params;
+	afile_uring *ring;
+	int result;
+
+	ring = (afile_uring *)calloc(1, sizeof(afile_uring));
+	if (ring == NULL) {
+		return NULL;
+	}
+
+	memset(&params, 0, sizeof(params));
+	ring->fd = (int)syscall(__NR_io_uring_setup, entries, &params);
+	if (ring->fd < 0) {
+		result = errno;
+		free(ring);
+		errno = result;
+		return NULL;
+	}
+	ring->entries = params.sq_entries;
+
+	ring->sq_mapping_length = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+	ring->cq_mapping_length = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+	ring->sqes_length = params.sq_entries * sizeof(struct io_uring_sqe);
+	ring->sq_mapping = mmap(NULL, ring->sq_mapping_length, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+	ring->cq_mapping = mmap(NULL, ring->cq_mapping_length, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_CQ_RING);
+	ring->sqes = mmap(NULL, ring->sqes_length, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+	if (ring->sq_mapping == MAP_FAILED || ring->cq_mapping == MAP_FAILED || ring->sqes == MAP_FAILED) {
+		result = errno;
+		afile_uring_free(ring);
+		errno = result;
+		return NULL;
+	}
+
+	ring->sq_head = (unsigned *)((char *)ring->sq_mapping + params.sq_off.head);
+	ring->sq_tail = (unsigned *)((char *)ring->sq_mapping + params.sq_off.tail);
+	ring->sq_mask = (unsigned *)((char *)ring->sq_mapping + params.sq_off.ring_mask);
+	ring->sq_array = (unsigned *)((char *)ring->sq_mapping + params.sq_off.array);
+	ring->cq_head = (unsigned *)((char *)ring->cq_mapping + params.cq_off.head);
+	ring->cq_tail = (unsigned *)((char *)ring->cq_mapping + params.cq_off.tail);
+	ring->cq_mask = (unsigned *)((char *)ring->cq_mapping + params.cq_off.ring_mask);
+	ring->cqes = (char *)ring->cq_mapping + params.cq_off.cqes;
+	return ring;
+#else
+	errno = ENOSYS;
+	return NULL;
+#endif
+}
+
+/*
+ * afile_uring_free
+ *
+ * Free an io_uring.  Operations still in flight are waited for first, since
+ * the kernel may still be reading into or writing from their buffers.
+ *
+ * Parameter: The ring
+ * Returns:   NULL
+ */
+afile_uring *afile_uring_free(afile_uring *ring) {
+	uint64_t tag;
+	int result;
+
+	if (ring != NULL) {
+		if (ring->sq_mapping != NULL && ring->sq_mapping != MAP_FAILED) {
+			afile_uring_submit(ring);
+			while (ring->in_flight > 0 && afile_uring_wait(ring, &tag, &result) == 0) {
+			}
+			munmap(ring->sq_mapping, ring->sq_mapping_length);
+		}
+		if (ring->cq_mapping != NULL && ring->cq_mapping != MAP_FAILED) {
+			munmap(ring->cq_mapping, ring->cq_mapping_length);
+		}
+		if (ring->sqes != NULL && ring->sqes != MAP_FAILED) {
+			munmap(ring->sqes, ring->sqes_length);
+		}
+		close(ring->fd);
+		free(ring);
+	}
+	return NULL;
+}
+
+/*
+ * afile_uring_register_buffers
+ *
+ * Register a run of buffers of the same size with the kernel, to be read
+ * into and written from by index.
+ *
+ * Parameter: The ring
+ * Parameter: The first buffer
+ * Parameter: The size of each buffer
+ * Parameter: The number of buffers
+ * Returns:   0 = success, non-zero = errno value from the failed operation
+ */
+int afile_uring_register_buffers(afile_uring *ring, void *buffers, size_t size, unsigned count) {
+#ifdef HAVE_LINUX_IO_URING_H
+	struct iovec *iovecs;
+	unsigned i;
+	int result = 0;
+
+	if (ring == NULL || buffers == NULL || count == 0) {
+		return EINVAL;
+	}
+
+	iovecs = (struct iovec *)malloc(count * sizeof(struct iovec));
+	if (iovecs == NULL) {
+		return ENOMEM;
+	}
+	for (i = 0; i < count; i++) {
+		iovecs[i].iov_base = (char *)buffers + i * size;
+		iovecs[i].iov_len = size;
+	}
+	if (syscall(__NR_io_uring_register, ring->fd, IORING_REGISTER_BUFFERS, iovecs, count) < 0) {
+		result = errno;
+	}
+	else {
+		ring->registered = 1;
+	}
+	free(iovecs);
+	return result;
+#else
+	return ENOSYS;
+#endif
+}
+
+/*
+ * afile_uring_read
+ *
+ * Queue a read at a file offset.  It is not started until the queue is
+ * submitted.
+ *
+ * Parameter: The ring
+ * Parameter: The file descriptor
+ * Parameter: The buffer to read into
+ * Parameter: The number of bytes to read
+ * Parameter: The file offset
+ * Parameter: The index of the registered buffer the buffer is in, or -1
+ * Parameter: The tag for the completion
+ * Returns:   0 = success, non-zero = errno value from the failed operation
+ */
+int afile_uring_read(afile_uring *ring, int fd, void *buffer, size_t length, off_t offset, int buffer_index, uint64_t tag) {
+#ifdef HAVE_LINUX_IO_URING_H
+	if (ring == NULL) {
+		return EINVAL;
+	}
+	return afile_uring_queue(ring, IORING_OP_READ, fd, buffer, length, offset, (ring->registered ? buffer_index : -1), tag);
+#else
+	return ENOSYS;
+#endif
+}
+
+/*
+ * afile_uring_write
+ *
+ * Queue a write at a file offset.  It is not started until the queue is
+ * submitted.
+ *
+ * Parameter: The ring
+ * Parameter: The file descriptor
+ * Parameter: The buffer to write from
+ * Parameter: The number of bytes to write
+ * Parameter: The file offset
+ * Parameter: The index of the registered buffer the buffer is in, or -1
+ * Parameter: The tag for the completion
+ * Returns:   0 = success, non-zero = errno value from the failed operation
+ */
+int afile_uring_write(afile_uring *ring, int fd, const void *buffer, size_t length, off_t offset, int buffer_index, uint64_t tag) {
+#ifdef HAVE_LINUX_IO_URING_H
+	if (ring == NULL) {
+		return EINVAL;
+	}
+	return afile_uring_queue(ring, IORING_OP_WRITE, fd, buffer, length, offset, (ring->registered ? buffer_index : -1), tag);
+#else
+	return ENOSYS;
+#endif
+}
+
+/*
+ * afile_uring_submit
+ *
+ * Submit the queued operations to the kernel.
+ *
+ * Parameter: The ring
+ * Returns:   0 = success, non-zero = errno value from the failed operation
+ */
+int afile_uring_submit(afile_uring *ring) {
+#ifdef HAVE_LINUX_IO_URING_H
+	long submitted;
+
+	if (ring == NULL) {
+		return EINVAL;
+	}
+	if (ring->queued == 0) {
+		return 0;
+	}
+
+	__atomic_store_n(ring->sq_tail, *ring->sq_tail + ring->queued, __ATOMIC_RELEASE);
+	while (ring->queued > 0) {
+		submitted = syscall(__NR_io_uring_enter, ring->fd, ring->queued, 0, 0, NULL, 0);
+		if (submitted < 0) {
+			if (errno == EINTR || errno == EAGAIN) {
+				continue;
+			}
+			return errno;
+		}
+		ring->in_flight += (unsigned)submitted;
+		ring->queued -= (unsigned)submitted;
+	}
+	return 0;
+#else
+	return ENOSYS;
+#endif
+}
+
+/*
+ * afile_uring_wait
+ *
+ * Wait for the next completion, submitting anything still queued first.
+ *
+ * Parameter: The ring
+ * Parameter: Pointer to where to put the tag of the completed operation
+ * Parameter: Pointer to where to put its result: the number of bytes read or
+ *            written, or a negative errno value
+ * Returns:   0 = success, non-zero = errno value from the failed operation
+ */
+int afile_uring_wait(afile_uring *ring, uint64_t *tag, int *result) {
+#ifdef HAVE_LINUX_IO_URING_H
+	struct io_uring_cqe *cqe;
+	unsigned head;
+	int error;
+
+	if (ring == NULL) {
+		return EINVAL;
+	}
+	error = afile_uring_submit(ring);
+	if (error != 0) {
+		return error;
+	}
+	if (ring->in_flight == 0) {
+		return ENOENT;
+	}
+
+	head = *ring->cq_head;
+	while (head == __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE)) {
+		if (syscall(__NR_io_uring_enter, ring->fd, 0, 1, IORING_ENTER_GETEVENTS, NULL, 0) < 0 && errno != EINTR) {
+			return errno;
+		}
+	}
+
+	cqe = &((struct io_uring_cqe *)ring->cqes)[head & *ring->cq_mask];
+	*tag = cqe->user_data;
+	*result = cqe->res;
+	__atomic_store_n(ring->cq_head, head + 1, __ATOMIC_RELEASE);
+	ring->in_flight--;
+	return 0;
+#else
+	return ENOSYS;
+#endif
+}
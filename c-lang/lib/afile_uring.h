@@ -0,0 +1,93 @@
+// afile_uring.h - Adept File io_uring
+
+#ifndef AFILE_URING_H
+#define AFILE_URING_H
+
+#include <stdint.h>
+#include <sys/types.h>
+
+/*
+ * An afile_uring is a Linux io_uring: a queue of reads and writes submitted
+ * to the kernel together, any number of them in flight at once, and a queue
+ * of their completions.  It is driven with the system calls directly, so no
+ * library is needed.  Each read or write is tagged, and its completion
+ * carries the tag back, since completions may come in any order.
+ *
+ * Buffers can be registered with the kernel once, so reads and writes into
+ * them do not have to map the buffer for each operation.
+ *
+ * Where io_uring is not built in, or the kernel does not allow it,
+ * afile_uring_create fails with ENOSYS or the error from the kernel, and the
+ * afile functions fall back to pread and pwrite.
+ *
+ * An afile_uring is owned by one thread at a time.
+ */
+
+typedef struct afile_uring {
+	// The ring file descriptor
+	int fd;
+
+	// Number of entries in the submission queue
+	unsigned entries;
+
+	// Operations queued and not yet submitted
+	unsigned queued;
+
+	// Operations submitted and not yet completed
+	unsigned in_flight;
+
+	// Nonzero if buffers are registered
+	int registered;
+
+	// The mapped queues
+	void *sq_mapping;
+	size_t sq_mapping_length;
+	void *cq_mapping;
+	size_t cq_mapping_length;
+	void *sqes;
+	size_t sqes_length;
+
+	// Pointers into the mapped queues
+	unsigned *sq_head;
+	unsigned *sq_tail;
+	unsigned *sq_mask;
+	unsigned *sq_array;
+	unsigned *cq_head;
+	unsigned *cq_tail;
+	unsigned *cq_mask;
+	void *cqes;
+} afile_uring;
+
+#ifdef	__cplusplus
+extern "C" {
+#endif
+
+// Determine if io_uring can be used.
+int afile_uring_available(void);
+
+// Create an io_uring.
+afile_uring *afile_uring_create(unsigned entries);
+
+// Free an io_uring.
+afile_uring *afile_uring_free(afile_uring *ring);
+
+// Register a run of buffers of the same size with the kernel.
+int afile_uring_register_buffers(afile_uring *ring, void *buffers, size_t size, unsigned count);
+
+// Queue a read.
+int afile_uring_read(afile_uring *ring, int fd, void *buffer, size_t length, off_t offset, int buffer_index, uint64_t tag);
+
+// Queue a write.
+int afile_uring_write(afile_uring *ring, int fd, const void *buffer, size_t length, off_t offset, int buffer_index, uint64_t tag);
+
+// Submit the queued operations.
+int afile_uring_submit(afile_uring *ring);
+
+// Wait for a completion.
+int afile_uring_wait(afile_uring *ring, uint64_t *tag, int *result);
+
+#ifdef	__cplusplus
+}
+#endif
+
+#endif	// AFILE_URING_H
@@ -26,6 +26,7 @@ static const char space_char = ' ';
 static astr *astr_allocate_string(astr *as, size_t length);
 static astr *astr_reallocate_string(astr *as, size_t length);
 static astr *astr_clear(astr *as);
+static astr *astr_compact(astr *as);
 static astr *astr_free_string(astr *as);
 
 /*
@@ -197,8 +198,8 @@ astr **astr_split(astr *as, char *delims) {
 
 	for(astr *atok = astr_tok(as, delims); atok != NULL; atok = astr_tok(as, delims)) {
 		numelements++;
-		asa = (astr**) realloc(asa, numelements);
-		asa[numelements - 2] = astr_copy(atok);
+		asa = (astr**) realloc(asa, numelements * sizeof(astr *));
+		asa[numelements - 2] = atok;
 	}
 
 	asa[numelements - 1] = NULL;
@@ -280,7 +281,7 @@ astr *astr_set_from_buffer(astr *as, const char *buffer, const int length) {
 
 		d = as->string;
 		d_end = as->string + length;
-		while (*s != '\0' && s < s_end && d < d_end) {
+		while (s < s_end && *s != '\0' && d < d_end) {
 			as->length++;
 			as->checksum += *s;
 			*d++ = *s++;
@@ -354,7 +355,7 @@ astr *astr_append_buffer(astr *as, const char *buffer, const int length) {
 		d_end = as->string + as->length + length;
 		s = buffer;
 		s_end = buffer + length;
-		while (*s != '\0' && s < s_end && d < d_end) {
+		while (s < s_end && *s != '\0' && d < d_end) {
 			as->length++;
 			as->checksum += *s;
 			*d++ = *s++;
@@ -380,10 +381,10 @@ astr *astr_append_buffer(astr *as, const char *buffer, const int length) {
  */
 static astr *astr_allocate_string(astr *as, size_t length) {
 	if (as != NULL) {
-		if (as->string != NULL) {
+		if (as->storage != NULL) {
 			if (length + 1 > as->allocated_length) {
 				astr_free_string(as);
-				as->string = (char *)calloc(length + 1, sizeof(char));
+				as->storage = as->string = (char *)calloc(length + 1, sizeof(char));
 				as->allocated_length = length + 1;
 			}
 			else {
@@ -392,7 +393,7 @@ static astr *astr_allocate_string(astr *as, size_t length) {
 		}
 		else {
 			astr_clear(as);
-			as->string = (char *)calloc(length + 1, sizeof(char));
+			as->storage = as->string = (char *)calloc(length + 1, sizeof(char));
 			as->allocated_length = length + 1;
 		}
 
@@ -410,29 +411,40 @@ static astr *astr_allocate_string(astr *as, size_t length) {
  *
  * Reallocate the string member of an astr instance.
  *
+ * If the string has been left trimmed and the new length fits in the storage
+ * once the string is moved back to the start, the storage is compacted rather
+ * than reallocated.
+ *
  * Parameter: The astr instance
  * Parameter: The new length of the string member
  * Returns:   Pointer to the astr instance
  */
 static astr *astr_reallocate_string(astr *as, size_t length) {
 	char *newstring = NULL;
+	size_t offset;
 	if (as != NULL) {
-		if (as->string != NULL) {
+		if (as->storage != NULL) {
+			offset = as->string - as->storage;
 			if (length + 1 > as->allocated_length) {
 				newstring = (char *)calloc(length + 1, sizeof(char));
 				if (newstring != NULL) {
 					as->allocated_length = length + 1;
 					strcpy(newstring, as->string);
-					free(as->string);
-					as->string = newstring;
+					free(as->storage);
+					as->storage = as->string = newstring;
 				}
 			}
+			else if (length + 1 > as->allocated_length - offset) {
+				astr_compact(as);
+			}
 		}
 		else {
 			astr_allocate_string(as, length);
 		}
 
 		as->tokenend = NULL;
+		as->codepoint_length = -1;
+		as->hash = 0;
 	}
 	return as;
 }
@@ -442,18 +454,43 @@ static astr *astr_reallocate_string(astr *as, size_t length) {
  *
  * Clear an astr instance.
  * Keep the storage allocation, set the other members to zero/NULL.
+ * The string is moved back to the start of the storage.
  *
  * Parameter: The astr instance
  * Returns:   Pointer to the astr instance
  */
 static astr *astr_clear(astr *as) {
 	if (as != NULL) {
-		if (as->string != NULL) {
-			memset(as->string, '\0', as->allocated_length);
+		if (as->storage != NULL) {
+			memset(as->storage, '\0', as->allocated_length);
+			as->string = as->storage;
 		}
 		as->length = 0;
 		as->checksum = 0;
 		as->tokenend = NULL;
+		as->codepoint_length = -1;
+		as->hash = 0;
+	}
+	return as;
+}
+
+/*
+ * astr_compact
+ *
+ * Move the string of a left-trimmed astr instance back to the start of its
+ * storage, so the whole allocation is available to the string again.
+ *
+ * Parameter: The astr instance
+ * Returns:   Pointer to the astr instance
+ */
+static astr *astr_compact(astr *as) {
+	size_t used;
+	if (as != NULL && as->storage != NULL && as->string != as->storage) {
+		used = strlen(as->string);
+		memmove(as->storage, as->string, used);
+		memset(as->storage + used, '\0', as->allocated_length - used);
+		as->string = as->storage;
+		as->tokenend = NULL;
 	}
 	return as;
 }
@@ -469,14 +506,16 @@ static astr *astr_clear(astr *as) {
  */
 static astr *astr_free_string(astr *as) {
 	if (as != NULL) {
-		if (as->string != NULL) {
-			free(as->string);
+		if (as->storage != NULL) {
+			free(as->storage);
 		}
+		as->storage = NULL;
 		as->string = NULL;
 		as->allocated_length = 0;
 		as->length = 0;
 		as->checksum = 0;
 		as->tokenend = NULL;
+		as->hash = 0;
 	}
 	return as;
 }
@@ -493,8 +532,8 @@ static astr *astr_free_string(astr *as) {
  */
 astr *astr_free(astr *as) {
 	if (as != NULL) {
-		if (as->string != NULL) {
-			free(as->string);
+		if (as->storage != NULL) {
+			free(as->storage);
 		}
 		free(as);
 	}
@@ -4,6 +4,7 @@
 #define ASTR_H
 
 #include <stdio.h>
+#include <stdint.h>
 
 /*
  * The astr object is optimized for retrieving the length of the string
@@ -38,7 +39,26 @@
  * need to call astr_update() to reset the checksum and length  values in
  * the astr structure.
  *
- * No effort has been made to make this module thread-safe.
+ * Strings are treated as UTF-8 by the functions that need to know where the
+ * characters are: astr_reverse, the case conversions, and the alphabetic,
+ * alphanumeric, blank, and space classifications.  Strings that are all ASCII
+ * stay on byte-at-a-time fast paths.
+ *
+ * The module is thread-safe in the way the standard C library is.  The
+ * module keeps no shared state that changes: the UTF-8 locale is loaded once
+ * with pthread_once, and compiled regular expressions are cached by each
+ * thread for itself.  An instance is owned by one thread at a time, and can
+ * be handed to another thread through anything that synchronizes the two,
+ * like a mutex, a condition variable, or pthread_join; nothing in an instance
+ * belongs to the thread that created it.  Several threads may read the same
+ * instance at once, as long as none of them changes it.  The hash and code
+ * point count that reading functions cache in the instance are stored
+ * atomically.  astr_tok changes the instance, like strtok, so it is not a
+ * reading function.
+ *
+ * The maps, radix trees, Bloom filters, and ropes follow the same rule: any
+ * number of threads may look things up at once, and a thread that changes
+ * one must have it to itself.
  */
 
 typedef struct astr {
@@ -51,13 +71,105 @@ typedef struct astr {
 	// String length
 	int length;
 
-	// Number of characters allocated for string, always at least length+1
+	// Number of characters allocated for storage, always at least length+1
 	int allocated_length;
 	
-	// Pointer to the end of the last token, used when tokenizing the string
+	// Pointer to the end of the last token, used when tokenizing the string.
+	// Tokenizing changes the instance, so it belongs to one thread at a time.
 	char *tokenend;
+
+	// Pointer to the start of the allocated storage.  A left trim moves string
+	// forward inside the storage instead of moving the characters; the storage
+	// is compacted the next time the astr is set or needs room to grow.
+	char *storage;
+
+	// Number of UTF-8 code points in the string, or -1 if it has not been
+	// counted since the string last changed.  Equal to length for ASCII,
+	// and for any string without continuation bytes, such as Latin-1.
+	// Read and written atomically, since reading functions set it.
+	int codepoint_length;
+
+	// Hash of the string, or 0 if it has not been calculated since the
+	// string last changed.  See astr_hash().  Read and written atomically,
+	// since reading functions set it.
+	uint64_t hash;
 } astr;
 
+/*
+ * An astr_view refers to a run of characters owned by someone else: an astr,
+ * a buffer, or a mapped file.  It is passed and returned by value, never
+ * allocates, and is not necessarily null-terminated.  A view is only valid
+ * as long as the characters it refers to are not changed or freed.
+ */
+typedef struct astr_view {
+	// Pointer to the first character of the view
+	const char *string;
+
+	// Number of characters in the view
+	int length;
+} astr_view;
+
+/*
+ * An astr_builder collects the pieces of a string as views and makes the
+ * string in one step: the total length is known before anything is copied,
+ * so the result takes one allocation and one copy of each piece, instead of
+ * the reallocation and rescan of every astr_append.  The pieces are not
+ * copied when they are added, so they must not be changed or freed until the
+ * string has been built.
+ */
+typedef struct astr_builder {
+	// The pieces, in order
+	astr_view *pieces;
+
+	// Number of pieces
+	int count;
+
+	// Number of pieces allocated
+	int allocated;
+
+	// Total length of the pieces
+	int length;
+} astr_builder;
+
+/*
+ * An astr_edit_program composes several edits into one compiled pass over the
+ * string.  astr_clean(), for example, is a trim followed by a pack; run as
+ * separate edits that costs several scans of the string plus an astr_update()
+ * after each one.  Run as a program it costs one scan, and the checksum and
+ * length are accumulated along the way.
+ *
+ * The operations are applied to each character in this order, no matter the
+ * order in which they were added to the program: delete, case mapping,
+ * squeeze, pack, trim, and finally not-empty on the result.
+ */
+
+// Operations that can be combined in an edit program.
+#define ASTR_EDIT_LEFT_TRIM  0x0001
+#define ASTR_EDIT_RIGHT_TRIM 0x0002
+#define ASTR_EDIT_TRIM       (ASTR_EDIT_LEFT_TRIM | ASTR_EDIT_RIGHT_TRIM)
+#define ASTR_EDIT_PACK       0x0004
+#define ASTR_EDIT_CLEAN      (ASTR_EDIT_TRIM | ASTR_EDIT_PACK)
+#define ASTR_EDIT_UPPER_CASE 0x0008
+#define ASTR_EDIT_LOWER_CASE 0x0010
+#define ASTR_EDIT_MIXED_CASE 0x0020
+#define ASTR_EDIT_SQUEEZE    0x0040
+#define ASTR_EDIT_DELETE     0x0080
+#define ASTR_EDIT_NOT_EMPTY  0x0100
+
+typedef struct astr_edit_program {
+	// Bitmask of the ASTR_EDIT_* operations in the program
+	int operations;
+
+	// Sole character used by ASTR_EDIT_NOT_EMPTY
+	char sole;
+
+	// Characters removed by ASTR_EDIT_DELETE, indexed by unsigned char
+	char delete_set[256];
+
+	// Characters whose runs are squeezed by ASTR_EDIT_SQUEEZE, indexed by unsigned char
+	char squeeze_set[256];
+} astr_edit_program;
+
 #ifdef	__cplusplus
 extern "C" {
 #endif
@@ -153,6 +265,12 @@ int astr_compare(const astr *as1, const astr *as2);
 // Compare the prefixes of two astr instances.
 int astr_prefix_compare(const astr *as1, const astr *as2, const int num_prefix_chars);
 
+// Hash a buffer.
+uint64_t astr_hash_buffer(const char *buffer, const int length);
+
+// Get the hash of an astr instance, calculated once and cached.
+uint64_t astr_hash(astr *as);
+
 // ----------------------
 // Conversions
 
@@ -189,6 +307,12 @@ astr *astr_pack(astr *as);
 // Pack and trim the astr.
 astr *astr_clean(astr *as);
 
+// Remove the specified number of characters from the left side of an astr.
+astr *astr_remove_left(astr *as, const int count);
+
+// Remove a prefix from the left side of an astr, if the astr starts with it.
+astr *astr_remove_prefix(astr *as, const char *prefix);
+
 // Make sure the astr string is not empty (or NULL), use space for sole character.
 astr *astr_not_empty(astr *as);
 
@@ -198,6 +322,153 @@ astr *astr_not_empty_char(astr *as, const char sole);
 // Reverse the characters in an astr string.
 astr *astr_reverse(astr *as);
 
+// ----------------------
+// Edit Programs
+
+// Allocate a new edit program with the specified ASTR_EDIT_* operations.
+astr_edit_program *astr_edit_program_create(int operations);
+
+// Add ASTR_EDIT_DELETE to an edit program, deleting the specified characters.
+astr_edit_program *astr_edit_program_set_delete(astr_edit_program *program, const char *chars);
+
+// Add ASTR_EDIT_SQUEEZE to an edit program, squeezing runs of the specified characters.
+astr_edit_program *astr_edit_program_set_squeeze(astr_edit_program *program, const char *chars);
+
+// Add ASTR_EDIT_NOT_EMPTY to an edit program, using the specified sole character.
+astr_edit_program *astr_edit_program_set_not_empty_char(astr_edit_program *program, const char sole);
+
+// Free an edit program.
+astr_edit_program *astr_edit_program_free(astr_edit_program *program);
+
+// Run an edit program over an astr in one pass.
+astr *astr_edit(astr *as, const astr_edit_program *program);
+
+// ----------------------
+// UTF-8
+
+// Determine if a buffer holds valid UTF-8.
+int astr_utf8_validate(const char *buffer, const int length);
+
+// Count the code points in a buffer of UTF-8.
+int astr_utf8_count(const char *buffer, const int length);
+
+// Decode the code point at the start of a buffer of UTF-8.
+int astr_utf8_decode(const char *buffer, const int length, int *codepoint);
+
+// Encode a code point as UTF-8.
+int astr_utf8_encode(const int codepoint, char *dst);
+
+// Determine if the string in an astr instance is valid UTF-8.
+int astr_is_utf8(const astr *as);
+
+// Get the number of code points in an astr instance, counted once and cached.
+int astr_codepoint_length(astr *as);
+
+// Convert a code point to upper case.
+int astr_codepoint_to_upper(const int codepoint);
+
+// Convert a code point to lower case.
+int astr_codepoint_to_lower(const int codepoint);
+
+// Determine if a code point is alphabetic.
+int astr_codepoint_is_alpha(const int codepoint);
+
+// Determine if a code point is alphanumeric.
+int astr_codepoint_is_alnum(const int codepoint);
+
+// Determine if a code point is white space.
+int astr_codepoint_is_space(const int codepoint);
+
+// Determine if a code point is blank.
+int astr_codepoint_is_blank(const int codepoint);
+
+// ----------------------
+// Builders
+
+// Create a builder with room for a number of pieces.
+astr_builder *astr_builder_create(const int capacity);
+
+// Add a view to a builder.
+astr_builder *astr_builder_add_view(astr_builder *builder, astr_view view);
+
+// Add a null-terminated string to a builder.
+astr_builder *astr_builder_add(astr_builder *builder, const char *string);
+
+// Add the string of an astr instance to a builder.
+astr_builder *astr_builder_add_astr(astr_builder *builder, const astr *as);
+
+// Remove all of the pieces from a builder, keeping its allocation.
+astr_builder *astr_builder_reset(astr_builder *builder);
+
+// Allocate a new astr initialized with the pieces of a builder.
+astr *astr_builder_build(const astr_builder *builder);
+
+// Reinitialize an astr with the pieces of a builder.
+astr *astr_builder_build_into(const astr_builder *builder, astr *as);
+
+// Free a builder.
+astr_builder *astr_builder_free(astr_builder *builder);
+
+// Allocate a new astr joining a NULL-terminated array of astr instances with a separator.
+astr *astr_join(astr **asa, const char *separator);
+
+// ----------------------
+// Sorting
+
+// Sort an array of astr instances into the order of astr_compare.
+astr **astr_sort(astr **asa, size_t count);
+
+// Sort an array of astr instances, keeping equal instances in their original order.
+astr **astr_sort_stable(astr **asa, size_t count);
+
+// Sort an array of astr instances in threads.
+astr **astr_sort_parallel(astr **asa, size_t count, int threads, int stable);
+
+// ----------------------
+// Searches
+
+// Find the first occurrence of a needle in a haystack, neither null-terminated.
+const char *astr_search_buffer(const char *haystack, const int haystack_length, const char *needle, const int needle_length);
+
+// Find a substring in an astr instance, starting from an index.
+int astr_find(const astr *as, const char *needle, const int start);
+
+// Find every non-overlapping occurrence of a substring in an astr instance.
+int *astr_find_all(const astr *as, const char *needle, int *count);
+
+// Replace every non-overlapping occurrence of a substring in an astr instance.
+astr *astr_replace_all(astr *as, const char *needle, const char *replacement);
+
+// ----------------------
+// Views
+
+// Make a view of the string in an astr instance.
+astr_view astr_view_of(const astr *as);
+
+// Make a view of a buffer of specified length.
+astr_view astr_view_from_buffer(const char *buffer, const int length);
+
+// Make a view of a null-terminated string.
+astr_view astr_view_from_string(const char *string);
+
+// Trim whitespace from the left side of a view.
+astr_view astr_view_left_trim(astr_view view);
+
+// Trim whitespace from the right side of a view.
+astr_view astr_view_right_trim(astr_view view);
+
+// Remove a prefix from the left side of a view, if the view starts with it.
+astr_view astr_view_remove_prefix(astr_view view, const char *prefix);
+
+// Determine if two views hold the same characters.
+int astr_view_equals(astr_view view1, astr_view view2);
+
+// Allocate a new astr initialized with the characters in a view.
+astr *astr_create_from_view(astr_view view);
+
+// Reinitialize an astr with the characters in a view.
+astr *astr_set_from_view(astr *as, astr_view view);
+
 // ----------------------
 // Utility
 
@@ -212,6 +483,21 @@ char *astr_hexdump_string(const astr *as);
 
 // Dump the astr structure.
 char *astr_hexdump_struct(const astr *as);
+
+// Get the size of the hex dump of a buffer, including the null terminator.
+size_t astr_hexdump_size(size_t length);
+
+// Dump a buffer in hex dump format into a new string.
+char *astr_hexdump_buffer(const void *buffer, size_t length);
+
+// Dump a buffer in hex dump format to a file.
+int astr_hexdump_write(FILE *file, const void *buffer, size_t length);
+
+// Dump a range of a buffer in hex dump format to a file.
+int astr_hexdump_write_range(FILE *file, const void *buffer, size_t length, size_t from, size_t to);
+
+// Dump the lines that differ between two buffers in hex dump format to a file.
+int astr_hexdump_write_diff(FILE *file, const void *buffer1, size_t length1, const void *buffer2, size_t length2);
 	
 // Print an astr instance in labeled string format.
 char *astr_print(const astr *as);
@@ -0,0 +1,442 @@
+// astr_bloom.c - Adept String Bloom Filter
+
+/*
+ * A blocked Bloom filter of string keys.
+ *
+ * The high half of the 64-bit hash of a key picks the block.  The hash is
+ * mixed again for the bits in the block, and each 9 bits of the mixed value
+ * are the index of one bit.  Double hashing is not used for them: modulo the
+ * 512 bits of a block it makes only a few hundred thousand patterns, all
+ * arithmetic progressions that overlap far more than random bits do, and the
+ * false positive rate goes up several times over at low rates.
+ *
+ * With the keys shared out among the blocks, the number of keys in the block
+ * a key is checked against varies, and the blocks with more keys in them
+ * give most of the false positives.  A filter is sized by the rate summed
+ * over the number of keys in a block, so it is larger than an ordinary Bloom
+ * filter for the same rate.
+ *
+ * The file written by astr_bloom_write is a 64-byte header followed by the
+ * blocks, so the blocks stay aligned to cache lines when the file is mapped.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <math.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "astr.h"
+#include "astr_bloom.h"
+
+#define ASTR_BLOOM_BLOCK_BITS (ASTR_BLOOM_BLOCK_WORDS * 64)
+#define ASTR_BLOOM_HEADER_SIZE 64
+#define ASTR_BLOOM_MAGIC "ADPBLOOM"
+#define ASTR_BLOOM_VERSION 2
+#define ASTR_BLOOM_MAX_HASHES 16
+#define ASTR_BLOOM_MAX_BLOCKS UINT32_MAX
+
+/*
+ * astr_bloom_block
+ *
+ * Get the block for a hash.
+ */
+static uint64_t *astr_bloom_block(const astr_bloom *bloom, uint64_t hash) {
+	return bloom->blocks + (((hash >> 32) * bloom->block_count) >> 32) * ASTR_BLOOM_BLOCK_WORDS;
+}
+
+/*
+ * astr_bloom_mix
+ *
+ * Mix the bits of a hash, so each bit of the result depends on all of them.
+ */
+static uint64_t astr_bloom_mix(uint64_t x) {
+	x ^= x >> 33;
+	x *= 0xff51afd7ed558ccdULL;
+	x ^= x >> 33;
+	x *= 0xc4ceb9fe1a85ec53ULL;
+	x ^= x >> 33;
+	return x;
+}
+
+/*
+ * astr_bloom_mask
+ *
+ * Make the bits to be set in a block for a hash.  A mixed value gives seven
+ * 9-bit indexes; the hash is mixed again for each seven.
+ */
+static void astr_bloom_mask(const astr_bloom *bloom, uint64_t hash, uint64_t *mask) {
+	uint64_t x = 0;
+	uint32_t bit;
+	int i;
+
+	memset(mask, 0, ASTR_BLOOM_BLOCK_WORDS * sizeof(uint64_t));
+	for (i = 0; i < bloom->hash_count; i++) {
+		if (i % 7 == 0) {
+			x = astr_bloom_mix(hash + i * 0x9e3779b97f4a7c15ULL);
+		}
+		bit = x % ASTR_BLOOM_BLOCK_BITS;
+		x /= ASTR_BLOOM_BLOCK_BITS;
+		mask[bit / 64] |= (uint64_t)1 << (bit % 64);
+	}
+}
+
+/*
+ * astr_bloom_add_hash
+ *
+ * Add the key with a hash to a filter.
+ */
+static void astr_bloom_add_hash(astr_bloom *bloom, uint64_t hash) {
+	uint64_t mask[ASTR_BLOOM_BLOCK_WORDS];
+	uint64_t *block = astr_bloom_block(bloom, hash);
+	int i;
+
+	astr_bloom_mask(bloom, hash, mask);
+	for (i = 0; i < ASTR_BLOOM_BLOCK_WORDS; i++) {
+		block[i] |= mask[i];
+	}
+	bloom->count++;
+}
+
+/*
+ * astr_bloom_contains_hash
+ *
+ * Determine if the key with a hash might be in a filter.
+ * The whole block is checked without a branch per bit.
+ */
+static int astr_bloom_contains_hash(const astr_bloom *bloom, uint64_t hash) {
+	uint64_t mask[ASTR_BLOOM_BLOCK_WORDS];
+	const uint64_t *block = astr_bloom_block(bloom, hash);
+	uint64_t missing = 0;
+	int i;
+
+	astr_bloom_mask(bloom, hash, mask);
+	for (i = 0; i < ASTR_BLOOM_BLOCK_WORDS; i++) {
+		missing |= mask[i] & ~block[i];
+	}
+	return missing == 0;
+}
+
+/*
+ * astr_bloom_rate
+ *
+ * Estimate the false positive rate of a blocked filter.  The number of keys
+ * in the block a key is checked against is taken to be Poisson distributed,
+ * and the rate for each number of keys is weighted by its probability.
+ *
+ * Parameter: The mean number of keys in a block
+ * Parameter: The number of bits set for each key
+ * Returns:   The false positive rate
+ */
+static double astr_bloom_rate(double keys_per_block, int hash_count) {
+	double spread = 12.0 * sqrt(keys_per_block) + 10.0;
+	double unset = 1.0 - (double)hash_count / ASTR_BLOOM_BLOCK_BITS;
+	double rate = 0.0;
+	long lo = (long)(keys_per_block > spread ? keys_per_block - spread : 0);
+	long hi = (long)(keys_per_block + spread);
+	long i;
+
+	for (i = lo; i <= hi; i++) {
+		rate += exp(i * log(keys_per_block) - keys_per_block - lgamma(i + 1.0)) * pow(1.0 - pow(unset, i), hash_count);
+	}
+	return rate;
+}
+
+/*
+ * astr_bloom_best_rate
+ *
+ * Find the number of bits to set for each key that gives the lowest false
+ * positive rate for a number of blocks.
+ *
+ * Parameter: The number of keys
+ * Parameter: The number of blocks
+ * Parameter: Pointer to the number of bits to set for each key
+ * Returns:   The false positive rate with that number of bits
+ */
+static double astr_bloom_best_rate(size_t count, size_t block_count, int *hash_count) {
+	double keys_per_block = (double)count / block_count;
+	double best = 1.0;
+	double rate;
+	int k;
+
+	*hash_count = 1;
+	for (k = 1; k <= ASTR_BLOOM_MAX_HASHES; k++) {
+		rate = astr_bloom_rate(keys_per_block, k);
+		if (rate < best) {
+			best = rate;
+			*hash_count = k;
+		}
+	}
+	return best;
+}
+
+/*
+ * astr_bloom_create
+ *
+ * Create a filter sized for a number of keys and a false positive rate.
+ *
+ * The filter is the smallest number of blocks whose estimated rate, with
+ * the best number of bits set per key, is no more than the rate wanted.
+ * Because of the blocking it is larger than an ordinary Bloom filter for
+ * the same rate, by about 4% at 1%, 9% at 0.1% and 16% at 0.01%.
+ *
+ * Parameter: The number of keys expected to be added
+ * Parameter: The false positive rate wanted, between 0 and 1, like 0.01
+ * Returns:   Pointer to the filter, or NULL if it could not be allocated,
+ *            the rate is out of range, or it would need more blocks than
+ *            the hash can pick from
+ */
+astr_bloom *astr_bloom_create(const size_t expected_count, const double false_positive_rate) {
+	astr_bloom *bloom;
+	double bits;
+	size_t count = (expected_count > 0 ? expected_count : 1);
+	size_t lo;
+	size_t hi;
+	size_t mid;
+	int hash_count;
+
+	if (!(false_positive_rate > 0.0 && false_positive_rate < 1.0)) {
+		return NULL;
+	}
+
+	// Start from the size of an ordinary Bloom filter, which is too small,
+	// double it until it is big enough, and search between the two.
+	bits = -(double)count * log(false_positive_rate) / (M_LN2 * M_LN2);
+	if (bits / ASTR_BLOOM_BLOCK_BITS >= ASTR_BLOOM_MAX_BLOCKS) {
+		return NULL;
+	}
+	lo = (size_t)ceil(bits / ASTR_BLOOM_BLOCK_BITS);
+	lo = (lo > 0 ? lo : 1);
+	hi = lo;
+	while (astr_bloom_best_rate(count, hi, &hash_count) > false_positive_rate) {
+		if (hi > ASTR_BLOOM_MAX_BLOCKS / 2) {
+			return NULL;
+		}
+		lo = hi + 1;
+		hi *= 2;
+	}
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		if (astr_bloom_best_rate(count, mid, &hash_count) > false_positive_rate) {
+			lo = mid + 1;
+		}
+		else {
+			hi = mid;
+		}
+	}
+
+	bloom = (astr_bloom *)calloc(1, sizeof(astr_bloom));
+	if (bloom == NULL) {
+		return NULL;
+	}
+	bloom->block_count = hi;
+	astr_bloom_best_rate(count, hi, &bloom->hash_count);
+
+	if (posix_memalign((void **)&bloom->blocks, 64, bloom->block_count * ASTR_BLOOM_BLOCK_WORDS * sizeof(uint64_t)) != 0) {
+		free(bloom);
+		return NULL;
+	}
+	memset(bloom->blocks, 0, bloom->block_count * ASTR_BLOOM_BLOCK_WORDS * sizeof(uint64_t));
+	return bloom;
+}
+
+/*
+ * astr_bloom_free
+ *
+ * Free a filter, or unmap it if it was mapped from a file.
+ *
+ * Parameter: The filter
+ * Returns:   NULL pointer
+ */
+astr_bloom *astr_bloom_free(astr_bloom *bloom) {
+	if (bloom != NULL) {
+		if (bloom->mapping != NULL) {
+			munmap(bloom->mapping, bloom->mapping_length);
+		}
+		else {
+			free(bloom->blocks);
+		}
+		free(bloom);
+	}
+	return NULL;
+}
+
+/*
+ * astr_bloom_add
+ *
+ * Add a key to a filter.
+ *
+ * Parameter: The filter
+ * Parameter: The key
+ */
+void astr_bloom_add(astr_bloom *bloom, astr *key) {
+	if (bloom != NULL && key != NULL) {
+		astr_bloom_add_hash(bloom, astr_hash(key));
+	}
+}
+
+/*
+ * astr_bloom_add_view
+ *
+ * Add a key in a view to a filter.
+ *
+ * Parameter: The filter
+ * Parameter: The key
+ */
+void astr_bloom_add_view(astr_bloom *bloom, astr_view key) {
+	if (bloom != NULL && key.string != NULL) {
+		astr_bloom_add_hash(bloom, astr_hash_buffer(key.string, key.length));
+	}
+}
+
+/*
+ * astr_bloom_contains
+ *
+ * Determine if a key might be in a filter.
+ *
+ * Parameter: The filter
+ * Parameter: The key
+ * Returns:   1 if the key might have been added, 0 if it definitely was not
+ */
+int astr_bloom_contains(const astr_bloom *bloom, astr *key) {
+	if (bloom == NULL || key == NULL) {
+		return 0;
+	}
+	return astr_bloom_contains_hash(bloom, astr_hash(key));
+}
+
+/*
+ * astr_bloom_contains_view
+ *
+ * Determine if a key in a view might be in a filter.
+ *
+ * Parameter: The filter
+ * Parameter: The key
+ * Returns:   1 if the key might have been added, 0 if it definitely was not
+ */
+int astr_bloom_contains_view(const astr_bloom *bloom, astr_view key) {
+	if (bloom == NULL || key.string == NULL) {
+		return 0;
+	}
+	return astr_bloom_contains_hash(bloom, astr_hash_buffer(key.string, key.length));
+}
+
+/*
+ * astr_bloom_write
+ *
+ * Write a filter to a file, a header followed by the blocks.
+ *
+ * Parameter: The filter
+ * Parameter: The file, open for writing in binary mode
+ * Returns:   0 = success, non-zero = errno value from the failed operation
+ */
+int astr_bloom_write(const astr_bloom *bloom, FILE *file) {
+	unsigned char header[ASTR_BLOOM_HEADER_SIZE];
+	uint32_t version = ASTR_BLOOM_VERSION;
+	uint32_t hash_count;
+	uint64_t block_count;
+	uint64_t count;
+	size_t words;
+
+	if (bloom == NULL || file == NULL) {
+		return EINVAL;
+	}
+
+	hash_count = bloom->hash_count;
+	block_count = bloom->block_count;
+	count = bloom->count;
+	memset(header, 0, sizeof(header));
+	memcpy(header, ASTR_BLOOM_MAGIC, 8);
+	memcpy(header + 8, &version, 4);
+	memcpy(header + 12, &hash_count, 4);
+	memcpy(header + 16, &block_count, 8);
+	memcpy(header + 24, &count, 8);
+
+	words = bloom->block_count * ASTR_BLOOM_BLOCK_WORDS;
+	errno = 0;
+	if (fwrite(header, 1, sizeof(header), file) != sizeof(header) || fwrite(bloom->blocks, sizeof(uint64_t), words, file) != words) {
+		return errno != 0 ? errno : EIO;
+	}
+	return 0;
+}
+
+/*
+ * astr_bloom_map
+ *
+ * Map a filter written by astr_bloom_write into memory.
+ * Nothing is read until a key is checked, and the pages are shared with
+ * every other process that maps the same file.  Keys added to a mapped
+ * filter are private to the process and are not written back to the file.
+ *
+ * Parameter: The name of the file
+ * Returns:   Pointer to the filter, or NULL with errno set if the file could
+ *            not be mapped or is not a filter
+ */
+astr_bloom *astr_bloom_map(const char *filename) {
+	astr_bloom *bloom;
+	struct stat stats;
+	unsigned char *mapping;
+	uint32_t version;
+	uint32_t hash_count;
+	uint64_t block_count;
+	uint64_t count;
+	int fd;
+
+	if (filename == NULL) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	fd = open(filename, O_RDONLY);
+	if (fd < 0) {
+		return NULL;
+	}
+	if (fstat(fd, &stats) != 0) {
+		close(fd);
+		return NULL;
+	}
+	if (stats.st_size < ASTR_BLOOM_HEADER_SIZE) {
+		close(fd);
+		errno = EINVAL;
+		return NULL;
+	}
+	mapping = (unsigned char *)mmap(NULL, stats.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (mapping == MAP_FAILED) {
+		return NULL;
+	}
+
+	memcpy(&version, mapping + 8, 4);
+	memcpy(&hash_count, mapping + 12, 4);
+	memcpy(&block_count, mapping + 16, 8);
+	memcpy(&count, mapping + 24, 8);
+	// The block count is checked against the file before it is multiplied,
+	// and must fit in the 32 bits of the hash that pick the block.
+	if (memcmp(mapping, ASTR_BLOOM_MAGIC, 8) != 0 || version != ASTR_BLOOM_VERSION
+			|| hash_count < 1 || hash_count > ASTR_BLOOM_MAX_HASHES || block_count == 0
+			|| block_count > ASTR_BLOOM_MAX_BLOCKS
+			|| block_count > (uint64_t)(stats.st_size - ASTR_BLOOM_HEADER_SIZE) / (ASTR_BLOOM_BLOCK_WORDS * sizeof(uint64_t))
+			|| (uint64_t)stats.st_size != ASTR_BLOOM_HEADER_SIZE + block_count * ASTR_BLOOM_BLOCK_WORDS * sizeof(uint64_t)) {
+		munmap(mapping, stats.st_size);
+		errno = EINVAL;
+		return NULL;
+	}
+
+	bloom = (astr_bloom *)calloc(1, sizeof(astr_bloom));
+	if (bloom == NULL) {
+		munmap(mapping, stats.st_size);
+		return NULL;
+	}
+	bloom->blocks = (uint64_t *)(mapping + ASTR_BLOOM_HEADER_SIZE);
+	bloom->block_count = block_count;
+	bloom->hash_count = hash_count;
+	bloom->count = count;
+	bloom->mapping = mapping;
+	bloom->mapping_length = stats.st_size;
+	return bloom;
+}
@@ -0,0 +1,86 @@
+// astr_bloom.h - Adept String Bloom Filter
+
+#ifndef ASTR_BLOOM_H
+#define ASTR_BLOOM_H
+
+#include <stdio.h>
+#include <stdint.h>
+
+#include "astr.h"
+
+/*
+ * An astr_bloom is a Bloom filter of string keys, to rule out keys that are
+ * definitely absent before doing an expensive lookup, as when checking each
+ * line against a blocklist of tens of millions of entries.  A key that was
+ * added is always reported as possibly present; a key that was not added is
+ * reported as possibly present only at about the false positive rate the
+ * filter was sized for.
+ *
+ * The filter is blocked: the bits for a key are all in one 512-bit block,
+ * one cache line, picked by the hash of the key.  Checking a key touches one
+ * cache line no matter how many bits are set per key.  Confining the bits to
+ * a block raises the false positive rate over that of an ordinary Bloom
+ * filter of the same size, more so the lower the rate, so a filter is made
+ * larger than an ordinary one to keep to the rate it was sized for.
+ *
+ * A filter can be written to a file and mapped back into memory with mmap,
+ * so a large filter built once is loaded by many processes without reading
+ * it.  The file is in the byte order of the machine that wrote it.
+ */
+
+// Number of 64-bit words in a block, one cache line
+#define ASTR_BLOOM_BLOCK_WORDS 8
+
+typedef struct astr_bloom {
+	// The blocks, aligned to cache lines
+	uint64_t *blocks;
+
+	// Number of blocks
+	size_t block_count;
+
+	// Number of bits set for each key
+	int hash_count;
+
+	// Number of keys added
+	size_t count;
+
+	// The file mapping holding the blocks, or NULL if they were allocated
+	void *mapping;
+
+	// Length of the file mapping
+	size_t mapping_length;
+} astr_bloom;
+
+#ifdef	__cplusplus
+extern "C" {
+#endif
+
+// Create a filter sized for a number of keys and a false positive rate.
+astr_bloom *astr_bloom_create(const size_t expected_count, const double false_positive_rate);
+
+// Free a filter.
+astr_bloom *astr_bloom_free(astr_bloom *bloom);
+
+// Add a key to a filter, using the hash cached in the key.
+void astr_bloom_add(astr_bloom *bloom, astr *key);
+
+// Add a key in a view to a filter.
+void astr_bloom_add_view(astr_bloom *bloom, astr_view key);
+
+// Determine if a key might be in a filter, using the hash cached in the key.
+int astr_bloom_contains(const astr_bloom *bloom, astr *key);
+
+// Determine if a key in a view might be in a filter.
+int astr_bloom_contains_view(const astr_bloom *bloom, astr_view key);
+
+// Write a filter to a file.
+int astr_bloom_write(const astr_bloom *bloom, FILE *file);
+
+// Map a filter written by astr_bloom_write into memory.
+astr_bloom *astr_bloom_map(const char *filename);
+
+#ifdef	__cplusplus
+}
+#endif
+
+#endif	// ASTR_BLOOM_H
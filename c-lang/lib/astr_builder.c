@@ -0,0 +1,306 @@
+// astr_builder.c - Adept String Builder
+
+/*
+ * An astr_builder collects the pieces of a string as views and makes the
+ * string with one allocation and one copy of each piece.
+ *
+ * Building a line from many fields with astr_append reallocates the string
+ * and rescans it for the checksum every time a field is added.  A builder
+ * only records where each piece is and adds up the lengths; the characters
+ * are copied once, when the string is built, and the checksum is calculated
+ * in the same pass.
+ *
+ * The pieces should not contain null characters.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "astr.h"
+
+static void astr_builder_copy(const astr_builder *builder, char *dst, int *checksum);
+
+/*
+ * astr_builder_create
+ *
+ * Create a builder with room for a number of pieces.
+ * The builder grows when more pieces are added.
+ *
+ * Parameter: The initial number of pieces, or 0 for a default
+ * Returns:   Pointer to the builder, or NULL if it could not be allocated
+ */
+astr_builder *astr_builder_create(const int capacity) {
+	astr_builder *builder = (astr_builder *)calloc(1, sizeof(astr_builder));
+	if (builder != NULL) {
+		builder->allocated = (capacity > 0 ? capacity : 16);
+		builder->pieces = (astr_view *)malloc(builder->allocated * sizeof(astr_view));
+		if (builder->pieces == NULL) {
+			free(builder);
+			builder = NULL;
+		}
+	}
+	return builder;
+}
+
+/*
+ * astr_builder_add_view
+ *
+ * Add a view to a builder.
+ * The characters are not copied until the string is built.
+ *
+ * Parameter: The builder
+ * Parameter: The view to add
+ * Returns:   Pointer to the builder
+ */
+astr_builder *astr_builder_add_view(astr_builder *builder, astr_view view) {
+	astr_view *newpieces;
+	if (builder != NULL && view.string != NULL && view.length > 0) {
+		if (builder->count == builder->allocated) {
+			newpieces = (astr_view *)realloc(builder->pieces, builder->allocated * 2 * sizeof(astr_view));
+			if (newpieces == NULL) {
+				return builder;
+			}
+			builder->pieces = newpieces;
+			builder->allocated *= 2;
+		}
+		builder->pieces[builder->count++] = view;
+		builder->length += view.length;
+	}
+	return builder;
+}
+
+/*
+ * astr_builder_add
+ *
+ * Add a null-terminated string to a builder.
+ *
+ * Parameter: The builder
+ * Parameter: The null-terminated string
+ * Returns:   Pointer to the builder
+ */
+astr_builder *astr_builder_add(astr_builder *builder, const char *string) {
+	return astr_builder_add_view(builder, astr_view_from_string(string));
+}
+
+/*
+ * astr_builder_add_astr
+ *
+ * Add the string of an astr instance to a builder.
+ *
+ * Parameter: The builder
+ * Parameter: The astr instance
+ * Returns:   Pointer to the builder
+ */
+astr_builder *astr_builder_add_astr(astr_builder *builder, const astr *as) {
+	return astr_builder_add_view(builder, astr_view_of(as));
+}
+
+/*
+ * astr_builder_reset
+ *
+ * Remove all of the pieces from a builder, keeping its allocation, so it can
+ * be used to build the next string.
+ *
+ * Parameter: The builder
+ * Returns:   Pointer to the builder
+ */
+astr_builder *astr_builder_reset(astr_builder *builder) {
+	if (builder != NULL) {
+		builder->count = 0;
+		builder->length = 0;
+	}
+	return builder;
+}
+
+/*
+ * astr_builder_copy
+ *
+ * Copy the pieces of a builder to a destination, adding up the checksum.
+ *
+ * Parameter: The builder
+ * Parameter: The destination, with room for the length of the builder
+ * Parameter: Pointer to the checksum
+ */
+static void astr_builder_copy(const astr_builder *builder, char *dst, int *checksum) {
+	const char *s;
+	const char *s_end;
+	int sum = 0;
+	int i;
+
+	for (i = 0; i < builder->count; i++) {
+		s = builder->pieces[i].string;
+		s_end = s + builder->pieces[i].length;
+		while (s < s_end) {
+			sum += *s;
+			*dst++ = *s++;
+		}
+	}
+	*checksum = sum;
+}
+
+/*
+ * astr_builder_build
+ *
+ * Allocate a new astr initialized with the pieces of a builder.
+ * The builder is not changed, and can be reset and used again.
+ *
+ * Parameter: The builder
+ * Returns:   Pointer to the astr instance
+ */
+astr *astr_builder_build(const astr_builder *builder) {
+	return astr_builder_build_into(builder, NULL);
+}
+
+/*
+ * astr_builder_build_into
+ *
+ * Reinitialize an astr with the pieces of a builder.
+ *
+ * The storage of the astr instance is reused when it is big enough and none
+ * of the pieces are in it; otherwise the string is built in one new
+ * allocation of exactly the right size.  If the astr instance is NULL a new
+ * one is allocated.
+ *
+ * Parameter: The builder
+ * Parameter: The astr instance to be reinitialized
+ * Returns:   Pointer to the astr instance
+ */
+astr *astr_builder_build_into(const astr_builder *builder, astr *as) {
+	char *storage;
+	char *storage_end;
+	int reuse;
+	int i;
+
+	if (as == NULL) {
+		as = astr_create_empty();
+		if (as == NULL) {
+			return NULL;
+		}
+	}
+	if (builder == NULL) {
+		return astr_set(as, "");
+	}
+
+	reuse = (as->storage != NULL && builder->length + 1 <= as->allocated_length);
+	if (reuse) {
+		storage_end = as->storage + as->allocated_length;
+		for (i = 0; i < builder->count; i++) {
+			if (builder->pieces[i].string < storage_end && builder->pieces[i].string + builder->pieces[i].length > as->storage) {
+				reuse = 0;
+				break;
+			}
+		}
+	}
+
+	if (reuse) {
+		storage = as->storage;
+		memset(storage + builder->length, '\0', as->allocated_length - builder->length);
+	}
+	else {
+		storage = (char *)calloc(builder->length + 1, sizeof(char));
+		if (storage == NULL) {
+			return as;
+		}
+	}
+
+	astr_builder_copy(builder, storage, &as->checksum);
+
+	if (!reuse) {
+		free(as->storage);
+		as->storage = storage;
+		as->allocated_length = builder->length + 1;
+	}
+	as->string = storage;
+	as->length = builder->length;
+	as->tokenend = NULL;
+	as->codepoint_length = -1;
+	as->hash = 0;
+	return as;
+}
+
+/*
+ * astr_builder_free
+ *
+ * Free a builder.
+ * The pieces belong to someone else and are not freed.
+ *
+ * Parameter: The builder
+ * Returns:   NULL pointer
+ */
+astr_builder *astr_builder_free(astr_builder *builder) {
+	if (builder != NULL) {
+		free(builder->pieces);
+		free(builder);
+	}
+	return NULL;
+}
+
+/*
+ * astr_join
+ *
+ * Allocate a new astr joining an array of astr instances with a separator
+ * between each one, as when writing a delimited record.
+ * The array is terminated by a NULL pointer, like the array from astr_split.
+ * The total length is calculated first, so the result takes one allocation.
+ *
+ * Parameter: The NULL-terminated array of astr instances
+ * Parameter: The null-terminated separator, or NULL for none
+ * Returns:   Pointer to the new astr instance
+ */
+astr *astr_join(astr **asa, const char *separator) {
+	astr *as;
+	char *d;
+	int separator_length;
+	int separator_checksum = 0;
+	int length = 0;
+	int checksum = 0;
+	int count = 0;
+	int i;
+
+	as = astr_create_empty();
+	if (as == NULL || asa == NULL) {
+		return as;
+	}
+	if (separator == NULL) {
+		separator = "";
+	}
+	separator_length = strlen(separator);
+	for (i = 0; i < separator_length; i++) {
+		separator_checksum += separator[i];
+	}
+
+	for (i = 0; asa[i] != NULL; i++) {
+		if (asa[i]->string != NULL) {
+			length += asa[i]->length;
+			checksum += asa[i]->checksum;
+		}
+		count++;
+	}
+	if (count > 1) {
+		length += (count - 1) * separator_length;
+		checksum += (count - 1) * separator_checksum;
+	}
+
+	as->storage = as->string = (char *)calloc(length + 1, sizeof(char));
+	if (as->string == NULL) {
+		return as;
+	}
+	as->allocated_length = length + 1;
+
+	d = as->string;
+	for (i = 0; asa[i] != NULL; i++) {
+		if (i > 0) {
+			memcpy(d, separator, separator_length);
+			d += separator_length;
+		}
+		if (asa[i]->string != NULL) {
+			memcpy(d, asa[i]->string, asa[i]->length);
+			d += asa[i]->length;
+		}
+	}
+	as->length = length;
+	as->checksum = checksum;
+	as->codepoint_length = -1;
+	as->hash = 0;
+	return as;
+}
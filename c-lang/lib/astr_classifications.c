@@ -3,15 +3,44 @@
 /*
  * Functions to determine if the contents of an astr match various
  * classifications.
- * Most of these functions use the regex library.
+ * The character class tests read the string as UTF-8 and test each code
+ * point; the rest of these functions use the regex library.
+ *
+ * Compiling a regular expression takes much longer than matching a line with
+ * it, so each thread keeps the last few expressions it compiled.  The cache
+ * belongs to the thread, so no locking is needed, and it is freed when the
+ * thread exits.
  */
 
 #include <stdlib.h>
 #include <string.h>
 #include <regex.h>
+#include <pthread.h>
 
 #include "astr.h"
 
+// Number of compiled expressions kept by each thread.
+#define ASTR_REGEX_CACHE_SIZE 8
+
+typedef struct astr_regex_cache_entry {
+	char *expression;
+	int cflags;
+	regex_t regex;
+} astr_regex_cache_entry;
+
+typedef struct astr_regex_cache {
+	int count;
+	int next;
+	astr_regex_cache_entry entries[ASTR_REGEX_CACHE_SIZE];
+} astr_regex_cache;
+
+static pthread_key_t astr_regex_cache_key;
+static pthread_once_t astr_regex_cache_once = PTHREAD_ONCE_INIT;
+static int astr_regex_cache_available = 0;
+
+static int astr_is_all(const astr *as, int (*test)(const int codepoint));
+static regex_t *astr_regex_cached(const char *expression, int cflags);
+
 /*
  * astr_is_empty
  *
@@ -39,11 +68,7 @@ int astr_is_empty(const astr *as) {
  * Returns    1 if blank and 0 if not blank.
  */
 int astr_is_blank(const astr *as) {
-	int result;
-	astr *expression = astr_create("^[[:blank:]]+$");
-	result = astr_match(as, expression, REG_EXTENDED);
-	astr_free(expression);
-	return result;
+	return astr_is_all(as, astr_codepoint_is_blank);
 }
 
 /*
@@ -56,29 +81,20 @@ int astr_is_blank(const astr *as) {
  * Returns    1 if blank and 0 if not space.
  */
 int astr_is_space(const astr *as) {
-	int result;
-	astr *expression = astr_create("^[[:space:]]+$");
-	result = astr_match(as, expression, REG_EXTENDED);
-	astr_free(expression);
-	return result;
+	return astr_is_all(as, astr_codepoint_is_space);
 }
 
 /*
  * astr_is_alphabetic
  *
  * Determine if the astr instance contains alphabetic characters only.
- * Example: AbcdEfg
+ * Example: AbcdEfg, Ärger
  *
  * Parameter: The astr instance to be checked
  * Returns    1 if the string contains alphabetic characters only, and 0 if not.
- *				  -1 if there was an error with the regular expression.
  */
 int astr_is_alphabetic(const astr *as) {
-	int result;
-	astr *expression = astr_create("^[[:alpha:]]+$");
-	result = astr_match(as, expression, REG_EXTENDED);
-	astr_free(expression);
-	return result;
+	return astr_is_all(as, astr_codepoint_is_alpha);
 }
 
 /*
@@ -89,14 +105,51 @@ int astr_is_alphabetic(const astr *as) {
  *
  * Parameter: The astr instance to be checked
  * Returns    1 if the string contains alphanumeric characters only, and 0 if not.
- *				  -1 if there was an error with the regular expression.
  */
 int astr_is_alphanumeric(const astr *as) {
-	int result;
-	astr *expression = astr_create("^[[:alnum:]]+$");
-	result = astr_match(as, expression, REG_EXTENDED);
-	astr_free(expression);
-	return result;
+	return astr_is_all(as, astr_codepoint_is_alnum);
+}
+
+/*
+ * astr_is_all
+ *
+ * Determine if every character in the astr instance passes a test.
+ * ASCII characters are tested directly; other characters are decoded from
+ * UTF-8 and the code point is tested.  A string that is not valid UTF-8 does
+ * not pass.
+ *
+ * Parameter: The astr instance to be checked
+ * Parameter: The test for one code point
+ * Returns    1 if the string is not empty and every character passes, and 0 if not.
+ */
+static int astr_is_all(const astr *as, int (*test)(const int codepoint)) {
+	const char *s;
+	const char *end;
+	int codepoint;
+	int n;
+
+	if (as == NULL || as->string == NULL || as->length <= 0 || *(as->string) == '\0') {
+		return 0;
+	}
+
+	s = as->string;
+	end = as->string + as->length;
+	while (s < end && *s != '\0') {
+		if ((*s & 0x80) == 0) {
+			if (!test(*s)) {
+				return 0;
+			}
+			s++;
+		}
+		else {
+			n = astr_utf8_decode(s, end - s, &codepoint);
+			if (n <= 0 || !test(codepoint)) {
+				return 0;
+			}
+			s += n;
+		}
+	}
+	return 1;
 }
 
 /*
@@ -164,8 +217,13 @@ int astr_is_10(const astr *as) {
  */
 int astr_match(const astr *as, const astr *expression, int posix_cflags) {
 	regex_t regex;
+	regex_t *cached;
 	int errc;
 	int match;
+	cached = astr_regex_cached(expression->string, posix_cflags);
+	if (cached != NULL) {
+		return !regexec(cached, as->string, 0, NULL, 0);
+	}
 	errc= regcomp(&regex, expression->string, posix_cflags);
 	if (errc) {
 		return -1;
@@ -175,3 +233,100 @@ int astr_match(const astr *as, const astr *expression, int posix_cflags) {
 	return !match;
 }
 
+/*
+ * astr_regex_cache_free
+ *
+ * Free the regex cache of a thread when the thread exits.
+ */
+static void astr_regex_cache_free(void *data) {
+	astr_regex_cache *cache = (astr_regex_cache *)data;
+	int i;
+	for (i = 0; i < cache->count; i++) {
+		if (cache->entries[i].expression != NULL) {
+			regfree(&cache->entries[i].regex);
+			free(cache->entries[i].expression);
+		}
+	}
+	free(cache);
+}
+
+/*
+ * astr_regex_cache_create_key
+ *
+ * Create the key for the regex caches of the threads.
+ * Called once, by pthread_once.
+ */
+static void astr_regex_cache_create_key(void) {
+	astr_regex_cache_available = (pthread_key_create(&astr_regex_cache_key, astr_regex_cache_free) == 0);
+}
+
+/*
+ * astr_regex_cached
+ *
+ * Get a compiled regular expression from the cache of the calling thread,
+ * compiling it and adding it to the cache if it is not there.  When the
+ * cache is full the oldest expression is replaced.
+ *
+ * Parameter: The regular expression
+ * Parameter: The POSIX cflags
+ * Returns:   The compiled expression, or NULL if it could not be compiled
+ *            or cached
+ */
+static regex_t *astr_regex_cached(const char *expression, int cflags) {
+	astr_regex_cache *cache;
+	astr_regex_cache_entry *entry;
+	char *copy;
+	int i;
+
+	pthread_once(&astr_regex_cache_once, astr_regex_cache_create_key);
+	if (!astr_regex_cache_available) {
+		return NULL;
+	}
+
+	cache = (astr_regex_cache *)pthread_getspecific(astr_regex_cache_key);
+	if (cache == NULL) {
+		cache = (astr_regex_cache *)calloc(1, sizeof(astr_regex_cache));
+		if (cache == NULL) {
+			return NULL;
+		}
+		if (pthread_setspecific(astr_regex_cache_key, cache) != 0) {
+			free(cache);
+			return NULL;
+		}
+	}
+
+	for (i = 0; i < cache->count; i++) {
+		entry = &cache->entries[i];
+		if (entry->expression != NULL && entry->cflags == cflags && strcmp(entry->expression, expression) == 0) {
+			return &entry->regex;
+		}
+	}
+
+	copy = strdup(expression);
+	if (copy == NULL) {
+		return NULL;
+	}
+
+	if (cache->count < ASTR_REGEX_CACHE_SIZE) {
+		entry = &cache->entries[cache->count++];
+	}
+	else {
+		entry = &cache->entries[cache->next];
+		cache->next = (cache->next + 1) % ASTR_REGEX_CACHE_SIZE;
+		if (entry->expression != NULL) {
+			regfree(&entry->regex);
+			free(entry->expression);
+		}
+	}
+
+	// The expression is compiled in place; a slot whose expression does not compile is left empty.
+	if (regcomp(&entry->regex, expression, cflags) != 0) {
+		entry->expression = NULL;
+		free(copy);
+		return NULL;
+	}
+	entry->expression = copy;
+	entry->cflags = cflags;
+	return &entry->regex;
+}
+
@@ -19,14 +19,23 @@
  * If the checksums do not match, the strings are not equal.  One integer
  * comparison quickly detects if the strings are not equal.
  * If the checksums match, do the full comparison to confirm equality.
+ * The lengths, and the hashes when both have been calculated, are checked
+ * the same way first.
  *
  * Parameter: The first astr instance
  * Parameter: The second astr instance
  * Returns:   1 if equal, 0 if not
  */
 int astr_equals(const astr *as1, const astr *as2) {
+	uint64_t hash1;
+	uint64_t hash2;
 	if (as1 != NULL && as2 != NULL) {
-		if (as1->checksum != as2->checksum) {
+		if (as1->checksum != as2->checksum || as1->length != as2->length) {
+			return 0;
+		}
+		hash1 = __atomic_load_n(&as1->hash, __ATOMIC_RELAXED);
+		hash2 = __atomic_load_n(&as2->hash, __ATOMIC_RELAXED);
+		if (hash1 != 0 && hash2 != 0 && hash1 != hash2) {
 			return 0;
 		}
 	}
@@ -172,3 +181,80 @@ int astr_prefix_compare(const astr *as1, const astr *as2, const int num_prefix_c
 	}
 	return result;
 }
+
+/*
+ * astr_hash_buffer
+ *
+ * Hash a buffer.
+ *
+ * The buffer is read eight bytes at a time, and each word is mixed into the
+ * hash with multiplies and rotates, as in MurmurHash3, with the length mixed
+ * in at the end.  The result is never 0, so 0 can mean "not calculated".
+ *
+ * Parameter: The buffer
+ * Parameter: The length of the buffer
+ * Returns:   The hash
+ */
+uint64_t astr_hash_buffer(const char *buffer, const int length) {
+	const uint64_t c1 = 0x87c37b91114253d5ULL;
+	const uint64_t c2 = 0x4cf5ad432745937fULL;
+	const char *p = buffer;
+	const char *end = buffer + (length > 0 ? length : 0);
+	uint64_t h = 0x9e3779b97f4a7c15ULL;
+	uint64_t w;
+
+	while (end - p >= 8) {
+		memcpy(&w, p, 8);
+		w *= c1;
+		w = (w << 31) | (w >> 33);
+		w *= c2;
+		h ^= w;
+		h = (h << 27) | (h >> 37);
+		h = h * 5 + 0x52dce729;
+		p += 8;
+	}
+	if (p < end) {
+		w = 0;
+		memcpy(&w, p, end - p);
+		w *= c1;
+		w = (w << 31) | (w >> 33);
+		w *= c2;
+		h ^= w;
+	}
+
+	h ^= (uint64_t)(end - buffer);
+	h ^= h >> 33;
+	h *= 0xff51afd7ed558ccdULL;
+	h ^= h >> 33;
+	h *= 0xc4ceb9fe1a85ec53ULL;
+	h ^= h >> 33;
+	return h != 0 ? h : 1;
+}
+
+/*
+ * astr_hash
+ *
+ * Get the hash of the string in an astr instance.
+ *
+ * The hash is kept in the astr instance once it has been calculated, until
+ * the string changes, so a key that is looked up again and again is only
+ * hashed once.
+ *
+ * Threads that only read the string may call this at the same time; the
+ * hash is stored atomically, and each thread stores the same hash.
+ *
+ * Parameter: The astr instance
+ * Returns:   The hash, the same as astr_hash_buffer of the string
+ */
+uint64_t astr_hash(astr *as) {
+	uint64_t hash;
+	if (as == NULL || as->string == NULL) {
+		return astr_hash_buffer("", 0);
+	}
+	hash = __atomic_load_n(&as->hash, __ATOMIC_RELAXED);
+	if (hash == 0) {
+		hash = astr_hash_buffer(as->string, as->length);
+		__atomic_store_n(&as->hash, hash, __ATOMIC_RELAXED);
+	}
+	return hash;
+}
@@ -12,10 +12,22 @@
 
 #include "astr.h"
 
+#define ASTR_CASE_UPPER 1
+#define ASTR_CASE_LOWER 2
+#define ASTR_CASE_MIXED 3
+
+#define ASTR_EDIT_CASE (ASTR_EDIT_UPPER_CASE | ASTR_EDIT_LOWER_CASE | ASTR_EDIT_MIXED_CASE)
+
+static astr *astr_edit_utf8_case(astr *as, int from, int mode, int last);
+static astr *astr_edit_pass(astr *as, int operations, const astr_edit_program *program);
+static int astr_edit_is_ascii(const char *s, int length);
+
 /*
  * astr_to_upper_case
  *
  * Convert all of the characters in the astr string to upper case.
+ * ASCII characters are converted in place; from the first character outside
+ * ASCII on, the string is converted as UTF-8.
  *
  * Parameter: The astr instance to be edited
  * Returns:   Pointer to the astr instance
@@ -24,6 +36,10 @@ astr *astr_to_upper_case(astr *as) {
 	int i;
 	if (as != NULL && as->string != NULL && as->length > 0) {
 		for (i = 0; i < as->length && (as->string)[i] != '\0'; i++) {
+			if ((as->string)[i] & 0x80) {
+				as = astr_edit_utf8_case(as, i, ASTR_CASE_UPPER, ' ');
+				break;
+			}
 			(as->string)[i] = toupper((as->string)[i]);
 		}
 		astr_update(as);
@@ -35,6 +51,8 @@ astr *astr_to_upper_case(astr *as) {
  * astr_to_lower_case
  *
  * Convert all of the characters in the astr string to lower case.
+ * ASCII characters are converted in place; from the first character outside
+ * ASCII on, the string is converted as UTF-8.
  *
  * Parameter: The astr instance to be edited
  * Returns:   Pointer to the astr instance
@@ -43,6 +61,10 @@ astr *astr_to_lower_case(astr *as) {
 	int i;
 	if (as != NULL && as->string != NULL && as->length > 0) {
 		for (i = 0; i < as->length && (as->string)[i] != '\0'; i++) {
+			if ((as->string)[i] & 0x80) {
+				as = astr_edit_utf8_case(as, i, ASTR_CASE_LOWER, ' ');
+				break;
+			}
 			(as->string)[i] = tolower((as->string)[i]);
 		}
 		astr_update(as);
@@ -57,7 +79,8 @@ astr *astr_to_lower_case(astr *as) {
  * The initial letter of each word will be upper case,
  * the rest of the characters in each word will be lower case.
  * A word is considered to be a series of characters where each character
- * satisfies the standard isalnum() test;
+ * satisfies the standard isalnum() test, or is an alphanumeric code point
+ * once the string is outside ASCII;
  *
  * Parameter: The astr instance to be edited
  * Returns:   Pointer to the astr instance
@@ -67,6 +90,10 @@ astr *astr_to_mixed_case(astr *as) {
 	char last = ' ';
 	if (as != NULL && as->string != NULL && as->length > 0) {
 		for (i = 0; i < as->length && (as->string)[i] != '\0'; i++) {
+			if ((as->string)[i] & 0x80) {
+				as = astr_edit_utf8_case(as, i, ASTR_CASE_MIXED, last);
+				break;
+			}
 			if(islower((as->string)[i]) && !isalnum(last)) {
 				(as->string)[i] = toupper((as->string)[i]);
 			}
@@ -85,31 +112,36 @@ astr *astr_to_mixed_case(astr *as) {
  *
  * Trim the left (leading) spaces of the astr string.
  *
+ * The characters are not moved.  The string pointer is moved past the leading
+ * spaces inside the storage, and the checksum and length are adjusted for just
+ * the characters that were trimmed, so the cost depends on the number of
+ * spaces trimmed and not on the length of the string.
+ *
  * Parameter: The astr instance to be edited
  * Returns:   Pointer to the astr instance
  */
 astr *astr_left_trim(astr *as) {
-	char *d;
 	char *s;
 	char *end;
 	if (as != NULL && as->string != NULL && as->length > 0) {
-		d = s = as->string;
+		s = as->string;
 		end = as->string + as->length;
-		while(s < end && isspace(*s)) {
+		while(s < end && isspace((unsigned char)*s)) {
+			as->checksum -= *s;
 			s++;
 		}
-		if (d < s) {
-			as->length -= (s - d);
-			while(s < end && *s != '\0' ) {
-				*d++ = *s++;
+		if (s > as->string) {
+			if (as->codepoint_length > 0) {
+				// The spaces are ASCII, one code point each.
+				as->codepoint_length -= (s - as->string);
 			}
-			while (d < end) {
-				*d++ = '\0';
+			as->length -= (s - as->string);
+			as->string = s;
+			as->hash = 0;
+			if (as->tokenend != NULL && as->tokenend < s) {
+				as->tokenend = s;
 			}
 		}
-		if(s > as->string) {
-			astr_update(as);
-		}
 	}
 	return as;
 }
@@ -125,20 +157,29 @@ astr *astr_left_trim(astr *as) {
 astr *astr_right_trim(astr *as) {
 	char *s;
 	char *beg;
-	char *end;
+	int stale = 0;
 	if (as != NULL && as->string != NULL && as->length > 0) {
 		s = as->string + as->length - 1;
 		beg = as->string;
-		end = as->string + as->length;
 		while(s >= beg && *s == '\0') {
+			stale = 1;
 			s--;
 		}
-		while(s >= beg && isspace(*s)) {
+		while(s >= beg && isspace((unsigned char)*s)) {
+			as->checksum -= *s;
 			*s-- = '\0';
 		}
-		if (s < (end - 1)) {
+		if (stale) {
+			// The length did not match the string, recalculate everything.
 			astr_update(as);
 		}
+		else {
+			if (as->codepoint_length > 0) {
+				as->codepoint_length -= as->length - ((s + 1) - beg);
+			}
+			as->length = (s + 1) - beg;
+			as->hash = 0;
+		}
 	}
 	return as;
 }
@@ -184,7 +225,7 @@ astr *astr_pack(astr *as) {
 			}
 		}
 		*d = '\0';
-		if (s < (end - 1)) {
+		if (d < s) {
 			astr_update(as);
 		}
 	}
@@ -195,13 +236,72 @@ astr *astr_pack(astr *as) {
  * astr_clean
  *
  * Trim and pack the spaces in the astr string.
+ * The trim and the pack are done together in one pass over the string.
  *
  * Parameter: The astr instance to be edited
  * Returns:   Pointer to the astr instance
  */
 astr *astr_clean(astr *as) {
-	as = astr_trim(as);
-	as = astr_pack(as);
+	return astr_edit_pass(as, ASTR_EDIT_CLEAN, NULL);
+}
+
+/*
+ * astr_remove_left
+ *
+ * Remove characters from the left side of the astr string.
+ *
+ * Like astr_left_trim, the characters are not moved; the string pointer is
+ * moved forward inside the storage.
+ *
+ * Parameter: The astr instance to be edited
+ * Parameter: The number of characters to remove, limited to the length
+ * Returns:   Pointer to the astr instance
+ */
+astr *astr_remove_left(astr *as, const int count) {
+	char *s;
+	char *end;
+	if (as != NULL && as->string != NULL && as->length > 0 && count > 0) {
+		s = as->string;
+		end = as->string + (count < as->length ? count : as->length);
+		if (as->codepoint_length >= 0) {
+			if (as->codepoint_length == as->length) {
+				as->codepoint_length -= (end - s);
+			}
+			else {
+				as->codepoint_length -= astr_utf8_count(s, end - s);
+			}
+		}
+		while (s < end) {
+			as->checksum -= *s++;
+		}
+		as->length -= (s - as->string);
+		as->string = s;
+		as->hash = 0;
+		if (as->tokenend != NULL && as->tokenend < s) {
+			as->tokenend = s;
+		}
+	}
+	return as;
+}
+
+/*
+ * astr_remove_prefix
+ *
+ * Remove a prefix from the left side of the astr string, if the string starts
+ * with the prefix.  The string is unchanged if it does not.
+ *
+ * Parameter: The astr instance to be edited
+ * Parameter: The null-terminated prefix to remove
+ * Returns:   Pointer to the astr instance
+ */
+astr *astr_remove_prefix(astr *as, const char *prefix) {
+	size_t prefix_length;
+	if (as != NULL && as->string != NULL && prefix != NULL) {
+		prefix_length = strlen(prefix);
+		if (prefix_length > 0 && prefix_length <= as->length && memcmp(as->string, prefix, prefix_length) == 0) {
+			as = astr_remove_left(as, prefix_length);
+		}
+	}
 	return as;
 }
 
@@ -244,13 +344,21 @@ astr *astr_not_empty_char(astr *as, const char sole) {
  *
  * Reverse the characters in an astr string.
  *
+ * A string of valid UTF-8 is reversed by code point: the bytes are reversed,
+ * then the bytes of each multibyte sequence, which are now backwards, are put
+ * back in order.  Any other string is reversed byte by byte.
+ *
  * Parameter: The astr instance to be edited
  * Returns:   Pointer to the astr instance
  */
 astr *astr_reverse(astr *as) {
 	char *b, *e;
+	char *s, *end;
 	char x;
+	int utf8;
 	if (as != NULL && as->length > 1) {
+		utf8 = (astr_codepoint_length(as) != as->length && astr_is_utf8(as));
+
 		b = as->string;
 		e = as->string + as->length - 1;
 		while (b < e) {
@@ -260,6 +368,392 @@ astr *astr_reverse(astr *as) {
 			b++;
 			e--;
 		}
+
+		if (utf8) {
+			s = as->string;
+			end = as->string + as->length;
+			while (s < end) {
+				if ((*s & 0xC0) != 0x80) {
+					s++;
+					continue;
+				}
+				// Continuation bytes, then the lead byte of the sequence.
+				b = s;
+				while ((*s & 0xC0) == 0x80) {
+					s++;
+				}
+				e = s++;
+				while (b < e) {
+					x = *b;
+					*b = *e;
+					*e = x;
+					b++;
+					e--;
+				}
+			}
+		}
+		as->hash = 0;
+	}
+	return as;
+}
+
+/*
+ * astr_edit_utf8_case
+ *
+ * Convert the case of the astr string as UTF-8, starting from a byte offset.
+ * The characters before the offset have already been converted.  Bytes that
+ * are not valid UTF-8 are copied unchanged.  Some code points have upper and
+ * lower case forms of different lengths, so the converted string is built in
+ * a separate buffer and copied back.
+ *
+ * Parameter: The astr instance to be edited
+ * Parameter: The byte offset to start converting from
+ * Parameter: ASTR_CASE_UPPER, ASTR_CASE_LOWER, or ASTR_CASE_MIXED
+ * Parameter: The code point before the offset, for ASTR_CASE_MIXED
+ * Returns:   Pointer to the astr instance
+ */
+static astr *astr_edit_utf8_case(astr *as, int from, int mode, int last) {
+	const char *s;
+	const char *end;
+	char *buffer;
+	char *d;
+	int codepoint;
+	int n;
+
+	// A two-byte sequence can map to a three-byte one, so allow half again.
+	buffer = (char *)malloc(from + ((as->length - from) / 2) * 3 + 4);
+	if (buffer == NULL) {
+		return as;
+	}
+
+	memcpy(buffer, as->string, from);
+	d = buffer + from;
+	s = as->string + from;
+	end = as->string + as->length;
+	while (s < end && *s != '\0') {
+		n = astr_utf8_decode(s, end - s, &codepoint);
+		if (n <= 0) {
+			*d++ = *s++;
+			last = ' ';
+			continue;
+		}
+
+		if (mode == ASTR_CASE_UPPER) {
+			codepoint = astr_codepoint_to_upper(codepoint);
+		}
+		else if (mode == ASTR_CASE_LOWER) {
+			codepoint = astr_codepoint_to_lower(codepoint);
+		}
+		else if (astr_codepoint_is_alnum(last)) {
+			codepoint = astr_codepoint_to_lower(codepoint);
+		}
+		else {
+			codepoint = astr_codepoint_to_upper(codepoint);
+		}
+
+		d += astr_utf8_encode(codepoint, d);
+		s += n;
+		last = codepoint;
+	}
+
+	if (d - buffer == as->length) {
+		memcpy(as->string, buffer, as->length);
+	}
+	else {
+		as = astr_set_from_buffer(as, buffer, d - buffer);
+	}
+	free(buffer);
+
+	return as;
+}
+
+/*
+ * astr_edit_program_create
+ *
+ * Create an edit program with the specified operations.
+ * ASTR_EDIT_DELETE and ASTR_EDIT_SQUEEZE need a set of characters, and
+ * ASTR_EDIT_NOT_EMPTY can use a sole character other than space; use the
+ * astr_edit_program_set_ functions to add those operations.
+ *
+ * Parameter: The ASTR_EDIT_* operations, or'ed together
+ * Returns:   Pointer to the edit program
+ */
+astr_edit_program *astr_edit_program_create(int operations) {
+	astr_edit_program *program = (astr_edit_program *)calloc(1, sizeof(astr_edit_program));
+	if (program != NULL) {
+		program->operations = operations & ~(ASTR_EDIT_DELETE | ASTR_EDIT_SQUEEZE);
+		program->sole = ' ';
+	}
+	return program;
+}
+
+/*
+ * astr_edit_program_set_delete
+ *
+ * Add the delete operation to an edit program.
+ * Every occurrence of the specified characters is removed from the string.
+ *
+ * Parameter: The edit program
+ * Parameter: The null-terminated string of characters to delete
+ * Returns:   Pointer to the edit program
+ */
+astr_edit_program *astr_edit_program_set_delete(astr_edit_program *program, const char *chars) {
+	const unsigned char *c;
+	if (program != NULL && chars != NULL) {
+		memset(program->delete_set, 0, sizeof(program->delete_set));
+		for (c = (const unsigned char *)chars; *c != '\0'; c++) {
+			program->delete_set[*c] = 1;
+		}
+		program->operations |= ASTR_EDIT_DELETE;
+	}
+	return program;
+}
+
+/*
+ * astr_edit_program_set_squeeze
+ *
+ * Add the squeeze operation to an edit program.
+ * Each run of a repeated character from the specified characters is replaced
+ * with a single occurrence of that character, like tr -s.
+ *
+ * Parameter: The edit program
+ * Parameter: The null-terminated string of characters to squeeze
+ * Returns:   Pointer to the edit program
+ */
+astr_edit_program *astr_edit_program_set_squeeze(astr_edit_program *program, const char *chars) {
+	const unsigned char *c;
+	if (program != NULL && chars != NULL) {
+		memset(program->squeeze_set, 0, sizeof(program->squeeze_set));
+		for (c = (const unsigned char *)chars; *c != '\0'; c++) {
+			program->squeeze_set[*c] = 1;
+		}
+		program->operations |= ASTR_EDIT_SQUEEZE;
+	}
+	return program;
+}
+
+/*
+ * astr_edit_program_set_not_empty_char
+ *
+ * Add the not-empty operation to an edit program.
+ * If the edited string is empty, it is replaced with the sole character.
+ *
+ * Parameter: The edit program
+ * Parameter: The character to use as the sole character if necessary
+ * Returns:   Pointer to the edit program
+ */
+astr_edit_program *astr_edit_program_set_not_empty_char(astr_edit_program *program, const char sole) {
+	if (program != NULL) {
+		program->sole = sole;
+		program->operations |= ASTR_EDIT_NOT_EMPTY;
+	}
+	return program;
+}
+
+/*
+ * astr_edit_program_free
+ *
+ * Free an edit program.
+ *
+ * Parameter: The edit program
+ * Returns:   NULL pointer
+ */
+astr_edit_program *astr_edit_program_free(astr_edit_program *program) {
+	if (program != NULL) {
+		free(program);
+	}
+	return NULL;
+}
+
+/*
+ * astr_edit
+ *
+ * Run an edit program over the astr string.
+ * All of the operations in the program are done in one pass over the string,
+ * except a change of case of a string that is not all ASCII, which is done
+ * by the UTF-8 aware case conversion as a pass of its own.
+ *
+ * Parameter: The astr instance to be edited
+ * Parameter: The edit program
+ * Returns:   Pointer to the astr instance
+ */
+astr *astr_edit(astr *as, const astr_edit_program *program) {
+	if (program != NULL) {
+		as = astr_edit_pass(as, program->operations, program);
+	}
+	return as;
+}
+
+/*
+ * astr_edit_pass
+ *
+ * Apply the edit operations to the astr string in a single pass.
+ *
+ * Each character is read once and written at most once.  The checksum and
+ * length are accumulated as the characters are written, and a snapshot of
+ * them is kept at the last non-space character so a right trim is just a
+ * truncation at the end of the pass.  Every decision (pack, squeeze, mixed
+ * case) is made against the last character written, so the operations see
+ * the output of the operations that come before them.
+ *
+ * Changing the case of a code point outside ASCII can change its length, so
+ * a string that is not all ASCII cannot have its case changed in place.  For
+ * that string, the characters are deleted first, the case is changed by
+ * astr_edit_utf8_case, as the astr_to_*_case functions change it, and then
+ * the rest of the operations are done.  The result is the same as the single
+ * pass: the case is changed after the delete and before the squeeze, and the
+ * operations after it do not change whether the last character written is
+ * alphanumeric.
+ *
+ * Parameter: The astr instance to be edited
+ * Parameter: The ASTR_EDIT_* operations
+ * Parameter: The edit program holding the character sets, or NULL if the
+ *            operations need none
+ * Returns:   Pointer to the astr instance
+ */
+static astr *astr_edit_pass(astr *as, int operations, const astr_edit_program *program) {
+	unsigned char *start;
+	unsigned char *s;
+	unsigned char *d;
+	unsigned char *end;
+	unsigned char c;
+	unsigned char high = 0;
+	int last = -1;
+	int leading = 1;
+	int checksum = 0;
+	int kept_length = 0;
+	int kept_checksum = 0;
+	int length;
+	int mode;
+
+	if (as == NULL) {
+		return as;
+	}
+
+	if (program == NULL) {
+		operations &= ~(ASTR_EDIT_DELETE | ASTR_EDIT_SQUEEZE | ASTR_EDIT_NOT_EMPTY);
+	}
+
+	if ((operations & ASTR_EDIT_CASE) && as->string != NULL && !astr_edit_is_ascii(as->string, as->length)) {
+		if (operations & ASTR_EDIT_DELETE) {
+			as = astr_edit_pass(as, ASTR_EDIT_DELETE, program);
+		}
+		if (operations & ASTR_EDIT_UPPER_CASE) {
+			mode = ASTR_CASE_UPPER;
+		}
+		else if (operations & ASTR_EDIT_LOWER_CASE) {
+			mode = ASTR_CASE_LOWER;
+		}
+		else {
+			mode = ASTR_CASE_MIXED;
+		}
+		if (as->string != NULL && as->length > 0) {
+			as = astr_edit_utf8_case(as, 0, mode, ' ');
+		}
+		return astr_edit_pass(as, operations & ~(ASTR_EDIT_DELETE | ASTR_EDIT_CASE), program);
+	}
+
+	if ((operations & ASTR_EDIT_LEFT_TRIM) && !(operations & ASTR_EDIT_DELETE)) {
+		// Nothing ahead of the leading spaces can be deleted, so skip them by
+		// moving the string pointer instead of copying the rest of the string.
+		as = astr_left_trim(as);
+	}
+
+	if (as->string != NULL && as->length > 0) {
+		start = s = d = (unsigned char *)as->string;
+		end = start + as->length;
+		while (s < end && *s != '\0') {
+			c = *s++;
+
+			if ((operations & ASTR_EDIT_DELETE) && program->delete_set[c]) {
+				continue;
+			}
+
+			if (operations & ASTR_EDIT_UPPER_CASE) {
+				c = toupper(c);
+			}
+			else if (operations & ASTR_EDIT_LOWER_CASE) {
+				c = tolower(c);
+			}
+			else if (operations & ASTR_EDIT_MIXED_CASE) {
+				if (islower(c) && (last < 0 || !isalnum(last))) {
+					c = toupper(c);
+				}
+				else if (isupper(c) && last >= 0 && isalnum(last)) {
+					c = tolower(c);
+				}
+			}
+
+			if ((operations & ASTR_EDIT_SQUEEZE) && c == last && program->squeeze_set[c]) {
+				continue;
+			}
+
+			if (isspace(c)) {
+				if ((operations & ASTR_EDIT_LEFT_TRIM) && leading) {
+					continue;
+				}
+				if ((operations & ASTR_EDIT_PACK) && last >= 0 && isspace(last)) {
+					continue;
+				}
+			}
+
+			*d++ = c;
+			checksum += (char)c;
+			high |= c;
+			last = c;
+
+			if (!isspace(c)) {
+				leading = 0;
+				kept_length = d - start;
+				kept_checksum = checksum;
+			}
+		}
+
+		length = d - start;
+		if (operations & ASTR_EDIT_RIGHT_TRIM) {
+			length = kept_length;
+			checksum = kept_checksum;
+		}
+
+		if (length < as->length) {
+			memset(start + length, '\0', as->length - length);
+		}
+		as->length = length;
+		as->checksum = checksum;
+		// A string written all in ASCII has a code point for each byte.
+		as->codepoint_length = ((high & 0x80) == 0 ? length : -1);
+		as->hash = 0;
+	}
+
+	if ((operations & ASTR_EDIT_NOT_EMPTY) && (as->string == NULL || as->length <= 0)) {
+		as = astr_not_empty_char(as, program->sole);
 	}
+
 	return as;
 }
+
+/*
+ * astr_edit_is_ascii
+ *
+ * Determine if a buffer holds only ASCII, checking eight bytes at a time.
+ *
+ * Parameter: The buffer
+ * Parameter: The length of the buffer
+ * Returns:   1 if every byte is ASCII, 0 if not
+ */
+static int astr_edit_is_ascii(const char *s, int length) {
+	unsigned long long block;
+	unsigned char high = 0;
+	int i;
+
+	for (i = 0; i + 8 <= length; i += 8) {
+		memcpy(&block, s + i, 8);
+		if (block & 0x8080808080808080ULL) {
+			return 0;
+		}
+	}
+	for (; i < length; i++) {
+		high |= s[i];
+	}
+	return (high & 0x80) == 0;
+}
@@ -0,0 +1,540 @@
+// astr_map.c - Adept String Map
+
+/*
+ * An open-addressing hash map with string keys, laid out like a SwissTable.
+ *
+ * The slots are probed a group of 16 at a time.  The first group comes from
+ * the high bits of the hash, and the next groups follow a triangular
+ * sequence, which visits every group because the number of groups is a power
+ * of two.  In each group the control bytes are compared with the low seven
+ * bits of the hash; only the slots that match have their keys compared.  A
+ * group with an empty slot ends the probe, because the key would have been
+ * put there.
+ *
+ * A removed key leaves a deleted marker, unless its group still has an empty
+ * slot, in which case no probe could have passed through the group and the
+ * slot is simply emptied.  The table is rebuilt when the keys and deleted
+ * markers fill seven eighths of it.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include "astr.h"
+#include "astr_map.h"
+
+#define ASTR_MAP_EMPTY ((signed char)-128)
+#define ASTR_MAP_DELETED ((signed char)-2)
+#define ASTR_MAP_GROUP_SIZE 16
+#define ASTR_MAP_ARENA_BLOCK_SIZE 65536
+#define ASTR_MAP_NOT_FOUND ((size_t)-1)
+
+/*
+ * astr_map_h1
+ *
+ * The part of a hash that picks the first group to probe.
+ */
+static size_t astr_map_h1(uint64_t hash) {
+	return (size_t)(hash >> 7);
+}
+
+/*
+ * astr_map_h2
+ *
+ * The part of a hash that is kept in the control byte of a slot.
+ */
+static signed char astr_map_h2(uint64_t hash) {
+	return (signed char)(hash & 0x7F);
+}
+
+/*
+ * astr_map_match
+ *
+ * Find the control bytes in a group that equal a value.
+ *
+ * Returns:   A mask with one bit for each matching slot in the group
+ */
+static unsigned int astr_map_match(const signed char *group, signed char value) {
+#if defined(__SSE2__)
+	__m128i control = _mm_loadu_si128((const __m128i *)group);
+	return (unsigned int)_mm_movemask_epi8(_mm_cmpeq_epi8(control, _mm_set1_epi8(value)));
+#else
+	unsigned int mask = 0;
+	int i;
+	for (i = 0; i < ASTR_MAP_GROUP_SIZE; i++) {
+		if (group[i] == value) {
+			mask |= 1U << i;
+		}
+	}
+	return mask;
+#endif
+}
+
+/*
+ * astr_map_match_free
+ *
+ * Find the empty and deleted slots in a group.  Both have the high bit of the
+ * control byte set, and full slots do not.
+ *
+ * Returns:   A mask with one bit for each free slot in the group
+ */
+static unsigned int astr_map_match_free(const signed char *group) {
+#if defined(__SSE2__)
+	return (unsigned int)_mm_movemask_epi8(_mm_loadu_si128((const __m128i *)group));
+#else
+	unsigned int mask = 0;
+	int i;
+	for (i = 0; i < ASTR_MAP_GROUP_SIZE; i++) {
+		if (group[i] < 0) {
+			mask |= 1U << i;
+		}
+	}
+	return mask;
+#endif
+}
+
+/*
+ * astr_map_find
+ *
+ * Find the slot that holds a key.
+ *
+ * Returns:   The index of the slot, or ASTR_MAP_NOT_FOUND
+ */
+static size_t astr_map_find(const astr_map *map, const char *key, int key_length, uint64_t hash) {
+	size_t mask = map->capacity / ASTR_MAP_GROUP_SIZE - 1;
+	size_t group = astr_map_h1(hash) & mask;
+	size_t step = 0;
+	size_t base;
+	size_t index;
+	unsigned int matches;
+	const astr_map_slot *slot;
+
+	while (step <= mask) {
+		base = group * ASTR_MAP_GROUP_SIZE;
+		matches = astr_map_match(map->control + base, astr_map_h2(hash));
+		while (matches != 0) {
+			index = base + __builtin_ctz(matches);
+			slot = &map->slots[index];
+			if (slot->hash == hash && slot->key_length == key_length && memcmp(slot->key, key, key_length) == 0) {
+				return index;
+			}
+			matches &= matches - 1;
+		}
+		if (astr_map_match(map->control + base, ASTR_MAP_EMPTY) != 0) {
+			break;
+		}
+		step++;
+		group = (group + step) & mask;
+	}
+	return ASTR_MAP_NOT_FOUND;
+}
+
+/*
+ * astr_map_find_free
+ *
+ * Find the first empty or deleted slot on the probe sequence of a hash.
+ * There is always one, because the table is never allowed to fill.
+ *
+ * Returns:   The index of the slot
+ */
+static size_t astr_map_find_free(const astr_map *map, uint64_t hash) {
+	size_t mask = map->capacity / ASTR_MAP_GROUP_SIZE - 1;
+	size_t group = astr_map_h1(hash) & mask;
+	size_t step = 0;
+	size_t base;
+	unsigned int matches;
+
+	for (;;) {
+		base = group * ASTR_MAP_GROUP_SIZE;
+		matches = astr_map_match_free(map->control + base);
+		if (matches != 0) {
+			return base + __builtin_ctz(matches);
+		}
+		step++;
+		group = (group + step) & mask;
+	}
+}
+
+/*
+ * astr_map_resize
+ *
+ * Rebuild the table with a new number of slots, dropping the deleted markers.
+ * The keys stay where they are in the arena.
+ *
+ * Returns:   0 = success, -1 if the table could not be allocated
+ */
+static int astr_map_resize(astr_map *map, size_t capacity) {
+	signed char *old_control = map->control;
+	astr_map_slot *old_slots = map->slots;
+	size_t old_capacity = map->capacity;
+	size_t index;
+	size_t i;
+
+	map->control = (signed char *)malloc(capacity);
+	map->slots = (astr_map_slot *)malloc(capacity * sizeof(astr_map_slot));
+	if (map->control == NULL || map->slots == NULL) {
+		free(map->control);
+		free(map->slots);
+		map->control = old_control;
+		map->slots = old_slots;
+		return -1;
+	}
+	memset(map->control, ASTR_MAP_EMPTY, capacity);
+	map->capacity = capacity;
+	map->deleted = 0;
+
+	for (i = 0; i < old_capacity; i++) {
+		if (old_control[i] >= 0) {
+			index = astr_map_find_free(map, old_slots[i].hash);
+			map->control[index] = old_control[i];
+			map->slots[index] = old_slots[i];
+		}
+	}
+	free(old_control);
+	free(old_slots);
+	return 0;
+}
+
+/*
+ * astr_map_copy_key
+ *
+ * Copy a key into the arena of the map, null-terminated.
+ *
+ * Returns:   The copy, or NULL if a block could not be allocated
+ */
+static const char *astr_map_copy_key(astr_map *map, const char *key, int key_length) {
+	astr_map_arena *block = map->arena;
+	size_t size;
+	char *copy;
+
+	if (block == NULL || block->size - block->used < (size_t)key_length + 1) {
+		size = ((size_t)key_length + 1 > ASTR_MAP_ARENA_BLOCK_SIZE ? (size_t)key_length + 1 : ASTR_MAP_ARENA_BLOCK_SIZE);
+		block = (astr_map_arena *)malloc(sizeof(astr_map_arena) + size);
+		if (block == NULL) {
+			return NULL;
+		}
+		block->next = map->arena;
+		block->used = 0;
+		block->size = size;
+		map->arena = block;
+	}
+
+	copy = block->bytes + block->used;
+	memcpy(copy, key, key_length);
+	copy[key_length] = '\0';
+	block->used += key_length + 1;
+	return copy;
+}
+
+/*
+ * astr_map_insert
+ *
+ * Find the slot for a key, adding the key with a NULL value if it is not in
+ * the map.
+ *
+ * Returns:   The index of the slot, or ASTR_MAP_NOT_FOUND if memory could
+ *            not be allocated
+ */
+static size_t astr_map_insert(astr_map *map, const char *key, int key_length, uint64_t hash, int *added) {
+	size_t index;
+	const char *copy;
+
+	*added = 0;
+	index = astr_map_find(map, key, key_length, hash);
+	if (index != ASTR_MAP_NOT_FOUND) {
+		return index;
+	}
+
+	if ((map->size + map->deleted + 1) * 8 > map->capacity * 7) {
+		// Grow if the keys fill much of the table, or just clear out the deleted markers.
+		if (astr_map_resize(map, (map->size + 1) * 16 > map->capacity * 7 ? map->capacity * 2 : map->capacity) != 0) {
+			return ASTR_MAP_NOT_FOUND;
+		}
+	}
+
+	copy = astr_map_copy_key(map, key, key_length);
+	if (copy == NULL) {
+		return ASTR_MAP_NOT_FOUND;
+	}
+
+	index = astr_map_find_free(map, hash);
+	if (map->control[index] == ASTR_MAP_DELETED) {
+		map->deleted--;
+	}
+	map->control[index] = astr_map_h2(hash);
+	map->slots[index].key = copy;
+	map->slots[index].key_length = key_length;
+	map->slots[index].hash = hash;
+	map->slots[index].value = NULL;
+	map->size++;
+	*added = 1;
+	return index;
+}
+
+/*
+ * astr_map_create
+ *
+ * Create a map with room for a number of keys before it has to grow.
+ *
+ * Parameter: The expected number of keys, or 0 for a default
+ * Returns:   Pointer to the map, or NULL if it could not be allocated
+ */
+astr_map *astr_map_create(const size_t capacity) {
+	astr_map *map;
+	size_t slots = ASTR_MAP_GROUP_SIZE;
+
+	while (slots * 7 / 8 < capacity) {
+		slots *= 2;
+	}
+
+	map = (astr_map *)calloc(1, sizeof(astr_map));
+	if (map != NULL) {
+		map->control = (signed char *)malloc(slots);
+		map->slots = (astr_map_slot *)malloc(slots * sizeof(astr_map_slot));
+		if (map->control == NULL || map->slots == NULL) {
+			free(map->control);
+			free(map->slots);
+			free(map);
+			return NULL;
+		}
+		memset(map->control, ASTR_MAP_EMPTY, slots);
+		map->capacity = slots;
+	}
+	return map;
+}
+
+/*
+ * astr_map_free
+ *
+ * Free a map and the arena holding its keys.
+ * The values are not freed.
+ *
+ * Parameter: The map
+ * Returns:   NULL pointer
+ */
+astr_map *astr_map_free(astr_map *map) {
+	astr_map_arena *block;
+	astr_map_arena *next;
+
+	if (map != NULL) {
+		for (block = map->arena; block != NULL; block = next) {
+			next = block->next;
+			free(block);
+		}
+		free(map->control);
+		free(map->slots);
+		free(map);
+	}
+	return NULL;
+}
+
+/*
+ * astr_map_size
+ *
+ * Get the number of keys in a map.
+ *
+ * Parameter: The map
+ * Returns:   The number of keys
+ */
+size_t astr_map_size(const astr_map *map) {
+	return map == NULL ? 0 : map->size;
+}
+
+/*
+ * astr_map_get
+ *
+ * Get the value for a key.
+ * The key is hashed once; the hash is kept in the astr instance for the next
+ * lookup.
+ *
+ * Parameter: The map
+ * Parameter: The key
+ * Returns:   The value, or NULL if the key is not in the map
+ */
+void *astr_map_get(const astr_map *map, astr *key) {
+	size_t index;
+	if (map == NULL || key == NULL || key->string == NULL) {
+		return NULL;
+	}
+	index = astr_map_find(map, key->string, key->length, astr_hash(key));
+	return index == ASTR_MAP_NOT_FOUND ? NULL : map->slots[index].value;
+}
+
+/*
+ * astr_map_get_view
+ *
+ * Get the value for a key in a view.
+ * Nothing is allocated, so a line can be looked up without copying it.
+ *
+ * Parameter: The map
+ * Parameter: The key
+ * Returns:   The value, or NULL if the key is not in the map
+ */
+void *astr_map_get_view(const astr_map *map, astr_view key) {
+	size_t index;
+	if (map == NULL || key.string == NULL) {
+		return NULL;
+	}
+	index = astr_map_find(map, key.string, key.length, astr_hash_buffer(key.string, key.length));
+	return index == ASTR_MAP_NOT_FOUND ? NULL : map->slots[index].value;
+}
+
+/*
+ * astr_map_contains_view
+ *
+ * Determine if a map has a key in a view, whatever its value.
+ *
+ * Parameter: The map
+ * Parameter: The key
+ * Returns:   1 if the key is in the map, 0 if not
+ */
+int astr_map_contains_view(const astr_map *map, astr_view key) {
+	if (map == NULL || key.string == NULL) {
+		return 0;
+	}
+	return astr_map_find(map, key.string, key.length, astr_hash_buffer(key.string, key.length)) != ASTR_MAP_NOT_FOUND;
+}
+
+/*
+ * astr_map_put
+ *
+ * Set the value for a key, adding the key if it is not in the map.
+ * The key is copied into the map.
+ *
+ * Parameter: The map
+ * Parameter: The key
+ * Parameter: The value
+ * Returns:   1 if the key was added, 0 if its value was replaced,
+ *            -1 if memory could not be allocated
+ */
+int astr_map_put(astr_map *map, astr *key, void *value) {
+	size_t index;
+	int added;
+	if (map == NULL || key == NULL || key->string == NULL) {
+		return -1;
+	}
+	index = astr_map_insert(map, key->string, key->length, astr_hash(key), &added);
+	if (index == ASTR_MAP_NOT_FOUND) {
+		return -1;
+	}
+	map->slots[index].value = value;
+	return added;
+}
+
+/*
+ * astr_map_put_view
+ *
+ * Set the value for a key in a view, adding the key if it is not in the map.
+ * The key is copied into the map.
+ *
+ * Parameter: The map
+ * Parameter: The key
+ * Parameter: The value
+ * Returns:   1 if the key was added, 0 if its value was replaced,
+ *            -1 if memory could not be allocated
+ */
+int astr_map_put_view(astr_map *map, astr_view key, void *value) {
+	size_t index;
+	int added;
+	if (map == NULL || key.string == NULL) {
+		return -1;
+	}
+	index = astr_map_insert(map, key.string, key.length, astr_hash_buffer(key.string, key.length), &added);
+	if (index == ASTR_MAP_NOT_FOUND) {
+		return -1;
+	}
+	map->slots[index].value = value;
+	return added;
+}
+
+/*
+ * astr_map_value_view
+ *
+ * Get the address of the value for a key in a view, adding the key with a
+ * NULL value if it is not in the map.  This finds or adds a key with one
+ * probe, as a group-by does for every line.
+ *
+ * The address is good until the next key is added to the map.
+ *
+ * Parameter: The map
+ * Parameter: The key
+ * Returns:   The address of the value, or NULL if memory could not be allocated
+ */
+void **astr_map_value_view(astr_map *map, astr_view key) {
+	size_t index;
+	int added;
+	if (map == NULL || key.string == NULL) {
+		return NULL;
+	}
+	index = astr_map_insert(map, key.string, key.length, astr_hash_buffer(key.string, key.length), &added);
+	return index == ASTR_MAP_NOT_FOUND ? NULL : &map->slots[index].value;
+}
+
+/*
+ * astr_map_remove_view
+ *
+ * Remove a key in a view from a map.
+ * The copy of the key stays in the arena until the map is freed.
+ *
+ * Parameter: The map
+ * Parameter: The key
+ * Returns:   1 if the key was removed, 0 if it was not in the map
+ */
+int astr_map_remove_view(astr_map *map, astr_view key) {
+	size_t index;
+	if (map == NULL || key.string == NULL) {
+		return 0;
+	}
+	index = astr_map_find(map, key.string, key.length, astr_hash_buffer(key.string, key.length));
+	if (index == ASTR_MAP_NOT_FOUND) {
+		return 0;
+	}
+
+	if (astr_map_match(map->control + (index & ~(size_t)(ASTR_MAP_GROUP_SIZE - 1)), ASTR_MAP_EMPTY) != 0) {
+		map->control[index] = ASTR_MAP_EMPTY;
+	}
+	else {
+		map->control[index] = ASTR_MAP_DELETED;
+		map->deleted++;
+	}
+	map->size--;
+	return 1;
+}
+
+/*
+ * astr_map_next
+ *
+ * Step through the keys and values of a map, in no particular order.
+ * Start with the position at 0.  The map must not be changed while it is
+ * being stepped through.
+ *
+ * Parameter: The map
+ * Parameter: Pointer to the position, updated for the next call
+ * Parameter: Pointer to the key, set to a view of the key in the map
+ * Parameter: Pointer to the value
+ * Returns:   1 if there was another key, 0 at the end of the map
+ */
+int astr_map_next(const astr_map *map, size_t *position, astr_view *key, void **value) {
+	size_t i;
+	if (map == NULL || position == NULL) {
+		return 0;
+	}
+	for (i = *position; i < map->capacity; i++) {
+		if (map->control[i] >= 0) {
+			if (key != NULL) {
+				*key = astr_view_from_buffer(map->slots[i].key, map->slots[i].key_length);
+			}
+			if (value != NULL) {
+				*value = map->slots[i].value;
+			}
+			*position = i + 1;
+			return 1;
+		}
+	}
+	*position = map->capacity;
+	return 0;
+}
@@ -0,0 +1,116 @@
+// astr_map.h - Adept String Map
+
+#ifndef ASTR_MAP_H
+#define ASTR_MAP_H
+
+#include <stdint.h>
+
+#include "astr.h"
+
+/*
+ * An astr_map maps string keys to values, for the group-by, join, and
+ * dedupe filters written on top of afile_process_lines.
+ *
+ * It is an open-addressing hash table laid out like a SwissTable.  Besides
+ * the slots, the table has one control byte per slot: empty, deleted, or the
+ * low seven bits of the hash of the key in the slot.  The control bytes are
+ * probed 16 at a time with SSE2, so one compare finds the few slots in a
+ * group whose keys might match, and the keys themselves are only compared in
+ * those slots.  The rest of the hash picks the first group to probe.
+ *
+ * Keys are copied into an arena owned by the map, so the map does not depend
+ * on the caller's strings.  Lookups by astr use the hash cached in the astr
+ * instance; lookups by view hash the view and allocate nothing.  Values are
+ * pointers, and are not freed by the map.
+ */
+
+typedef struct astr_map_slot {
+	// The key, null-terminated, in the arena of the map
+	const char *key;
+
+	// Length of the key
+	int key_length;
+
+	// Hash of the key
+	uint64_t hash;
+
+	// The value
+	void *value;
+} astr_map_slot;
+
+typedef struct astr_map_arena {
+	// The next block, NULL for the last one
+	struct astr_map_arena *next;
+
+	// Number of bytes used in this block
+	size_t used;
+
+	// Number of bytes in this block
+	size_t size;
+
+	// The bytes of this block
+	char bytes[];
+} astr_map_arena;
+
+typedef struct astr_map {
+	// Control bytes, one per slot
+	signed char *control;
+
+	// The slots
+	astr_map_slot *slots;
+
+	// Number of slots, a power of two and a multiple of 16
+	size_t capacity;
+
+	// Number of keys in the map
+	size_t size;
+
+	// Number of slots holding deleted keys
+	size_t deleted;
+
+	// The arena holding the keys, newest block first
+	astr_map_arena *arena;
+} astr_map;
+
+#ifdef	__cplusplus
+extern "C" {
+#endif
+
+// Create a map with room for a number of keys.
+astr_map *astr_map_create(const size_t capacity);
+
+// Free a map and its keys.  The values are not freed.
+astr_map *astr_map_free(astr_map *map);
+
+// Get the number of keys in a map.
+size_t astr_map_size(const astr_map *map);
+
+// Get the value for a key, using the hash cached in the key.
+void *astr_map_get(const astr_map *map, astr *key);
+
+// Get the value for a key in a view.
+void *astr_map_get_view(const astr_map *map, astr_view key);
+
+// Determine if a map has a key in a view.
+int astr_map_contains_view(const astr_map *map, astr_view key);
+
+// Set the value for a key, using the hash cached in the key.
+int astr_map_put(astr_map *map, astr *key, void *value);
+
+// Set the value for a key in a view.
+int astr_map_put_view(astr_map *map, astr_view key, void *value);
+
+// Get the address of the value for a key in a view, adding the key if it is not there.
+void **astr_map_value_view(astr_map *map, astr_view key);
+
+// Remove a key in a view.
+int astr_map_remove_view(astr_map *map, astr_view key);
+
+// Step through the keys and values of a map.
+int astr_map_next(const astr_map *map, size_t *position, astr_view *key, void **value);
+
+#ifdef	__cplusplus
+}
+#endif
+
+#endif	// ASTR_MAP_H
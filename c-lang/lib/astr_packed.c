@@ -0,0 +1,675 @@
+// astr_packed.c - Adept String Packed Array
+
+/*
+ * A read-only, front-coded array of sorted strings.
+ *
+ * The image starts with a 64-byte header, followed by the offset of each
+ * block as a 64-bit integer, followed by the blocks.  In a block the first
+ * string is its length and its characters; each of the rest is the length of
+ * the prefix it shares with the string before it, the length of the rest of
+ * it, and the rest of its characters.  The lengths are variable-length
+ * integers, seven bits to a byte, so short lengths take one byte.
+ *
+ * Strings are ordered by their bytes as unsigned characters, shorter first
+ * when one is a prefix of the other, the order of astr_compare.
+ *
+ * Only the header and the block offsets are checked when an image is opened,
+ * so mapping a file does not read all of it.  The blocks are checked as they
+ * are read: every length is checked against the end of the image, so a
+ * truncated or corrupt file fails the lookup instead of reading past it.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "astr.h"
+#include "astr_packed.h"
+
+#define ASTR_PACKED_HEADER_SIZE 64
+#define ASTR_PACKED_MAGIC "ADPPACKD"
+#define ASTR_PACKED_VERSION 1
+#define ASTR_PACKED_DEFAULT_BLOCK_SIZE 16
+
+/*
+ * astr_packed_varint_size
+ *
+ * Get the number of bytes in the variable-length encoding of a number.
+ */
+static size_t astr_packed_varint_size(uint64_t value) {
+	size_t size = 1;
+	while (value >= 0x80) {
+		value >>= 7;
+		size++;
+	}
+	return size;
+}
+
+/*
+ * astr_packed_varint_put
+ *
+ * Encode a number, seven bits to a byte, low bits first.
+ *
+ * Returns:   Pointer to the byte after the encoding
+ */
+static unsigned char *astr_packed_varint_put(unsigned char *p, uint64_t value) {
+	while (value >= 0x80) {
+		*p++ = (unsigned char)(value | 0x80);
+		value >>= 7;
+	}
+	*p++ = (unsigned char)value;
+	return p;
+}
+
+/*
+ * astr_packed_varint_get
+ *
+ * Decode a number that must fit in an int.
+ *
+ * Returns:   Pointer to the byte after the encoding, or NULL if the encoding
+ *            runs past the end or the number is too big
+ */
+static const unsigned char *astr_packed_varint_get(const unsigned char *p, const unsigned char *end, int *value) {
+	uint64_t v = 0;
+	int shift = 0;
+	while (p < end && (*p & 0x80)) {
+		v |= (uint64_t)(*p++ & 0x7F) << shift;
+		shift += 7;
+		if (shift > 28) {
+			return NULL;
+		}
+	}
+	if (p >= end) {
+		return NULL;
+	}
+	v |= (uint64_t)*p++ << shift;
+	if (v > INT_MAX) {
+		return NULL;
+	}
+	*value = (int)v;
+	return p;
+}
+
+/*
+ * astr_packed_string_get
+ *
+ * Decode the length of the characters that follow it, which must all be
+ * before the end of the image.
+ *
+ * Returns:   Pointer to the characters, or NULL if they run past the end
+ */
+static const unsigned char *astr_packed_string_get(const unsigned char *p, const unsigned char *end, int *length) {
+	p = astr_packed_varint_get(p, end, length);
+	if (p == NULL || *length > end - p) {
+		return NULL;
+	}
+	return p;
+}
+
+/*
+ * astr_packed_common
+ *
+ * Get the length of the prefix two buffers share.
+ */
+static int astr_packed_common(const unsigned char *s1, int length1, const unsigned char *s2, int length2) {
+	int n = (length1 < length2 ? length1 : length2);
+	int i;
+	for (i = 0; i < n && s1[i] == s2[i]; i++) {
+	}
+	return i;
+}
+
+/*
+ * astr_packed_compare
+ *
+ * Compare two buffers as unsigned bytes, the shorter first when one is a
+ * prefix of the other.
+ */
+static int astr_packed_compare(const unsigned char *s1, int length1, const unsigned char *s2, int length2) {
+	int c = memcmp(s1, s2, length1 < length2 ? length1 : length2);
+	if (c != 0) {
+		return c;
+	}
+	return (length1 > length2) - (length1 < length2);
+}
+
+/*
+ * astr_packed_open
+ *
+ * Fill in a packed array from the header of its image, checking the header.
+ *
+ * Returns:   0 = success, EINVAL if the image is not a packed array
+ */
+static int astr_packed_open(astr_packed *packed) {
+	uint32_t version;
+	uint32_t block_size;
+	uint32_t max_length;
+	uint64_t count;
+	uint64_t block_count;
+	uint64_t blocks_length;
+	const unsigned char *image = packed->image;
+	size_t i;
+
+	if (packed->image_length < ASTR_PACKED_HEADER_SIZE || memcmp(image, ASTR_PACKED_MAGIC, 8) != 0) {
+		return EINVAL;
+	}
+	memcpy(&version, image + 8, 4);
+	memcpy(&block_size, image + 12, 4);
+	memcpy(&count, image + 16, 8);
+	memcpy(&block_count, image + 24, 8);
+	memcpy(&blocks_length, image + 32, 8);
+	memcpy(&max_length, image + 40, 4);
+	// Each size is checked against what is left of the image before it is
+	// used, so no sum or product of the sizes can wrap around.
+	if (version != ASTR_PACKED_VERSION || block_size == 0 || block_size > INT_MAX || max_length > INT_MAX
+			|| block_count > (packed->image_length - ASTR_PACKED_HEADER_SIZE) / sizeof(uint64_t)
+			|| block_count != count / block_size + (count % block_size != 0)
+			|| blocks_length != packed->image_length - ASTR_PACKED_HEADER_SIZE - block_count * sizeof(uint64_t)) {
+		return EINVAL;
+	}
+
+	packed->count = count;
+	packed->block_size = block_size;
+	packed->block_count = block_count;
+	packed->max_length = max_length;
+	packed->offsets = (const uint64_t *)(image + ASTR_PACKED_HEADER_SIZE);
+	packed->blocks = image + ASTR_PACKED_HEADER_SIZE + block_count * sizeof(uint64_t);
+	for (i = 0; i < block_count; i++) {
+		if (packed->offsets[i] >= blocks_length) {
+			return EINVAL;
+		}
+	}
+	return 0;
+}
+
+/*
+ * astr_packed_create
+ *
+ * Create a packed array from an array of astr instances sorted in the order
+ * of astr_compare, as by astr_sort.  The strings are copied; the astr
+ * instances can be freed afterward.
+ *
+ * Larger blocks take less memory, because fewer strings are stored whole,
+ * and take longer to search, because more strings are scanned in a block.
+ *
+ * Parameter: The sorted array of astr instances
+ * Parameter: The number of astr instances
+ * Parameter: The number of strings in each block, or 0 for a default
+ * Returns:   Pointer to the packed array, or NULL with errno set if it could
+ *            not be allocated or the array is not sorted
+ */
+astr_packed *astr_packed_create(astr **asa, const size_t count, const int block_size) {
+	astr_packed *packed;
+	unsigned char *p;
+	uint64_t *offsets;
+	unsigned char *blocks;
+	uint32_t version = ASTR_PACKED_VERSION;
+	uint32_t size = (block_size > 0 ? block_size : ASTR_PACKED_DEFAULT_BLOCK_SIZE);
+	uint32_t max_length = 0;
+	uint64_t block_count;
+	uint64_t blocks_length = 0;
+	uint64_t total = count;
+	const unsigned char *s;
+	const unsigned char *prev = NULL;
+	int prev_length = 0;
+	int shared;
+	int result;
+	size_t i;
+
+	if (asa == NULL && count > 0) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	// Check the order and measure the blocks.
+	for (i = 0; i < count; i++) {
+		if (asa[i] == NULL || asa[i]->string == NULL) {
+			errno = EINVAL;
+			return NULL;
+		}
+		s = (const unsigned char *)asa[i]->string;
+		if (i > 0 && astr_packed_compare(prev, prev_length, s, asa[i]->length) > 0) {
+			errno = EINVAL;
+			return NULL;
+		}
+		if (i % size == 0) {
+			blocks_length += astr_packed_varint_size(asa[i]->length) + asa[i]->length;
+		}
+		else {
+			shared = astr_packed_common(prev, prev_length, s, asa[i]->length);
+			blocks_length += astr_packed_varint_size(shared) + astr_packed_varint_size(asa[i]->length - shared) + asa[i]->length - shared;
+		}
+		if ((uint32_t)asa[i]->length > max_length) {
+			max_length = asa[i]->length;
+		}
+		prev = s;
+		prev_length = asa[i]->length;
+	}
+	block_count = (count + size - 1) / size;
+
+	packed = (astr_packed *)calloc(1, sizeof(astr_packed));
+	if (packed == NULL) {
+		return NULL;
+	}
+	packed->image_length = ASTR_PACKED_HEADER_SIZE + block_count * sizeof(uint64_t) + blocks_length;
+	packed->image = (unsigned char *)calloc(packed->image_length, 1);
+	if (packed->image == NULL) {
+		free(packed);
+		return NULL;
+	}
+
+	memcpy(packed->image, ASTR_PACKED_MAGIC, 8);
+	memcpy(packed->image + 8, &version, 4);
+	memcpy(packed->image + 12, &size, 4);
+	memcpy(packed->image + 16, &total, 8);
+	memcpy(packed->image + 24, &block_count, 8);
+	memcpy(packed->image + 32, &blocks_length, 8);
+	memcpy(packed->image + 40, &max_length, 4);
+
+	offsets = (uint64_t *)(packed->image + ASTR_PACKED_HEADER_SIZE);
+	blocks = packed->image + ASTR_PACKED_HEADER_SIZE + block_count * sizeof(uint64_t);
+	p = blocks;
+	for (i = 0; i < count; i++) {
+		s = (const unsigned char *)asa[i]->string;
+		if (i % size == 0) {
+			offsets[i / size] = p - blocks;
+			p = astr_packed_varint_put(p, asa[i]->length);
+			memcpy(p, s, asa[i]->length);
+			p += asa[i]->length;
+		}
+		else {
+			shared = astr_packed_common(prev, prev_length, s, asa[i]->length);
+			p = astr_packed_varint_put(p, shared);
+			p = astr_packed_varint_put(p, asa[i]->length - shared);
+			memcpy(p, s + shared, asa[i]->length - shared);
+			p += asa[i]->length - shared;
+		}
+		prev = s;
+		prev_length = asa[i]->length;
+	}
+
+	result = astr_packed_open(packed);
+	if (result != 0) {
+		astr_packed_free(packed);
+		errno = result;
+		return NULL;
+	}
+	return packed;
+}
+
+/*
+ * astr_packed_free
+ *
+ * Free a packed array, or unmap it if it was mapped from a file.
+ *
+ * Parameter: The packed array
+ * Returns:   NULL pointer
+ */
+astr_packed *astr_packed_free(astr_packed *packed) {
+	if (packed != NULL) {
+		if (packed->mapped) {
+			munmap(packed->image, packed->image_length);
+		}
+		else {
+			free(packed->image);
+		}
+		free(packed);
+	}
+	return NULL;
+}
+
+/*
+ * astr_packed_count
+ *
+ * Get the number of strings in a packed array.
+ *
+ * Parameter: The packed array
+ * Returns:   The number of strings
+ */
+size_t astr_packed_count(const astr_packed *packed) {
+	return packed == NULL ? 0 : packed->count;
+}
+
+/*
+ * astr_packed_view
+ *
+ * Get a view of a string in a packed array by index.
+ *
+ * The first string of a block is stored whole, and the view refers to it in
+ * the array.  Any other string is put together in the buffer supplied by the
+ * caller, from the first string of its block and the differences after it.
+ * A buffer of max_length characters is always big enough.  The view is not
+ * null-terminated.
+ *
+ * Parameter: The packed array
+ * Parameter: The index of the string
+ * Parameter: The buffer for the string
+ * Parameter: The size of the buffer
+ * Returns:   A view of the string, or a view of NULL if the index is out of
+ *            range, the string does not fit in the buffer, or the block
+ *            holding it is corrupt
+ */
+astr_view astr_packed_view(const astr_packed *packed, const size_t index, char *buffer, const int size) {
+	astr_view view = { NULL, 0 };
+	const unsigned char *end;
+	const unsigned char *p;
+	int length;
+	int shared;
+	int rest;
+	size_t j;
+
+	if (packed == NULL || index >= packed->count) {
+		return view;
+	}
+
+	end = packed->image + packed->image_length;
+	p = packed->blocks + packed->offsets[index / packed->block_size];
+	p = astr_packed_string_get(p, end, &length);
+	if (p == NULL) {
+		return view;
+	}
+	if (index % packed->block_size == 0) {
+		view.string = (const char *)p;
+		view.length = length;
+		return view;
+	}
+
+	if (buffer == NULL || length > size) {
+		return view;
+	}
+	memcpy(buffer, p, length);
+	p += length;
+	for (j = index % packed->block_size; j > 0; j--) {
+		p = astr_packed_varint_get(p, end, &shared);
+		if (p == NULL || shared > length) {
+			return view;
+		}
+		p = astr_packed_string_get(p, end, &rest);
+		if (p == NULL || rest > size - shared) {
+			return view;
+		}
+		memcpy(buffer + shared, p, rest);
+		p += rest;
+		length = shared + rest;
+	}
+	view.string = buffer;
+	view.length = length;
+	return view;
+}
+
+/*
+ * astr_packed_get
+ *
+ * Reinitialize an astr with a string in a packed array by index.
+ * If the astr instance is NULL a new one is allocated.
+ *
+ * Parameter: The packed array
+ * Parameter: The index of the string
+ * Parameter: The astr instance to be reinitialized
+ * Returns:   Pointer to the astr instance, or NULL if the index is out of range
+ *            or the string cannot be read
+ */
+astr *astr_packed_get(const astr_packed *packed, const size_t index, astr *as) {
+	char local[256];
+	char *buffer = local;
+	astr_view view;
+
+	if (packed == NULL || index >= packed->count) {
+		return NULL;
+	}
+	if (packed->max_length > (int)sizeof(local)) {
+		buffer = (char *)malloc(packed->max_length);
+		if (buffer == NULL) {
+			return NULL;
+		}
+	}
+
+	view = astr_packed_view(packed, index, buffer, packed->max_length);
+	if (view.string == NULL) {
+		as = NULL;
+	}
+	else {
+		as = (as == NULL ? astr_create_from_view(view) : astr_set_from_view(as, view));
+	}
+
+	if (buffer != local) {
+		free(buffer);
+	}
+	return as;
+}
+
+/*
+ * astr_packed_search
+ *
+ * Find the first string that is not less than a key.
+ *
+ * The blocks are binary searched by their first strings, for the last block
+ * that starts with a string less than the key.  In that block the strings are compared with the key without being
+ * put together: knowing how much of the key the string before matched, and
+ * how much the next string shares with it, settles most comparisons before
+ * looking at any characters.
+ *
+ * Returns:   The index of the string, or the count if every string is less or
+ *            a block read is corrupt
+ */
+static size_t astr_packed_search(const astr_packed *packed, astr_view key, int *found) {
+	const unsigned char *k = (const unsigned char *)key.string;
+	const unsigned char *image_end = packed->image + packed->image_length;
+	const unsigned char *p;
+	size_t lo = 0;
+	size_t hi = packed->block_count;
+	size_t mid;
+	size_t block;
+	size_t index;
+	size_t end;
+	int length;
+	int shared;
+	int rest;
+	int match;
+	int m;
+	int c;
+
+	*found = 0;
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		p = astr_packed_string_get(packed->blocks + packed->offsets[mid], image_end, &length);
+		if (p == NULL) {
+			return packed->count;
+		}
+		if (astr_packed_compare(p, length, k, key.length) < 0) {
+			lo = mid + 1;
+		}
+		else {
+			hi = mid;
+		}
+	}
+	if (lo == 0) {
+		// Every string is at least the key.
+		if (packed->count > 0) {
+			p = astr_packed_string_get(packed->blocks + packed->offsets[0], image_end, &length);
+			*found = (p != NULL && astr_packed_compare(p, length, k, key.length) == 0);
+		}
+		return 0;
+	}
+
+	// The first string of this block is less than the key, and the first
+	// string of the next block is not.
+	block = lo - 1;
+	index = block * packed->block_size;
+	end = index + packed->block_size;
+	if (end > packed->count) {
+		end = packed->count;
+	}
+	p = astr_packed_string_get(packed->blocks + packed->offsets[block], image_end, &length);
+	if (p == NULL) {
+		return packed->count;
+	}
+	match = astr_packed_common(p, length, k, key.length);
+	p += length;
+
+	for (index++; index < end; index++) {
+		p = astr_packed_varint_get(p, image_end, &shared);
+		if (p != NULL) {
+			p = astr_packed_string_get(p, image_end, &rest);
+		}
+		if (p == NULL) {
+			*found = 0;
+			return packed->count;
+		}
+		if (shared < match) {
+			// This string leaves the one before where that one still matched the key, so it is greater.
+			return index;
+		}
+		if (shared == match) {
+			m = astr_packed_common(p, rest, k + match, key.length - match);
+			if (m == rest) {
+				if (match + m == key.length) {
+					*found = 1;
+					return index;
+				}
+				// This string is a prefix of the key, so it is less.
+			}
+			else if (match + m == key.length) {
+				// The key is a prefix of this string, so it is greater.
+				return index;
+			}
+			else {
+				c = (int)p[m] - (int)k[match + m];
+				if (c > 0) {
+					return index;
+				}
+			}
+			match += m;
+		}
+		// Otherwise this string matches the one before past where that one left the key, so it is less too.
+		p += rest;
+	}
+
+	if (end < packed->count) {
+		p = astr_packed_string_get(packed->blocks + packed->offsets[block + 1], image_end, &length);
+		*found = (p != NULL && astr_packed_compare(p, length, k, key.length) == 0);
+	}
+	return end;
+}
+
+/*
+ * astr_packed_lower_bound
+ *
+ * Find the index of the first string in a packed array that is not less than
+ * a key, where the key would go if it were added.
+ *
+ * Parameter: The packed array
+ * Parameter: The key
+ * Returns:   The index, or the number of strings if every string is less
+ */
+size_t astr_packed_lower_bound(const astr_packed *packed, astr_view key) {
+	int found;
+	if (packed == NULL || key.string == NULL) {
+		return 0;
+	}
+	return astr_packed_search(packed, key, &found);
+}
+
+/*
+ * astr_packed_find
+ *
+ * Find the index of a key in a packed array.
+ *
+ * Parameter: The packed array
+ * Parameter: The key
+ * Returns:   The index of the first string equal to the key, or -1 if the
+ *            key is not in the array
+ */
+long astr_packed_find(const astr_packed *packed, astr_view key) {
+	size_t index;
+	int found;
+	if (packed == NULL || key.string == NULL) {
+		return -1;
+	}
+	index = astr_packed_search(packed, key, &found);
+	return found ? (long)index : -1;
+}
+
+/*
+ * astr_packed_write
+ *
+ * Write the image of a packed array to a file.
+ *
+ * Parameter: The packed array
+ * Parameter: The file, open for writing in binary mode
+ * Returns:   0 = success, non-zero = errno value from the failed operation
+ */
+int astr_packed_write(const astr_packed *packed, FILE *file) {
+	if (packed == NULL || file == NULL) {
+		return EINVAL;
+	}
+	errno = 0;
+	if (fwrite(packed->image, 1, packed->image_length, file) != packed->image_length) {
+		return errno != 0 ? errno : EIO;
+	}
+	return 0;
+}
+
+/*
+ * astr_packed_map
+ *
+ * Map a packed array written by astr_packed_write into memory.
+ * Nothing is read until a string is looked up, and the pages are shared with
+ * every other process that maps the same file.
+ *
+ * Parameter: The name of the file
+ * Returns:   Pointer to the packed array, or NULL with errno set if the file
+ *            could not be mapped or is not a packed array
+ */
+astr_packed *astr_packed_map(const char *filename) {
+	astr_packed *packed;
+	struct stat stats;
+	void *mapping;
+	int result;
+	int fd;
+
+	if (filename == NULL) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	fd = open(filename, O_RDONLY);
+	if (fd < 0) {
+		return NULL;
+	}
+	if (fstat(fd, &stats) != 0) {
+		close(fd);
+		return NULL;
+	}
+	if (stats.st_size < ASTR_PACKED_HEADER_SIZE) {
+		close(fd);
+		errno = EINVAL;
+		return NULL;
+	}
+	mapping = mmap(NULL, stats.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (mapping == MAP_FAILED) {
+		return NULL;
+	}
+
+	packed = (astr_packed *)calloc(1, sizeof(astr_packed));
+	if (packed == NULL) {
+		munmap(mapping, stats.st_size);
+		return NULL;
+	}
+	packed->image = (unsigned char *)mapping;
+	packed->image_length = stats.st_size;
+	packed->mapped = 1;
+	result = astr_packed_open(packed);
+	if (result != 0) {
+		astr_packed_free(packed);
+		errno = result;
+		return NULL;
+	}
+	return packed;
+}
@@ -0,0 +1,94 @@
+// astr_packed.h - Adept String Packed Array
+
+#ifndef ASTR_PACKED_H
+#define ASTR_PACKED_H
+
+#include <stdio.h>
+#include <stdint.h>
+
+#include "astr.h"
+
+/*
+ * An astr_packed is a read-only array of sorted strings, front-coded in
+ * blocks, for keeping a big sorted list of keys in a fraction of the memory
+ * the astr instances take.  An astr instance is a struct and a separate
+ * buffer; a packed array is one buffer holding only the characters, and
+ * sorted keys share most of their characters with the key before them.
+ *
+ * The strings are cut into blocks of a fixed number of strings.  The first
+ * string of a block is stored whole.  Each of the others is stored as the
+ * number of characters it shares with the string before it, followed by the
+ * characters that differ.  A table of block offsets leads to any block, so a
+ * string is found by binary search over the first strings of the blocks and
+ * then a scan of at most one block.
+ *
+ * The whole array is one image, the same in memory and in a file, so it can
+ * be written out and mapped back in with mmap.  The file is in the byte order
+ * of the machine that wrote it.
+ */
+
+typedef struct astr_packed {
+	// The image: the header, the block offsets, and the blocks
+	unsigned char *image;
+
+	// Length of the image
+	size_t image_length;
+
+	// Number of strings
+	size_t count;
+
+	// Number of strings in each block, except maybe the last
+	int block_size;
+
+	// Number of blocks
+	size_t block_count;
+
+	// Length of the longest string
+	int max_length;
+
+	// Offset of each block from the start of the blocks
+	const uint64_t *offsets;
+
+	// The blocks
+	const unsigned char *blocks;
+
+	// Nonzero if the image is mapped from a file rather than allocated
+	int mapped;
+} astr_packed;
+
+#ifdef	__cplusplus
+extern "C" {
+#endif
+
+// Create a packed array from a sorted array of astr instances.
+astr_packed *astr_packed_create(astr **asa, const size_t count, const int block_size);
+
+// Free a packed array.
+astr_packed *astr_packed_free(astr_packed *packed);
+
+// Get the number of strings in a packed array.
+size_t astr_packed_count(const astr_packed *packed);
+
+// Get a view of a string in a packed array by index.
+astr_view astr_packed_view(const astr_packed *packed, const size_t index, char *buffer, const int size);
+
+// Reinitialize an astr with a string in a packed array by index.
+astr *astr_packed_get(const astr_packed *packed, const size_t index, astr *as);
+
+// Find the index of the first string that is not less than a key.
+size_t astr_packed_lower_bound(const astr_packed *packed, astr_view key);
+
+// Find the index of a key.
+long astr_packed_find(const astr_packed *packed, astr_view key);
+
+// Write a packed array to a file.
+int astr_packed_write(const astr_packed *packed, FILE *file);
+
+// Map a packed array written by astr_packed_write into memory.
+astr_packed *astr_packed_map(const char *filename);
+
+#ifdef	__cplusplus
+}
+#endif
+
+#endif	// ASTR_PACKED_H
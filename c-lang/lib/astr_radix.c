@@ -0,0 +1,660 @@
+// astr_radix.c - Adept String Radix Tree
+
+/*
+ * A compressed radix tree of string keys.
+ *
+ * Adding a key walks down the tree as far as the key matches.  Where the key
+ * leaves an edge part of the way along its label, the edge is split with a
+ * new node; where it leaves a node, the rest of the key becomes the label of
+ * a new leaf.  Removing a key undoes that: a leaf without a value is removed,
+ * and a node left with no value and one child is merged into the child.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "astr.h"
+#include "astr_radix.h"
+
+typedef struct astr_radix_range_state {
+	astr_view from;
+	astr_view to;
+	char *key;
+	int allocated;
+	int visited;
+	int (*visit)(astr_view key, void *value, void *context);
+	void *context;
+} astr_radix_range_state;
+
+/*
+ * astr_radix_node_create
+ *
+ * Allocate a node with a label and no children.
+ *
+ * Returns:   Pointer to the node, or NULL if it could not be allocated
+ */
+static astr_radix_node *astr_radix_node_create(const char *label, const int label_length) {
+	astr_radix_node *node = (astr_radix_node *)malloc(sizeof(astr_radix_node) + label_length);
+	if (node != NULL) {
+		node->value = NULL;
+		node->children = NULL;
+		node->count = 0;
+		node->allocated = 0;
+		node->has_value = 0;
+		node->label_length = label_length;
+		memcpy(node->label, label, label_length);
+	}
+	return node;
+}
+
+/*
+ * astr_radix_node_free
+ *
+ * Free a node and everything below it.
+ */
+static void astr_radix_node_free(astr_radix_node *node) {
+	int i;
+	for (i = 0; i < node->count; i++) {
+		astr_radix_node_free(node->children[i]);
+	}
+	free(node->children);
+	free(node);
+}
+
+/*
+ * astr_radix_first
+ *
+ * Get the first characters of the labels of the children of a node, which
+ * follow the child pointers.
+ */
+static unsigned char *astr_radix_first(const astr_radix_node *node) {
+	return (unsigned char *)(node->children + node->allocated);
+}
+
+/*
+ * astr_radix_child
+ *
+ * Find the child of a node whose label starts with a character.
+ *
+ * Returns:   The index of the child, or -1 if there is none
+ */
+static int astr_radix_child(const astr_radix_node *node, const char c) {
+	const unsigned char *first;
+	const unsigned char *found;
+	if (node->count == 0) {
+		return -1;
+	}
+	first = astr_radix_first(node);
+	found = (const unsigned char *)memchr(first, (unsigned char)c, node->count);
+	return found == NULL ? -1 : found - first;
+}
+
+/*
+ * astr_radix_reserve
+ *
+ * Make room for a number of children in a node.
+ *
+ * Returns:   0 = success, -1 if the children could not be allocated
+ */
+static int astr_radix_reserve(astr_radix_node *node, const int count) {
+	astr_radix_node **children;
+	int allocated;
+
+	if (count <= node->allocated) {
+		return 0;
+	}
+	allocated = (node->allocated == 0 ? 2 : node->allocated * 2);
+	while (allocated < count) {
+		allocated *= 2;
+	}
+	if (allocated > 256) {
+		allocated = 256;
+	}
+
+	children = (astr_radix_node **)malloc(allocated * (sizeof(astr_radix_node *) + 1));
+	if (children == NULL) {
+		return -1;
+	}
+	if (node->count > 0) {
+		memcpy(children, node->children, node->count * sizeof(astr_radix_node *));
+		memcpy(children + allocated, astr_radix_first(node), node->count);
+	}
+	free(node->children);
+	node->children = children;
+	node->allocated = allocated;
+	return 0;
+}
+
+/*
+ * astr_radix_add_child
+ *
+ * Add a child to a node, keeping the children in order.
+ *
+ * Returns:   0 = success, -1 if the children could not be allocated
+ */
+static int astr_radix_add_child(astr_radix_node *node, astr_radix_node *child) {
+	unsigned char c = (unsigned char)child->label[0];
+	unsigned char *first;
+	int i;
+
+	if (astr_radix_reserve(node, node->count + 1) != 0) {
+		return -1;
+	}
+	first = astr_radix_first(node);
+	for (i = 0; i < node->count && first[i] < c; i++) {
+	}
+	memmove(node->children + i + 1, node->children + i, (node->count - i) * sizeof(astr_radix_node *));
+	memmove(first + i + 1, first + i, node->count - i);
+	node->children[i] = child;
+	first[i] = c;
+	node->count++;
+	return 0;
+}
+
+/*
+ * astr_radix_remove_child
+ *
+ * Remove a child from a node, without freeing it.
+ */
+static void astr_radix_remove_child(astr_radix_node *node, const int i) {
+	unsigned char *first = astr_radix_first(node);
+	memmove(node->children + i, node->children + i + 1, (node->count - i - 1) * sizeof(astr_radix_node *));
+	memmove(first + i, first + i + 1, node->count - i - 1);
+	node->count--;
+}
+
+/*
+ * astr_radix_merge
+ *
+ * Merge a child of a node, which has no value and one child of its own, into
+ * that child.  The grandchild is reallocated with the two labels joined and
+ * takes the child's place.  If it cannot be reallocated the tree is left as
+ * it was, which is still correct, just not as compact.
+ */
+static void astr_radix_merge(astr_radix_node *node, const int i) {
+	astr_radix_node *child = node->children[i];
+	astr_radix_node *merged;
+
+	merged = (astr_radix_node *)realloc(child->children[0], sizeof(astr_radix_node) + child->label_length + child->children[0]->label_length);
+	if (merged == NULL) {
+		return;
+	}
+	memmove(merged->label + child->label_length, merged->label, merged->label_length);
+	memcpy(merged->label, child->label, child->label_length);
+	merged->label_length += child->label_length;
+	node->children[i] = merged;
+	free(child->children);
+	free(child);
+}
+
+/*
+ * astr_radix_find
+ *
+ * Find the node for a key.
+ *
+ * Returns:   Pointer to the node, or NULL if there is none
+ */
+static const astr_radix_node *astr_radix_find(const astr_radix *radix, astr_view key) {
+	const astr_radix_node *node = radix->root;
+	const astr_radix_node *child;
+	int pos = 0;
+	int i;
+
+	while (pos < key.length) {
+		i = astr_radix_child(node, key.string[pos]);
+		if (i < 0) {
+			return NULL;
+		}
+		child = node->children[i];
+		if (child->label_length > key.length - pos || memcmp(child->label, key.string + pos, child->label_length) != 0) {
+			return NULL;
+		}
+		pos += child->label_length;
+		node = child;
+	}
+	return node;
+}
+
+/*
+ * astr_radix_create
+ *
+ * Create an empty radix tree.
+ *
+ * Returns:   Pointer to the radix tree, or NULL if it could not be allocated
+ */
+astr_radix *astr_radix_create(void) {
+	astr_radix *radix = (astr_radix *)calloc(1, sizeof(astr_radix));
+	if (radix != NULL) {
+		radix->root = astr_radix_node_create("", 0);
+		if (radix->root == NULL) {
+			free(radix);
+			radix = NULL;
+		}
+	}
+	return radix;
+}
+
+/*
+ * astr_radix_free
+ *
+ * Free a radix tree.
+ * The values are not freed.
+ *
+ * Parameter: The radix tree
+ * Returns:   NULL pointer
+ */
+astr_radix *astr_radix_free(astr_radix *radix) {
+	if (radix != NULL) {
+		astr_radix_node_free(radix->root);
+		free(radix);
+	}
+	return NULL;
+}
+
+/*
+ * astr_radix_size
+ *
+ * Get the number of keys in a radix tree.
+ *
+ * Parameter: The radix tree
+ * Returns:   The number of keys
+ */
+size_t astr_radix_size(const astr_radix *radix) {
+	return radix == NULL ? 0 : radix->size;
+}
+
+/*
+ * astr_radix_put
+ *
+ * Set the value for a key, adding the key if it is not in the tree.
+ *
+ * Parameter: The radix tree
+ * Parameter: The key
+ * Parameter: The value
+ * Returns:   1 if the key was added, 0 if its value was replaced,
+ *            -1 if memory could not be allocated
+ */
+int astr_radix_put(astr_radix *radix, const astr *key, void *value) {
+	if (key == NULL || key->string == NULL) {
+		return -1;
+	}
+	return astr_radix_put_view(radix, astr_view_of(key), value);
+}
+
+/*
+ * astr_radix_put_view
+ *
+ * Set the value for a key in a view, adding the key if it is not in the tree.
+ * The key is copied into the tree.
+ *
+ * Parameter: The radix tree
+ * Parameter: The key
+ * Parameter: The value
+ * Returns:   1 if the key was added, 0 if its value was replaced,
+ *            -1 if memory could not be allocated
+ */
+int astr_radix_put_view(astr_radix *radix, astr_view key, void *value) {
+	astr_radix_node *node;
+	astr_radix_node *child;
+	astr_radix_node *split;
+	int added;
+	int pos = 0;
+	int m;
+	int i;
+
+	if (radix == NULL || key.string == NULL) {
+		return -1;
+	}
+
+	node = radix->root;
+	for (;;) {
+		if (pos == key.length) {
+			added = !node->has_value;
+			node->value = value;
+			node->has_value = 1;
+			radix->size += added;
+			return added;
+		}
+
+		i = astr_radix_child(node, key.string[pos]);
+		if (i < 0) {
+			child = astr_radix_node_create(key.string + pos, key.length - pos);
+			if (child == NULL) {
+				return -1;
+			}
+			child->value = value;
+			child->has_value = 1;
+			if (astr_radix_add_child(node, child) != 0) {
+				free(child);
+				return -1;
+			}
+			radix->size++;
+			return 1;
+		}
+
+		child = node->children[i];
+		for (m = 1; m < child->label_length && pos + m < key.length && child->label[m] == key.string[pos + m]; m++) {
+		}
+		if (m < child->label_length) {
+			// The key leaves the edge part of the way along, so split it there.
+			split = astr_radix_node_create(child->label, m);
+			if (split == NULL || astr_radix_reserve(split, 2) != 0) {
+				free(split);
+				return -1;
+			}
+			memmove(child->label, child->label + m, child->label_length - m);
+			child->label_length -= m;
+			astr_radix_add_child(split, child);
+			node->children[i] = split;
+			child = split;
+		}
+		node = child;
+		pos += m;
+	}
+}
+
+/*
+ * astr_radix_get
+ *
+ * Get the value for a key.
+ *
+ * Parameter: The radix tree
+ * Parameter: The key
+ * Returns:   The value, or NULL if the key is not in the tree
+ */
+void *astr_radix_get(const astr_radix *radix, const astr *key) {
+	if (key == NULL || key->string == NULL) {
+		return NULL;
+	}
+	return astr_radix_get_view(radix, astr_view_of(key));
+}
+
+/*
+ * astr_radix_get_view
+ *
+ * Get the value for a key in a view.
+ *
+ * Parameter: The radix tree
+ * Parameter: The key
+ * Returns:   The value, or NULL if the key is not in the tree
+ */
+void *astr_radix_get_view(const astr_radix *radix, astr_view key) {
+	const astr_radix_node *node;
+	if (radix == NULL || key.string == NULL) {
+		return NULL;
+	}
+	node = astr_radix_find(radix, key);
+	return (node != NULL && node->has_value) ? node->value : NULL;
+}
+
+/*
+ * astr_radix_remove_view
+ *
+ * Remove a key in a view from a radix tree.
+ *
+ * Parameter: The radix tree
+ * Parameter: The key
+ * Returns:   1 if the key was removed, 0 if it was not in the tree
+ */
+int astr_radix_remove_view(astr_radix *radix, astr_view key) {
+	astr_radix_node *grandparent = NULL;
+	astr_radix_node *parent = NULL;
+	astr_radix_node *node;
+	astr_radix_node *child;
+	int grandparent_index = -1;
+	int parent_index = -1;
+	int pos = 0;
+	int i;
+
+	if (radix == NULL || key.string == NULL) {
+		return 0;
+	}
+
+	node = radix->root;
+	while (pos < key.length) {
+		i = astr_radix_child(node, key.string[pos]);
+		if (i < 0) {
+			return 0;
+		}
+		child = node->children[i];
+		if (child->label_length > key.length - pos || memcmp(child->label, key.string + pos, child->label_length) != 0) {
+			return 0;
+		}
+		grandparent = parent;
+		grandparent_index = parent_index;
+		parent = node;
+		parent_index = i;
+		node = child;
+		pos += child->label_length;
+	}
+	if (!node->has_value) {
+		return 0;
+	}
+
+	node->has_value = 0;
+	node->value = NULL;
+	radix->size--;
+
+	if (parent == NULL) {
+		// The empty key is held by the root, which stays.
+		return 1;
+	}
+	if (node->count == 0) {
+		astr_radix_remove_child(parent, parent_index);
+		astr_radix_node_free(node);
+		if (grandparent != NULL && !parent->has_value && parent->count == 1) {
+			astr_radix_merge(grandparent, grandparent_index);
+		}
+	}
+	else if (node->count == 1) {
+		astr_radix_merge(parent, parent_index);
+	}
+	return 1;
+}
+
+/*
+ * astr_radix_longest_prefix
+ *
+ * Find the longest key in a radix tree that is a prefix of a string, as when
+ * routing a URL to the most specific route that matches it.
+ *
+ * Parameter: The radix tree
+ * Parameter: The string
+ * Parameter: Pointer to the length of the key found, or NULL
+ * Parameter: Pointer to the value of the key found, or NULL
+ * Returns:   1 if a key was found, 0 if none of the keys is a prefix
+ */
+int astr_radix_longest_prefix(const astr_radix *radix, astr_view text, int *length, void **value) {
+	const astr_radix_node *node;
+	const astr_radix_node *child;
+	const astr_radix_node *found = NULL;
+	int found_length = 0;
+	int pos = 0;
+	int i;
+
+	if (radix == NULL || text.string == NULL) {
+		return 0;
+	}
+
+	node = radix->root;
+	for (;;) {
+		if (node->has_value) {
+			found = node;
+			found_length = pos;
+		}
+		if (pos == text.length || (i = astr_radix_child(node, text.string[pos])) < 0) {
+			break;
+		}
+		child = node->children[i];
+		if (child->label_length > text.length - pos || memcmp(child->label, text.string + pos, child->label_length) != 0) {
+			break;
+		}
+		pos += child->label_length;
+		node = child;
+	}
+
+	if (found == NULL) {
+		return 0;
+	}
+	if (length != NULL) {
+		*length = found_length;
+	}
+	if (value != NULL) {
+		*value = found->value;
+	}
+	return 1;
+}
+
+/*
+ * astr_radix_all_prefixes
+ *
+ * Find all of the keys in a radix tree that are prefixes of a string,
+ * shortest first.  The lengths and values of the keys are stored in arrays
+ * supplied by the caller, up to the size of the arrays.
+ *
+ * Parameter: The radix tree
+ * Parameter: The string
+ * Parameter: Array for the lengths of the keys found, or NULL
+ * Parameter: Array for the values of the keys found, or NULL
+ * Parameter: The number of elements in the arrays
+ * Returns:   The number of keys that are prefixes of the string, which may
+ *            be more than the number stored
+ */
+int astr_radix_all_prefixes(const astr_radix *radix, astr_view text, int *lengths, void **values, const int max) {
+	const astr_radix_node *node;
+	const astr_radix_node *child;
+	int count = 0;
+	int pos = 0;
+	int i;
+
+	if (radix == NULL || text.string == NULL) {
+		return 0;
+	}
+
+	node = radix->root;
+	for (;;) {
+		if (node->has_value) {
+			if (count < max) {
+				if (lengths != NULL) {
+					lengths[count] = pos;
+				}
+				if (values != NULL) {
+					values[count] = node->value;
+				}
+			}
+			count++;
+		}
+		if (pos == text.length || (i = astr_radix_child(node, text.string[pos])) < 0) {
+			break;
+		}
+		child = node->children[i];
+		if (child->label_length > text.length - pos || memcmp(child->label, text.string + pos, child->label_length) != 0) {
+			break;
+		}
+		pos += child->label_length;
+		node = child;
+	}
+	return count;
+}
+
+/*
+ * astr_radix_range_node
+ *
+ * Visit the keys in the range under a node, with the key so far in the
+ * buffer of the state.  While check_from is set, the keys under the node
+ * might still be before the start of the range.
+ *
+ * Returns:   0 to go on to the next node, nonzero to stop
+ */
+static int astr_radix_range_node(astr_radix_range_state *state, const astr_radix_node *node, int length, int check_from) {
+	char *key;
+	int allocated;
+	int n;
+	int c;
+	int i;
+
+	if (length + node->label_length > state->allocated) {
+		allocated = state->allocated;
+		while (allocated < length + node->label_length) {
+			allocated *= 2;
+		}
+		key = (char *)realloc(state->key, allocated);
+		if (key == NULL) {
+			return -1;
+		}
+		state->key = key;
+		state->allocated = allocated;
+	}
+	memcpy(state->key + length, node->label, node->label_length);
+	length += node->label_length;
+
+	if (state->to.string != NULL) {
+		// Every key from here on is at or after the end of the range.
+		n = (length < state->to.length ? length : state->to.length);
+		c = memcmp(state->key, state->to.string, n);
+		if (c > 0 || (c == 0 && length >= state->to.length)) {
+			return 1;
+		}
+	}
+	if (check_from) {
+		n = (length < state->from.length ? length : state->from.length);
+		c = memcmp(state->key, state->from.string, n);
+		if (c < 0) {
+			// Every key under this node is before the start of the range.
+			return 0;
+		}
+		if (c > 0 || length >= state->from.length) {
+			check_from = 0;
+		}
+	}
+
+	if (node->has_value && !check_from) {
+		state->visited++;
+		if (state->visit != NULL && state->visit(astr_view_from_buffer(state->key, length), node->value, state->context) != 0) {
+			return 1;
+		}
+	}
+	for (i = 0; i < node->count; i++) {
+		if (astr_radix_range_node(state, node->children[i], length, check_from) != 0) {
+			return 1;
+		}
+	}
+	return 0;
+}
+
+/*
+ * astr_radix_range
+ *
+ * Visit the keys in a radix tree from one key up to, but not including,
+ * another, in order.  The visit function is called with each key and value
+ * and the context, and returns 0 to go on to the next key or nonzero to stop.
+ * The view of the key is only valid during the call.
+ *
+ * Parameter: The radix tree
+ * Parameter: The first key in the range, or a view of NULL to start at the beginning
+ * Parameter: The key after the range, or a view of NULL to go to the end
+ * Parameter: The visit function, or NULL to just count the keys
+ * Parameter: The context passed to the visit function
+ * Returns:   The number of keys visited
+ */
+int astr_radix_range(const astr_radix *radix, astr_view from, astr_view to, int (*visit)(astr_view key, void *value, void *context), void *context) {
+	astr_radix_range_state state;
+
+	if (radix == NULL) {
+		return 0;
+	}
+
+	state.from = from;
+	state.to = to;
+	state.allocated = 64;
+	state.key = (char *)malloc(state.allocated);
+	if (state.key == NULL) {
+		return 0;
+	}
+	state.visited = 0;
+	state.visit = visit;
+	state.context = context;
+	astr_radix_range_node(&state, radix->root, 0, from.string != NULL);
+	free(state.key);
+	return state.visited;
+}
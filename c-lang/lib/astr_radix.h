@@ -0,0 +1,101 @@
+// astr_radix.h - Adept String Radix Tree
+
+#ifndef ASTR_RADIX_H
+#define ASTR_RADIX_H
+
+#include <stddef.h>
+
+#include "astr.h"
+
+/*
+ * An astr_radix is a compressed radix tree of string keys, for matching
+ * each input line against a large table of prefixes, like URL routes or
+ * account number ranges.  astr_prefix_equals compares two strings; a radix
+ * tree finds the longest key that is a prefix of a line, or all of them, in
+ * one walk down the tree no matter how many keys there are.
+ *
+ * Each edge of the tree is labeled with a run of characters, so a chain of
+ * nodes with one child each is stored as one node.  A node is one
+ * allocation holding its label, and its children are one allocation holding
+ * the child pointers followed by the first character of each child's label,
+ * sorted.  Finding the child for the next character scans a few contiguous
+ * bytes instead of following a pointer to every child.
+ *
+ * Keys are compared as unsigned bytes, like memcmp, so iterating over a
+ * range of keys visits them in that order.  Values are pointers, and are
+ * not freed by the tree.
+ */
+
+typedef struct astr_radix_node {
+	// The value, if the path to this node is a key
+	void *value;
+
+	// The children, followed by the first character of each child's label
+	struct astr_radix_node **children;
+
+	// Number of children
+	unsigned short count;
+
+	// Number of children there is room for
+	unsigned short allocated;
+
+	// Nonzero if the path to this node is a key
+	unsigned char has_value;
+
+	// Length of the label
+	int label_length;
+
+	// The characters on the edge into this node, not null-terminated
+	char label[];
+} astr_radix_node;
+
+typedef struct astr_radix {
+	// The root, with an empty label
+	astr_radix_node *root;
+
+	// Number of keys in the tree
+	size_t size;
+} astr_radix;
+
+#ifdef	__cplusplus
+extern "C" {
+#endif
+
+// Create an empty radix tree.
+astr_radix *astr_radix_create(void);
+
+// Free a radix tree.  The values are not freed.
+astr_radix *astr_radix_free(astr_radix *radix);
+
+// Get the number of keys in a radix tree.
+size_t astr_radix_size(const astr_radix *radix);
+
+// Set the value for a key.
+int astr_radix_put(astr_radix *radix, const astr *key, void *value);
+
+// Set the value for a key in a view.
+int astr_radix_put_view(astr_radix *radix, astr_view key, void *value);
+
+// Get the value for a key.
+void *astr_radix_get(const astr_radix *radix, const astr *key);
+
+// Get the value for a key in a view.
+void *astr_radix_get_view(const astr_radix *radix, astr_view key);
+
+// Remove a key in a view.
+int astr_radix_remove_view(astr_radix *radix, astr_view key);
+
+// Find the longest key that is a prefix of a string.
+int astr_radix_longest_prefix(const astr_radix *radix, astr_view text, int *length, void **value);
+
+// Find all of the keys that are prefixes of a string, shortest first.
+int astr_radix_all_prefixes(const astr_radix *radix, astr_view text, int *lengths, void **values, const int max);
+
+// Visit the keys from one key up to, but not including, another, in order.
+int astr_radix_range(const astr_radix *radix, astr_view from, astr_view to, int (*visit)(astr_view key, void *value, void *context), void *context);
+
+#ifdef	__cplusplus
+}
+#endif
+
+#endif	// ASTR_RADIX_H
@@ -0,0 +1,669 @@
+// astr_rope.c - Adept String Rope
+
+/*
+ * A balanced tree of chunks for very large, frequently edited strings.
+ *
+ * Every edit is made from two operations on the tree: split, which cuts a
+ * tree into the characters before and after a position, and join, which
+ * puts two trees together.  Both walk one path from the root, so both are
+ * O(log n).  Join hangs the shorter tree off the side of the taller one at
+ * the height where they match and rebalances on the way back up, the same
+ * way an AVL insert does.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <errno.h>
+
+#include "astr.h"
+#include "astr_rope.h"
+
+// The largest chunk in a leaf.  Leaves smaller than this are merged when
+// they are joined.
+#define ASTR_ROPE_CHUNK_SIZE 4096
+
+static astr_rope_node *astr_rope_leaf(const char *buffer, const size_t length);
+static astr_rope_node *astr_rope_build(const char *buffer, const size_t length);
+static astr_rope_node *astr_rope_join(astr_rope_node *left, astr_rope_node *right);
+static void astr_rope_split(astr_rope_node *node, const size_t position, astr_rope_node **left, astr_rope_node **right);
+static void astr_rope_free_node(astr_rope_node *node);
+
+/*
+ * astr_rope_height
+ *
+ * Get the height of a subtree, 0 if it is empty.
+ */
+static int astr_rope_height(const astr_rope_node *node) {
+	return node == NULL ? 0 : node->height;
+}
+
+/*
+ * astr_rope_node_length
+ *
+ * Get the length of a subtree, 0 if it is empty.
+ */
+static size_t astr_rope_node_length(const astr_rope_node *node) {
+	return node == NULL ? 0 : node->length;
+}
+
+/*
+ * astr_rope_update
+ *
+ * Recalculate the length and height of an internal node from its children.
+ */
+static astr_rope_node *astr_rope_update(astr_rope_node *node) {
+	int left_height = astr_rope_height(node->left);
+	int right_height = astr_rope_height(node->right);
+	node->length = astr_rope_node_length(node->left) + astr_rope_node_length(node->right);
+	node->height = 1 + (left_height > right_height ? left_height : right_height);
+	return node;
+}
+
+/*
+ * astr_rope_rotate_left
+ *
+ * Rotate a subtree left, making the right child the root.
+ */
+static astr_rope_node *astr_rope_rotate_left(astr_rope_node *node) {
+	astr_rope_node *right = node->right;
+	node->right = right->left;
+	right->left = astr_rope_update(node);
+	return astr_rope_update(right);
+}
+
+/*
+ * astr_rope_rotate_right
+ *
+ * Rotate a subtree right, making the left child the root.
+ */
+static astr_rope_node *astr_rope_rotate_right(astr_rope_node *node) {
+	astr_rope_node *left = node->left;
+	node->left = left->right;
+	left->right = astr_rope_update(node);
+	return astr_rope_update(left);
+}
+
+/*
+ * astr_rope_balance
+ *
+ * Restore the balance of an internal node whose children differ in height by
+ * at most two, with a single or double rotation.
+ */
+static astr_rope_node *astr_rope_balance(astr_rope_node *node) {
+	int balance;
+
+	astr_rope_update(node);
+	balance = astr_rope_height(node->left) - astr_rope_height(node->right);
+	if (balance > 1) {
+		if (astr_rope_height(node->left->left) < astr_rope_height(node->left->right)) {
+			node->left = astr_rope_rotate_left(node->left);
+		}
+		return astr_rope_rotate_right(node);
+	}
+	else if (balance < -1) {
+		if (astr_rope_height(node->right->right) < astr_rope_height(node->right->left)) {
+			node->right = astr_rope_rotate_right(node->right);
+		}
+		return astr_rope_rotate_left(node);
+	}
+	return node;
+}
+
+/*
+ * astr_rope_leaf
+ *
+ * Allocate a leaf with a copy of a buffer.
+ */
+static astr_rope_node *astr_rope_leaf(const char *buffer, const size_t length) {
+	astr_rope_node *node = (astr_rope_node *)calloc(1, sizeof(astr_rope_node));
+	if (node != NULL) {
+		node->chunk = (char *)malloc(length > 0 ? length : 1);
+		if (node->chunk == NULL) {
+			free(node);
+			return NULL;
+		}
+		memcpy(node->chunk, buffer, length);
+		node->length = length;
+		node->height = 1;
+	}
+	return node;
+}
+
+/*
+ * astr_rope_build
+ *
+ * Build a balanced tree from a buffer, cut into full chunks.
+ * The chunks are split evenly between the two sides, so the tree is as
+ * balanced as it can be.
+ */
+static astr_rope_node *astr_rope_build(const char *buffer, const size_t length) {
+	astr_rope_node *node;
+	size_t chunks;
+	size_t middle;
+
+	if (length == 0) {
+		return NULL;
+	}
+	if (length <= ASTR_ROPE_CHUNK_SIZE) {
+		return astr_rope_leaf(buffer, length);
+	}
+
+	chunks = (length + ASTR_ROPE_CHUNK_SIZE - 1) / ASTR_ROPE_CHUNK_SIZE;
+	middle = (chunks / 2) * ASTR_ROPE_CHUNK_SIZE;
+	node = (astr_rope_node *)calloc(1, sizeof(astr_rope_node));
+	if (node != NULL) {
+		node->left = astr_rope_build(buffer, middle);
+		node->right = astr_rope_build(buffer + middle, length - middle);
+		astr_rope_update(node);
+	}
+	return node;
+}
+
+/*
+ * astr_rope_join
+ *
+ * Join two trees, with all of the characters of the left tree before all of
+ * the characters of the right tree.  Two small leaves are merged into one.
+ */
+static astr_rope_node *astr_rope_join(astr_rope_node *left, astr_rope_node *right) {
+	astr_rope_node *node;
+	char *chunk;
+
+	if (left == NULL) {
+		return right;
+	}
+	if (right == NULL) {
+		return left;
+	}
+
+	if (left->chunk != NULL && right->chunk != NULL && left->length + right->length <= ASTR_ROPE_CHUNK_SIZE) {
+		chunk = (char *)realloc(left->chunk, left->length + right->length);
+		if (chunk != NULL) {
+			memcpy(chunk + left->length, right->chunk, right->length);
+			left->chunk = chunk;
+			left->length += right->length;
+			astr_rope_free_node(right);
+			return left;
+		}
+	}
+
+	if (left->height > right->height + 1) {
+		left->right = astr_rope_join(left->right, right);
+		return astr_rope_balance(left);
+	}
+	if (right->height > left->height + 1) {
+		right->left = astr_rope_join(left, right->left);
+		return astr_rope_balance(right);
+	}
+
+	node = (astr_rope_node *)calloc(1, sizeof(astr_rope_node));
+	if (node != NULL) {
+		node->left = left;
+		node->right = right;
+		astr_rope_update(node);
+	}
+	return node;
+}
+
+/*
+ * astr_rope_split
+ *
+ * Split a tree at a position: the characters before the position go to the
+ * left tree, the rest to the right tree.  The tree is consumed.
+ */
+static void astr_rope_split(astr_rope_node *node, const size_t position, astr_rope_node **left, astr_rope_node **right) {
+	astr_rope_node *l;
+	astr_rope_node *r;
+	astr_rope_node *a;
+	astr_rope_node *b;
+	size_t left_length;
+
+	if (node == NULL || position == 0) {
+		*left = NULL;
+		*right = node;
+		return;
+	}
+	if (position >= node->length) {
+		*left = node;
+		*right = NULL;
+		return;
+	}
+
+	if (node->chunk != NULL) {
+		*right = astr_rope_leaf(node->chunk + position, node->length - position);
+		node->length = position;
+		*left = node;
+		return;
+	}
+
+	l = node->left;
+	r = node->right;
+	left_length = astr_rope_node_length(l);
+	free(node);
+	if (position < left_length) {
+		astr_rope_split(l, position, &a, &b);
+		*left = a;
+		*right = astr_rope_join(b, r);
+	}
+	else if (position == left_length) {
+		*left = l;
+		*right = r;
+	}
+	else {
+		astr_rope_split(r, position - left_length, &a, &b);
+		*left = astr_rope_join(l, a);
+		*right = b;
+	}
+}
+
+/*
+ * astr_rope_insert_in_chunk
+ *
+ * Insert a buffer at a position without changing the shape of the tree, when
+ * it fits in the leaf that holds the position.
+ *
+ * Returns:   1 if the buffer was inserted, 0 if not
+ */
+static int astr_rope_insert_in_chunk(astr_rope_node *node, const size_t position, const char *buffer, const size_t length) {
+	char *chunk;
+	size_t left_length;
+	int inserted = 0;
+
+	if (node->chunk != NULL) {
+		if (node->length + length <= ASTR_ROPE_CHUNK_SIZE) {
+			chunk = (char *)realloc(node->chunk, node->length + length);
+			if (chunk != NULL) {
+				memmove(chunk + position + length, chunk + position, node->length - position);
+				memcpy(chunk + position, buffer, length);
+				node->chunk = chunk;
+				node->length += length;
+				return 1;
+			}
+		}
+		return 0;
+	}
+
+	left_length = astr_rope_node_length(node->left);
+	if (position <= left_length) {
+		inserted = astr_rope_insert_in_chunk(node->left, position, buffer, length);
+	}
+	if (!inserted && position >= left_length) {
+		inserted = astr_rope_insert_in_chunk(node->right, position - left_length, buffer, length);
+	}
+	if (inserted) {
+		node->length += length;
+	}
+	return inserted;
+}
+
+/*
+ * astr_rope_delete_in_chunk
+ *
+ * Delete characters without changing the shape of the tree, when they are all
+ * in one leaf and do not empty it.
+ *
+ * Returns:   1 if the characters were deleted, 0 if not
+ */
+static int astr_rope_delete_in_chunk(astr_rope_node *node, const size_t position, const size_t length) {
+	size_t left_length;
+	int deleted = 0;
+
+	if (node->chunk != NULL) {
+		if (length < node->length) {
+			memmove(node->chunk + position, node->chunk + position + length, node->length - position - length);
+			node->length -= length;
+			return 1;
+		}
+		return 0;
+	}
+
+	left_length = astr_rope_node_length(node->left);
+	if (position + length <= left_length) {
+		deleted = astr_rope_delete_in_chunk(node->left, position, length);
+	}
+	else if (position >= left_length) {
+		deleted = astr_rope_delete_in_chunk(node->right, position - left_length, length);
+	}
+	if (deleted) {
+		node->length -= length;
+	}
+	return deleted;
+}
+
+/*
+ * astr_rope_free_node
+ *
+ * Free a subtree.
+ */
+static void astr_rope_free_node(astr_rope_node *node) {
+	if (node != NULL) {
+		astr_rope_free_node(node->left);
+		astr_rope_free_node(node->right);
+		free(node->chunk);
+		free(node);
+	}
+}
+
+/*
+ * astr_rope_copy_node
+ *
+ * Copy the characters of a subtree to a destination, adding up the checksum.
+ */
+static char *astr_rope_copy_node(const astr_rope_node *node, char *dst, int *checksum) {
+	const char *s;
+	const char *s_end;
+
+	if (node != NULL) {
+		if (node->chunk != NULL) {
+			s = node->chunk;
+			s_end = node->chunk + node->length;
+			while (s < s_end) {
+				*checksum += *s;
+				*dst++ = *s++;
+			}
+		}
+		else {
+			dst = astr_rope_copy_node(node->left, dst, checksum);
+			dst = astr_rope_copy_node(node->right, dst, checksum);
+		}
+	}
+	return dst;
+}
+
+/*
+ * astr_rope_write_node
+ *
+ * Write the characters of a subtree to a file, one chunk at a time.
+ */
+static int astr_rope_write_node(const astr_rope_node *node, FILE *file) {
+	int result = 0;
+	if (node != NULL) {
+		if (node->chunk != NULL) {
+			if (fwrite(node->chunk, 1, node->length, file) != node->length) {
+				result = (errno != 0 ? errno : EIO);
+			}
+		}
+		else {
+			result = astr_rope_write_node(node->left, file);
+			if (result == 0) {
+				result = astr_rope_write_node(node->right, file);
+			}
+		}
+	}
+	return result;
+}
+
+/*
+ * astr_rope_create
+ *
+ * Create a rope with contents from a string.
+ *
+ * Parameter: The source null-terminated string, or NULL for an empty rope
+ * Returns:   Pointer to the rope
+ */
+astr_rope *astr_rope_create(const char *string) {
+	return astr_rope_create_from_buffer(string, string == NULL ? 0 : strlen(string));
+}
+
+/*
+ * astr_rope_create_from_buffer
+ *
+ * Create a rope with contents from a buffer.
+ * The buffer is copied into a balanced tree of full chunks.
+ *
+ * Parameter: The source buffer
+ * Parameter: The length of the source buffer
+ * Returns:   Pointer to the rope
+ */
+astr_rope *astr_rope_create_from_buffer(const char *buffer, const size_t length) {
+	astr_rope *rope = (astr_rope *)calloc(1, sizeof(astr_rope));
+	if (rope != NULL && buffer != NULL) {
+		rope->root = astr_rope_build(buffer, length);
+	}
+	return rope;
+}
+
+/*
+ * astr_rope_create_from_astr
+ *
+ * Create a rope with contents from an astr instance.
+ *
+ * Parameter: The source astr instance
+ * Returns:   Pointer to the rope
+ */
+astr_rope *astr_rope_create_from_astr(const astr *as) {
+	if (as == NULL || as->string == NULL) {
+		return astr_rope_create(NULL);
+	}
+	return astr_rope_create_from_buffer(as->string, as->length);
+}
+
+/*
+ * astr_rope_length
+ *
+ * Get the length of a rope.
+ *
+ * Parameter: The rope
+ * Returns:   The number of characters in the rope
+ */
+size_t astr_rope_length(const astr_rope *rope) {
+	return rope == NULL ? 0 : astr_rope_node_length(rope->root);
+}
+
+/*
+ * astr_rope_char_at
+ *
+ * Get the character at a position in a rope.
+ *
+ * Parameter: The rope
+ * Parameter: The position
+ * Returns:   The character, or -1 if the position is not in the rope
+ */
+int astr_rope_char_at(const astr_rope *rope, const size_t position) {
+	const astr_rope_node *node;
+	size_t p = position;
+
+	if (rope == NULL || rope->root == NULL || position >= rope->root->length) {
+		return -1;
+	}
+
+	node = rope->root;
+	while (node->chunk == NULL) {
+		if (p < astr_rope_node_length(node->left)) {
+			node = node->left;
+		}
+		else {
+			p -= astr_rope_node_length(node->left);
+			node = node->right;
+		}
+	}
+	return node->chunk[p];
+}
+
+/*
+ * astr_rope_insert
+ *
+ * Insert a string into a rope at a position.
+ *
+ * Parameter: The rope
+ * Parameter: The position, from 0 to the length of the rope
+ * Parameter: The null-terminated string to insert
+ * Returns:   Pointer to the rope
+ */
+astr_rope *astr_rope_insert(astr_rope *rope, const size_t position, const char *string) {
+	if (string == NULL) {
+		return rope;
+	}
+	return astr_rope_insert_buffer(rope, position, string, strlen(string));
+}
+
+/*
+ * astr_rope_insert_buffer
+ *
+ * Insert a buffer into a rope at a position.
+ *
+ * If the buffer fits in the chunk that holds the position, it is inserted in
+ * that chunk.  Otherwise the rope is split at the position and joined back
+ * together around a tree built from the buffer.
+ *
+ * Parameter: The rope
+ * Parameter: The position, from 0 to the length of the rope
+ * Parameter: The buffer to insert
+ * Parameter: The length of the buffer
+ * Returns:   Pointer to the rope
+ */
+astr_rope *astr_rope_insert_buffer(astr_rope *rope, const size_t position, const char *buffer, const size_t length) {
+	astr_rope_node *left;
+	astr_rope_node *right;
+
+	if (rope == NULL || buffer == NULL || length == 0 || position > astr_rope_length(rope)) {
+		return rope;
+	}
+
+	if (rope->root != NULL && astr_rope_insert_in_chunk(rope->root, position, buffer, length)) {
+		return rope;
+	}
+
+	astr_rope_split(rope->root, position, &left, &right);
+	rope->root = astr_rope_join(astr_rope_join(left, astr_rope_build(buffer, length)), right);
+	return rope;
+}
+
+/*
+ * astr_rope_append
+ *
+ * Append a string to a rope.
+ *
+ * Parameter: The rope
+ * Parameter: The null-terminated string to append
+ * Returns:   Pointer to the rope
+ */
+astr_rope *astr_rope_append(astr_rope *rope, const char *string) {
+	return astr_rope_insert(rope, astr_rope_length(rope), string);
+}
+
+/*
+ * astr_rope_delete
+ *
+ * Delete characters from a rope.
+ *
+ * If the characters are all in one chunk, they are deleted from that chunk.
+ * Otherwise the rope is split before and after them, and the two outside
+ * pieces are joined.
+ *
+ * Parameter: The rope
+ * Parameter: The position of the first character to delete
+ * Parameter: The number of characters to delete, cut off at the end of the rope
+ * Returns:   Pointer to the rope
+ */
+astr_rope *astr_rope_delete(astr_rope *rope, const size_t position, const size_t length) {
+	astr_rope_node *left;
+	astr_rope_node *middle;
+	astr_rope_node *right;
+	size_t count = length;
+
+	if (rope == NULL || rope->root == NULL || position >= rope->root->length || length == 0) {
+		return rope;
+	}
+	if (count > rope->root->length - position) {
+		count = rope->root->length - position;
+	}
+
+	if (astr_rope_delete_in_chunk(rope->root, position, count)) {
+		return rope;
+	}
+
+	astr_rope_split(rope->root, position, &left, &right);
+	astr_rope_split(right, count, &middle, &right);
+	astr_rope_free_node(middle);
+	rope->root = astr_rope_join(left, right);
+	return rope;
+}
+
+/*
+ * astr_rope_concat
+ *
+ * Concatenate a rope onto another.
+ * The chunks of the second rope are moved, not copied, and it is left empty.
+ *
+ * Parameter: The rope to be added to
+ * Parameter: The rope to add, which is emptied
+ * Returns:   Pointer to the first rope
+ */
+astr_rope *astr_rope_concat(astr_rope *rope, astr_rope *other) {
+	if (rope != NULL && other != NULL && rope != other) {
+		rope->root = astr_rope_join(rope->root, other->root);
+		other->root = NULL;
+	}
+	return rope;
+}
+
+/*
+ * astr_rope_to_astr
+ *
+ * Allocate a new astr with the contents of a rope.
+ * The string is allocated once, at its full length, and the checksum is
+ * added up while the chunks are copied.
+ *
+ * Parameter: The rope
+ * Returns:   Pointer to the astr instance, or NULL if the rope is too long
+ *            for an astr or the astr could not be allocated
+ */
+astr *astr_rope_to_astr(const astr_rope *rope) {
+	astr *as;
+	size_t length = astr_rope_length(rope);
+
+	if (length >= INT_MAX) {
+		return NULL;
+	}
+
+	as = astr_create_empty();
+	if (as != NULL) {
+		as->storage = as->string = (char *)calloc(length + 1, sizeof(char));
+		if (as->string == NULL) {
+			return astr_free(as);
+		}
+		as->allocated_length = length + 1;
+		as->length = length;
+		as->codepoint_length = -1;
+		as->hash = 0;
+		if (rope != NULL) {
+			astr_rope_copy_node(rope->root, as->string, &as->checksum);
+		}
+	}
+	return as;
+}
+
+/*
+ * astr_rope_write
+ *
+ * Write the contents of a rope to a file, one chunk at a time, without
+ * flattening it.
+ *
+ * Parameter: The rope
+ * Parameter: The file, open for writing
+ * Returns:   0 = success, non-zero = errno value from the failed operation
+ */
+int astr_rope_write(const astr_rope *rope, FILE *file) {
+	if (rope == NULL || file == NULL) {
+		return EINVAL;
+	}
+	return astr_rope_write_node(rope->root, file);
+}
+
+/*
+ * astr_rope_free
+ *
+ * Free a rope and all of its chunks.
+ *
+ * Parameter: The rope
+ * Returns:   NULL pointer
+ */
+astr_rope *astr_rope_free(astr_rope *rope) {
+	if (rope != NULL) {
+		astr_rope_free_node(rope->root);
+		free(rope);
+	}
+	return NULL;
+}
@@ -0,0 +1,95 @@
+// astr_rope.h - Adept String Rope
+
+#ifndef ASTR_ROPE_H
+#define ASTR_ROPE_H
+
+#include <stdio.h>
+
+#include "astr.h"
+
+/*
+ * An astr_rope holds a very large string as a balanced tree of chunks, for
+ * strings that are edited in the middle.  Inserting into or deleting from an
+ * astr moves every character after the edit; in a rope the tree is split at
+ * the edit and joined back together, which costs O(log n) no matter where the
+ * edit is.  Two ropes are concatenated the same way.
+ *
+ * The tree is an AVL tree: the heights of the two children of every node
+ * differ by at most one.  The characters are in the leaves, in chunks of at
+ * most a few kilobytes, and each node holds the length of its subtree, so a
+ * position is found by walking down from the root.  Small edits that fit in
+ * one chunk are made in that chunk without changing the tree.
+ *
+ * Positions and lengths are byte counts.  A rope can be flattened back into
+ * an astr when a contiguous string is needed, or written out chunk by chunk
+ * without ever being flattened.
+ */
+
+typedef struct astr_rope_node {
+	// The children of an internal node, both NULL for a leaf
+	struct astr_rope_node *left;
+	struct astr_rope_node *right;
+
+	// The characters of a leaf, not null-terminated; NULL for an internal node
+	char *chunk;
+
+	// Number of characters in this subtree
+	size_t length;
+
+	// Height of this subtree, 1 for a leaf
+	int height;
+} astr_rope_node;
+
+typedef struct astr_rope {
+	// The root of the tree, NULL when the rope is empty
+	astr_rope_node *root;
+} astr_rope;
+
+#ifdef	__cplusplus
+extern "C" {
+#endif
+
+// Create a rope with contents from a string.
+astr_rope *astr_rope_create(const char *string);
+
+// Create a rope with contents from a buffer.
+astr_rope *astr_rope_create_from_buffer(const char *buffer, const size_t length);
+
+// Create a rope with contents from an astr instance.
+astr_rope *astr_rope_create_from_astr(const astr *as);
+
+// Get the length of a rope.
+size_t astr_rope_length(const astr_rope *rope);
+
+// Get the character at a position in a rope.
+int astr_rope_char_at(const astr_rope *rope, const size_t position);
+
+// Insert a string into a rope at a position.
+astr_rope *astr_rope_insert(astr_rope *rope, const size_t position, const char *string);
+
+// Insert a buffer into a rope at a position.
+astr_rope *astr_rope_insert_buffer(astr_rope *rope, const size_t position, const char *buffer, const size_t length);
+
+// Append a string to a rope.
+astr_rope *astr_rope_append(astr_rope *rope, const char *string);
+
+// Delete characters from a rope.
+astr_rope *astr_rope_delete(astr_rope *rope, const size_t position, const size_t length);
+
+// Concatenate a rope onto another, emptying the second rope.
+astr_rope *astr_rope_concat(astr_rope *rope, astr_rope *other);
+
+// Allocate a new astr with the contents of a rope.
+astr *astr_rope_to_astr(const astr_rope *rope);
+
+// Write the contents of a rope to a file.
+int astr_rope_write(const astr_rope *rope, FILE *file);
+
+// Free a rope.
+astr_rope *astr_rope_free(astr_rope *rope);
+
+#ifdef	__cplusplus
+}
+#endif
+
+#endif	// ASTR_ROPE_H
@@ -0,0 +1,268 @@
+// astr_searches.c - Adept String Searches
+
+/*
+ * Functions to find substrings in an astr instance and to replace them.
+ *
+ * All of the searches use astr_search_buffer.  A one-character needle is
+ * found with memchr.  Longer needles are found with SSE2 by comparing the
+ * first and last characters of the needle against 16 candidate positions at
+ * a time, and only comparing the whole needle where both match; that filter
+ * rejects almost every position in ordinary text without a branch per byte.
+ * The tail of the haystack, and processors without SSE2, use memmem, which
+ * is a Two-Way search in the GNU C library.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include "astr.h"
+
+/*
+ * astr_search_buffer
+ *
+ * Find the first occurrence of a needle in a haystack.
+ * Neither buffer needs to be null-terminated.
+ *
+ * Parameter: The haystack
+ * Parameter: The length of the haystack
+ * Parameter: The needle
+ * Parameter: The length of the needle
+ * Returns:   Pointer to the first occurrence of the needle in the haystack,
+ *            the haystack if the needle is empty,
+ *            or NULL if the needle was not found
+ */
+const char *astr_search_buffer(const char *haystack, const int haystack_length, const char *needle, const int needle_length) {
+	const char *h = haystack;
+	const char *h_end;
+	int bits;
+	int bit;
+#if defined(__SSE2__)
+	__m128i first;
+	__m128i last;
+	__m128i block_first;
+	__m128i block_last;
+#endif
+
+	if (haystack == NULL || needle == NULL || needle_length > haystack_length) {
+		return NULL;
+	}
+	if (needle_length <= 0) {
+		return haystack;
+	}
+	if (needle_length == 1) {
+		return (const char *)memchr(haystack, *needle, haystack_length);
+	}
+
+	// The last position where the needle can start.
+	h_end = haystack + haystack_length - needle_length;
+
+#if defined(__SSE2__)
+	first = _mm_set1_epi8(needle[0]);
+	last = _mm_set1_epi8(needle[needle_length - 1]);
+	while (h + 16 <= h_end + 1) {
+		block_first = _mm_loadu_si128((const __m128i *)h);
+		block_last = _mm_loadu_si128((const __m128i *)(h + needle_length - 1));
+		bits = _mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(block_first, first), _mm_cmpeq_epi8(block_last, last)));
+		while (bits != 0) {
+			bit = __builtin_ctz(bits);
+			if (memcmp(h + bit + 1, needle + 1, needle_length - 2) == 0) {
+				return h + bit;
+			}
+			bits &= bits - 1;
+		}
+		h += 16;
+	}
+#else
+	(void)bits;
+	(void)bit;
+#endif
+
+	return (const char *)memmem(h, (h_end - h) + needle_length, needle, needle_length);
+}
+
+/*
+ * astr_find
+ *
+ * Find a substring in the string of an astr instance.
+ *
+ * Parameter: The astr instance to be searched
+ * Parameter: The null-terminated substring to find
+ * Parameter: The index in the string to start searching from
+ * Returns:   The index of the first occurrence of the substring at or after
+ *            the start, or -1 if it was not found
+ */
+int astr_find(const astr *as, const char *needle, const int start) {
+	const char *found;
+	if (as == NULL || as->string == NULL || needle == NULL || start < 0 || start > as->length) {
+		return -1;
+	}
+
+	found = astr_search_buffer(as->string + start, as->length - start, needle, strlen(needle));
+	return found == NULL ? -1 : found - as->string;
+}
+
+/*
+ * astr_find_all
+ *
+ * Find every occurrence of a substring in the string of an astr instance.
+ * Occurrences do not overlap; the search resumes after each one found.
+ * An empty substring is not found.
+ *
+ * The caller must free the returned array.
+ *
+ * Parameter: The astr instance to be searched
+ * Parameter: The null-terminated substring to find
+ * Parameter: Pointer to the number of occurrences found
+ * Returns:   Pointer to an allocated array of the indexes of the occurrences,
+ *            or NULL if there were none or the array could not be allocated
+ */
+int *astr_find_all(const astr *as, const char *needle, int *count) {
+	const char *s;
+	const char *s_end;
+	const char *found;
+	int needle_length;
+	int *indexes = NULL;
+	int *newindexes;
+	int allocated = 0;
+	int n = 0;
+
+	if (count != NULL) {
+		*count = 0;
+	}
+	if (as == NULL || as->string == NULL || needle == NULL || *needle == '\0') {
+		return NULL;
+	}
+
+	needle_length = strlen(needle);
+	s = as->string;
+	s_end = as->string + as->length;
+	while ((found = astr_search_buffer(s, s_end - s, needle, needle_length)) != NULL) {
+		if (n == allocated) {
+			allocated = (allocated == 0 ? 16 : allocated * 2);
+			newindexes = (int *)realloc(indexes, allocated * sizeof(int));
+			if (newindexes == NULL) {
+				free(indexes);
+				return NULL;
+			}
+			indexes = newindexes;
+		}
+		indexes[n++] = found - as->string;
+		s = found + needle_length;
+	}
+
+	if (count != NULL) {
+		*count = n;
+	}
+	return indexes;
+}
+
+/*
+ * astr_replace_all
+ *
+ * Replace every occurrence of a substring in the string of an astr instance.
+ * Occurrences do not overlap; the search resumes after each one replaced.
+ *
+ * The occurrences are counted first, so the length of the result is known
+ * before anything is copied.  When the replacement is no longer than the
+ * substring the string is rewritten in place; otherwise the result is built
+ * in one new allocation of exactly the right size.  The checksum is adjusted
+ * by the difference between the substring and the replacement for each
+ * occurrence instead of being recalculated.
+ *
+ * Parameter: The astr instance to be edited
+ * Parameter: The null-terminated substring to replace
+ * Parameter: The null-terminated replacement
+ * Returns:   Pointer to the astr instance
+ */
+astr *astr_replace_all(astr *as, const char *needle, const char *replacement) {
+	const char *s;
+	const char *s_end;
+	const char *found;
+	char *d;
+	char *newstorage;
+	int needle_length;
+	int replacement_length;
+	int needle_checksum = 0;
+	int replacement_checksum = 0;
+	int count = 0;
+	size_t newlength;
+	size_t run;
+	int i;
+
+	if (as == NULL || as->string == NULL || needle == NULL || *needle == '\0' || replacement == NULL) {
+		return as;
+	}
+
+	needle_length = strlen(needle);
+	replacement_length = strlen(replacement);
+
+	s = as->string;
+	s_end = as->string + as->length;
+	while ((found = astr_search_buffer(s, s_end - s, needle, needle_length)) != NULL) {
+		count++;
+		s = found + needle_length;
+	}
+	if (count == 0) {
+		return as;
+	}
+
+	for (i = 0; i < needle_length; i++) {
+		needle_checksum += needle[i];
+	}
+	for (i = 0; i < replacement_length; i++) {
+		replacement_checksum += replacement[i];
+	}
+	newlength = as->length + (size_t)count * (replacement_length - needle_length);
+
+	if (replacement_length <= needle_length) {
+		// The result is never ahead of the source, so copy forward in place.
+		d = as->string;
+		s = as->string;
+		while ((found = astr_search_buffer(s, s_end - s, needle, needle_length)) != NULL) {
+			run = found - s;
+			if (d != s) {
+				memmove(d, s, run);
+			}
+			d += run;
+			memcpy(d, replacement, replacement_length);
+			d += replacement_length;
+			s = found + needle_length;
+		}
+		memmove(d, s, s_end - s);
+		d += s_end - s;
+		memset(d, '\0', as->length - newlength);
+	}
+	else {
+		newstorage = (char *)calloc(newlength + 1, sizeof(char));
+		if (newstorage == NULL) {
+			return as;
+		}
+		d = newstorage;
+		s = as->string;
+		while ((found = astr_search_buffer(s, s_end - s, needle, needle_length)) != NULL) {
+			run = found - s;
+			memcpy(d, s, run);
+			d += run;
+			memcpy(d, replacement, replacement_length);
+			d += replacement_length;
+			s = found + needle_length;
+		}
+		memcpy(d, s, s_end - s);
+		free(as->storage);
+		as->storage = as->string = newstorage;
+		as->allocated_length = newlength + 1;
+	}
+
+	as->length = newlength;
+	as->checksum += count * (replacement_checksum - needle_checksum);
+	as->tokenend = NULL;
+	as->codepoint_length = -1;
+	as->hash = 0;
+	return as;
+}
@@ -0,0 +1,574 @@
+// astr_sorting.c - Adept String Sorting
+
+/*
+ * Functions to sort arrays of astr instances into the order of astr_compare.
+ *
+ * Sorting with qsort and astr_compare follows a pointer and calls strcmp for
+ * every comparison.  These functions first make an array of entries, each
+ * with a pointer to an astr instance and a key: the next eight bytes of the
+ * string, packed big-endian into an integer so that comparing keys compares
+ * the bytes in order.  Most comparisons are settled by the keys, in the
+ * entry array, without touching the strings.
+ *
+ * astr_sort is a multikey quicksort on the keys.  Entries with equal keys are
+ * gathered into one partition, and if their strings go on past the key, the
+ * next eight bytes are loaded into the keys and the partition is sorted on
+ * those.  The pivot of a large partition is the median of nine keys, so
+ * sorted and reversed input split evenly, and a partition that is split
+ * badly too many times is finished by heapsort.  astr_sort_stable is a
+ * merge sort that compares the keys first and the rest of the strings only
+ * when the keys are equal.  astr_sort_parallel sorts slices of the array in
+ * threads and merges the slices.
+ *
+ * NULL instances sort first, then instances with a NULL string, as in
+ * astr_compare.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <pthread.h>
+
+#include "astr.h"
+
+// Partitions this small are sorted by insertion.
+#define ASTR_SORT_INSERTION_SIZE 16
+
+// Partitions this large take the pivot from nine keys instead of three.
+#define ASTR_SORT_NINTHER_SIZE 128
+
+// Arrays smaller than this are not worth sorting in threads.
+#define ASTR_SORT_PARALLEL_MINIMUM 16384
+
+// The most threads a parallel sort will start.
+#define ASTR_SORT_MAX_THREADS 64
+
+typedef struct astr_sort_entry {
+	// The key: eight bytes of the string from the current depth, big-endian
+	uint64_t key;
+
+	// The astr instance
+	astr *as;
+} astr_sort_entry;
+
+typedef struct astr_sort_slice {
+	astr_sort_entry *entries;
+	astr_sort_entry *work;
+	size_t count;
+	int stable;
+} astr_sort_slice;
+
+/*
+ * astr_sort_key
+ *
+ * Load the eight bytes of a string at a depth as a big-endian key.  Bytes
+ * past the end of the string are zero, the same as the terminator.
+ */
+static uint64_t astr_sort_key(const astr *as, size_t depth) {
+	unsigned char bytes[8] = { 0 };
+	size_t available;
+	uint64_t key;
+
+	if (as->length > depth) {
+		available = as->length - depth;
+		memcpy(bytes, as->string + depth, available < 8 ? available : 8);
+	}
+	memcpy(&key, bytes, 8);
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+	key = __builtin_bswap64(key);
+#endif
+	return key;
+}
+
+/*
+ * astr_sort_compare_entries
+ *
+ * Compare two entries whose keys were loaded at a depth: by the keys, then
+ * by the rest of the strings when the keys are equal and the strings go on.
+ */
+static int astr_sort_compare_entries(const astr_sort_entry *e1, const astr_sort_entry *e2, size_t depth) {
+	if (e1->key != e2->key) {
+		return e1->key < e2->key ? -1 : 1;
+	}
+	if (e1->as->length < depth + 8) {
+		// The key holds the end of the string, so the strings are equal.
+		return 0;
+	}
+	return strcmp(e1->as->string + depth + 8, e2->as->string + depth + 8);
+}
+
+/*
+ * astr_sort_insertion
+ *
+ * Sort a few entries by insertion, with keys loaded at a depth.
+ */
+static void astr_sort_insertion(astr_sort_entry *entries, size_t count, size_t depth) {
+	astr_sort_entry entry;
+	size_t i;
+	size_t j;
+
+	for (i = 1; i < count; i++) {
+		entry = entries[i];
+		for (j = i; j > 0 && astr_sort_compare_entries(&entry, &entries[j - 1], depth) < 0; j--) {
+			entries[j] = entries[j - 1];
+		}
+		entries[j] = entry;
+	}
+}
+
+/*
+ * astr_sort_median
+ *
+ * Get the median of three keys.
+ */
+static uint64_t astr_sort_median(uint64_t a, uint64_t b, uint64_t c) {
+	return (a < b) ? ((b < c) ? b : ((a < c) ? c : a)) : ((a < c) ? a : ((b < c) ? c : b));
+}
+
+/*
+ * astr_sort_pivot
+ *
+ * Choose a pivot key: the median of three keys for a small partition, and
+ * the median of the medians of three groups of three, spread across it, for
+ * a larger one, so sorted, reversed and partly sorted runs split evenly.
+ */
+static uint64_t astr_sort_pivot(const astr_sort_entry *entries, size_t count) {
+	size_t step;
+
+	if (count < ASTR_SORT_NINTHER_SIZE) {
+		return astr_sort_median(entries[0].key, entries[count / 2].key, entries[count - 1].key);
+	}
+	step = count / 8;
+	return astr_sort_median(
+		astr_sort_median(entries[0].key, entries[step].key, entries[2 * step].key),
+		astr_sort_median(entries[count / 2 - step].key, entries[count / 2].key, entries[count / 2 + step].key),
+		astr_sort_median(entries[count - 1 - 2 * step].key, entries[count - 1 - step].key, entries[count - 1].key));
+}
+
+/*
+ * astr_sort_sift
+ *
+ * Sift an entry down a heap of entries, with keys loaded at a depth.
+ */
+static void astr_sort_sift(astr_sort_entry *entries, size_t root, size_t count, size_t depth) {
+	astr_sort_entry entry = entries[root];
+	size_t child;
+
+	while ((child = 2 * root + 1) < count) {
+		if (child + 1 < count && astr_sort_compare_entries(&entries[child], &entries[child + 1], depth) < 0) {
+			child++;
+		}
+		if (astr_sort_compare_entries(&entry, &entries[child], depth) >= 0) {
+			break;
+		}
+		entries[root] = entries[child];
+		root = child;
+	}
+	entries[root] = entry;
+}
+
+/*
+ * astr_sort_heap
+ *
+ * Sort entries by heapsort, with keys loaded at a depth.  Slower than the
+ * multikey quicksort on most input, but never worse than n log n, so it
+ * finishes a partition the quicksort keeps splitting badly.
+ */
+static void astr_sort_heap(astr_sort_entry *entries, size_t count, size_t depth) {
+	astr_sort_entry swap;
+	size_t i;
+
+	for (i = count / 2; i > 0; i--) {
+		astr_sort_sift(entries, i - 1, count, depth);
+	}
+	for (i = count - 1; i > 0; i--) {
+		swap = entries[0];
+		entries[0] = entries[i];
+		entries[i] = swap;
+		astr_sort_sift(entries, 0, i, depth);
+	}
+}
+
+/*
+ * astr_sort_limit
+ *
+ * Get the number of bad splits to allow in sorting a partition before
+ * finishing it by heapsort: twice the base 2 logarithm of its size.
+ */
+static int astr_sort_limit(size_t count) {
+	int limit = 0;
+
+	while (count > 1) {
+		count >>= 1;
+		limit += 2;
+	}
+	return limit;
+}
+
+/*
+ * astr_sort_multikey
+ *
+ * Sort entries by multikey quicksort, with keys loaded at a depth.
+ *
+ * The entries are partitioned three ways around a pivot key.  The smaller and
+ * larger partitions are sorted at the same depth.  The entries equal to the
+ * pivot are done if the pivot key holds the end of its string; otherwise
+ * their keys are reloaded eight bytes deeper and they are sorted again.
+ *
+ * The two smallest of the three partitions are sorted by recursion and the
+ * largest in the loop, so the recursion is no deeper than the base 2
+ * logarithm of the count.  After the limit of splits at a depth, the
+ * partition is finished by heapsort.
+ *
+ * Parameter: The entries
+ * Parameter: The number of entries
+ * Parameter: The depth of the keys, in bytes
+ * Parameter: The number of splits left before heapsort
+ */
+static void astr_sort_multikey(astr_sort_entry *entries, size_t count, size_t depth, int limit) {
+	astr_sort_entry swap;
+	astr_sort_entry *part[3];
+	size_t counts[3];
+	size_t depths[3];
+	uint64_t pivot;
+	size_t lt;
+	size_t gt;
+	size_t i;
+	int largest;
+	int p;
+
+	while (count > ASTR_SORT_INSERTION_SIZE) {
+		if (limit-- <= 0) {
+			astr_sort_heap(entries, count, depth);
+			return;
+		}
+		pivot = astr_sort_pivot(entries, count);
+
+		// entries[0, lt) < pivot, entries[lt, i) == pivot, entries(gt, count) > pivot
+		lt = 0;
+		i = 0;
+		gt = count;
+		while (i < gt) {
+			if (entries[i].key < pivot) {
+				swap = entries[lt];
+				entries[lt++] = entries[i];
+				entries[i++] = swap;
+			}
+			else if (entries[i].key > pivot) {
+				swap = entries[--gt];
+				entries[gt] = entries[i];
+				entries[i] = swap;
+			}
+			else {
+				i++;
+			}
+		}
+
+		part[0] = entries;
+		counts[0] = lt;
+		depths[0] = depth;
+		part[1] = entries + lt;
+		counts[1] = gt - lt;
+		depths[1] = depth + 8;
+		part[2] = entries + gt;
+		counts[2] = count - gt;
+		depths[2] = depth;
+
+		// The entries equal to the pivot go on eight bytes deeper, if the strings do.
+		if (part[1][0].as->length < depth + 8) {
+			counts[1] = 0;
+		}
+		else {
+			for (i = 0; i < counts[1]; i++) {
+				part[1][i].key = astr_sort_key(part[1][i].as, depth + 8);
+			}
+		}
+
+		largest = 0;
+		for (p = 1; p < 3; p++) {
+			if (counts[p] > counts[largest]) {
+				largest = p;
+			}
+		}
+		for (p = 0; p < 3; p++) {
+			if (p != largest && counts[p] > 1) {
+				astr_sort_multikey(part[p], counts[p], depths[p], (p == 1 ? astr_sort_limit(counts[p]) : limit));
+			}
+		}
+
+		// A new depth is a fresh start, not a bad split.
+		if (largest == 1) {
+			limit = astr_sort_limit(counts[1]);
+		}
+		entries = part[largest];
+		count = counts[largest];
+		depth = depths[largest];
+	}
+	astr_sort_insertion(entries, count, depth);
+}
+
+/*
+ * astr_sort_merge
+ *
+ * Merge two sorted runs of entries, with keys loaded at depth 0, into a
+ * destination.  Entries from the first run go first when they are equal, so
+ * the merge is stable.
+ */
+static void astr_sort_merge(const astr_sort_entry *run1, size_t count1, const astr_sort_entry *run2, size_t count2, astr_sort_entry *dst) {
+	const astr_sort_entry *end1 = run1 + count1;
+	const astr_sort_entry *end2 = run2 + count2;
+
+	while (run1 < end1 && run2 < end2) {
+		if (astr_sort_compare_entries(run2, run1, 0) < 0) {
+			*dst++ = *run2++;
+		}
+		else {
+			*dst++ = *run1++;
+		}
+	}
+	while (run1 < end1) {
+		*dst++ = *run1++;
+	}
+	while (run2 < end2) {
+		*dst++ = *run2++;
+	}
+}
+
+/*
+ * astr_sort_merge_sort
+ *
+ * Sort entries stably, with keys loaded at depth 0, using a work array of the
+ * same size.  Runs are sorted by insertion and then merged bottom up, back
+ * and forth between the two arrays.
+ */
+static void astr_sort_merge_sort(astr_sort_entry *entries, astr_sort_entry *work, size_t count) {
+	astr_sort_entry *src = entries;
+	astr_sort_entry *dst = work;
+	astr_sort_entry *swap;
+	size_t width;
+	size_t i;
+	size_t middle;
+	size_t end;
+
+	for (i = 0; i < count; i += ASTR_SORT_INSERTION_SIZE) {
+		astr_sort_insertion(entries + i, (count - i < ASTR_SORT_INSERTION_SIZE ? count - i : ASTR_SORT_INSERTION_SIZE), 0);
+	}
+
+	for (width = ASTR_SORT_INSERTION_SIZE; width < count; width *= 2) {
+		for (i = 0; i < count; i += 2 * width) {
+			middle = (i + width < count ? i + width : count);
+			end = (i + 2 * width < count ? i + 2 * width : count);
+			astr_sort_merge(src + i, middle - i, src + middle, end - middle, dst + i);
+		}
+		swap = src;
+		src = dst;
+		dst = swap;
+	}
+
+	if (src != entries) {
+		memcpy(entries, src, count * sizeof(astr_sort_entry));
+	}
+}
+
+/*
+ * astr_sort_slice_thread
+ *
+ * Sort one slice of the entries, in a thread of a parallel sort.
+ */
+static void *astr_sort_slice_thread(void *arg) {
+	astr_sort_slice *slice = (astr_sort_slice *)arg;
+	size_t i;
+
+	if (slice->stable) {
+		astr_sort_merge_sort(slice->entries, slice->work, slice->count);
+	}
+	else {
+		astr_sort_multikey(slice->entries, slice->count, 0, astr_sort_limit(slice->count));
+		// The merges compare keys from the start of the strings again.
+		for (i = 0; i < slice->count; i++) {
+			slice->entries[i].key = astr_sort_key(slice->entries[i].as, 0);
+		}
+	}
+	return NULL;
+}
+
+/*
+ * astr_sort_entries
+ *
+ * Sort an array of astr instances: move the NULL instances and NULL strings
+ * to the front, keeping their order, then sort the rest as entries.
+ *
+ * Parameter: The array of astr instances
+ * Parameter: The number of astr instances
+ * Parameter: 1 to keep equal instances in order, 0 if not
+ * Parameter: The number of threads to use, 1 or less for none
+ * Returns:   Pointer to the array, or NULL if the entries could not be allocated
+ */
+static astr **astr_sort_entries(astr **asa, size_t count, int stable, int threads) {
+	astr_sort_entry *entries;
+	astr_sort_entry *work = NULL;
+	astr_sort_slice slices[ASTR_SORT_MAX_THREADS];
+	pthread_t thread_ids[ASTR_SORT_MAX_THREADS];
+	int started[ASTR_SORT_MAX_THREADS];
+	size_t null_instances = 0;
+	size_t null_strings = 0;
+	size_t front = 0;
+	size_t nulls;
+	size_t n = 0;
+	size_t i;
+	size_t begin;
+	int t;
+	int slices_left;
+
+	if (asa == NULL) {
+		return NULL;
+	}
+
+	// Count the NULL instances and NULL strings, to size the entries.
+	for (i = 0; i < count; i++) {
+		if (asa[i] == NULL) {
+			null_instances++;
+		}
+		else if (asa[i]->string == NULL) {
+			null_strings++;
+		}
+	}
+	nulls = null_instances + null_strings;
+	entries = (astr_sort_entry *)malloc((count > nulls ? count - nulls : 1) * sizeof(astr_sort_entry));
+	if (entries == NULL) {
+		return NULL;
+	}
+
+	// In one pass, copy the strings to the entries and the NULL strings to
+	// the front, in order; no string is overwritten before it is copied.
+	for (i = 0; i < count; i++) {
+		if (asa[i] == NULL) {
+			continue;
+		}
+		if (asa[i]->string == NULL) {
+			asa[front++] = asa[i];
+		}
+		else {
+			entries[n].as = asa[i];
+			entries[n].key = astr_sort_key(asa[i], 0);
+			n++;
+		}
+	}
+
+	// NULL instances first, then NULL strings.
+	memmove(asa + null_instances, asa, null_strings * sizeof(astr *));
+	for (i = 0; i < null_instances; i++) {
+		asa[i] = NULL;
+	}
+	if (n < 2) {
+		for (i = 0; i < n; i++) {
+			asa[nulls + i] = entries[i].as;
+		}
+		free(entries);
+		return asa;
+	}
+
+	if (stable || threads > 1) {
+		work = (astr_sort_entry *)malloc(n * sizeof(astr_sort_entry));
+		if (work == NULL) {
+			free(entries);
+			return NULL;
+		}
+	}
+
+	if (threads > ASTR_SORT_MAX_THREADS) {
+		threads = ASTR_SORT_MAX_THREADS;
+	}
+	if (threads > 1 && n >= ASTR_SORT_PARALLEL_MINIMUM) {
+		// Sort a slice in each thread; a slice whose thread will not start is sorted here.
+		for (t = 0; t < threads; t++) {
+			begin = n * t / threads;
+			slices[t].entries = entries + begin;
+			slices[t].work = work + begin;
+			slices[t].count = n * (t + 1) / threads - begin;
+			slices[t].stable = stable;
+			started[t] = (pthread_create(&thread_ids[t], NULL, astr_sort_slice_thread, &slices[t]) == 0);
+			if (!started[t]) {
+				astr_sort_slice_thread(&slices[t]);
+			}
+		}
+		for (t = 0; t < threads; t++) {
+			if (started[t]) {
+				pthread_join(thread_ids[t], NULL);
+			}
+		}
+
+		// Merge neighboring slices until there is one.
+		slices_left = threads;
+		while (slices_left > 1) {
+			for (t = 0; t + 1 < slices_left; t += 2) {
+				astr_sort_merge(slices[t].entries, slices[t].count, slices[t + 1].entries, slices[t + 1].count, slices[t].work);
+				memcpy(slices[t].entries, slices[t].work, (slices[t].count + slices[t + 1].count) * sizeof(astr_sort_entry));
+				slices[t].count += slices[t + 1].count;
+			}
+			for (t = 0; t < slices_left; t += 2) {
+				slices[t / 2] = slices[t];
+			}
+			slices_left = (slices_left + 1) / 2;
+		}
+	}
+	else if (stable) {
+		astr_sort_merge_sort(entries, work, n);
+	}
+	else {
+		astr_sort_multikey(entries, n, 0, astr_sort_limit(n));
+	}
+
+	for (i = 0; i < n; i++) {
+		asa[nulls + i] = entries[i].as;
+	}
+	free(work);
+	free(entries);
+	return asa;
+}
+
+/*
+ * astr_sort
+ *
+ * Sort an array of astr instances into the order of astr_compare.
+ * Equal instances may not stay in their original order.
+ *
+ * Parameter: The array of astr instances
+ * Parameter: The number of astr instances
+ * Returns:   Pointer to the array, or NULL if memory could not be allocated
+ */
+astr **astr_sort(astr **asa, size_t count) {
+	return astr_sort_entries(asa, count, 0, 1);
+}
+
+/*
+ * astr_sort_stable
+ *
+ * Sort an array of astr instances into the order of astr_compare, keeping
+ * equal instances in their original order.
+ *
+ * Parameter: The array of astr instances
+ * Parameter: The number of astr instances
+ * Returns:   Pointer to the array, or NULL if memory could not be allocated
+ */
+astr **astr_sort_stable(astr **asa, size_t count) {
+	return astr_sort_entries(asa, count, 1, 1);
+}
+
+/*
+ * astr_sort_parallel
+ *
+ * Sort an array of astr instances into the order of astr_compare, in
+ * threads.  The array is cut into one slice per thread, the slices are
+ * sorted at the same time, and then neighboring slices are merged.  Small
+ * arrays are sorted without threads.
+ *
+ * Parameter: The array of astr instances
+ * Parameter: The number of astr instances
+ * Parameter: The number of threads
+ * Parameter: 1 to keep equal instances in order, 0 if not
+ * Returns:   Pointer to the array, or NULL if memory could not be allocated
+ */
+astr **astr_sort_parallel(astr **asa, size_t count, int threads, int stable) {
+	return astr_sort_entries(asa, count, stable, threads);
+}
@@ -0,0 +1,524 @@
+// astr_utf8.c - Adept String UTF-8
+
+/*
+ * Functions to validate, count, decode, and encode UTF-8, and to classify and
+ * case-map the code points.
+ *
+ * Validation uses the lookup algorithm of Keiser and Lemire when the processor
+ * supports SSSE3: every 16-byte block is checked with three table lookups and
+ * a few logical operations, with no branches on the data.  Blocks of ASCII
+ * skip the lookups.  Other processors use a scalar validator that skips ASCII
+ * eight bytes at a time.
+ *
+ * Classification and case mapping of code points outside ASCII use the
+ * C.UTF-8 locale, loaded once by whichever thread needs it first, independent
+ * of the locale of the program.  If no UTF-8 locale is available only ASCII
+ * characters are classified and mapped.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <locale.h>
+#include <wctype.h>
+#include <pthread.h>
+
+#include "astr.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define ASTR_UTF8_SSSE3 1
+#include <immintrin.h>
+#endif
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+static int astr_utf8_validate_scalar(const unsigned char *s, int length);
+static locale_t astr_utf8_locale();
+
+static pthread_once_t astr_utf8_locale_once = PTHREAD_ONCE_INIT;
+static locale_t astr_utf8_locale_loaded = (locale_t)0;
+
+#ifdef ASTR_UTF8_SSSE3
+
+// Error bits of the lookup algorithm.
+#define TOO_SHORT      (1 << 0)
+#define TOO_LONG       (1 << 1)
+#define OVERLONG_3     (1 << 2)
+#define TOO_LARGE      (1 << 3)
+#define SURROGATE      (1 << 4)
+#define OVERLONG_2     (1 << 5)
+#define TOO_LARGE_1000 (1 << 6)
+#define OVERLONG_4     (1 << 6)
+#define TWO_CONTS      (1 << 7)
+#define CARRY          (TOO_SHORT | TOO_LONG | TWO_CONTS)
+
+__attribute__((target("ssse3")))
+static __m128i astr_utf8_check_block(__m128i input, __m128i prev_input) {
+	const __m128i nibble_mask = _mm_set1_epi8(0x0F);
+	// Indexed by the high nibble of the first byte of a pair.
+	const __m128i byte_1_high_table = _mm_setr_epi8(
+		TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG,
+		TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG,
+		(char)TWO_CONTS, (char)TWO_CONTS, (char)TWO_CONTS, (char)TWO_CONTS,
+		TOO_SHORT | OVERLONG_2,
+		TOO_SHORT,
+		TOO_SHORT | OVERLONG_3 | SURROGATE,
+		TOO_SHORT | TOO_LARGE | TOO_LARGE_1000 | OVERLONG_4);
+	// Indexed by the low nibble of the first byte of a pair.
+	const __m128i byte_1_low_table = _mm_setr_epi8(
+		(char)(CARRY | OVERLONG_3 | OVERLONG_2 | OVERLONG_4),
+		(char)(CARRY | OVERLONG_2),
+		(char)CARRY,
+		(char)CARRY,
+		(char)(CARRY | TOO_LARGE),
+		(char)(CARRY | TOO_LARGE | TOO_LARGE_1000),
+		(char)(CARRY | TOO_LARGE | TOO_LARGE_1000),
+		(char)(CARRY | TOO_LARGE | TOO_LARGE_1000),
+		(char)(CARRY | TOO_LARGE | TOO_LARGE_1000),
+		(char)(CARRY | TOO_LARGE | TOO_LARGE_1000),
+		(char)(CARRY | TOO_LARGE | TOO_LARGE_1000),
+		(char)(CARRY | TOO_LARGE | TOO_LARGE_1000),
+		(char)(CARRY | TOO_LARGE | TOO_LARGE_1000),
+		(char)(CARRY | TOO_LARGE | TOO_LARGE_1000 | SURROGATE),
+		(char)(CARRY | TOO_LARGE | TOO_LARGE_1000),
+		(char)(CARRY | TOO_LARGE | TOO_LARGE_1000));
+	// Indexed by the high nibble of the second byte of a pair.
+	const __m128i byte_2_high_table = _mm_setr_epi8(
+		TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT,
+		TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT,
+		(char)(TOO_LONG | OVERLONG_2 | TWO_CONTS | OVERLONG_3 | TOO_LARGE_1000 | OVERLONG_4),
+		(char)(TOO_LONG | OVERLONG_2 | TWO_CONTS | OVERLONG_3 | TOO_LARGE),
+		(char)(TOO_LONG | OVERLONG_2 | TWO_CONTS | SURROGATE | TOO_LARGE),
+		(char)(TOO_LONG | OVERLONG_2 | TWO_CONTS | SURROGATE | TOO_LARGE),
+		TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT);
+	__m128i prev1 = _mm_alignr_epi8(input, prev_input, 15);
+	__m128i prev2 = _mm_alignr_epi8(input, prev_input, 14);
+	__m128i prev3 = _mm_alignr_epi8(input, prev_input, 13);
+	__m128i byte_1_high = _mm_shuffle_epi8(byte_1_high_table, _mm_and_si128(_mm_srli_epi16(prev1, 4), nibble_mask));
+	__m128i byte_1_low = _mm_shuffle_epi8(byte_1_low_table, _mm_and_si128(prev1, nibble_mask));
+	__m128i byte_2_high = _mm_shuffle_epi8(byte_2_high_table, _mm_and_si128(_mm_srli_epi16(input, 4), nibble_mask));
+	__m128i special_cases = _mm_and_si128(_mm_and_si128(byte_1_high, byte_1_low), byte_2_high);
+	// The third and fourth bytes of three and four byte sequences must be continuations.
+	__m128i is_third_byte = _mm_subs_epu8(prev2, _mm_set1_epi8((char)(0xE0 - 0x80)));
+	__m128i is_fourth_byte = _mm_subs_epu8(prev3, _mm_set1_epi8((char)(0xF0 - 0x80)));
+	__m128i must_be_continuation = _mm_and_si128(_mm_or_si128(is_third_byte, is_fourth_byte), _mm_set1_epi8((char)0x80));
+	return _mm_xor_si128(must_be_continuation, special_cases);
+}
+
+__attribute__((target("ssse3")))
+static int astr_utf8_validate_ssse3(const unsigned char *s, int length) {
+	// A block that ends with these bytes or greater ends with an incomplete sequence.
+	const __m128i max_value = _mm_setr_epi8(
+		(char)0xFF, (char)0xFF, (char)0xFF, (char)0xFF, (char)0xFF, (char)0xFF, (char)0xFF, (char)0xFF,
+		(char)0xFF, (char)0xFF, (char)0xFF, (char)0xFF, (char)0xFF,
+		(char)(0xF0 - 1), (char)(0xE0 - 1), (char)(0xC0 - 1));
+	__m128i prev_input = _mm_setzero_si128();
+	__m128i prev_incomplete = _mm_setzero_si128();
+	__m128i error = _mm_setzero_si128();
+	__m128i input;
+	unsigned char tail[16];
+	int i;
+
+	for (i = 0; i + 16 <= length; i += 16) {
+		input = _mm_loadu_si128((const __m128i *)(s + i));
+		if (_mm_movemask_epi8(input) == 0) {
+			// All ASCII, only a sequence left open by the last block can be an error.
+			error = _mm_or_si128(error, prev_incomplete);
+			prev_incomplete = _mm_setzero_si128();
+		}
+		else {
+			error = _mm_or_si128(error, astr_utf8_check_block(input, prev_input));
+			prev_incomplete = _mm_subs_epu8(input, max_value);
+		}
+		prev_input = input;
+	}
+
+	// Pad the last partial block with NUL; a sequence cut off by the end of
+	// the buffer is then followed by a non-continuation and is an error.
+	memset(tail, 0, sizeof(tail));
+	memcpy(tail, s + i, length - i);
+	input = _mm_loadu_si128((const __m128i *)tail);
+	error = _mm_or_si128(error, astr_utf8_check_block(input, prev_input));
+	error = _mm_or_si128(error, _mm_subs_epu8(input, max_value));
+
+	return (_mm_movemask_epi8(_mm_cmpeq_epi8(error, _mm_setzero_si128())) == 0xFFFF ? 1 : 0);
+}
+
+#endif // ASTR_UTF8_SSSE3
+
+/*
+ * astr_utf8_validate
+ *
+ * Determine if a buffer holds valid UTF-8.
+ * Overlong encodings, surrogates, and code points above U+10FFFF are invalid.
+ *
+ * Parameter: The buffer
+ * Parameter: The length of the buffer
+ * Returns:   1 if the buffer is valid UTF-8, 0 if not
+ */
+int astr_utf8_validate(const char *buffer, const int length) {
+	if (buffer == NULL || length <= 0) {
+		return 1;
+	}
+#ifdef ASTR_UTF8_SSSE3
+	if (__builtin_cpu_supports("ssse3")) {
+		return astr_utf8_validate_ssse3((const unsigned char *)buffer, length);
+	}
+#endif
+	return astr_utf8_validate_scalar((const unsigned char *)buffer, length);
+}
+
+/*
+ * astr_utf8_validate_scalar
+ *
+ * Validate UTF-8 one sequence at a time, skipping ASCII eight bytes at a time.
+ *
+ * Parameter: The buffer
+ * Parameter: The length of the buffer
+ * Returns:   1 if the buffer is valid UTF-8, 0 if not
+ */
+static int astr_utf8_validate_scalar(const unsigned char *s, int length) {
+	unsigned long long block;
+	int i = 0;
+	int n;
+
+	while (i < length) {
+		if (i + 8 <= length) {
+			memcpy(&block, s + i, 8);
+			if ((block & 0x8080808080808080ULL) == 0) {
+				i += 8;
+				continue;
+			}
+		}
+		n = astr_utf8_decode((const char *)s + i, length - i, NULL);
+		if (n <= 0) {
+			return 0;
+		}
+		i += n;
+	}
+	return 1;
+}
+
+/*
+ * astr_utf8_count
+ *
+ * Count the code points in a buffer of UTF-8.
+ * Every byte that is not a continuation byte starts a code point, so in a
+ * buffer that is not valid UTF-8 each stray byte counts as one code point.
+ *
+ * Parameter: The buffer
+ * Parameter: The length of the buffer
+ * Returns:   The number of code points
+ */
+int astr_utf8_count(const char *buffer, const int length) {
+	const signed char *s = (const signed char *)buffer;
+	int count = 0;
+	int i = 0;
+
+	if (buffer == NULL || length <= 0) {
+		return 0;
+	}
+
+#if defined(__SSE2__)
+	{
+		// Continuation bytes are 0x80 to 0xBF, -128 to -65 as signed bytes.
+		const __m128i continuation_max = _mm_set1_epi8(-65);
+		__m128i sum = _mm_setzero_si128();
+		__m128i counts;
+		int blocks;
+
+		while (i + 16 <= length) {
+			counts = _mm_setzero_si128();
+			// The byte counters can count 255 blocks before they overflow.
+			for (blocks = 0; blocks < 255 && i + 16 <= length; blocks++, i += 16) {
+				__m128i input = _mm_loadu_si128((const __m128i *)(s + i));
+				counts = _mm_sub_epi8(counts, _mm_cmpgt_epi8(input, continuation_max));
+			}
+			sum = _mm_add_epi64(sum, _mm_sad_epu8(counts, _mm_setzero_si128()));
+		}
+		count = _mm_cvtsi128_si32(sum) + _mm_cvtsi128_si32(_mm_unpackhi_epi64(sum, sum));
+	}
+#endif
+
+	for (; i < length; i++) {
+		if (s[i] > -65) {
+			count++;
+		}
+	}
+	return count;
+}
+
+/*
+ * astr_utf8_decode
+ *
+ * Decode the code point at the start of a buffer of UTF-8.
+ *
+ * Parameter: The buffer
+ * Parameter: The length of the buffer
+ * Parameter: Pointer to the decoded code point, or NULL
+ * Returns:   The number of bytes in the sequence, 0 if the buffer is empty,
+ *            or -1 if the sequence is not valid UTF-8
+ */
+int astr_utf8_decode(const char *buffer, const int length, int *codepoint) {
+	const unsigned char *s = (const unsigned char *)buffer;
+	int cp;
+	int n;
+	int i;
+
+	if (buffer == NULL || length <= 0) {
+		return 0;
+	}
+
+	if (s[0] < 0x80) {
+		cp = s[0];
+		n = 1;
+	}
+	else {
+		if (s[0] >= 0xC2 && s[0] <= 0xDF) {
+			cp = s[0] & 0x1F;
+			n = 2;
+		}
+		else if (s[0] >= 0xE0 && s[0] <= 0xEF) {
+			cp = s[0] & 0x0F;
+			n = 3;
+		}
+		else if (s[0] >= 0xF0 && s[0] <= 0xF4) {
+			cp = s[0] & 0x07;
+			n = 4;
+		}
+		else {
+			return -1;
+		}
+
+		if (length < n) {
+			return -1;
+		}
+
+		for (i = 1; i < n; i++) {
+			if ((s[i] & 0xC0) != 0x80) {
+				return -1;
+			}
+			cp = (cp << 6) | (s[i] & 0x3F);
+		}
+
+		if ((n == 3 && cp < 0x800) || (n == 4 && (cp < 0x10000 || cp > 0x10FFFF)) || (cp >= 0xD800 && cp <= 0xDFFF)) {
+			return -1;
+		}
+	}
+
+	if (codepoint != NULL) {
+		*codepoint = cp;
+	}
+	return n;
+}
+
+/*
+ * astr_utf8_encode
+ *
+ * Encode a code point as UTF-8.
+ *
+ * Parameter: The code point
+ * Parameter: The destination, with room for at least four bytes
+ * Returns:   The number of bytes written, 0 if the code point is not valid
+ */
+int astr_utf8_encode(const int codepoint, char *dst) {
+	unsigned char *d = (unsigned char *)dst;
+
+	if (dst == NULL || codepoint < 0 || codepoint > 0x10FFFF || (codepoint >= 0xD800 && codepoint <= 0xDFFF)) {
+		return 0;
+	}
+
+	if (codepoint < 0x80) {
+		d[0] = codepoint;
+		return 1;
+	}
+	if (codepoint < 0x800) {
+		d[0] = 0xC0 | (codepoint >> 6);
+		d[1] = 0x80 | (codepoint & 0x3F);
+		return 2;
+	}
+	if (codepoint < 0x10000) {
+		d[0] = 0xE0 | (codepoint >> 12);
+		d[1] = 0x80 | ((codepoint >> 6) & 0x3F);
+		d[2] = 0x80 | (codepoint & 0x3F);
+		return 3;
+	}
+	d[0] = 0xF0 | (codepoint >> 18);
+	d[1] = 0x80 | ((codepoint >> 12) & 0x3F);
+	d[2] = 0x80 | ((codepoint >> 6) & 0x3F);
+	d[3] = 0x80 | (codepoint & 0x3F);
+	return 4;
+}
+
+/*
+ * astr_is_utf8
+ *
+ * Determine if the string in an astr instance is valid UTF-8.
+ *
+ * Parameter: The astr instance
+ * Returns:   1 if the string is valid UTF-8, 0 if not
+ */
+int astr_is_utf8(const astr *as) {
+	if (as == NULL || as->string == NULL) {
+		return 0;
+	}
+	return astr_utf8_validate(as->string, as->length);
+}
+
+/*
+ * astr_codepoint_length
+ *
+ * Get the number of code points in the string of an astr instance.
+ *
+ * The count is kept in the astr instance once it has been calculated, until
+ * the string is changed.  Every byte that is not a continuation byte is
+ * counted, so a count equal to the length does not mean the string is ASCII:
+ * a string of Latin-1 has that count too.
+ *
+ * Threads that only read the string may call this at the same time; the
+ * count is stored atomically, and each thread stores the same count.
+ *
+ * Parameter: The astr instance
+ * Returns:   The number of code points
+ */
+int astr_codepoint_length(astr *as) {
+	int codepoint_length;
+	if (as == NULL || as->string == NULL) {
+		return 0;
+	}
+	codepoint_length = __atomic_load_n(&as->codepoint_length, __ATOMIC_RELAXED);
+	if (codepoint_length < 0) {
+		codepoint_length = astr_utf8_count(as->string, as->length);
+		__atomic_store_n(&as->codepoint_length, codepoint_length, __ATOMIC_RELAXED);
+	}
+	return codepoint_length;
+}
+
+/*
+ * astr_utf8_locale_load
+ *
+ * Load the UTF-8 locale.  Called once, by pthread_once.
+ */
+static void astr_utf8_locale_load(void) {
+	astr_utf8_locale_loaded = newlocale(LC_CTYPE_MASK, "C.UTF-8", (locale_t)0);
+	if (astr_utf8_locale_loaded == (locale_t)0) {
+		astr_utf8_locale_loaded = newlocale(LC_CTYPE_MASK, "en_US.UTF-8", (locale_t)0);
+	}
+}
+
+/*
+ * astr_utf8_locale
+ *
+ * Get the UTF-8 locale used to classify and case-map code points.
+ * The locale is loaded the first time it is needed, in any thread.
+ *
+ * Returns:   The locale, or 0 if no UTF-8 locale is available
+ */
+static locale_t astr_utf8_locale() {
+	pthread_once(&astr_utf8_locale_once, astr_utf8_locale_load);
+	return astr_utf8_locale_loaded;
+}
+
+/*
+ * astr_codepoint_to_upper
+ *
+ * Convert a code point to upper case.
+ *
+ * Parameter: The code point
+ * Returns:   The upper case code point, or the code point if it has none
+ */
+int astr_codepoint_to_upper(const int codepoint) {
+	locale_t locale;
+	if (codepoint < 0x80) {
+		return toupper(codepoint);
+	}
+	locale = astr_utf8_locale();
+	return (locale != (locale_t)0 ? (int)towupper_l(codepoint, locale) : codepoint);
+}
+
+/*
+ * astr_codepoint_to_lower
+ *
+ * Convert a code point to lower case.
+ *
+ * Parameter: The code point
+ * Returns:   The lower case code point, or the code point if it has none
+ */
+int astr_codepoint_to_lower(const int codepoint) {
+	locale_t locale;
+	if (codepoint < 0x80) {
+		return tolower(codepoint);
+	}
+	locale = astr_utf8_locale();
+	return (locale != (locale_t)0 ? (int)towlower_l(codepoint, locale) : codepoint);
+}
+
+/*
+ * astr_codepoint_is_alpha
+ *
+ * Determine if a code point is alphabetic.
+ *
+ * Parameter: The code point
+ * Returns:   1 if alphabetic, 0 if not
+ */
+int astr_codepoint_is_alpha(const int codepoint) {
+	locale_t locale;
+	if (codepoint < 0x80) {
+		return (isalpha(codepoint) ? 1 : 0);
+	}
+	locale = astr_utf8_locale();
+	return (locale != (locale_t)0 && iswalpha_l(codepoint, locale) ? 1 : 0);
+}
+
+/*
+ * astr_codepoint_is_alnum
+ *
+ * Determine if a code point is alphanumeric.
+ *
+ * Parameter: The code point
+ * Returns:   1 if alphanumeric, 0 if not
+ */
+int astr_codepoint_is_alnum(const int codepoint) {
+	locale_t locale;
+	if (codepoint < 0x80) {
+		return (isalnum(codepoint) ? 1 : 0);
+	}
+	locale = astr_utf8_locale();
+	return (locale != (locale_t)0 && iswalnum_l(codepoint, locale) ? 1 : 0);
+}
+
+/*
+ * astr_codepoint_is_space
+ *
+ * Determine if a code point is white space.
+ *
+ * Parameter: The code point
+ * Returns:   1 if white space, 0 if not
+ */
+int astr_codepoint_is_space(const int codepoint) {
+	locale_t locale;
+	if (codepoint < 0x80) {
+		return (isspace(codepoint) ? 1 : 0);
+	}
+	locale = astr_utf8_locale();
+	return (locale != (locale_t)0 && iswspace_l(codepoint, locale) ? 1 : 0);
+}
+
+/*
+ * astr_codepoint_is_blank
+ *
+ * Determine if a code point is blank (a space or tab-like separator).
+ *
+ * Parameter: The code point
+ * Returns:   1 if blank, 0 if not
+ */
+int astr_codepoint_is_blank(const int codepoint) {
+	locale_t locale;
+	if (codepoint < 0x80) {
+		return (isblank(codepoint) ? 1 : 0);
+	}
+	locale = astr_utf8_locale();
+	return (locale != (locale_t)0 && iswblank_l(codepoint, locale) ? 1 : 0);
+}
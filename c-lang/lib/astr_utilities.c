@@ -2,16 +2,45 @@
 
 /*
  * General-purpose utility functions.
+ *
+ * The hex dumps are built from lookup tables a line at a time.  They can be
+ * made into a string allocated at exactly the size of the dump, or written
+ * to a file a fixed number of lines at a time, for a whole buffer, a range of
+ * a buffer, or the differences between two buffers.
  */
 
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
 #include <ctype.h>
+#include <errno.h>
 
 #include "astr.h"
 
-static char *dump_buffer(char *dst, size_t dstlen, const void *src, size_t srclen);
+// Characters in a line of a hex dump after the offset, including the eol.
+#define HEXDUMP_LINE_LENGTH 68
+
+// The longest line of a hex dump, with a 16 digit offset and a diff prefix.
+#define HEXDUMP_MAX_LINE_LENGTH (2 + 16 + HEXDUMP_LINE_LENGTH)
+
+// Number of lines written to a file at a time.
+#define HEXDUMP_CHUNK_LINES 256
+
+static const char hex_digits[] = "0123456789ABCDEF";
+
+// Two hexadecimal digits for each byte value.
+static const char hex_pairs[] =
+	"000102030405060708090A0B0C0D0E0F101112131415161718191A1B1C1D1E1F"
+	"202122232425262728292A2B2C2D2E2F303132333435363738393A3B3C3D3E3F"
+	"404142434445464748494A4B4C4D4E4F505152535455565758595A5B5C5D5E5F"
+	"606162636465666768696A6B6C6D6E6F707172737475767778797A7B7C7D7E7F"
+	"808182838485868788898A8B8C8D8E8F909192939495969798999A9B9C9D9E9F"
+	"A0A1A2A3A4A5A6A7A8A9AAABACADAEAFB0B1B2B3B4B5B6B7B8B9BABBBCBDBEBF"
+	"C0C1C2C3C4C5C6C7C8C9CACBCCCDCECFD0D1D2D3D4D5D6D7D8D9DADBDCDDDEDF"
+	"E0E1E2E3E4E5E6E7E8E9EAEBECEDEEEFF0F1F2F3F4F5F6F7F8F9FAFBFCFDFEFF";
+
+static int hexdump_offset_digits(size_t end);
+static char *hexdump_line(char *dst, const unsigned char *src, size_t offset, size_t from, size_t to, int digits);
 
 /*
  * astr_update
@@ -37,7 +66,10 @@ astr *astr_update(astr *as) {
 		}
 		as->checksum = cs;
 		as->length = len;
+		as->codepoint_length = -1;
+		as->hash = 0;
 	}
+	return as;
 }
 
 /*
@@ -147,28 +179,18 @@ char *astr_hexdump(const astr *as) {
  * astr_hexdump_string
  *
  * Dump the string in an astr instance in hex dump format.
+ * The whole storage after the start of the string is dumped, including the
+ * null characters after the end of the string.
  *
  * Parameter: The astr instance
  * Returns:	  The address of the null-terminated destination buffer.
  */
 char *astr_hexdump_string(const astr *as) {
-	char *dumpbuffer = NULL;
-	int  dumpbufferlen;
-
 	if (as != NULL && as->string != NULL) {
-		// Calculate the size of the buffer required to hold the hex dump.
-		dumpbufferlen = (74 * ((as->allocated_length / 16) + (as->allocated_length % 16))) + 1;
-
-		// Allocate the buffer to hold the hex dump.
-		dumpbuffer = (char *) calloc(dumpbufferlen, sizeof(char));
-
-		// If the allocation worked, write the hex dump into the input buffer.
-		if(dumpbuffer != NULL) {
-			dump_buffer(dumpbuffer, dumpbufferlen, as->string, as->allocated_length);
-		}
+		// The string may start past the beginning of the storage after a left trim.
+		return astr_hexdump_buffer(as->string, as->allocated_length - (as->string - as->storage));
 	}
-
-	return dumpbuffer;
+	return NULL;
 }
 
 /*
@@ -180,151 +202,270 @@ char *astr_hexdump_string(const astr *as) {
  * Returns:	  The address of the null-terminated destination buffer.
  */
 char *astr_hexdump_struct(const astr *as) {
-	char *dumpbuffer = NULL;
-	int  dumpbufferlen;
-
 	if (as != NULL) {
-		// Calculate the size of the buffer required to hold the hex dump.
-		dumpbufferlen = (74 * ((sizeof(as) / 16) + (sizeof(as) % 16))) + 1;
-
-		// Allocate the buffer to hold the hex dump.
-		dumpbuffer = (char *) calloc(dumpbufferlen, sizeof(char));
-
-		// If the allocation worked, write the hex dump into the input buffer.
-		if(dumpbuffer != NULL)
-		{
-			dump_buffer(dumpbuffer, dumpbufferlen, as, sizeof(astr));
-		}
+		return astr_hexdump_buffer(as, sizeof(astr));
 	}
-
-	return dumpbuffer;
+	return NULL;
 }
 
 /*
- * dump_buffer
- *
- * Dump a buffer.
- *
- * This function dumps a buffer in the familiar dump format of DEBUG,
- * with 16 hexadecimal values per line on the left and 16 ASCII
- * characters per line on the right.  Unprintable ASCII characters show
- * as '.'.
+ * astr_hexdump_size
  *
- * The destination buffer must be large enough to contain the dumped
- * bytes.  The size of the destination buffer can be found using the
- * following equation:
+ * Get the size of the buffer needed for the hex dump of a buffer, including
+ * the null terminator.
  *
- * 			(74 * ((buflen / 16) + (buflen % 16))) + 1
+ * Every line is the same length: the offset, 16 hexadecimal values, and 16
+ * characters.  The offset is five digits, or as many more as the offset of
+ * the last line needs.
  *
- * Output:
+ * Parameter: The length of the buffer to be dumped
+ * Returns:   The size of the hex dump, in characters
+ */
+size_t astr_hexdump_size(size_t length) {
+	size_t lines = (length + 15) / 16;
+	return lines * (hexdump_offset_digits(length) + HEXDUMP_LINE_LENGTH) + 1;
+}
+
+/*
+ * astr_hexdump_buffer
  *
- * 00000  41 20 6C 6F 6E 67 20 73 74 72 69 6E 67 20 74 68  A long string th
- * 00010  61 74 20 69 73 20 6D 75 63 68 20 6C 6F 6E 67 CC  at is much long.
- * ----=----1----=----2----=----3----=----4----=----5----=----6----=----7----=
- *                                           Buffer with LF eol ends at 73 ^
- *                                         Buffer with CR/LF eol ends at 74 ^
+ * Dump a buffer in hex dump format into a new string.
+ * The string is allocated at exactly the size of the dump.
+ * The caller must free the string.
  *
- * Parameter: dst    - address of the destination buffer
- * Parameter: dstlen - length of the destination buffer
- * Parameter: src     - address of the buffer to be dumped
- * Parameter: srclen  - length of the buffer to be dumped
- * Returns:	  The address of the null-terminated destination buffer.
- * ------------------------------------------------------------------------------
+ * Parameter: The buffer to be dumped
+ * Parameter: The length of the buffer
+ * Returns:   The address of the null-terminated dump, or NULL if the buffer
+ *            is empty or the dump could not be allocated
  */
+char *astr_hexdump_buffer(const void *buffer, size_t length) {
+	char *dump;
+	char *d;
+	size_t offset;
+	int digits;
 
-static char *dump_buffer(char *dst, size_t dstlen, const void *src, size_t srclen) {
-	int i;
-	int count_out;
-	int offset = 0;
-	char eol[3];
-	int eollen = 2;
-	char temp[6];
-	short val;
-	char *pdst = 0;
-	char *pend = 0;
-
-	struct
-	{
-		char offset[5];
-		char filler1[2];
-		struct
-		{
-			char hexval[2];
-			char space;
-		} hexvalues[16];
-		char filler2;
-		char ASCIIval[16];
-	} dumpline;
-
-	if (src == NULL || srclen <= 0 || dst == NULL) {
+	if (buffer == NULL || length == 0) {
 		return NULL;
 	}
 
-	sprintf(eol, "\n");
-	eollen = strlen(eol);
-
-	pdst = dst;
-	pend = pdst + dstlen;
-
-	count_out = 0;
-
-	while(count_out < srclen)
-	{
-		memset((char *) &dumpline, ' ', sizeof(dumpline));
+	dump = (char *)malloc(astr_hexdump_size(length));
+	if (dump != NULL) {
+		digits = hexdump_offset_digits(length);
+		d = dump;
+		for (offset = 0; offset < length; offset += 16) {
+			d = hexdump_line(d, (const unsigned char *)buffer, offset, 0, length, digits);
+		}
+		*d = '\0';
+	}
+	return dump;
+}
 
-		sprintf(temp, "%5.5X", offset);
-		memcpy(dumpline.offset, temp, strlen(temp));
+/*
+ * astr_hexdump_write
+ *
+ * Dump a buffer in hex dump format to a file.
+ *
+ * Parameter: The file, open for writing
+ * Parameter: The buffer to be dumped
+ * Parameter: The length of the buffer
+ * Returns:   0 = success, non-zero = errno value from the failed operation
+ */
+int astr_hexdump_write(FILE *file, const void *buffer, size_t length) {
+	return astr_hexdump_write_range(file, buffer, length, 0, length);
+}
 
-		// Dump sixteen bytes on this line...
-		for(i = 0; i < 16 && count_out < srclen; i++, count_out++, offset++) {
-			val = ((char *)src)[count_out];
+/*
+ * astr_hexdump_write_range
+ *
+ * Dump a range of a buffer in hex dump format to a file.
+ *
+ * The offsets are the offsets in the whole buffer, and the lines stay on the
+ * same 16 byte boundaries as in a dump of the whole buffer; the positions on
+ * the first and last lines that are outside the range are left blank.  The
+ * dump is written a fixed number of lines at a time from a buffer on the
+ * stack, so no buffer the size of the dump is ever allocated.
+ *
+ * Parameter: The file, open for writing
+ * Parameter: The buffer to be dumped
+ * Parameter: The length of the buffer
+ * Parameter: The offset of the first byte of the range
+ * Parameter: The offset after the last byte of the range, cut off at the length
+ * Returns:   0 = success, non-zero = errno value from the failed operation
+ */
+int astr_hexdump_write_range(FILE *file, const void *buffer, size_t length, size_t from, size_t to) {
+	char chunk[HEXDUMP_CHUNK_LINES * HEXDUMP_MAX_LINE_LENGTH];
+	char *d;
+	size_t offset;
+	int digits;
+	int lines;
+
+	if (file == NULL || (buffer == NULL && length > 0)) {
+		return EINVAL;
+	}
+	if (to > length) {
+		to = length;
+	}
+	if (from >= to) {
+		return 0;
+	}
 
-			val &= 0xFF;
+	digits = hexdump_offset_digits(to);
+	offset = from & ~(size_t)15;
+	while (offset < to) {
+		d = chunk;
+		for (lines = 0; lines < HEXDUMP_CHUNK_LINES && offset < to; lines++, offset += 16) {
+			d = hexdump_line(d, (const unsigned char *)buffer, offset, from, to, digits);
+		}
+		if (fwrite(chunk, 1, d - chunk, file) != d - chunk) {
+			return errno != 0 ? errno : EIO;
+		}
+	}
+	return 0;
+}
 
-			sprintf(temp, "%2.2X", val);
-			memcpy(dumpline.hexvalues[i].hexval, temp, strlen(temp));
+/*
+ * astr_hexdump_write_diff
+ *
+ * Dump the differences between two buffers in hex dump format to a file.
+ *
+ * Only the lines that differ are written.  For each one, the line from the
+ * first buffer is written with a "< " prefix, the line from the second
+ * buffer with a "> " prefix, and then a line with "^^" under each byte that
+ * differs.  Where one buffer is shorter than the other, the missing bytes are
+ * blank and count as different.
+ *
+ * Parameter: The file, open for writing
+ * Parameter: The first buffer
+ * Parameter: The length of the first buffer
+ * Parameter: The second buffer
+ * Parameter: The length of the second buffer
+ * Returns:   0 = success, non-zero = errno value from the failed operation
+ */
+int astr_hexdump_write_diff(FILE *file, const void *buffer1, size_t length1, const void *buffer2, size_t length2) {
+	char chunk[HEXDUMP_CHUNK_LINES * HEXDUMP_MAX_LINE_LENGTH];
+	const unsigned char *b1 = (const unsigned char *)buffer1;
+	const unsigned char *b2 = (const unsigned char *)buffer2;
+	char *d;
+	char *marks;
+	size_t length = (length1 > length2 ? length1 : length2);
+	size_t common = (length1 < length2 ? length1 : length2);
+	size_t offset;
+	size_t p;
+	int digits;
+	int lines;
+	int i;
 
-			dumpline.hexvalues[i].space = ' ';
+	if (file == NULL || (b1 == NULL && length1 > 0) || (b2 == NULL && length2 > 0)) {
+		return EINVAL;
+	}
 
-			if(isprint(val)) {
-				dumpline.ASCIIval[i] = val;
+	digits = hexdump_offset_digits(length);
+	offset = 0;
+	while (offset < length) {
+		d = chunk;
+		for (lines = 0; lines + 3 <= HEXDUMP_CHUNK_LINES && offset < length; offset += 16) {
+			p = offset + 16;
+			if (p <= common && memcmp(b1 + offset, b2 + offset, 16) == 0) {
+				continue;
 			}
-			else {
-				dumpline.ASCIIval[i] = '.';
-			}
-		}
 
-		if(pdst + sizeof(dumpline) < pend) {
-			memcpy(pdst, (char *) &dumpline, sizeof(dumpline));
-			pdst += sizeof(dumpline);
-		}
-		else {
-			if(pend - pdst > 0) {
-				memset(pdst, ' ', pend - pdst);
+			*d++ = '<';
+			*d++ = ' ';
+			d = hexdump_line(d, b1, offset, 0, length1, digits);
+			*d++ = '>';
+			*d++ = ' ';
+			d = hexdump_line(d, b2, offset, 0, length2, digits);
+
+			marks = d;
+			memset(marks, ' ', digits + HEXDUMP_LINE_LENGTH + 1);
+			for (i = 0; i < 16 && offset + i < length; i++) {
+				p = offset + i;
+				if (p >= common || b1[p] != b2[p]) {
+					marks[2 + digits + 2 + i * 3] = '^';
+					marks[2 + digits + 2 + i * 3 + 1] = '^';
+				}
 			}
-			pdst = pend;
+			d += 2 + digits + HEXDUMP_LINE_LENGTH - 1;
+			while (d > marks && d[-1] == ' ') {
+				d--;
+			}
+			*d++ = '\n';
+			lines += 3;
 		}
-
-		if(pdst + eollen < pend) {
-			memcpy(pdst, eol, eollen);
-			pdst += eollen;
+		if (d > chunk && fwrite(chunk, 1, d - chunk, file) != d - chunk) {
+			return errno != 0 ? errno : EIO;
 		}
-		else {
-			if(pend - pdst > 0) {
-				memset(pdst, ' ', pend - pdst);
-			}
+	}
+	return 0;
+}
 
-			pdst = pend;
-		}
+/*
+ * hexdump_offset_digits
+ *
+ * Get the number of hexadecimal digits in the offsets of a dump: five, or
+ * as many more as the offset of the last line needs.
+ *
+ * Parameter: The offset after the last byte to be dumped
+ * Returns:   The number of digits
+ */
+static int hexdump_offset_digits(size_t end) {
+	size_t last = (end == 0 ? 0 : (end - 1) & ~(size_t)15);
+	int digits = 5;
+	while (digits < 16 && (last >> (4 * digits)) != 0) {
+		digits++;
 	}
+	return digits;
+}
+
+/*
+ * hexdump_line
+ *
+ * Write one line of a hex dump.
+ *
+ * This writes a line in the familiar dump format of DEBUG, with 16
+ * hexadecimal values on the left and 16 ASCII characters on the right.
+ * Unprintable characters show as '.'.  The hexadecimal values come from a
+ * table, two characters for each byte value, so there are no calls to
+ * sprintf.  Bytes outside the range are left blank.
+ *
+ * Output:
+ *
+ * 00000  41 20 6C 6F 6E 67 20 73 74 72 69 6E 67 20 74 68  A long string th
+ * 00010  61 74 20 69 73 20 6D 75 63 68 20 6C 6F 6E 67 CC  at is much long.
+ * ----=----1----=----2----=----3----=----4----=----5----=----6----=----7----=
+ *                                           Buffer with LF eol ends at 73 ^
+ *
+ * Parameter: dst    - address of the destination, with room for the line
+ * Parameter: src    - address of the buffer being dumped
+ * Parameter: offset - offset of the line in the buffer, a multiple of 16
+ * Parameter: from   - offset of the first byte to show
+ * Parameter: to     - offset after the last byte to show
+ * Parameter: digits - number of hexadecimal digits in the offset
+ * Returns:   The address after the end of the line.
+ */
+static char *hexdump_line(char *dst, const unsigned char *src, size_t offset, size_t from, size_t to, int digits) {
+	char *hex = dst + digits + 2;
+	char *ascii = hex + 16 * 3 + 1;
+	const char *pair;
+	unsigned char c;
+	size_t p;
+	int i;
 
-	if(pdst < pend) {
-		*pdst = '\0';
+	for (i = digits - 1; i >= 0; i--) {
+		dst[i] = hex_digits[(offset >> (4 * (digits - 1 - i))) & 0xF];
 	}
-	else {
-		pdst = pend - 1;
-		*pdst = '\0';
+	memset(dst + digits, ' ', HEXDUMP_LINE_LENGTH - 1);
+
+	for (i = 0; i < 16; i++) {
+		p = offset + i;
+		if (p >= from && p < to) {
+			c = src[p];
+			pair = hex_pairs + 2 * c;
+			hex[i * 3] = pair[0];
+			hex[i * 3 + 1] = pair[1];
+			ascii[i] = (c >= 0x20 && c < 0x7F) ? c : '.';
+		}
 	}
-
-	return dst;
+	ascii[16] = '\n';
+	return ascii + 17;
 }
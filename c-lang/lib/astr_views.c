@@ -0,0 +1,179 @@
+// astr_views.c - Adept String Views
+
+/*
+ * An astr_view refers to characters owned by someone else, with a pointer and
+ * a length.  Views are passed and returned by value and never allocate, so
+ * trimming or stripping a prefix from a view only moves the pointer.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+#include "astr.h"
+
+/*
+ * astr_view_of
+ *
+ * Make a view of the string in an astr instance.
+ * The view is valid until the astr instance is changed or freed.
+ *
+ * Parameter: The astr instance
+ * Returns:   The view, empty if the astr instance or its string is NULL
+ */
+astr_view astr_view_of(const astr *as) {
+	astr_view view = { "", 0 };
+	if (as != NULL && as->string != NULL) {
+		view.string = as->string;
+		view.length = as->length;
+	}
+	return view;
+}
+
+/*
+ * astr_view_from_buffer
+ *
+ * Make a view of a buffer of specified length.
+ * The buffer does not need to be null-terminated.
+ *
+ * Parameter: The buffer
+ * Parameter: The length of the buffer
+ * Returns:   The view, empty if the buffer is NULL
+ */
+astr_view astr_view_from_buffer(const char *buffer, const int length) {
+	astr_view view = { "", 0 };
+	if (buffer != NULL && length > 0) {
+		view.string = buffer;
+		view.length = length;
+	}
+	return view;
+}
+
+/*
+ * astr_view_from_string
+ *
+ * Make a view of a null-terminated string.
+ *
+ * Parameter: The null-terminated string
+ * Returns:   The view, empty if the string is NULL
+ */
+astr_view astr_view_from_string(const char *string) {
+	astr_view view = { "", 0 };
+	if (string != NULL) {
+		view.string = string;
+		view.length = strlen(string);
+	}
+	return view;
+}
+
+/*
+ * astr_view_left_trim
+ *
+ * Trim the left (leading) spaces of a view.
+ *
+ * Parameter: The view
+ * Returns:   The trimmed view
+ */
+astr_view astr_view_left_trim(astr_view view) {
+	while (view.length > 0 && isspace((unsigned char)*view.string)) {
+		view.string++;
+		view.length--;
+	}
+	return view;
+}
+
+/*
+ * astr_view_right_trim
+ *
+ * Trim the right (trailing) spaces of a view.
+ *
+ * Parameter: The view
+ * Returns:   The trimmed view
+ */
+astr_view astr_view_right_trim(astr_view view) {
+	while (view.length > 0 && isspace((unsigned char)view.string[view.length - 1])) {
+		view.length--;
+	}
+	return view;
+}
+
+/*
+ * astr_view_remove_prefix
+ *
+ * Remove a prefix from the left side of a view, if the view starts with the
+ * prefix.  The view is unchanged if it does not.
+ *
+ * Parameter: The view
+ * Parameter: The null-terminated prefix to remove
+ * Returns:   The view without the prefix
+ */
+astr_view astr_view_remove_prefix(astr_view view, const char *prefix) {
+	int prefix_length;
+	if (prefix != NULL) {
+		prefix_length = strlen(prefix);
+		if (prefix_length <= view.length && memcmp(view.string, prefix, prefix_length) == 0) {
+			view.string += prefix_length;
+			view.length -= prefix_length;
+		}
+	}
+	return view;
+}
+
+/*
+ * astr_view_equals
+ *
+ * Determine if two views hold the same characters.
+ *
+ * Parameter: The first view
+ * Parameter: The second view
+ * Returns:   1 if equal, 0 if not
+ */
+int astr_view_equals(astr_view view1, astr_view view2) {
+	if (view1.length != view2.length) {
+		return 0;
+	}
+	return (memcmp(view1.string, view2.string, view1.length) == 0 ? 1 : 0);
+}
+
+/*
+ * astr_create_from_view
+ *
+ * Create a new astr instance with the characters in a view.
+ *
+ * Parameter: The view
+ * Returns:   Pointer to the astr instance
+ */
+astr *astr_create_from_view(astr_view view) {
+	return astr_set_from_view(NULL, view);
+}
+
+/*
+ * astr_set_from_view
+ *
+ * (Re)initialize an astr instance with the characters in a view.
+ * All of the characters are copied, NUL characters included, and the length
+ * is the length of the view.
+ *
+ * Parameter: The astr instance to be reinitialized, or NULL to create one
+ * Parameter: The view
+ * Returns:   Pointer to the astr instance
+ */
+astr *astr_set_from_view(astr *as, astr_view view) {
+	int i;
+	if (view.length > 0) {
+		as = astr_set_from_buffer(as, view.string, view.length);
+		if (as != NULL && as->string != NULL && memchr(view.string, '\0', view.length) != NULL) {
+			// The buffer was copied up to the NUL and padded; copy all of it.
+			memcpy(as->string, view.string, view.length);
+			as->length = view.length;
+			as->checksum = 0;
+			for (i = 0; i < view.length; i++) {
+				as->checksum += view.string[i];
+			}
+		}
+	}
+	else {
+		as = astr_set(as, "");
+	}
+	return as;
+}
@@ -5,6 +5,7 @@
 #include <string.h>
 #include <errno.h>
 #include <unistd.h>
+#include <pthread.h>
 
 #include "astr.h"
 #include "afile.h"
@@ -231,6 +232,147 @@ void test_process_lines(void) {
 	astr_free(open_modes);
 }
 
+static char *read_whole_file(const char *name, long *length) {
+	FILE *file;
+	char *content;
+
+	file = fopen(name, "rb");
+	fseek(file, 0, SEEK_END);
+	*length = ftell(file);
+	rewind(file);
+	content = (char *)malloc(*length + 1);
+	*length = (long)fread(content, 1, *length, file);
+	content[*length] = '\0';
+	fclose(file);
+	return content;
+}
+
+void test_writer(void) {
+	char *name = "test_writer.tmp";
+	char big[1000];
+	astr *filename;
+	astr *open_modes;
+	astr *as;
+	afile *af;
+	afile_writer *writer;
+	char *content;
+	long length;
+	int result;
+	int i;
+
+	filename = astr_create(name);
+	open_modes = astr_create("w");
+	af = afile_create(filename, open_modes);
+	result = afile_open(af);
+	aut_assert("1 test_writer", result == 0);
+
+	// What stdio holds is written before the writer's output.
+	fprintf(af->file, "first\n");
+	writer = afile_writer_create(af, 64, 1);
+	aut_assert("2 test_writer", writer != NULL && writer->size == 64 && writer->unlocked);
+
+	as = astr_create(content_lower);
+	result = afile_write_astr(writer, as);
+	result |= afile_write_view(writer, astr_view_from_string(" "));
+	result |= afile_write_line(writer, astr_view_from_string(content_upper));
+	aut_assert("3 test_writer", result == 0 && writer->length == 54 && writer->writes == 0);
+
+	// Too big for the buffer, written with it in one go.
+	memset(big, 'b', sizeof(big));
+	result = afile_write_line(writer, astr_view_from_buffer(big, sizeof(big)));
+	aut_assert("4 test_writer", result == 0 && writer->length == 0 && writer->writes == 1);
+
+	for (i = 0; i < 10; i++) {
+		result |= afile_write_line(writer, astr_view_from_string(content_mixed));
+	}
+	result |= afile_write_line(writer, astr_view_from_buffer("", 0));
+	aut_assert("5 test_writer", result == 0 && writer->writes > 1);
+
+	// Freeing the writer flushes it, and stdio carries on where it left off.
+	writer = afile_writer_free(writer);
+	aut_assert("6 test_writer", writer == NULL);
+	fprintf(af->file, "last\n");
+	afile_close(af);
+	aut_assert("7 test_writer", afile_writer_create(af, 0, 0) == NULL);
+
+	content = read_whole_file(name, &length);
+	aut_assert("8 test_writer", length == 6 + 54 + 1001 + 10 * 27 + 1 + 5);
+	aut_assert("9 test_writer", strncmp(content, "first\nabcdefghijklmnopqrstuvwxyz ABCDEFGHIJKLMNOPQRSTUVWXYZ\nbbb", 63) == 0);
+	aut_assert("10 test_writer", content[6 + 54 + 1000] == '\n' && content[6 + 54 + 1001] == 'A');
+	aut_assert("11 test_writer", strcmp(content + length - 7, "\n\nlast\n") == 0);
+	free(content);
+
+	aut_assert("12 test_writer", afile_write_line(NULL, astr_view_of(as)) == EBADF && afile_writer_flush(NULL) == EBADF);
+	unlink(name);
+
+	astr_free(as);
+	af = afile_free(af);
+	astr_free(filename);
+	astr_free(open_modes);
+}
+
+#define WRITER_THREADS 4
+#define WRITER_LINES 5000
+
+static void *write_lines(void *arg) {
+	afile_writer *writer = (afile_writer *)arg;
+	char line[64];
+	int length;
+	int i;
+
+	for (i = 0; i < WRITER_LINES; i++) {
+		length = sprintf(line, "line %d of a thread that shares the writer", i);
+		afile_write_line(writer, astr_view_from_buffer(line, length));
+	}
+	return NULL;
+}
+
+void test_writer_threads(void) {
+	char *name = "test_writer_threads.tmp";
+	pthread_t threads[WRITER_THREADS];
+	astr *filename;
+	astr *open_modes;
+	afile *af;
+	afile_writer *writer;
+	char *content;
+	char *s;
+	char *newline;
+	long length;
+	int lines = 0;
+	int whole = 1;
+	int t;
+
+	filename = astr_create(name);
+	open_modes = astr_create("w");
+	af = afile_create(filename, open_modes);
+	afile_open(af);
+
+	// Lines from several threads are not mixed.
+	writer = afile_writer_create(af, 4096, 0);
+	for (t = 0; t < WRITER_THREADS; t++) {
+		pthread_create(&threads[t], NULL, write_lines, writer);
+	}
+	for (t = 0; t < WRITER_THREADS; t++) {
+		pthread_join(threads[t], NULL);
+	}
+	aut_assert("1 test_writer_threads", afile_writer_flush(writer) == 0);
+	afile_writer_free(writer);
+	afile_close(af);
+
+	content = read_whole_file(name, &length);
+	for (s = content; (newline = strchr(s, '\n')) != NULL; s = newline + 1) {
+		lines++;
+		whole &= (strncmp(s, "line ", 5) == 0 && strncmp(newline - 17, "shares the writer", 17) == 0);
+	}
+	aut_assert("2 test_writer_threads", lines == WRITER_THREADS * WRITER_LINES && whole && *s == '\0');
+	free(content);
+	unlink(name);
+
+	af = afile_free(af);
+	astr_free(filename);
+	astr_free(open_modes);
+}
+
 // ----------
 
 int main(int argc, char *argv[]) {
@@ -241,6 +383,8 @@ int main(int argc, char *argv[]) {
 	aut_run_test(test_file_exists);
 	aut_run_test(test_write);
 	aut_run_test(test_process_lines);
+	aut_run_test(test_writer);
+	aut_run_test(test_writer_threads);
 	aut_report();
 	aut_terminate_suite();
 	aut_return();
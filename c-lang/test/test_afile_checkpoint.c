@@ -0,0 +1,246 @@
+// test_afile_checkpoint.c - test the checkpointed processing functions
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#ifdef HAVE_ZLIB_H
+#include <zlib.h>
+#endif
+
+#include "astr.h"
+#include "afile.h"
+#include "aclock.h"
+#include "adept_unit_test.h"
+
+int suite_runs;
+int suite_fails;
+aclock *suite_clock;
+int test_runs;
+int test_fails;
+astr *suite_messages;
+
+#define LINES 1000
+
+static char *name = "test_afile_checkpoint.tmp";
+static char *checkpoint_name = "test_afile_checkpoint.ckpt";
+
+// The lines a run processed, and when it fails, as a job that dies would.
+typedef struct run_counts {
+	long first;
+	long last;
+	long lines;
+	long fail_at;
+	int crash;
+} run_counts;
+
+static void write_lines(int count) {
+	FILE *file;
+	int i;
+
+	file = fopen(name, "w");
+	for (i = 0; i < count; i++) {
+		fprintf(file, "line %d\n", i);
+	}
+	fclose(file);
+}
+
+static afile *open_checkpointed(long interval) {
+	astr *filename = astr_create(name);
+	astr *path = astr_create(checkpoint_name);
+	afile *af = afile_create(filename, NULL);
+	afile_set_checkpoint(af, path, interval);
+	afile_open(af);
+	astr_free(filename);
+	astr_free(path);
+	return af;
+}
+
+int run_line_ctx(astr_view line, void *ctx) {
+	run_counts *counts = (run_counts *)ctx;
+	long number = atol(line.string + 5);
+
+	if (number == counts->fail_at) {
+		if (counts->crash) {
+			_exit(1);
+		}
+		return EIO;
+	}
+	if (counts->lines == 0) {
+		counts->first = number;
+	}
+	counts->last = number;
+	counts->lines++;
+	return AFILE_CONTINUE;
+}
+
+static void start_run(run_counts *counts, long fail_at) {
+	memset(counts, 0, sizeof(*counts));
+	counts->first = -1;
+	counts->fail_at = fail_at;
+}
+
+// ----------
+
+void test_checkpoint_file(void) {
+	astr *path = astr_create(checkpoint_name);
+	afile_checkpoint written;
+	afile_checkpoint read;
+	FILE *file;
+
+	unlink(checkpoint_name);
+	aut_assert("1 none yet", afile_checkpoint_read(path, &read) == ENOENT);
+
+	memset(&written, 0, sizeof(written));
+	written.offset = 5000000000LL;
+	written.lines = 123456;
+	written.processed = 654;
+	written.inode = 42;
+	written.size = 6000000000LL;
+	written.mtime.tv_sec = 1700000000;
+	written.mtime.tv_nsec = 999999999;
+	aut_assert("2 written", afile_checkpoint_write(path, &written) == 0);
+	aut_assert("3 no temporary file left", access("test_afile_checkpoint.ckpt.tmp", F_OK) != 0);
+	aut_assert("4 read back", afile_checkpoint_read(path, &read) == 0 && memcmp(&read, &written, sizeof(read)) == 0);
+
+	file = fopen(checkpoint_name, "w");
+	fputs("afile checkpoint 1 12 what\n", file);
+	fclose(file);
+	aut_assert("5 not a checkpoint", afile_checkpoint_read(path, &read) == EINVAL);
+
+	unlink(checkpoint_name);
+	astr_free(path);
+}
+
+void test_checkpoint_resume(void) {
+	afile_checkpoint checkpoint;
+	run_counts counts;
+	long line_count;
+	afile *af;
+	int result;
+
+	unlink(checkpoint_name);
+	write_lines(LINES);
+
+	// The job dies at a line; the checkpoint is of the line before.
+	af = open_checkpointed(100);
+	start_run(&counts, 550);
+	result = afile_process_checkpointed(af, NULL, run_line_ctx, &counts, &line_count);
+	aut_assert("1 died", result == EIO && line_count == 550 && counts.first == 0 && counts.last == 549);
+	aut_assert("2 checkpoint", afile_checkpoint_read(af->checkpoint_path, &checkpoint) == 0 && checkpoint.lines == 550 && checkpoint.processed == 550 && checkpoint.offset == 10 * 7 + 90 * 8 + 450 * 9);
+	afile_free(af);
+
+	// Run again, it carries on from the line that failed.
+	af = open_checkpointed(100);
+	start_run(&counts, -1);
+	result = afile_process_checkpointed(af, NULL, run_line_ctx, &counts, &line_count);
+	aut_assert("3 carried on", result == 0 && counts.first == 550 && counts.last == LINES - 1 && counts.lines == LINES - 550);
+	aut_assert("4 counted from the start", line_count == LINES);
+
+	// Once the file is done, running again processes nothing.
+	start_run(&counts, -1);
+	result = afile_process_checkpointed(af, NULL, run_line_ctx, &counts, &line_count);
+	aut_assert("5 nothing left", result == 0 && counts.lines == 0 && line_count == LINES);
+	afile_free(af);
+
+	// A different file is processed from its start.
+	write_lines(LINES / 2);
+	af = open_checkpointed(100);
+	start_run(&counts, -1);
+	result = afile_process_checkpointed(af, NULL, run_line_ctx, &counts, &line_count);
+	aut_assert("6 another file", result == 0 && counts.first == 0 && counts.lines == LINES / 2 && line_count == LINES / 2);
+	aut_assert("7 needs a checkpoint path", afile_process_checkpointed(af, NULL, NULL, NULL, NULL) == EINVAL);
+	afile_free(af);
+
+	unlink(name);
+	unlink(checkpoint_name);
+}
+
+static int match_tens(astr_view line, void *ctx) {
+	return atol(line.string + 5) % 10 == 0;
+}
+
+void test_checkpoint_interval(void) {
+	afile_checkpoint checkpoint;
+	run_counts counts;
+	long line_count;
+	afile *af;
+	pid_t pid;
+	int status;
+	int result;
+
+	unlink(checkpoint_name);
+	write_lines(LINES);
+
+	// A job killed between checkpoints leaves the last one it wrote.
+	pid = fork();
+	if (pid == 0) {
+		af = open_checkpointed(300);
+		start_run(&counts, 750);
+		counts.crash = 1;
+		afile_process_checkpointed(af, match_tens, run_line_ctx, &counts, NULL);
+		_exit(0);
+	}
+	waitpid(pid, &status, 0);
+	aut_assert("1 killed", WIFEXITED(status) && WEXITSTATUS(status) == 1);
+	af = open_checkpointed(300);
+	aut_assert("2 last checkpoint", afile_checkpoint_read(af->checkpoint_path, &checkpoint) == 0 && checkpoint.lines == 600 && checkpoint.processed == 60);
+
+	// The lines after it are processed again.
+	start_run(&counts, -1);
+	result = afile_process_checkpointed(af, match_tens, run_line_ctx, &counts, &line_count);
+	aut_assert("3 carried on", result == 0 && counts.first == 600 && counts.lines == 40 && line_count == LINES / 10);
+	afile_free(af);
+
+	unlink(name);
+	unlink(checkpoint_name);
+}
+
+#ifdef HAVE_ZLIB_H
+void test_checkpoint_gzip(void) {
+	run_counts counts;
+	long line_count;
+	gzFile gz;
+	afile *af;
+	int result;
+	int i;
+
+	unlink(checkpoint_name);
+	gz = gzopen(name, "wb");
+	for (i = 0; i < LINES; i++) {
+		gzprintf(gz, "line %d\n", i);
+	}
+	gzclose(gz);
+
+	// A compressed file is carried on by reading up to the checkpoint.
+	af = open_checkpointed(100);
+	start_run(&counts, 321);
+	result = afile_process_checkpointed(af, NULL, run_line_ctx, &counts, &line_count);
+	aut_assert("1 died", result == EIO && line_count == 321);
+	afile_free(af);
+	af = open_checkpointed(100);
+	start_run(&counts, -1);
+	result = afile_process_checkpointed(af, NULL, run_line_ctx, &counts, &line_count);
+	aut_assert("2 carried on", result == 0 && counts.first == 321 && counts.lines == LINES - 321 && line_count == LINES);
+	afile_free(af);
+
+	unlink(name);
+	unlink(checkpoint_name);
+}
+#endif
+
+int main(int argc, char *argv[]) {
+	aut_initialize_suite();
+	aut_run_test(test_checkpoint_file);
+	aut_run_test(test_checkpoint_resume);
+	aut_run_test(test_checkpoint_interval);
+#ifdef HAVE_ZLIB_H
+	aut_run_test(test_checkpoint_gzip);
+#endif
+	aut_report();
+	aut_terminate_suite();
+	aut_return();
+}
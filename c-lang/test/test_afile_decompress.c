@@ -0,0 +1,361 @@
+// test_afile_decompress.c - test reading compressed files
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#ifdef HAVE_ZLIB_H
+#include <zlib.h>
+#endif
+
+#include "astr.h"
+#include "afile.h"
+#include "afile_decompress.h"
+#include "aclock.h"
+#include "adept_unit_test.h"
+
+int suite_runs;
+int suite_fails;
+aclock *suite_clock;
+int test_runs;
+int test_fails;
+astr *suite_messages;
+
+#define LINES 20000
+
+static char *name = "test_afile_decompress.tmp";
+static char *text;
+static size_t text_length;
+
+// The lines read back, put together again.
+typedef struct read_back {
+	char *text;
+	size_t length;
+	size_t size;
+} read_back;
+
+static void create_text(void) {
+	int i;
+
+	text = (char *)malloc(LINES * 40);
+	text_length = 0;
+	for (i = 0; i < LINES; i++) {
+		text_length += sprintf(text + text_length, "line %d of the compressed file\n", i);
+	}
+}
+
+static int append_line(astr_view line, void *ctx) {
+	read_back *back = (read_back *)ctx;
+
+	if (back->length + line.length + 1 > back->size) {
+		return ENOSPC;
+	}
+	memcpy(back->text + back->length, line.string, line.length);
+	back->length += line.length;
+	back->text[back->length++] = '\n';
+	return AFILE_CONTINUE;
+}
+
+// Read the file back with the views, and compare it with the text.
+static int read_matches(int compression, int threads, int depth, long *nlines) {
+	astr *filename = astr_create(name);
+	afile *af;
+	read_back back;
+	int result;
+
+	back.size = text_length * 2;
+	back.text = (char *)malloc(back.size);
+	back.length = 0;
+
+	af = afile_create_explicit(filename, NULL, 4096, _IOFBF);
+	afile_set_compression(af, compression, threads);
+	afile_set_prefetch_depth(af, depth);
+	afile_open(af);
+	result = afile_process_views_ctx(af, NULL, append_line, &back, nlines);
+	afile_close(af);
+	if (result == 0 && (back.length != text_length || memcmp(back.text, text, text_length) != 0)) {
+		result = -1;
+	}
+
+	afile_free(af);
+	free(back.text);
+	astr_free(filename);
+	return result;
+}
+
+#ifdef HAVE_ZLIB_H
+
+static long counted_lines;
+
+static int count_line(astr *as) {
+	counted_lines++;
+	return 0;
+}
+
+/*
+ * Compress some text into one gzip member.  A BGZF member records its own
+ * length in a "BC" extra field, as bgzip writes it.
+ */
+static size_t gzip_member(const char *data, size_t length, int bgzf, unsigned char *out, size_t size) {
+	z_stream z;
+	size_t header = (bgzf ? 18 : 0);
+	size_t total;
+	uLong crc;
+
+	memset(&z, 0, sizeof(z));
+	deflateInit2(&z, Z_DEFAULT_COMPRESSION, Z_DEFLATED, (bgzf ? -MAX_WBITS : 16 + MAX_WBITS), 8, Z_DEFAULT_STRATEGY);
+	z.next_in = (unsigned char *)data;
+	z.avail_in = length;
+	z.next_out = out + header;
+	z.avail_out = size - header - 8;
+	deflate(&z, Z_FINISH);
+	total = header + z.total_out;
+	deflateEnd(&z);
+
+	if (bgzf) {
+		memcpy(out, "\x1f\x8b\x08\x04\0\0\0\0\0\xff\x06\0BC\x02\0", 16);
+		crc = crc32(0L, (const unsigned char *)data, length);
+		out[total++] = crc & 0xff;
+		out[total++] = (crc >> 8) & 0xff;
+		out[total++] = (crc >> 16) & 0xff;
+		out[total++] = (crc >> 24) & 0xff;
+		out[total++] = length & 0xff;
+		out[total++] = (length >> 8) & 0xff;
+		out[total++] = (length >> 16) & 0xff;
+		out[total++] = (length >> 24) & 0xff;
+		out[16] = (total - 1) & 0xff;
+		out[17] = ((total - 1) >> 8) & 0xff;
+	}
+	return total;
+}
+
+// Write the text as gzip members of about a piece size each, cut anywhere.
+static void write_gzip(const char *filename, size_t piece, int bgzf, size_t cut) {
+	unsigned char *out = (unsigned char *)malloc(2 * piece + 1024);
+	FILE *file = fopen(filename, "wb");
+	size_t offset;
+	size_t length;
+	size_t n;
+
+	for (offset = 0; offset < text_length; offset += length) {
+		length = (text_length - offset < piece ? text_length - offset : piece);
+		n = gzip_member(text + offset, length, bgzf, out, 2 * piece + 1024);
+		if (cut > 0 && offset + length == text_length) {
+			n -= cut;
+		}
+		fwrite(out, 1, n, file);
+	}
+	if (bgzf) {
+		// The empty member bgzip ends a file with.
+		fwrite("\x1f\x8b\x08\x04\0\0\0\0\0\xff\x06\0BC\x02\0\x1b\0\x03\0\0\0\0\0\0\0\0\0", 1, 28, file);
+	}
+	fclose(file);
+	free(out);
+}
+
+#endif
+
+// ----------
+
+void test_detect(void) {
+	aut_assert("1 gzip", afile_compression_detect("\x1f\x8b\x08\0", 4) == AFILE_COMPRESSION_GZIP);
+	aut_assert("2 zstd", afile_compression_detect("\x28\xb5\x2f\xfd", 4) == AFILE_COMPRESSION_ZSTD);
+	aut_assert("3 text", afile_compression_detect("line", 4) == AFILE_COMPRESSION_NONE);
+	aut_assert("4 too short", afile_compression_detect("\x1f", 1) == AFILE_COMPRESSION_NONE && afile_compression_detect("\x28\xb5\x2f", 3) == AFILE_COMPRESSION_NONE);
+	aut_assert("5 none available", afile_compression_available(AFILE_COMPRESSION_NONE));
+#ifdef HAVE_ZLIB_H
+	aut_assert("6 gzip available", afile_compression_available(AFILE_COMPRESSION_GZIP));
+#endif
+#ifndef HAVE_ZSTD_H
+	errno = 0;
+	aut_assert("7 zstd not built in", afile_decompressor_create(0, AFILE_COMPRESSION_ZSTD, NULL, 0, 0, 1) == NULL && errno == ENOTSUP);
+#endif
+}
+
+void test_uncompressed(void) {
+	FILE *file;
+	long nlines;
+	int result;
+
+	// A file that is not compressed is read as it is.
+	file = fopen(name, "wb");
+	fwrite(text, 1, text_length, file);
+	fclose(file);
+	result = read_matches(AFILE_COMPRESSION_AUTO, 1, 0, &nlines);
+	aut_assert("1 uncompressed", result == 0 && nlines == LINES);
+	result = read_matches(AFILE_COMPRESSION_NONE, 1, 3, &nlines);
+	aut_assert("2 uncompressed, prefetched", result == 0 && nlines == LINES);
+	unlink(name);
+}
+
+#ifdef HAVE_ZLIB_H
+
+void test_gzip(void) {
+	astr *filename;
+	afile *af;
+	afile_reader *reader;
+	astr_view line;
+	long nlines;
+	int result;
+
+	// One member.
+	write_gzip(name, text_length, 0, 0);
+	result = read_matches(AFILE_COMPRESSION_AUTO, 1, 0, &nlines);
+	aut_assert("1 gzip", result == 0 && nlines == LINES);
+	result = read_matches(AFILE_COMPRESSION_GZIP, 4, 3, &nlines);
+	aut_assert("2 gzip, prefetched", result == 0 && nlines == LINES);
+
+	// The reader says what it found, and the same file read as it is is not text.
+	filename = astr_create(name);
+	af = afile_create_explicit(filename, NULL, 4096, _IOFBF);
+	afile_open(af);
+	reader = afile_reader_create(af);
+	line = afile_reader_next(reader);
+	aut_assert("3 gzip found", reader->compression == AFILE_COMPRESSION_GZIP && reader->decompressor != NULL && line.length == 30 && memcmp(line.string, text, 30) == 0);
+	afile_reader_free(reader);
+	afile_close(af);
+	af = afile_free(af);
+	af = afile_create_explicit(filename, NULL, 4096, _IOFBF);
+	afile_set_compression(af, AFILE_COMPRESSION_NONE, 1);
+	afile_open(af);
+	reader = afile_reader_create(af);
+	line = afile_reader_next(reader);
+	aut_assert("4 gzip read as it is", reader->compression == AFILE_COMPRESSION_NONE && reader->decompressor == NULL && (unsigned char)line.string[0] == 0x1f);
+	afile_reader_free(reader);
+	afile_close(af);
+	afile_free(af);
+	astr_free(filename);
+
+	// Many members, one after another, as cat of gzip files makes.
+	write_gzip(name, 10000, 0, 0);
+	result = read_matches(AFILE_COMPRESSION_AUTO, 4, 0, &nlines);
+	aut_assert("5 gzip members", result == 0 && nlines == LINES);
+
+	// Cut short.
+	write_gzip(name, text_length, 0, 1000);
+	result = read_matches(AFILE_COMPRESSION_AUTO, 1, 0, &nlines);
+	aut_assert("6 gzip cut short", result == EIO && nlines < LINES);
+
+	unlink(name);
+}
+
+void test_gzip_parallel(void) {
+	astr *filename;
+	afile *af;
+	afile_reader *reader;
+	FILE *file;
+	long nlines;
+	long line_counts[4];
+	int result;
+
+	// Members that say where they end are decompressed on several threads.
+	write_gzip(name, 30000, 1, 0);
+	result = read_matches(AFILE_COMPRESSION_AUTO, 4, 0, &nlines);
+	aut_assert("1 bgzf on threads", result == 0 && nlines == LINES);
+	result = read_matches(AFILE_COMPRESSION_AUTO, 3, 2, &nlines);
+	aut_assert("2 bgzf on threads, prefetched", result == 0 && nlines == LINES);
+	result = read_matches(AFILE_COMPRESSION_AUTO, 1, 0, &nlines);
+	aut_assert("3 bgzf on one thread", result == 0 && nlines == LINES);
+
+	filename = astr_create(name);
+	af = afile_create_explicit(filename, NULL, 4096, _IOFBF);
+	afile_set_compression(af, AFILE_COMPRESSION_AUTO, 4);
+	afile_open(af);
+	reader = afile_reader_create(af);
+	aut_assert("4 bgzf job", reader->decompressor != NULL && reader->decompressor->job != NULL);
+	afile_reader_free(reader);
+	afile_close(af);
+
+	// The parallel processing functions leave a compressed file to the line reader.
+	afile_open(af);
+	counted_lines = 0;
+	nlines = afile_process_lines_parallel(af, 4, 0, count_line, line_counts);
+	aut_assert("5 bgzf processed in parallel", nlines == LINES && counted_lines == LINES && line_counts[0] == LINES);
+	afile_close(af);
+	afile_free(af);
+	astr_free(filename);
+
+	// A corrupt member is an error.
+	write_gzip(name, 30000, 1, 0);
+	file = fopen(name, "r+b");
+	fseek(file, 5000, SEEK_SET);
+	fputs("corrupt", file);
+	fclose(file);
+	result = read_matches(AFILE_COMPRESSION_AUTO, 4, 0, &nlines);
+	aut_assert("6 bgzf corrupt", result == EIO);
+
+	unlink(name);
+}
+
+void test_gzip_pipe(void) {
+	char *pipe_name = "test_afile_decompress_pipe.tmp";
+	astr *filename;
+	afile *af;
+	read_back back;
+	unsigned char *out;
+	FILE *file;
+	pid_t pid;
+	long nlines;
+	size_t n;
+	int status;
+	int result;
+
+	unlink(pipe_name);
+	result = mkfifo(pipe_name, 0600);
+	aut_assert("1 gzip pipe", result == 0);
+
+	pid = fork();
+	if (pid == 0) {
+		out = (unsigned char *)malloc(2 * text_length);
+		n = gzip_member(text, text_length, 0, out, 2 * text_length);
+		file = fopen(pipe_name, "w");
+		fwrite(out, 1, n, file);
+		fclose(file);
+		_exit(0);
+	}
+
+	// A pipe cannot be looked at first, so the bytes read to tell are handed out again.
+	back.size = text_length * 2;
+	back.text = (char *)malloc(back.size);
+	back.length = 0;
+	filename = astr_create(pipe_name);
+	af = afile_create_explicit(filename, NULL, 4096, _IOFBF);
+	afile_open(af);
+	result = afile_process_views_ctx(af, NULL, append_line, &back, &nlines);
+	aut_assert("2 gzip pipe", result == 0 && nlines == LINES);
+	aut_assert("3 gzip pipe", back.length == text_length && memcmp(back.text, text, text_length) == 0);
+	afile_close(af);
+
+	waitpid(pid, &status, 0);
+	aut_assert("4 gzip pipe", WIFEXITED(status) && WEXITSTATUS(status) == 0);
+	result = unlink(pipe_name);
+	aut_assert("5 gzip pipe", result == 0);
+
+	afile_free(af);
+	free(back.text);
+	astr_free(filename);
+}
+
+#endif
+
+// ----------
+
+int main(int argc, char *argv[]) {
+	create_text();
+	aut_initialize_suite();
+	aut_run_test(test_detect);
+	aut_run_test(test_uncompressed);
+#ifdef HAVE_ZLIB_H
+	aut_run_test(test_gzip);
+	aut_run_test(test_gzip_parallel);
+	aut_run_test(test_gzip_pipe);
+#endif
+	aut_report();
+	aut_terminate_suite();
+	free(text);
+	aut_return();
+}
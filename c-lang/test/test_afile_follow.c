@@ -0,0 +1,232 @@
+// test_afile_follow.c - test the follow mode functions
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "astr.h"
+#include "afile.h"
+#include "aclock.h"
+#include "adept_unit_test.h"
+
+int suite_runs;
+int suite_fails;
+aclock *suite_clock;
+int test_runs;
+int test_fails;
+astr *suite_messages;
+
+static char *name = "test_afile_follow.tmp";
+static char *rotated_name = "test_afile_follow.tmp.1";
+
+// What the lines followed were: "line <n>", numbered in order from 0.
+typedef struct follow_check {
+	long next_number;
+	int bad;
+	int stop_after;
+	int lines;
+} follow_check;
+
+static void write_text(const char *text, int flags) {
+	int fd;
+
+	fd = open(name, O_WRONLY | O_CREAT | flags, 0600);
+	if (fd >= 0) {
+		if (write(fd, text, strlen(text)) < 0) {
+			perror("write");
+		}
+		close(fd);
+	}
+}
+
+static void append_lines(int from, int to) {
+	char line[32];
+	int i;
+
+	for (i = from; i < to; i++) {
+		snprintf(line, sizeof(line), "line %d\n", i);
+		write_text(line, O_APPEND);
+	}
+}
+
+static afile *open_follow(void) {
+	astr *filename = astr_create(name);
+	afile *af = afile_create(filename, NULL);
+	afile_open(af);
+	astr_free(filename);
+	return af;
+}
+
+int check_line_ctx(astr_view line, void *ctx) {
+	follow_check *check = (follow_check *)ctx;
+	char expected[32];
+	int length;
+
+	length = snprintf(expected, sizeof(expected), "line %ld", check->next_number++);
+	if (line.length != length || memcmp(line.string, expected, length) != 0) {
+		check->bad++;
+	}
+	check->lines++;
+	return (check->lines == check->stop_after ? AFILE_STOP : AFILE_CONTINUE);
+}
+
+// ----------
+
+// Lines appended a piece at a time, so a line is often only partly written.
+static void *write_pieces(void *arg) {
+	char line[32];
+	int i;
+
+	for (i = 10; i < 1000; i++) {
+		snprintf(line, sizeof(line), "line %d\n", i);
+		if (i % 100 == 0) {
+			write_text("line ", O_APPEND);
+			usleep(20000);
+			write_text(line + 5, O_APPEND);
+		}
+		else {
+			write_text(line, O_APPEND);
+		}
+	}
+	return NULL;
+}
+
+void test_follow_appends(void) {
+	follow_check check;
+	pthread_t writer;
+	long line_count;
+	afile *af;
+	int result;
+
+	unlink(name);
+	append_lines(0, 10);
+	af = open_follow();
+	memset(&check, 0, sizeof(check));
+	pthread_create(&writer, NULL, write_pieces, NULL);
+	result = afile_follow_views_ctx(af, NULL, check_line_ctx, &check, 500, &line_count);
+	pthread_join(writer, NULL);
+	aut_assert("1 appended lines", result == 0 && line_count == 1000 && check.lines == 1000);
+	aut_assert("2 whole and in order", check.bad == 0 && check.next_number == 1000);
+	aut_assert("3 left at the end", ftello(af->file) == lseek(fileno(af->file), 0, SEEK_END));
+	afile_free(af);
+	unlink(name);
+}
+
+static void *truncate_and_write(void *arg) {
+	usleep(100000);
+	write_text("", O_TRUNC);
+	usleep(300000);
+	append_lines(50, 100);
+	return NULL;
+}
+
+void test_follow_truncated(void) {
+	follow_check check;
+	pthread_t writer;
+	long line_count;
+	afile *af;
+	int result;
+
+	unlink(name);
+	append_lines(0, 50);
+	af = open_follow();
+	memset(&check, 0, sizeof(check));
+	pthread_create(&writer, NULL, truncate_and_write, NULL);
+	result = afile_follow_views_ctx(af, NULL, check_line_ctx, &check, 600, &line_count);
+	pthread_join(writer, NULL);
+	aut_assert("1 read again from the start", result == 0 && line_count == 100 && check.bad == 0 && check.next_number == 100);
+	afile_free(af);
+	unlink(name);
+}
+
+static void *rotate_and_write(void *arg) {
+	usleep(100000);
+	append_lines(50, 60);
+	write_text("line 60", O_APPEND);
+	rename(name, rotated_name);
+	usleep(100000);
+	append_lines(61, 100);
+	return NULL;
+}
+
+void test_follow_rotated(void) {
+	follow_check check;
+	pthread_t writer;
+	long line_count;
+	afile *af;
+	int result;
+
+	unlink(name);
+	unlink(rotated_name);
+	append_lines(0, 50);
+	af = open_follow();
+	memset(&check, 0, sizeof(check));
+	pthread_create(&writer, NULL, rotate_and_write, NULL);
+	result = afile_follow_views_ctx(af, NULL, check_line_ctx, &check, 600, &line_count);
+	pthread_join(writer, NULL);
+
+	// The last line of the old file counts, even without its newline.
+	aut_assert("1 the old file and then the new", result == 0 && line_count == 100 && check.bad == 0 && check.next_number == 100);
+	afile_free(af);
+	unlink(name);
+	unlink(rotated_name);
+}
+
+static int even_lines;
+
+int match_even(astr *as) {
+	return atol(as->string + 5) % 2 == 0;
+}
+
+int count_even(astr *as) {
+	if (as->string[as->length - 1] == '\n' && atol(as->string + 5) % 2 == 0) {
+		even_lines++;
+	}
+	return 0;
+}
+
+void test_follow_partial(void) {
+	follow_check check;
+	long line_count;
+	afile *af;
+	int result;
+
+	unlink(name);
+	write_text("line 0\nline 1\nline 2\nline 3\nline 4", O_TRUNC);
+	af = open_follow();
+
+	// The partial last line is kept back, and the file is left at its start.
+	even_lines = 0;
+	result = afile_follow_matching_lines(af, match_even, count_even, 50, &line_count);
+	aut_assert("1 whole lines, with newlines", result == 0 && line_count == 2 && even_lines == 2);
+	aut_assert("2 left at the partial line", ftello(af->file) == 28);
+
+	// Following again carries on with the partial line, once it is whole.
+	write_text("0\nline 41\n", O_APPEND);
+	memset(&check, 0, sizeof(check));
+	check.next_number = 40;
+	check.stop_after = 1;
+	result = afile_follow_views_ctx(af, NULL, check_line_ctx, &check, AFILE_FOLLOW_FOREVER, &line_count);
+	aut_assert("3 stopped", result == 0 && line_count == 1 && check.bad == 0);
+	aut_assert("4 left after the line processed", ftello(af->file) == 36);
+	aut_assert("5 no process function", afile_follow_views_ctx(af, NULL, NULL, NULL, 0, NULL) == EINVAL);
+	afile_close(af);
+	aut_assert("6 not open", afile_follow_views_ctx(af, NULL, check_line_ctx, &check, 0, NULL) == EBADF);
+	afile_free(af);
+	unlink(name);
+}
+
+int main(int argc, char *argv[]) {
+	aut_initialize_suite();
+	aut_run_test(test_follow_appends);
+	aut_run_test(test_follow_truncated);
+	aut_run_test(test_follow_rotated);
+	aut_run_test(test_follow_partial);
+	aut_report();
+	aut_terminate_suite();
+	aut_return();
+}
@@ -0,0 +1,249 @@
+// test_afile_parallel.c - test the parallel file processing functions
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+
+#include "astr.h"
+#include "afile.h"
+#include "aclock.h"
+#include "adept_unit_test.h"
+
+int suite_runs;
+int suite_fails;
+aclock *suite_clock;
+int test_runs;
+int test_fails;
+astr *suite_messages;
+
+#define LINES 200000
+#define THREADS 4
+
+static char *name = "test_afile_parallel.tmp";
+
+static long sum_of_numbers;
+static long next_number;
+static int out_of_order;
+static char *collected;
+static size_t collected_length;
+
+static void write_lines(void) {
+	FILE *file;
+	int i;
+
+	file = fopen(name, "w");
+	for (i = 0; i < LINES; i++) {
+		fprintf(file, "line %d\n", i);
+	}
+	fclose(file);
+}
+
+static afile *open_lines(void) {
+	astr *filename = astr_create(name);
+	afile *af = afile_create(filename, NULL);
+	afile_open(af);
+	astr_free(filename);
+	return af;
+}
+
+int sum_line(astr *as) {
+	__atomic_add_fetch(&sum_of_numbers, atol(as->string + 5), __ATOMIC_RELAXED);
+	return 0;
+}
+
+int check_order(astr *as) {
+	long number = atol(as->string + 5);
+	if (number < next_number || as->string[as->length - 1] != '\n') {
+		out_of_order++;
+	}
+	next_number = number + 1;
+	sum_of_numbers += number;
+	return 0;
+}
+
+int match_seventh(astr *as) {
+	return atol(as->string + 5) % 7 == 0;
+}
+
+int check_edited(astr *as) {
+	if (strncmp(as->string, "LINE ", 5) != 0) {
+		out_of_order++;
+	}
+	return check_order(as);
+}
+
+int collect_line(astr *as) {
+	memcpy(collected + collected_length, as->string, as->length);
+	collected_length += as->length;
+	return 0;
+}
+
+// ----------
+
+void test_unordered(void) {
+	long line_counts[THREADS];
+	long line_count;
+	long expected = (long)LINES * (LINES - 1) / 2;
+	afile *af;
+	int busy = 0;
+	int t;
+
+	write_lines();
+	af = open_lines();
+	sum_of_numbers = 0;
+	line_count = afile_process_lines_parallel(af, THREADS, 0, sum_line, line_counts);
+	aut_assert("1 all lines", line_count == LINES);
+	aut_assert("2 each line once", sum_of_numbers == expected);
+	for (t = 0; t < THREADS; t++) {
+		busy += (line_counts[t] > 0);
+		line_count -= line_counts[t];
+	}
+	aut_assert("3 worker counts add up", line_count == 0 && busy >= 1);
+	aut_assert("4 at end", fgetc(af->file) == EOF);
+	afile_free(af);
+}
+
+void test_ordered(void) {
+	long line_counts[THREADS];
+	long line_count;
+	afile *af;
+
+	af = open_lines();
+	sum_of_numbers = 0;
+	next_number = 0;
+	out_of_order = 0;
+	line_count = afile_process_lines_parallel(af, THREADS, 1, check_order, line_counts);
+	aut_assert("1 all lines", line_count == LINES && next_number == LINES);
+	aut_assert("2 in order", out_of_order == 0);
+	aut_assert("3 worker counts add up", line_counts[0] + line_counts[1] + line_counts[2] + line_counts[3] == LINES);
+	afile_free(af);
+}
+
+void test_matching_edited(void) {
+	astr_edit_program *program;
+	long line_count;
+	char line[64];
+	afile *af;
+
+	af = open_lines();
+	program = astr_edit_program_create(ASTR_EDIT_UPPER_CASE);
+	afile_set_edit_program(af, program);
+	astr_edit_program_free(program);
+
+	// Start after the first line.
+	fgets(line, sizeof(line), af->file);
+	next_number = 0;
+	out_of_order = 0;
+	line_count = afile_process_matching_lines_parallel(af, THREADS, 1, match_seventh, check_edited, NULL);
+	aut_assert("1 matching lines", line_count == (LINES - 1) / 7);
+	aut_assert("2 edited, in order", out_of_order == 0 && next_number == (LINES - 1) / 7 * 7 + 1);
+	afile_free(af);
+}
+
+void test_one_thread(void) {
+	long line_counts[1];
+	long line_count;
+	afile *af;
+
+	af = open_lines();
+	next_number = 0;
+	out_of_order = 0;
+	line_count = afile_process_lines_parallel(af, 1, 1, check_order, line_counts);
+	aut_assert("1 one thread", line_count == LINES && line_counts[0] == LINES && out_of_order == 0);
+	line_count = afile_process_lines_parallel(af, THREADS, 0, sum_line, NULL);
+	aut_assert("2 nothing left", line_count == 0);
+	afile_free(af);
+	unlink(name);
+}
+
+// ----------
+
+void test_separators(void) {
+	long line_count;
+	FILE *file;
+	afile *af;
+	int i;
+
+	// Chunks start after a separator of two bytes, not inside it.
+	file = fopen(name, "w");
+	for (i = 0; i < LINES; i++) {
+		fprintf(file, "line %d\r\n", i);
+	}
+	fclose(file);
+	af = open_lines();
+	afile_set_separator(af, "\r\n", 2);
+	next_number = 0;
+	out_of_order = 0;
+	line_count = afile_process_lines_parallel(af, THREADS, 1, check_order, NULL);
+	aut_assert("1 separator", line_count == LINES && next_number == LINES && out_of_order == 0);
+	afile_free(af);
+
+	// Chunks start at a multiple of a fixed record length.
+	file = fopen(name, "w");
+	for (i = 0; i < LINES; i++) {
+		fprintf(file, "line %07d\n", i);
+	}
+	fclose(file);
+	af = open_lines();
+	afile_set_record_length(af, 13);
+	next_number = 0;
+	out_of_order = 0;
+	line_count = afile_process_lines_parallel(af, THREADS, 1, check_order, NULL);
+	aut_assert("2 fixed records", line_count == LINES && next_number == LINES && out_of_order == 0);
+	afile_free(af);
+	unlink(name);
+}
+
+void test_nul_bytes(void) {
+	size_t length = (size_t)LINES * 24;
+	char *serial = (char *)malloc(length);
+	size_t serial_length;
+	long line_count;
+	FILE *file;
+	afile *af;
+	int i;
+
+	// Lines with NUL bytes in them are passed on whole, as serially.
+	file = fopen(name, "w");
+	for (i = 0; i < LINES; i++) {
+		fprintf(file, "line %d", i);
+		fputc('\0', file);
+		fprintf(file, "x%d\n", i);
+	}
+	fclose(file);
+
+	collected = serial;
+	collected_length = 0;
+	af = open_lines();
+	line_count = afile_process_matching_lines(af, NULL, collect_line);
+	afile_free(af);
+	serial_length = collected_length;
+	aut_assert("1 serial", line_count == LINES && serial_length > (size_t)LINES * 10 && memchr(serial, '\0', serial_length) != NULL);
+
+	collected = (char *)malloc(length);
+	collected_length = 0;
+	af = open_lines();
+	line_count = afile_process_lines_parallel(af, THREADS, 1, collect_line, NULL);
+	afile_free(af);
+	aut_assert("2 parallel", line_count == LINES && collected_length == serial_length && memcmp(collected, serial, serial_length) == 0);
+
+	free(collected);
+	free(serial);
+	collected = NULL;
+	unlink(name);
+}
+
+int main(int argc, char *argv[]) {
+	aut_initialize_suite();
+	aut_run_test(test_unordered);
+	aut_run_test(test_ordered);
+	aut_run_test(test_matching_edited);
+	aut_run_test(test_one_thread);
+	aut_run_test(test_separators);
+	aut_run_test(test_nul_bytes);
+	aut_report();
+	aut_terminate_suite();
+	aut_return();
+}
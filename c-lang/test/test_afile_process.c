@@ -6,6 +6,8 @@
 #include <errno.h>
 #include <unistd.h>
 #include <regex.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
 
 #include "astr.h"
 #include "afile.h"
@@ -37,6 +39,15 @@ int match_line_lowercase(astr *as) {
 	return result;
 }
 
+int edited_lines_ok = 0;
+
+int check_edited_line(astr *as) {
+	if (strcmp(as->string, "ABC DEF") == 0 && as->length == 7) {
+		edited_lines_ok++;
+	}
+	return 0;
+}
+
 // ----------
 
 void test_process_lines(void) {
@@ -161,12 +172,724 @@ void test_process_matching_lines(void) {
 	astr_free(open_modes);
 }
 
+void test_process_edited_lines(void) {
+	char *name = "test_process_edited_lines.tmp";
+	astr *filename;
+	astr *open_modes;
+	astr_edit_program *program;
+	afile *af;
+	int result;
+	int i;
+	int nlines;
+
+	filename = astr_create(name);
+	open_modes = astr_create("w");
+	af = afile_create(filename, open_modes);
+	result = afile_open(af);
+	aut_assert("1 test_process_edited_lines", result == 0);
+
+	for (i = 0; i < 5; i++) {
+		fprintf(af->file, "  abc    def \t\n");
+		fprintf(af->file, "abc def\n");
+	}
+
+	result = afile_close(af);
+	aut_assert("2 test_process_edited_lines", result == 0);
+
+	open_modes = astr_set(open_modes, "r");
+	afile_set_open_modes(af, open_modes);
+	result = afile_open(af);
+	aut_assert("3 test_process_edited_lines", result == 0);
+
+	// Clean and upper-case each line in one pass before it is processed.
+	program = astr_edit_program_create(ASTR_EDIT_CLEAN | ASTR_EDIT_UPPER_CASE);
+	afile_set_edit_program(af, program);
+	program = astr_edit_program_free(program);
+
+	edited_lines_ok = 0;
+	nlines = afile_process_lines(af, check_edited_line);
+	aut_assert("4 test_process_edited_lines", nlines == 10);
+	aut_assert("5 test_process_edited_lines", edited_lines_ok == 10);
+
+	result = afile_close(af);
+	aut_assert("6 test_process_edited_lines", result == 0);
+
+	result = unlink(af->filespec->string);
+	aut_assert("7 test_process_edited_lines", result == 0);
+
+	af = afile_free(af);
+	astr_free(filename);
+	astr_free(open_modes);
+}
+
+int view_lines = 0;
+int view_bytes = 0;
+int view_long_lines = 0;
+
+int count_view(astr_view line) {
+	view_lines++;
+	view_bytes += line.length;
+	if (line.length > 1000 && line.string[0] == 'x' && line.string[line.length - 1] == 'x') {
+		view_long_lines++;
+	}
+	return 0;
+}
+
+int match_view_lowercase(astr_view line) {
+	return line.length > 0 && line.string[0] >= 'a' && line.string[0] <= 'z';
+}
+
+int check_edited_view(astr_view line) {
+	if (line.length == 7 && memcmp(line.string, "ABC DEF", 7) == 0) {
+		edited_lines_ok++;
+	}
+	return 0;
+}
+
+static void write_view_lines(FILE *file, int long_length) {
+	int i;
+	int j;
+
+	for (i = 0; i < 5; i++) {
+		fprintf(file, "%s\n%s\n%s\n", content_lower, content_upper, content_mixed);
+	}
+	for (j = 0; j < long_length; j++) {
+		fputc('x', file);
+	}
+	fprintf(file, "\n\n%s", content_lower);
+}
+
+void test_process_views(void) {
+	char *name = "test_process_views.tmp";
+	char line[64];
+	astr *filename;
+	astr *open_modes;
+	astr_edit_program *program;
+	afile *af;
+	int result;
+	int nlines;
+
+	filename = astr_create(name);
+	open_modes = astr_create("w");
+	af = afile_create_explicit(filename, open_modes, 256, _IOFBF);
+	result = afile_open(af);
+	aut_assert("1 test_process_views", result == 0);
+	write_view_lines(af->file, 5000);
+	afile_close(af);
+
+	// Every line, including one longer than the buffer and a last line with no newline.
+	open_modes = astr_set(open_modes, "r");
+	afile_set_open_modes(af, open_modes);
+	result = afile_open(af);
+	aut_assert("2 test_process_views", result == 0);
+	view_lines = view_bytes = view_long_lines = 0;
+	nlines = afile_process_views(af, count_view);
+	aut_assert("3 test_process_views", nlines == 18 && view_lines == 18);
+	aut_assert("4 test_process_views", view_bytes == 16 * 26 + 5000 && view_long_lines == 1);
+	aut_assert("5 test_process_views", fgets(line, sizeof(line), af->file) == NULL);
+	afile_close(af);
+
+	// From the current position, matching.
+	afile_open(af);
+	fgets(line, sizeof(line), af->file);
+	view_lines = 0;
+	nlines = afile_process_matching_views(af, match_view_lowercase, count_view);
+	aut_assert("6 test_process_views", nlines == 6 && view_lines == 6);
+	afile_close(af);
+
+	// Edited lines are views of the edited copy.
+	af = afile_free(af);
+	open_modes = astr_set(open_modes, "w");
+	af = afile_create(filename, open_modes);
+	afile_open(af);
+	fprintf(af->file, "  abc    def \t\nabc def\n  abc def");
+	afile_close(af);
+	open_modes = astr_set(open_modes, "r");
+	afile_set_open_modes(af, open_modes);
+	afile_open(af);
+	program = astr_edit_program_create(ASTR_EDIT_CLEAN | ASTR_EDIT_UPPER_CASE);
+	afile_set_edit_program(af, program);
+	program = astr_edit_program_free(program);
+	edited_lines_ok = 0;
+	nlines = afile_process_views(af, check_edited_view);
+	aut_assert("7 test_process_views", nlines == 3 && edited_lines_ok == 3);
+	afile_close(af);
+
+	// An empty file has no lines.
+	af = afile_free(af);
+	open_modes = astr_set(open_modes, "w+");
+	af = afile_create(filename, open_modes);
+	afile_open(af);
+	nlines = afile_process_views(af, count_view);
+	aut_assert("8 test_process_views", nlines == 0);
+	afile_close(af);
+
+	result = unlink(name);
+	aut_assert("9 test_process_views", result == 0);
+
+	af = afile_free(af);
+	astr_free(filename);
+	astr_free(open_modes);
+}
+
+void test_process_views_pipe(void) {
+	char *name = "test_process_views_pipe.tmp";
+	astr *filename;
+	astr *open_modes;
+	afile *af;
+	FILE *file;
+	pid_t pid;
+	int status;
+	int result;
+	int nlines;
+
+	unlink(name);
+	result = mkfifo(name, 0600);
+	aut_assert("1 test_process_views_pipe", result == 0);
+
+	pid = fork();
+	if (pid == 0) {
+		file = fopen(name, "w");
+		write_view_lines(file, 100000);
+		fclose(file);
+		_exit(0);
+	}
+
+	// A pipe cannot be mapped, so it is read into a buffer that has to grow.
+	filename = astr_create(name);
+	open_modes = astr_create("r");
+	af = afile_create_explicit(filename, open_modes, 256, _IOFBF);
+	result = afile_open(af);
+	aut_assert("2 test_process_views_pipe", result == 0);
+	view_lines = view_bytes = view_long_lines = 0;
+	nlines = afile_process_views(af, count_view);
+	aut_assert("3 test_process_views_pipe", nlines == 18 && view_lines == 18);
+	aut_assert("4 test_process_views_pipe", view_bytes == 16 * 26 + 100000 && view_long_lines == 1);
+	afile_close(af);
+
+	waitpid(pid, &status, 0);
+	aut_assert("5 test_process_views_pipe", WIFEXITED(status) && WEXITSTATUS(status) == 0);
+	result = unlink(name);
+	aut_assert("6 test_process_views_pipe", result == 0);
+
+	af = afile_free(af);
+	astr_free(filename);
+	astr_free(open_modes);
+}
+
+// What the context functions count, instead of globals.
+typedef struct view_counts {
+	int lines;
+	long bytes;
+	int batches;
+	int largest_batch;
+	int stop_after;
+	int error_after;
+} view_counts;
+
+int match_view_ctx(astr_view line, void *ctx) {
+	return line.length > 0 && line.string[0] >= 'a' && line.string[0] <= 'z';
+}
+
+int count_view_ctx(astr_view line, void *ctx) {
+	view_counts *counts = (view_counts *)ctx;
+
+	counts->lines++;
+	counts->bytes += line.length;
+	if (counts->lines == counts->stop_after) {
+		return AFILE_STOP;
+	}
+	if (counts->lines == counts->error_after) {
+		return EIO;
+	}
+	return AFILE_CONTINUE;
+}
+
+int count_batch_ctx(const astr_view *lines, int count, void *ctx) {
+	view_counts *counts = (view_counts *)ctx;
+	int i;
+
+	counts->batches++;
+	if (count > counts->largest_batch) {
+		counts->largest_batch = count;
+	}
+	for (i = 0; i < count; i++) {
+		counts->lines++;
+		counts->bytes += lines[i].length;
+		if (lines[i].length > 0 && lines[i].string[lines[i].length - 1] == '\n') {
+			return EINVAL;
+		}
+	}
+	if (counts->stop_after > 0 && counts->lines >= counts->stop_after) {
+		return AFILE_STOP;
+	}
+	return AFILE_CONTINUE;
+}
+
+void test_process_ctx(void) {
+	char *name = "test_process_ctx.tmp";
+	char line[64];
+	astr *filename;
+	astr *open_modes;
+	afile *af;
+	view_counts counts;
+	long nlines;
+	int result;
+
+	filename = astr_create(name);
+	open_modes = astr_create("w");
+	af = afile_create_explicit(filename, open_modes, 256, _IOFBF);
+	result = afile_open(af);
+	aut_assert("1 test_process_ctx", result == 0);
+	write_view_lines(af->file, 5000);
+	afile_close(af);
+
+	// The state is in the context.
+	open_modes = astr_set(open_modes, "r");
+	afile_set_open_modes(af, open_modes);
+	afile_open(af);
+	memset(&counts, 0, sizeof(counts));
+	result = afile_process_views_ctx(af, NULL, count_view_ctx, &counts, &nlines);
+	aut_assert("2 test_process_ctx", result == 0 && nlines == 18 && counts.lines == 18 && counts.bytes == 16 * 26 + 5000);
+	afile_close(af);
+
+	// Matching.
+	afile_open(af);
+	memset(&counts, 0, sizeof(counts));
+	result = afile_process_views_ctx(af, match_view_ctx, count_view_ctx, &counts, &nlines);
+	aut_assert("3 test_process_ctx", result == 0 && nlines == 7 && counts.lines == 7);
+	afile_close(af);
+
+	// Stop early, leaving the file just after the last line processed.
+	afile_open(af);
+	memset(&counts, 0, sizeof(counts));
+	counts.stop_after = 4;
+	result = afile_process_views_ctx(af, NULL, count_view_ctx, &counts, &nlines);
+	aut_assert("4 test_process_ctx", result == 0 && nlines == 4 && counts.lines == 4);
+	aut_assert("5 test_process_ctx", ftello(af->file) == 4 * 27 && fgets(line, sizeof(line), af->file) != NULL && strncmp(line, content_upper, 26) == 0);
+
+	// Carry on from there.
+	memset(&counts, 0, sizeof(counts));
+	result = afile_process_views_ctx(af, NULL, count_view_ctx, &counts, &nlines);
+	aut_assert("6 test_process_ctx", result == 0 && nlines == 13 && ftello(af->file) == 15 * 27 + 5001 + 1 + 26);
+	afile_close(af);
+
+	// Stop with an error.
+	afile_open(af);
+	memset(&counts, 0, sizeof(counts));
+	counts.error_after = 7;
+	result = afile_process_views_ctx(af, NULL, count_view_ctx, &counts, &nlines);
+	aut_assert("7 test_process_ctx", result == EIO && nlines == 7 && counts.lines == 7 && ftello(af->file) == 7 * 27);
+	afile_close(af);
+
+	// Batches from the mapped file are full, except the last.
+	afile_open(af);
+	memset(&counts, 0, sizeof(counts));
+	result = afile_process_batches(af, 4, count_batch_ctx, &counts, &nlines);
+	aut_assert("8 test_process_ctx", result == 0 && nlines == 18 && counts.lines == 18 && counts.bytes == 16 * 26 + 5000);
+	aut_assert("9 test_process_ctx", counts.batches == 5 && counts.largest_batch == 4);
+	afile_close(af);
+
+	// Stop a batch early.
+	afile_open(af);
+	memset(&counts, 0, sizeof(counts));
+	counts.stop_after = 5;
+	result = afile_process_batches(af, 4, count_batch_ctx, &counts, &nlines);
+	aut_assert("10 test_process_ctx", result == 0 && nlines == 8 && counts.batches == 2 && ftello(af->file) == 8 * 27);
+	aut_assert("11 test_process_ctx", afile_process_batches(af, 0, count_batch_ctx, &counts, NULL) == EINVAL);
+	afile_close(af);
+	aut_assert("12 test_process_ctx", afile_process_views_ctx(af, NULL, count_view_ctx, &counts, NULL) == EBADF);
+
+	// Batches through a prefetching reader.
+	af = afile_free(af);
+	af = afile_create_explicit(filename, open_modes, 256, _IOFBF);
+	afile_set_prefetch_depth(af, 3);
+	afile_open(af);
+	memset(&counts, 0, sizeof(counts));
+	result = afile_process_batches(af, 64, count_batch_ctx, &counts, &nlines);
+	aut_assert("13 test_process_ctx", result == 0 && nlines == 18 && counts.bytes == 16 * 26 + 5000);
+	afile_close(af);
+
+	result = unlink(name);
+	aut_assert("14 test_process_ctx", result == 0);
+
+	af = afile_free(af);
+	astr_free(filename);
+	astr_free(open_modes);
+}
+
+void test_process_batches_pipe(void) {
+	char *name = "test_process_batches_pipe.tmp";
+	astr *filename;
+	astr *open_modes;
+	afile *af;
+	FILE *file;
+	view_counts counts;
+	pid_t pid;
+	long nlines;
+	int status;
+	int result;
+
+	unlink(name);
+	result = mkfifo(name, 0600);
+	aut_assert("1 test_process_batches_pipe", result == 0);
+
+	pid = fork();
+	if (pid == 0) {
+		file = fopen(name, "w");
+		write_view_lines(file, 100000);
+		fclose(file);
+		_exit(0);
+	}
+
+	// The lines of a pipe are batched as they sit in the buffer.
+	filename = astr_create(name);
+	open_modes = astr_create("r");
+	af = afile_create_explicit(filename, open_modes, 4096, _IOFBF);
+	result = afile_open(af);
+	aut_assert("2 test_process_batches_pipe", result == 0);
+	memset(&counts, 0, sizeof(counts));
+	result = afile_process_batches(af, 8, count_batch_ctx, &counts, &nlines);
+	aut_assert("3 test_process_batches_pipe", result == 0 && nlines == 18 && counts.lines == 18);
+	aut_assert("4 test_process_batches_pipe", counts.bytes == 16 * 26 + 100000 && counts.largest_batch > 1 && counts.batches < 18);
+	afile_close(af);
+
+	waitpid(pid, &status, 0);
+	aut_assert("5 test_process_batches_pipe", WIFEXITED(status) && WEXITSTATUS(status) == 0);
+	result = unlink(name);
+	aut_assert("6 test_process_batches_pipe", result == 0);
+
+	af = afile_free(af);
+	astr_free(filename);
+	astr_free(open_modes);
+}
+
+// The records a context function is passed, joined by '|'.
+typedef struct record_log {
+	char text[4096];
+	int length;
+	int records;
+} record_log;
+
+int log_record_ctx(astr_view record, void *ctx) {
+	record_log *log = (record_log *)ctx;
+
+	if (log->length + record.length + 1 > (int)sizeof(log->text)) {
+		return ENOSPC;
+	}
+	memcpy(log->text + log->length, record.string, record.length);
+	log->length += record.length;
+	log->text[log->length++] = '|';
+	log->records++;
+	return AFILE_CONTINUE;
+}
+
+// Read all the records of a file with a line reader, and check each one.
+static int read_records(afile *af, int count) {
+	char expected[32];
+	afile_reader *reader;
+	astr_view record;
+	int length;
+	int ok = 1;
+	int i = 0;
+
+	afile_open(af);
+	reader = afile_reader_create(af);
+	for (record = afile_reader_next(reader); record.string != NULL; record = afile_reader_next(reader)) {
+		length = snprintf(expected, sizeof(expected), "record %d<->", i++);
+		if (record.length != length || memcmp(record.string, expected, length) != 0) {
+			ok = 0;
+		}
+	}
+	ok = ok && reader->error == 0 && i == count;
+	afile_reader_free(reader);
+	afile_close(af);
+	return ok;
+}
+
+void test_separators(void) {
+	char *name = "test_separators.tmp";
+	char binary[8 * 5 + 3];
+	astr *filename;
+	astr *open_modes;
+	afile *af;
+	record_log log;
+	long nlines;
+	int result;
+	int i;
+
+	filename = astr_create(name);
+	open_modes = astr_create("w");
+	af = afile_create_explicit(filename, open_modes, 256, _IOFBF);
+	aut_assert("1 test_separators", af->separator_length == 1 && af->separator[0] == '\n' && af->record_length == 0);
+	aut_assert("2 test_separators", afile_set_separator(af, "", 0) == EINVAL && afile_set_separator(af, "12345678901234567", 17) == EINVAL);
+
+	// NUL-delimited, as written by find -print0.
+	afile_open(af);
+	fwrite("./a\0./b c\0./d\ne\0", 1, 16, af->file);
+	afile_close(af);
+	open_modes = astr_set(open_modes, "r");
+	afile_set_open_modes(af, open_modes);
+	afile_set_separator(af, "\0", 1);
+	afile_open(af);
+	memset(&log, 0, sizeof(log));
+	result = afile_process_views_ctx(af, NULL, log_record_ctx, &log, &nlines);
+	aut_assert("3 test_separators", result == 0 && nlines == 3 && log.length == 16 && memcmp(log.text, "./a|./b c|./d\ne|", 16) == 0);
+	afile_close(af);
+
+	// Record separators, the last record without one.
+	open_modes = astr_set(open_modes, "w");
+	afile_set_open_modes(af, open_modes);
+	afile_open(af);
+	fputs("one\x1etwo\x1e\x1ethree", af->file);
+	afile_close(af);
+	open_modes = astr_set(open_modes, "r");
+	afile_set_open_modes(af, open_modes);
+	afile_set_separator(af, "\x1e", 1);
+	afile_open(af);
+	memset(&log, 0, sizeof(log));
+	result = afile_process_views_ctx(af, NULL, log_record_ctx, &log, &nlines);
+	aut_assert("4 test_separators", result == 0 && nlines == 4 && log.length == 15 && memcmp(log.text, "one|two||three|", 15) == 0);
+	afile_close(af);
+	af = afile_free(af);
+
+	// A separator of several bytes, cut across the reads of a small buffer.
+	open_modes = astr_set(open_modes, "w");
+	af = afile_create_explicit(filename, open_modes, 16, _IOFBF);
+	afile_open(af);
+	for (i = 0; i < 200; i++) {
+		fprintf(af->file, "record %d<->", i);
+	}
+	afile_close(af);
+	open_modes = astr_set(open_modes, "r");
+	afile_set_open_modes(af, open_modes);
+	afile_set_separator(af, "<->", 3);
+	aut_assert("5 test_separators", read_records(af, 200));
+	afile_set_prefetch_depth(af, 2);
+	aut_assert("6 test_separators", read_records(af, 200));
+	afile_set_prefetch_depth(af, 0);
+	afile_open(af);
+	memset(&log, 0, sizeof(log));
+	result = afile_process_views_ctx(af, NULL, log_record_ctx, &log, &nlines);
+	aut_assert("7 test_separators", result == 0 && nlines == 200 && log.length == 1890 + 200);
+	aut_assert("8 test_separators", memcmp(log.text, "record 0|record 1|record 2|", 27) == 0);
+	afile_close(af);
+
+	// Binary records of a fixed length, with a short one at the end.
+	for (i = 0; i < (int)sizeof(binary); i++) {
+		binary[i] = (char)(i % 8 == 0 ? '0' + i / 8 : (i % 8 == 4 ? '\n' : 0));
+	}
+	open_modes = astr_set(open_modes, "w");
+	afile_set_open_modes(af, open_modes);
+	afile_open(af);
+	fwrite(binary, 1, sizeof(binary), af->file);
+	afile_close(af);
+	open_modes = astr_set(open_modes, "r");
+	afile_set_open_modes(af, open_modes);
+	afile_set_record_length(af, 8);
+	afile_open(af);
+	memset(&log, 0, sizeof(log));
+	result = afile_process_views_ctx(af, NULL, log_record_ctx, &log, &nlines);
+	aut_assert("9 test_separators", result == 0 && nlines == 6 && log.length == 43 + 6);
+	aut_assert("10 test_separators", memcmp(log.text, binary, 8) == 0 && log.text[8] == '|' && memcmp(log.text + 45, binary + 40, 3) == 0);
+	afile_close(af);
+
+	// Through a prefetching reader, the records are the same.
+	afile_set_prefetch_depth(af, 2);
+	afile_open(af);
+	memset(&log, 0, sizeof(log));
+	result = afile_process_views_ctx(af, NULL, log_record_ctx, &log, &nlines);
+	aut_assert("11 test_separators", result == 0 && nlines == 6 && log.length == 43 + 6 && memcmp(log.text + 18, binary + 16, 8) == 0);
+	afile_close(af);
+
+	// A separator turns fixed records off.
+	afile_set_separator(af, "\n", 1);
+	aut_assert("12 test_separators", af->record_length == 0);
+
+	result = unlink(name);
+	aut_assert("13 test_separators", result == 0);
+
+	af = afile_free(af);
+	astr_free(filename);
+	astr_free(open_modes);
+}
+
+int long_lines_ok = 0;
+int nul_lines_ok = 0;
+
+int check_long_line(astr *as) {
+	if (as->length == 40001 && as->string[0] == 'y' && as->string[39999] == 'y' && as->string[40000] == '\n') {
+		long_lines_ok++;
+	}
+	if (as->length == 11 && memcmp(as->string, "nul\0inside\n", 11) == 0) {
+		nul_lines_ok++;
+	}
+	return 0;
+}
+
+void test_reader(void) {
+	char *name = "test_reader.tmp";
+	char line[64];
+	astr *filename;
+	astr *open_modes;
+	afile *af;
+	afile_reader *reader;
+	astr_view view;
+	int result;
+	int i;
+	int nlines;
+
+	filename = astr_create(name);
+	open_modes = astr_create("w");
+	af = afile_create_explicit(filename, open_modes, 100, _IOFBF);
+	result = afile_open(af);
+	aut_assert("1 test_reader", result == 0);
+	fprintf(af->file, "first\n");
+	for (i = 0; i < 40000; i++) {
+		fputc('y', af->file);
+	}
+	fwrite("\nnul\0inside\n\nlast", 1, 17, af->file);
+	afile_close(af);
+
+	open_modes = astr_set(open_modes, "r");
+	afile_set_open_modes(af, open_modes);
+	afile_open(af);
+	reader = afile_reader_create(af);
+	aut_assert("2 test_reader", reader != NULL && reader->offset == 0);
+	view = afile_reader_next(reader);
+	aut_assert("3 test_reader", view.length == 6 && memcmp(view.string, "first\n", 6) == 0);
+	view = afile_reader_next(reader);
+	aut_assert("4 test_reader", view.length == 40001 && view.string[40000] == '\n' && reader->size >= 40001);
+	view = afile_reader_next(reader);
+	aut_assert("5 test_reader", view.length == 11 && memcmp(view.string, "nul\0inside\n", 11) == 0);
+
+	// Freeing the reader leaves the stream just after the last line read.
+	reader = afile_reader_free(reader);
+	aut_assert("6 test_reader", fgets(line, sizeof(line), af->file) != NULL && strcmp(line, "\n") == 0);
+	reader = afile_reader_create(af);
+	view = afile_reader_next(reader);
+	aut_assert("7 test_reader", view.length == 4 && memcmp(view.string, "last", 4) == 0);
+	view = afile_reader_next(reader);
+	aut_assert("8 test_reader", view.string == NULL && reader->error == 0);
+	reader = afile_reader_free(reader);
+	afile_close(af);
+	aut_assert("9 test_reader", afile_reader_create(af) == NULL && errno == EBADF);
+
+	// The line processing functions do not split long lines.
+	afile_open(af);
+	long_lines_ok = 0;
+	nul_lines_ok = 0;
+	nlines = afile_process_lines(af, check_long_line);
+	aut_assert("10 test_reader", nlines == 5 && long_lines_ok == 1 && nul_lines_ok == 1);
+	afile_close(af);
+
+	result = unlink(name);
+	aut_assert("11 test_reader", result == 0);
+
+	af = afile_free(af);
+	astr_free(filename);
+	astr_free(open_modes);
+}
+
+int prefetched_lines_ok = 0;
+
+int check_prefetched_line(astr *as) {
+	char expected[32];
+	sprintf(expected, "line %d\n", prefetched_lines_ok);
+	if (strcmp(as->string, expected) == 0) {
+		prefetched_lines_ok++;
+	}
+	return 0;
+}
+
+void test_prefetch(void) {
+	char *name = "test_prefetch.tmp";
+	char line[64];
+	astr *filename;
+	astr *open_modes;
+	afile *af;
+	afile_reader *reader;
+	astr_view view;
+	int result;
+	int i;
+	int nlines;
+
+	filename = astr_create(name);
+	open_modes = astr_create("w");
+	af = afile_create_explicit(filename, open_modes, 64, _IOFBF);
+	result = afile_open(af);
+	aut_assert("1 test_prefetch", result == 0);
+	for (i = 0; i < 10000; i++) {
+		fprintf(af->file, "line %d\n", i);
+	}
+	afile_close(af);
+
+	// Small blocks, so most lines are in one block and some cross into the next.
+	open_modes = astr_set(open_modes, "r");
+	afile_set_open_modes(af, open_modes);
+	afile_set_prefetch_depth(af, 3);
+	aut_assert("2 test_prefetch", af->prefetch_depth == 3);
+	afile_open(af);
+	prefetched_lines_ok = 0;
+	nlines = afile_process_lines(af, check_prefetched_line);
+	aut_assert("3 test_prefetch", nlines == 10000 && prefetched_lines_ok == 10000);
+	aut_assert("4 test_prefetch", af->prefetch_stats.blocks > 1000);
+	aut_assert("5 test_prefetch", af->prefetch_stats.consumer_stalls + af->prefetch_stats.reader_stalls > 0);
+	afile_close(af);
+
+	// Stop part way, and the stream carries on after the last line read.
+	afile_open(af);
+	reader = afile_reader_create(af);
+	aut_assert("6 test_prefetch", reader != NULL && reader->prefetch != NULL);
+	for (i = 0; i < 100; i++) {
+		view = afile_reader_next(reader);
+	}
+	aut_assert("7 test_prefetch", view.length == 8 && memcmp(view.string, "line 99\n", 8) == 0);
+	afile_reader_free(reader);
+	aut_assert("8 test_prefetch", fgets(line, sizeof(line), af->file) != NULL && strcmp(line, "line 100\n") == 0);
+	afile_close(af);
+
+	// A line longer than the blocks and the buffer.
+	af = afile_free(af);
+	open_modes = astr_set(open_modes, "w");
+	af = afile_create_explicit(filename, open_modes, 64, _IOFBF);
+	afile_open(af);
+	for (i = 0; i < 40000; i++) {
+		fputc('y', af->file);
+	}
+	fprintf(af->file, "\nlast");
+	afile_close(af);
+	open_modes = astr_set(open_modes, "r");
+	afile_set_open_modes(af, open_modes);
+	afile_set_prefetch_depth(af, 2);
+	afile_open(af);
+	long_lines_ok = 0;
+	nlines = afile_process_lines(af, check_long_line);
+	aut_assert("9 test_prefetch", nlines == 2 && long_lines_ok == 1);
+	afile_close(af);
+
+	result = unlink(name);
+	aut_assert("10 test_prefetch", result == 0);
+
+	af = afile_free(af);
+	astr_free(filename);
+	astr_free(open_modes);
+}
+
 // ----------
 
 int main(int argc, char *argv[]) {
 	aut_initialize_suite();
 	aut_run_test(test_process_lines);
 	aut_run_test(test_process_matching_lines);
+	aut_run_test(test_process_edited_lines);
+	aut_run_test(test_process_views);
+	aut_run_test(test_process_views_pipe);
+	aut_run_test(test_process_ctx);
+	aut_run_test(test_process_batches_pipe);
+	aut_run_test(test_separators);
+	aut_run_test(test_reader);
+	aut_run_test(test_prefetch);
 	aut_report();
 	aut_terminate_suite();
 	aut_return();
@@ -0,0 +1,158 @@
+// test_afile_set.c - test the file set functions
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "astr.h"
+#include "afile.h"
+#include "aclock.h"
+#include "adept_unit_test.h"
+
+int suite_runs;
+int suite_fails;
+aclock *suite_clock;
+int test_runs;
+int test_fails;
+astr *suite_messages;
+
+#define DIRECTORY "test_afile_set.dir"
+
+static long lines_seen;
+static char first_lines[4][32];
+static int files_started;
+
+static void write_file(const char *path, const char *name, int lines) {
+	FILE *file;
+	int i;
+
+	file = fopen(path, "w");
+	for (i = 0; i < lines; i++) {
+		fprintf(file, "%s %d\n", name, i);
+	}
+	fclose(file);
+}
+
+static void make_files(void) {
+	mkdir(DIRECTORY, 0700);
+	mkdir(DIRECTORY "/sub", 0700);
+	write_file(DIRECTORY "/a.log", "a", 300);
+	write_file(DIRECTORY "/b.log", "b", 50);
+	write_file(DIRECTORY "/sub/c.log", "c", 1000);
+	write_file(DIRECTORY "/sub/d.txt", "d", 10);
+	symlink("..", DIRECTORY "/sub/loop");
+}
+
+static void remove_files(void) {
+	unlink(DIRECTORY "/sub/loop");
+	unlink(DIRECTORY "/sub/d.txt");
+	unlink(DIRECTORY "/sub/c.log");
+	unlink(DIRECTORY "/b.log");
+	unlink(DIRECTORY "/a.log");
+	rmdir(DIRECTORY "/sub");
+	rmdir(DIRECTORY);
+}
+
+int count_line_ctx(astr_view line, void *ctx) {
+	__atomic_add_fetch(&lines_seen, 1, __ATOMIC_RELAXED);
+	return AFILE_CONTINUE;
+}
+
+// On one thread, the order the files are started in.
+int note_first_line(astr_view line, void *ctx) {
+	if (line.length >= 2 && line.string[line.length - 2] == ' ' && line.string[line.length - 1] == '0' && files_started < 4) {
+		snprintf(first_lines[files_started++], sizeof(first_lines[0]), "%.*s", line.length, line.string);
+	}
+	return AFILE_CONTINUE;
+}
+
+// ----------
+
+void test_set_add(void) {
+	afile_set *set;
+	int result;
+
+	make_files();
+	set = afile_set_create();
+	result = afile_set_add_directory(set, DIRECTORY, "*.log", 1);
+	aut_assert("1 found recursively", result == 0 && set->count == 3);
+	aut_assert("2 in order of names", strcmp(set->files[0].path->string, DIRECTORY "/a.log") == 0 && strcmp(set->files[1].path->string, DIRECTORY "/b.log") == 0 && strcmp(set->files[2].path->string, DIRECTORY "/sub/c.log") == 0);
+	aut_assert("3 sizes", set->files[0].size == 10 * 4 + 90 * 5 + 200 * 6 && set->files[1].size == 10 * 4 + 40 * 5);
+	set = afile_set_free(set);
+
+	set = afile_set_create();
+	result = afile_set_add_directory(set, DIRECTORY, NULL, 0);
+	aut_assert("4 not recursively", result == 0 && set->count == 2);
+	result = afile_set_add(set, DIRECTORY "/sub/d.txt");
+	aut_assert("5 added", result == 0 && set->count == 3 && set->files[2].error == 0);
+	result = afile_set_add(set, DIRECTORY "/missing.log");
+	aut_assert("6 missing", result == ENOENT && set->count == 4 && set->files[3].error == ENOENT);
+	result = afile_set_add(set, DIRECTORY "/sub");
+	aut_assert("7 a directory", result == EISDIR && set->count == 5);
+	aut_assert("8 no directory", afile_set_add_directory(set, DIRECTORY "/none", NULL, 0) == ENOENT);
+	set = afile_set_free(set);
+	remove_files();
+}
+
+void test_set_process(void) {
+	afile_set *set;
+	int result;
+
+	make_files();
+	set = afile_set_create();
+	afile_set_add_directory(set, DIRECTORY, "*.log", 1);
+	afile_set_add(set, DIRECTORY "/missing.log");
+
+	// The missing file fails; the others are processed.
+	lines_seen = 0;
+	result = afile_set_process(set, NULL, 3, NULL, count_line_ctx, NULL);
+	aut_assert("1 first failure", result == ENOENT && set->failed == 1);
+	aut_assert("2 total", set->line_count == 1350 && lines_seen == 1350);
+	aut_assert("3 each file", set->files[0].line_count == 300 && set->files[1].line_count == 50 && set->files[2].line_count == 1000 && set->files[3].line_count == 0);
+
+	// On one thread, the files are started largest first.
+	files_started = 0;
+	result = afile_set_process(set, NULL, 1, NULL, note_first_line, NULL);
+	aut_assert("4 largest first", files_started == 3 && strcmp(first_lines[0], "c 0") == 0 && strcmp(first_lines[1], "a 0") == 0 && strcmp(first_lines[2], "b 0") == 0);
+	aut_assert("5 no process function", afile_set_process(set, NULL, 2, NULL, NULL, NULL) == EINVAL);
+	set = afile_set_free(set);
+	remove_files();
+}
+
+void test_set_settings(void) {
+	astr *filename = astr_create("settings");
+	afile *settings;
+	afile_set *set;
+	int result;
+
+	make_files();
+	set = afile_set_create();
+	afile_set_add_directory(set, DIRECTORY, "*.log", 1);
+
+	// Separated by spaces, each file has one more record than lines.
+	settings = afile_create_explicit(filename, NULL, 64, _IOFBF);
+	afile_set_separator(settings, " ", 1);
+	afile_set_prefetch_depth(settings, 2);
+	lines_seen = 0;
+	result = afile_set_process(set, settings, 8, NULL, count_line_ctx, NULL);
+	aut_assert("1 settings", result == 0 && set->failed == 0 && set->line_count == 1353 && lines_seen == 1353);
+	aut_assert("2 each file", set->files[0].line_count == 301 && set->files[2].line_count == 1001);
+
+	afile_free(settings);
+	set = afile_set_free(set);
+	astr_free(filename);
+	remove_files();
+}
+
+int main(int argc, char *argv[]) {
+	aut_initialize_suite();
+	aut_run_test(test_set_add);
+	aut_run_test(test_set_process);
+	aut_run_test(test_set_settings);
+	aut_report();
+	aut_terminate_suite();
+	aut_return();
+}
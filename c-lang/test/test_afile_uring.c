@@ -0,0 +1,208 @@
+// test_afile_uring.c - test the io_uring and pread backends
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+
+#include "astr.h"
+#include "afile.h"
+#include "afile_uring.h"
+#include "aclock.h"
+#include "adept_unit_test.h"
+
+int suite_runs;
+int suite_fails;
+aclock *suite_clock;
+int test_runs;
+int test_fails;
+astr *suite_messages;
+
+#define LINES 20000
+
+static char *name = "test_afile_uring.tmp";
+
+// Write the test lines through an I/O backend.
+static int write_lines(int backend) {
+	astr *filename = astr_create(name);
+	astr *open_modes = astr_create("w");
+	char *text = (char *)malloc(LINES * 12);
+	size_t length = 0;
+	afile *af;
+	int result;
+	int i;
+
+	for (i = 0; i < LINES; i++) {
+		length += sprintf(text + length, "line %d\n", i);
+	}
+
+	af = afile_create_explicit(filename, open_modes, 4096, _IOFBF);
+	afile_set_io_backend(af, backend);
+	afile_open(af);
+	fputs("header\n", af->file);
+	result = afile_write_buffer(af, text, length);
+	fputs("footer\n", af->file);
+	afile_close(af);
+
+	afile_free(af);
+	free(text);
+	astr_free(filename);
+	astr_free(open_modes);
+	return result;
+}
+
+// Read the test lines back through an I/O backend, and check them.
+static int read_lines(int backend, int depth, int *io_backend) {
+	astr *filename = astr_create(name);
+	afile *af;
+	afile_reader *reader;
+	astr_view view;
+	char line[32];
+	int errors = 0;
+	int i;
+
+	af = afile_create_explicit(filename, NULL, 1000, _IOFBF);
+	afile_set_io_backend(af, backend);
+	afile_set_prefetch_depth(af, depth);
+	afile_open(af);
+	reader = afile_reader_create(af);
+	*io_backend = reader->io_backend;
+	view = afile_reader_next(reader);
+	errors += (view.length != 7 || memcmp(view.string, "header\n", 7) != 0);
+	for (i = 0; i < LINES; i++) {
+		sprintf(line, "line %d\n", i);
+		view = afile_reader_next(reader);
+		errors += (view.length != (int)strlen(line) || memcmp(view.string, line, view.length) != 0);
+	}
+	view = afile_reader_next(reader);
+	errors += (view.length != 7 || memcmp(view.string, "footer\n", 7) != 0);
+	view = afile_reader_next(reader);
+	errors += (view.string != NULL || reader->error != 0);
+	afile_reader_free(reader);
+
+	afile_free(af);
+	astr_free(filename);
+	return errors;
+}
+
+// ----------
+
+void test_ring(void) {
+	afile_uring *ring;
+	char *buffers = NULL;
+	char check[64];
+	uint64_t tag;
+	int result;
+	int n;
+	int fd;
+
+	if (!afile_uring_available()) {
+		ring = afile_uring_create(4);
+		aut_assert("1 not available", ring == NULL && errno != 0);
+		return;
+	}
+
+	ring = afile_uring_create(4);
+	aut_assert("1 create", ring != NULL && ring->entries >= 4);
+
+	fd = open(name, O_RDWR | O_CREAT | O_TRUNC, 0600);
+	aut_assert("2 write queued", afile_uring_write(ring, fd, "0123456789", 10, 0, -1, 7) == 0 && ring->queued == 1);
+	result = afile_uring_wait(ring, &tag, &n);
+	aut_assert("3 write completed", result == 0 && tag == 7 && n == 10 && ring->in_flight == 0);
+	aut_assert("4 nothing in flight", afile_uring_wait(ring, &tag, &n) == ENOENT);
+
+	// Two registered buffers, and reads into both in flight at once.
+	result = posix_memalign((void **)&buffers, 4096, 2 * 4096);
+	aut_assert("5 buffers", result == 0 && buffers != NULL);
+	if (result != 0 || buffers == NULL) {
+		afile_uring_free(ring);
+		close(fd);
+		unlink(name);
+		return;
+	}
+	memset(buffers, 0, 2 * 4096);
+	result = afile_uring_register_buffers(ring, buffers, 4096, 2);
+	aut_assert("6 register", result == 0 && ring->registered);
+	afile_uring_read(ring, fd, buffers, 4, 0, 0, 1);
+	afile_uring_read(ring, fd, buffers + 4096, 4, 6, 1, 2);
+	afile_uring_submit(ring);
+	aut_assert("7 in flight", ring->in_flight == 2 && ring->queued == 0);
+	result = afile_uring_wait(ring, &tag, &n);
+	aut_assert("8 first read", result == 0 && (tag == 1 || tag == 2) && n == 4);
+	result = afile_uring_wait(ring, &tag, &n);
+	aut_assert("9 second read", result == 0 && (tag == 1 || tag == 2) && n == 4 && ring->in_flight == 0);
+	aut_assert("10 read fixed", memcmp(buffers, "0123", 4) == 0 && memcmp(buffers + 4096, "6789", 4) == 0);
+
+	afile_uring_read(ring, fd, check, sizeof(check), 8, -1, 3);
+	result = afile_uring_wait(ring, &tag, &n);
+	aut_assert("11 short read at end", result == 0 && tag == 3 && n == 2 && memcmp(check, "89", 2) == 0);
+
+	ring = afile_uring_free(ring);
+	aut_assert("12 free", ring == NULL);
+	close(fd);
+	free(buffers);
+	unlink(name);
+}
+
+void test_backends(void) {
+	int io_backend;
+	int expected = (afile_uring_available() ? AFILE_IO_URING : AFILE_IO_PREAD);
+
+	aut_assert("1 write read", write_lines(AFILE_IO_READ) == 0);
+	aut_assert("2 read read", read_lines(AFILE_IO_READ, 0, &io_backend) == 0 && io_backend == AFILE_IO_READ);
+	aut_assert("3 read pread", read_lines(AFILE_IO_PREAD, 0, &io_backend) == 0 && io_backend == AFILE_IO_PREAD);
+	aut_assert("4 read uring", read_lines(AFILE_IO_URING, 0, &io_backend) == 0 && io_backend == expected);
+	aut_assert("5 read uring deep", read_lines(AFILE_IO_URING, 16, &io_backend) == 0 && io_backend == expected);
+
+	aut_assert("6 write pread", write_lines(AFILE_IO_PREAD) == 0);
+	aut_assert("7 read back", read_lines(AFILE_IO_READ, 0, &io_backend) == 0);
+	aut_assert("8 write uring", write_lines(AFILE_IO_URING) == 0);
+	aut_assert("9 read back", read_lines(AFILE_IO_URING, 3, &io_backend) == 0);
+	unlink(name);
+}
+
+void test_write_ring(void) {
+	astr *filename = astr_create(name);
+	astr *open_modes = astr_create("w");
+	afile_uring *ring;
+	char check[32];
+	afile *af;
+	FILE *file;
+	int result;
+
+	// The ring is set up by the first write and kept for the next ones.
+	af = afile_create_explicit(filename, open_modes, 4096, _IOFBF);
+	afile_set_io_backend(af, AFILE_IO_URING);
+	afile_open(af);
+	result = afile_write_buffer(af, "first\n", 6);
+	ring = af->write_ring;
+	aut_assert("1 first write", result == 0 && (afile_uring_available() ? ring != NULL : ring == NULL && af->write_ring_error != 0));
+	result = afile_write_buffer(af, "second\n", 7);
+	aut_assert("2 ring kept", result == 0 && af->write_ring == ring);
+	afile_close(af);
+	aut_assert("3 freed with the file", af->write_ring == NULL && af->write_ring_error == 0);
+
+	file = fopen(name, "r");
+	memset(check, 0, sizeof(check));
+	aut_assert("4 written", file != NULL && fread(check, 1, sizeof(check), file) == 13 && strcmp(check, "first\nsecond\n") == 0);
+	fclose(file);
+
+	afile_free(af);
+	astr_free(filename);
+	astr_free(open_modes);
+	unlink(name);
+}
+
+// ----------
+
+int main(int argc, char *argv[]) {
+	aut_initialize_suite();
+	aut_run_test(test_ring);
+	aut_run_test(test_backends);
+	aut_run_test(test_write_ring);
+	aut_report();
+	aut_terminate_suite();
+	aut_return();
+}
@@ -124,7 +124,7 @@ void test_append(void) {
 	char *buf_plus_buf = "XYZ   XYZ   ";
 	char *buf_plus_str = "XYZ   ABC";
 	astr *as_str;
-	astr *as_buf;
+	astr *as_buf = NULL;
 
 	as_str = astr_create(str);
 	as_str = astr_append(as_str, str);
@@ -0,0 +1,191 @@
+// test_astr_bloom.c - test astr Bloom filter functions
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+
+#include "astr.h"
+#include "astr_bloom.h"
+#include "afile.h"
+#include "aclock.h"
+#include "adept_unit_test.h"
+
+int suite_runs;
+int suite_fails;
+aclock *suite_clock;
+int test_runs;
+int test_fails;
+astr *suite_messages;
+
+// ----------
+
+void test_create(void) {
+	astr_bloom *bloom;
+
+	bloom = astr_bloom_create(1000, 0.01);
+	aut_assert("1 create", bloom != NULL && bloom->count == 0);
+	aut_assert("2 sized for the rate", bloom->block_count == 20 && bloom->hash_count == 7);
+	aut_assert("3 blocks aligned", ((size_t)bloom->blocks % 64) == 0);
+	aut_assert("4 empty contains nothing", !astr_bloom_contains_view(bloom, astr_view_from_string("anything")));
+	bloom = astr_bloom_free(bloom);
+	aut_assert("5 free", bloom == NULL);
+
+	aut_assert("6 rate of 0", astr_bloom_create(1000, 0.0) == NULL);
+	aut_assert("7 rate of 1", astr_bloom_create(1000, 1.0) == NULL);
+	bloom = astr_bloom_create(0, 0.5);
+	aut_assert("8 tiny filter", bloom != NULL && bloom->block_count == 1 && bloom->hash_count >= 1);
+	astr_bloom_free(bloom);
+}
+
+void test_membership(void) {
+	astr_bloom *bloom;
+	astr *key;
+	char buffer[32];
+	int n = 100000;
+	int missing = 0;
+	int false_positives = 0;
+	int i;
+
+	bloom = astr_bloom_create(n, 0.01);
+	key = astr_create("blocked@example.com");
+	astr_bloom_add(bloom, key);
+	aut_assert("1 contains astr", astr_bloom_contains(bloom, key));
+	aut_assert("2 contains view", astr_bloom_contains_view(bloom, astr_view_from_buffer("blocked@example.com trailing", 19)));
+
+	for (i = 1; i < n; i++) {
+		sprintf(buffer, "user%d@example.com", i);
+		astr_bloom_add_view(bloom, astr_view_from_string(buffer));
+	}
+	aut_assert("3 count", bloom->count == (size_t)n);
+
+	for (i = 1; i < n; i++) {
+		sprintf(buffer, "user%d@example.com", i);
+		missing += !astr_bloom_contains_view(bloom, astr_view_from_string(buffer));
+	}
+	aut_assert("4 no false negatives", missing == 0);
+
+	for (i = 0; i < n; i++) {
+		sprintf(buffer, "other%d@example.org", i);
+		false_positives += astr_bloom_contains_view(bloom, astr_view_from_string(buffer));
+	}
+	aut_assert("5 false positive rate near 1%", false_positives < n * 0.0115);
+
+	astr_free(key);
+	astr_bloom_free(bloom);
+}
+
+void test_low_rate(void) {
+	astr_bloom *bloom;
+	char buffer[32];
+	int n = 200000;
+	int probes = 2000000;
+	int false_positives = 0;
+	int i;
+
+	// Blocking raises the rate most at low rates, so the filter is made
+	// larger to keep to it.
+	bloom = astr_bloom_create(n, 0.0001);
+	for (i = 0; i < n; i++) {
+		sprintf(buffer, "user%d@example.com", i);
+		astr_bloom_add_view(bloom, astr_view_from_string(buffer));
+	}
+	for (i = 0; i < probes; i++) {
+		sprintf(buffer, "other%d@example.org", i);
+		false_positives += astr_bloom_contains_view(bloom, astr_view_from_string(buffer));
+	}
+	aut_assert("1 false positive rate near 0.01%", false_positives < probes * 0.00015);
+	astr_bloom_free(bloom);
+}
+
+void test_write_map(void) {
+	char *name = "test_bloom.tmp";
+	astr_bloom *bloom;
+	astr_bloom *mapped;
+	astr *filename;
+	astr *open_modes;
+	afile *af;
+	char buffer[32];
+	unsigned char image[128];
+	uint32_t version = 2;
+	uint32_t hash_count = 7;
+	uint64_t block_count = ((uint64_t)1 << 58) + 1;
+	FILE *file;
+	int missing = 0;
+	int result;
+	int i;
+
+	bloom = astr_bloom_create(5000, 0.001);
+	for (i = 0; i < 5000; i++) {
+		sprintf(buffer, "%d", i * 3);
+		astr_bloom_add_view(bloom, astr_view_from_string(buffer));
+	}
+
+	filename = astr_create(name);
+	open_modes = astr_create("wb");
+	af = afile_create(filename, open_modes);
+	result = afile_open(af);
+	aut_assert("1 open", result == 0);
+	result = afile_write_bloom(af, bloom);
+	aut_assert("2 write bloom", result == 0);
+	afile_close(af);
+	aut_assert("3 write closed", afile_write_bloom(af, bloom) == EBADF);
+
+	mapped = afile_map_bloom(af);
+	aut_assert("4 map", mapped != NULL && mapped->mapping != NULL);
+	aut_assert("5 mapped header", mapped->block_count == bloom->block_count && mapped->hash_count == bloom->hash_count && mapped->count == 5000);
+	aut_assert("6 mapped blocks", memcmp(mapped->blocks, bloom->blocks, bloom->block_count * ASTR_BLOOM_BLOCK_WORDS * sizeof(uint64_t)) == 0);
+	for (i = 0; i < 5000; i++) {
+		sprintf(buffer, "%d", i * 3);
+		missing += !astr_bloom_contains_view(mapped, astr_view_from_string(buffer));
+	}
+	aut_assert("7 mapped contains keys", missing == 0);
+	astr_bloom_add_view(mapped, astr_view_from_string("added after mapping"));
+	aut_assert("8 add to mapped", astr_bloom_contains_view(mapped, astr_view_from_string("added after mapping")));
+	mapped = astr_bloom_free(mapped);
+
+	// A file that is not a filter is not mapped.
+	af = afile_free(af);
+	af = afile_create(filename, open_modes);
+	afile_open(af);
+	fprintf(af->file, "this is not a Bloom filter, just some text that is long enough to have a header\n");
+	afile_close(af);
+	mapped = afile_map_bloom(af);
+	aut_assert("9 map not a filter", mapped == NULL && errno == EINVAL);
+
+	// A block count so large that the size of the blocks wraps around.
+	memset(image, 0, sizeof(image));
+	memcpy(image, "ADPBLOOM", 8);
+	memcpy(image + 8, &version, 4);
+	memcpy(image + 12, &hash_count, 4);
+	memcpy(image + 16, &block_count, 8);
+	file = fopen(name, "wb");
+	fwrite(image, 1, sizeof(image), file);
+	fclose(file);
+	errno = 0;
+	mapped = astr_bloom_map(name);
+	aut_assert("10 map too many blocks", mapped == NULL && errno == EINVAL);
+
+	unlink(name);
+	mapped = astr_bloom_map(name);
+	aut_assert("11 map missing file", mapped == NULL && errno == ENOENT);
+
+	afile_free(af);
+	astr_free(filename);
+	astr_free(open_modes);
+	astr_bloom_free(bloom);
+}
+
+// ----------
+
+int main(int argc, char *argv[]) {
+	aut_initialize_suite();
+	aut_run_test(test_create);
+	aut_run_test(test_membership);
+	aut_run_test(test_low_rate);
+	aut_run_test(test_write_map);
+	aut_report();
+	aut_terminate_suite();
+	aut_return();
+}
@@ -0,0 +1,124 @@
+// test_astr_builder.c - test astr builder functions
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "astr.h"
+#include "aclock.h"
+#include "adept_unit_test.h"
+
+int suite_runs;
+int suite_fails;
+aclock *suite_clock;
+int test_runs;
+int test_fails;
+astr *suite_messages;
+
+// ----------
+
+void test_build(void) {
+	astr_builder *builder;
+	astr *field;
+	astr *as;
+	astr *expected;
+
+	field = astr_create("field");
+	builder = astr_builder_create(2);
+	builder = astr_builder_add(builder, "first ");
+	builder = astr_builder_add_astr(builder, field);
+	builder = astr_builder_add_view(builder, astr_view_from_buffer(" and the rest", 8));
+	builder = astr_builder_add(builder, "");
+	aut_assert("1 builder pieces", builder->count == 3 && builder->length == 19);
+
+	as = astr_builder_build(builder);
+	expected = astr_create("first field and the");
+	aut_assert("2 build", strcmp(as->string, "first field and the") == 0);
+	aut_assert("3 build length and checksum", as->length == expected->length && as->checksum == expected->checksum);
+	aut_assert("4 build exact allocation", as->allocated_length == 20);
+
+	builder = astr_builder_reset(builder);
+	aut_assert("5 reset", builder->count == 0 && builder->length == 0);
+	as = astr_builder_build_into(astr_builder_add(builder, "short"), as);
+	aut_assert("6 build into reuses storage", strcmp(as->string, "short") == 0 && as->allocated_length == 20);
+	aut_assert("7 build into clears tail", as->string[6] == '\0' && as->string[18] == '\0');
+
+	builder = astr_builder_free(builder);
+	astr_free(expected);
+	astr_free(field);
+	astr_free(as);
+}
+
+void test_build_from_self(void) {
+	astr_builder *builder;
+	astr *as;
+
+	as = astr_create("abc");
+	builder = astr_builder_create(0);
+	astr_builder_add_astr(builder, as);
+	astr_builder_add(builder, "-");
+	astr_builder_add_astr(builder, as);
+	as = astr_builder_build_into(builder, as);
+	aut_assert("1 build into from itself", strcmp(as->string, "abc-abc") == 0 && as->length == 7);
+
+	astr_builder_free(builder);
+	astr_free(as);
+}
+
+void test_join(void) {
+	astr *fields[4];
+	astr *as;
+	astr *expected;
+	astr **asa;
+	astr *src;
+	int i;
+
+	fields[0] = astr_create("one");
+	fields[1] = astr_create("");
+	fields[2] = astr_create("three");
+	fields[3] = NULL;
+
+	as = astr_join(fields, ",");
+	expected = astr_create("one,,three");
+	aut_assert("1 join", strcmp(as->string, "one,,three") == 0);
+	aut_assert("2 join length and checksum", as->length == expected->length && as->checksum == expected->checksum);
+	astr_free(as);
+
+	as = astr_join(fields + 3, ",");
+	aut_assert("3 join none", as->string != NULL && as->length == 0);
+	astr_free(as);
+
+	as = astr_join(fields, NULL);
+	aut_assert("4 join no separator", strcmp(as->string, "onethree") == 0);
+	astr_free(as);
+
+	// Split and join round trip.
+	src = astr_create("a:b:c:d:e:f:g:h:i:j:k:l");
+	asa = astr_split(src, ":");
+	as = astr_join(asa, ":");
+	aut_assert("5 split then join", strcmp(as->string, "a:b:c:d:e:f:g:h:i:j:k:l") == 0);
+	for (i = 0; asa[i] != NULL; i++) {
+		astr_free(asa[i]);
+	}
+	free(asa);
+	astr_free(src);
+	astr_free(as);
+
+	for (i = 0; fields[i] != NULL; i++) {
+		astr_free(fields[i]);
+	}
+	astr_free(expected);
+}
+
+// ----------
+
+int main(int argc, char *argv[]) {
+	aut_initialize_suite();
+	aut_run_test(test_build);
+	aut_run_test(test_build_from_self);
+	aut_run_test(test_join);
+	aut_report();
+	aut_terminate_suite();
+	aut_return();
+}
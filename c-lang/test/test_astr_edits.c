@@ -174,6 +174,62 @@ void test_trim(void) {
 	astr_free(asupper);
 }
 
+void test_left_trim_storage(void) {
+	astr *as;
+	astr *asupper;
+	char *storage;
+
+	as = astr_create(leading);
+	storage = as->storage;
+	asupper = astr_create(upper);
+
+	// The trim moves the string pointer, not the characters.
+	as = astr_left_trim(as);
+	aut_assert("1 test left trim", astr_equals(as, asupper) == 1);
+	aut_assert("2 test left trim length", as->length == strlen(upper));
+	aut_assert("3 test left trim storage", as->storage == storage && as->string > as->storage);
+
+	// Appending more than fits after the string compacts the storage.
+	as = astr_append(as, "123456");
+	aut_assert("4 test append after trim", strncmp(as->string, upper, strlen(upper)) == 0);
+	aut_assert("5 test append after trim", strcmp(as->string + strlen(upper), "123456") == 0);
+	aut_assert("6 test append after trim", as->string == as->storage && as->storage == storage);
+	aut_assert("7 test append after trim", as->length == strlen(as->string));
+
+	// Reusing the astr compacts the storage.
+	as = astr_left_trim(astr_set(as, "   abc"));
+	aut_assert("8 test set after trim", strcmp(as->string, "abc") == 0 && as->string != as->storage);
+	as = astr_set(as, "xyz");
+	aut_assert("9 test set after trim", strcmp(as->string, "xyz") == 0 && as->string == as->storage);
+
+	astr_free(as);
+	astr_free(asupper);
+}
+
+void test_remove_prefix(void) {
+	astr *as;
+	astr *asexpected;
+
+	as = astr_create("https://example.com/path");
+	asexpected = astr_create("example.com/path");
+
+	as = astr_remove_prefix(as, "http://");
+	aut_assert("1 test remove prefix no match", strcmp(as->string, "https://example.com/path") == 0);
+
+	as = astr_remove_prefix(as, "https://");
+	aut_assert("2 test remove prefix", astr_equals(as, asexpected) == 1);
+	aut_assert("3 test remove prefix length", as->length == strlen(asexpected->string));
+
+	as = astr_remove_left(as, 12);
+	aut_assert("4 test remove left", strcmp(as->string, "path") == 0 && as->length == 4);
+
+	as = astr_remove_left(as, 100);
+	aut_assert("5 test remove left all", strcmp(as->string, "") == 0 && as->length == 0 && as->checksum == 0);
+
+	astr_free(as);
+	astr_free(asexpected);
+}
+
 void test_not_empty(void) {
 	astr *as;
 	char *empty = "";
@@ -276,6 +332,116 @@ void test_reverse_string(void) {
 	aut_assert("3 test reverse", strcmp(as->string, forward_string) == 0);
 }
 
+void test_edit_program_clean(void) {
+	char *strings[] = { dirty_string, packed_dirty_string, cleaned_dirty_string, leading_trailing, "", "   ", NULL };
+	astr_edit_program *program;
+	astr *as_edit;
+	astr *as_clean;
+	int i;
+
+	program = astr_edit_program_create(ASTR_EDIT_CLEAN);
+	aut_assert("1 test program", program != NULL);
+
+	for (i = 0; strings[i] != NULL; i++) {
+		as_edit = astr_create(strings[i]);
+		as_clean = astr_create(strings[i]);
+		as_edit = astr_edit(as_edit, program);
+		as_clean = astr_pack(astr_right_trim(astr_left_trim(as_clean)));
+		aut_assert("2 test edit matches separate edits", strcmp(as_edit->string, as_clean->string) == 0);
+		aut_assert("3 test edit length", as_edit->length == strlen(as_edit->string));
+		aut_assert("4 test edit checksum", astr_equals(as_edit, as_clean) == 1);
+		astr_free(as_edit);
+		astr_free(as_clean);
+	}
+
+	program = astr_edit_program_free(program);
+	aut_assert("5 test program free", program == NULL);
+}
+
+void test_edit_program_case(void) {
+	astr_edit_program *program;
+	astr *as;
+	astr *aslower;
+
+	program = astr_edit_program_create(ASTR_EDIT_CLEAN | ASTR_EDIT_MIXED_CASE);
+	as = astr_create("  hELLO   wORLD  ");
+	as = astr_edit(as, program);
+	aut_assert("1 test mixed case", strcmp(as->string, "Hello World") == 0);
+	program = astr_edit_program_free(program);
+
+	program = astr_edit_program_create(ASTR_EDIT_TRIM | ASTR_EDIT_UPPER_CASE);
+	as = astr_set(as, leading_trailing);
+	as = astr_edit(as, program);
+	aut_assert("2 test upper case", strcmp(as->string, upper) == 0);
+	program = astr_edit_program_free(program);
+
+	program = astr_edit_program_create(ASTR_EDIT_LOWER_CASE);
+	as = astr_set(as, upper);
+	as = astr_edit(as, program);
+	aut_assert("3 test lower case", strcmp(as->string, lower) == 0);
+	aslower = astr_create(lower);
+	aut_assert("4 test lower case checksum", as->checksum == aslower->checksum);
+	program = astr_edit_program_free(program);
+
+	// Outside ASCII, the case is changed as astr_to_mixed_case changes it.
+	program = astr_edit_program_create(ASTR_EDIT_CLEAN | ASTR_EDIT_MIXED_CASE);
+	as = astr_set(as, "  \xC3\xA9LAN   cAF\xC3\x89 ");
+	as = astr_edit(as, program);
+	aut_assert("5 test mixed case utf8", strcmp(as->string, "\xC3\x89lan Caf\xC3\xA9") == 0);
+	aut_assert("6 test mixed case utf8 length", as->length == 11 && astr_codepoint_length(as) == 9);
+	program = astr_edit_program_free(program);
+
+	program = astr_edit_program_create(ASTR_EDIT_UPPER_CASE);
+	program = astr_edit_program_set_delete(program, "x");
+	as = astr_set(as, "\xC3\xA9xlan stra\xC3\x9F" "e");
+	as = astr_edit(as, program);
+	aut_assert("7 test upper case utf8", strcmp(as->string, "\xC3\x89LAN STRA\xC3\x9F" "E") == 0);
+	aslower = astr_set(aslower, as->string);
+	aut_assert("8 test upper case utf8 checksum", as->checksum == aslower->checksum);
+	program = astr_edit_program_free(program);
+
+	// Bytes that are not UTF-8 are left as they are.
+	program = astr_edit_program_create(ASTR_EDIT_UPPER_CASE);
+	as = astr_set(as, "\xE9lan");
+	as = astr_edit(as, program);
+	aut_assert("9 test upper case latin-1", strcmp(as->string, "\xE9LAN") == 0 && as->codepoint_length == -1);
+	program = astr_edit_program_free(program);
+
+	astr_free(as);
+	astr_free(aslower);
+}
+
+void test_edit_program_squeeze_delete(void) {
+	astr_edit_program *program;
+	astr *as;
+
+	program = astr_edit_program_create(0);
+	program = astr_edit_program_set_squeeze(program, "-/");
+	as = astr_create("a--b//c..d");
+	as = astr_edit(as, program);
+	aut_assert("1 test squeeze", strcmp(as->string, "a-b/c..d") == 0);
+
+	// The delete is done before the squeeze.
+	program = astr_edit_program_set_delete(program, "x");
+	as = astr_set(as, "a-x-b");
+	as = astr_edit(as, program);
+	aut_assert("2 test delete then squeeze", strcmp(as->string, "a-b") == 0);
+	aut_assert("3 test delete then squeeze length", as->length == 3);
+	program = astr_edit_program_free(program);
+
+	// Deleting every character leaves the string empty, not-empty fills it.
+	program = astr_edit_program_create(ASTR_EDIT_TRIM);
+	program = astr_edit_program_set_delete(program, "abc");
+	program = astr_edit_program_set_not_empty_char(program, '-');
+	as = astr_set(as, " abc cba ");
+	as = astr_edit(as, program);
+	aut_assert("4 test not empty", strcmp(as->string, "-") == 0);
+	aut_assert("5 test not empty length", as->length == 1);
+	program = astr_edit_program_free(program);
+
+	astr_free(as);
+}
+
 // ----------
 
 int main(int argc, char *argv[]) {
@@ -286,6 +452,8 @@ int main(int argc, char *argv[]) {
 	aut_run_test(test_left_trim);
 	aut_run_test(test_right_trim);
 	aut_run_test(test_trim);
+	aut_run_test(test_left_trim_storage);
+	aut_run_test(test_remove_prefix);
 	aut_run_test(test_not_empty);
 	aut_run_test(test_not_empty_char);
 	aut_run_test(test_pack_dirty_string);
@@ -294,6 +462,9 @@ int main(int argc, char *argv[]) {
 	aut_run_test(test_clean_packed_string);
 	aut_run_test(test_clean_cleaned_string);
 	aut_run_test(test_reverse_string);
+	aut_run_test(test_edit_program_clean);
+	aut_run_test(test_edit_program_case);
+	aut_run_test(test_edit_program_squeeze_delete);
 	aut_report();
 	aut_terminate_suite();
 	aut_return();
@@ -0,0 +1,170 @@
+// test_astr_map.c - test astr map functions
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "astr.h"
+#include "astr_map.h"
+#include "aclock.h"
+#include "adept_unit_test.h"
+
+int suite_runs;
+int suite_fails;
+aclock *suite_clock;
+int test_runs;
+int test_fails;
+astr *suite_messages;
+
+// ----------
+
+void test_hash(void) {
+	astr *as1;
+	astr *as2;
+	uint64_t hash;
+
+	as1 = astr_create("the quick brown fox");
+	as2 = astr_create("the quick brown fox");
+	aut_assert("1 hash not calculated", as1->hash == 0);
+	hash = astr_hash(as1);
+	aut_assert("2 hash cached", hash != 0 && as1->hash == hash);
+	aut_assert("3 hash equals buffer hash", hash == astr_hash_buffer("the quick brown fox", 19));
+	aut_assert("4 equal strings, equal hashes", astr_hash(as2) == hash);
+	aut_assert("5 equals with hashes", astr_equals(as1, as2));
+
+	astr_append(as2, "!");
+	aut_assert("6 append resets hash", as2->hash == 0);
+	aut_assert("7 changed string, changed hash", astr_hash(as2) != hash);
+	aut_assert("8 not equals with hashes", !astr_equals(as1, as2));
+
+	astr_set(as2, "the quick brown fox");
+	aut_assert("9 set resets hash", as2->hash == 0);
+	aut_assert("10 equals after set", astr_equals(as1, as2) && astr_hash(as2) == hash);
+
+	aut_assert("11 hash of empty buffer", astr_hash_buffer("", 0) != 0);
+	aut_assert("12 hash depends on length", astr_hash_buffer("abcdefgh\0", 9) != astr_hash_buffer("abcdefgh", 8));
+
+	astr_free(as1);
+	astr_free(as2);
+}
+
+void test_put_get(void) {
+	astr_map *map;
+	astr *key;
+	int one = 1;
+	int two = 2;
+
+	map = astr_map_create(0);
+	key = astr_create("alpha");
+	aut_assert("1 empty map", astr_map_size(map) == 0 && astr_map_get(map, key) == NULL);
+	aut_assert("2 put adds", astr_map_put(map, key, &one) == 1 && astr_map_size(map) == 1);
+	aut_assert("3 get", astr_map_get(map, key) == &one);
+	aut_assert("4 get view", astr_map_get_view(map, astr_view_from_buffer("alphabet", 5)) == &one);
+	aut_assert("5 contains view", astr_map_contains_view(map, astr_view_from_string("alpha")));
+	aut_assert("6 not contains prefix", !astr_map_contains_view(map, astr_view_from_string("alph")));
+	aut_assert("7 put replaces", astr_map_put_view(map, astr_view_from_string("alpha"), &two) == 0 && astr_map_size(map) == 1);
+	aut_assert("8 get replaced", astr_map_get(map, key) == &two);
+
+	// The key is copied into the map.
+	astr_set(key, "beta");
+	aut_assert("9 key copied", astr_map_get(map, key) == NULL && astr_map_get_view(map, astr_view_from_string("alpha")) == &two);
+
+	aut_assert("10 remove", astr_map_remove_view(map, astr_view_from_string("alpha")) == 1 && astr_map_size(map) == 0);
+	aut_assert("11 remove missing", astr_map_remove_view(map, astr_view_from_string("alpha")) == 0);
+	aut_assert("12 get removed", astr_map_get_view(map, astr_view_from_string("alpha")) == NULL);
+	aut_assert("13 put empty key", astr_map_put_view(map, astr_view_from_string(""), &one) == 1 && astr_map_get_view(map, astr_view_from_string("")) == &one);
+
+	astr_free(key);
+	map = astr_map_free(map);
+	aut_assert("14 free", map == NULL);
+}
+
+void test_value_view(void) {
+	astr_map *map;
+	const char *words[] = { "red", "green", "red", "blue", "red", "green", NULL };
+	void **value;
+	int i;
+
+	map = astr_map_create(4);
+	for (i = 0; words[i] != NULL; i++) {
+		value = astr_map_value_view(map, astr_view_from_string(words[i]));
+		*value = (void *)((size_t)*value + 1);
+	}
+	aut_assert("1 distinct keys", astr_map_size(map) == 3);
+	aut_assert("2 red count", (size_t)astr_map_get_view(map, astr_view_from_string("red")) == 3);
+	aut_assert("3 green count", (size_t)astr_map_get_view(map, astr_view_from_string("green")) == 2);
+	aut_assert("4 blue count", (size_t)astr_map_get_view(map, astr_view_from_string("blue")) == 1);
+	astr_map_free(map);
+}
+
+void test_many_keys(void) {
+	astr_map *map;
+	char key[32];
+	astr_view view;
+	void *value;
+	size_t position;
+	int n = 20000;
+	int ok;
+	int i;
+
+	map = astr_map_create(0);
+	ok = 1;
+	for (i = 0; i < n; i++) {
+		sprintf(key, "key %d", i);
+		ok &= (astr_map_put_view(map, astr_view_from_string(key), (void *)(size_t)(i + 1)) == 1);
+	}
+	aut_assert("1 put many", ok && astr_map_size(map) == (size_t)n);
+	aut_assert("2 map grew", map->capacity >= (size_t)n);
+
+	ok = 1;
+	for (i = 0; i < n; i++) {
+		sprintf(key, "key %d", i);
+		ok &= ((size_t)astr_map_get_view(map, astr_view_from_string(key)) == (size_t)(i + 1));
+	}
+	aut_assert("3 get many", ok);
+
+	// Remove the odd keys, then put them back, reusing the deleted slots.
+	ok = 1;
+	for (i = 1; i < n; i += 2) {
+		sprintf(key, "key %d", i);
+		ok &= astr_map_remove_view(map, astr_view_from_string(key));
+	}
+	aut_assert("4 remove odd", ok && astr_map_size(map) == (size_t)n / 2);
+	ok = 1;
+	for (i = 0; i < n; i++) {
+		sprintf(key, "key %d", i);
+		ok &= (astr_map_contains_view(map, astr_view_from_string(key)) == (i % 2 == 0));
+	}
+	aut_assert("5 only even left", ok);
+	for (i = 1; i < n; i += 2) {
+		sprintf(key, "key %d", i);
+		astr_map_put_view(map, astr_view_from_string(key), (void *)(size_t)(i + 1));
+	}
+	aut_assert("6 put back", astr_map_size(map) == (size_t)n);
+
+	// Step through every key once.
+	ok = 1;
+	i = 0;
+	position = 0;
+	while (astr_map_next(map, &position, &view, &value)) {
+		ok &= (view.string[view.length] == '\0' && atoi(view.string + 4) + 1 == (int)(size_t)value);
+		i++;
+	}
+	aut_assert("7 iterate", ok && i == n);
+
+	astr_map_free(map);
+}
+
+// ----------
+
+int main(int argc, char *argv[]) {
+	aut_initialize_suite();
+	aut_run_test(test_hash);
+	aut_run_test(test_put_get);
+	aut_run_test(test_value_view);
+	aut_run_test(test_many_keys);
+	aut_report();
+	aut_terminate_suite();
+	aut_return();
+}
@@ -0,0 +1,320 @@
+// test_astr_packed.c - test astr packed array functions
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+
+#include "astr.h"
+#include "astr_packed.h"
+#include "afile.h"
+#include "aclock.h"
+#include "adept_unit_test.h"
+
+int suite_runs;
+int suite_fails;
+aclock *suite_clock;
+int test_runs;
+int test_fails;
+astr *suite_messages;
+
+static const char *words[] = {
+	"", "a", "ab", "abc", "abc", "abcd", "abd", "b", "ba", "bab", "babble", "baby", "c",
+	"http://example.com/", "http://example.com/a", "http://example.com/about", "http://example.org/", "zz", NULL
+};
+
+static astr **create_words(size_t *count) {
+	astr **asa;
+	size_t i;
+	for (i = 0; words[i] != NULL; i++) {
+	}
+	asa = (astr **)malloc(i * sizeof(astr *));
+	for (i = 0; words[i] != NULL; i++) {
+		asa[i] = astr_create(words[i]);
+	}
+	*count = i;
+	return asa;
+}
+
+static void free_words(astr **asa, size_t count) {
+	size_t i;
+	for (i = 0; i < count; i++) {
+		astr_free(asa[i]);
+	}
+	free(asa);
+}
+
+// ----------
+
+void test_create(void) {
+	astr_packed *packed;
+	astr **asa;
+	astr *as;
+	astr *swap;
+	astr_view view;
+	char buffer[64];
+	size_t count;
+	size_t i;
+	int ok;
+
+	asa = create_words(&count);
+	packed = astr_packed_create(asa, count, 4);
+	aut_assert("1 create", packed != NULL && astr_packed_count(packed) == count);
+	aut_assert("2 blocks", packed->block_size == 4 && packed->block_count == 5 && packed->max_length == 24);
+
+	ok = 1;
+	for (i = 0; i < count; i++) {
+		view = astr_packed_view(packed, i, buffer, sizeof(buffer));
+		ok &= (view.string != NULL && view.length == asa[i]->length && memcmp(view.string, asa[i]->string, view.length) == 0);
+	}
+	aut_assert("3 view every string", ok);
+	view = astr_packed_view(packed, 4, buffer, sizeof(buffer));
+	aut_assert("4 first of block not copied", view.string != buffer && (const unsigned char *)view.string > packed->image);
+	view = astr_packed_view(packed, 5, buffer, sizeof(buffer));
+	aut_assert("5 others put together in buffer", view.string == buffer);
+	view = astr_packed_view(packed, 15, buffer, 10);
+	aut_assert("6 buffer too small", view.string == NULL);
+	view = astr_packed_view(packed, count, buffer, sizeof(buffer));
+	aut_assert("7 index out of range", view.string == NULL);
+
+	as = astr_packed_get(packed, 15, NULL);
+	aut_assert("8 get", strcmp(as->string, "http://example.com/about") == 0 && astr_equals(as, asa[15]));
+	as = astr_packed_get(packed, 2, as);
+	aut_assert("9 get into", strcmp(as->string, "ab") == 0 && as->length == 2);
+	aut_assert("10 get out of range", astr_packed_get(packed, count, as) == NULL);
+	astr_free(as);
+
+	aut_assert("11 smaller than the strings", packed->image_length < 64 + 5 * 8 + 117);
+	packed = astr_packed_free(packed);
+	aut_assert("12 free", packed == NULL);
+
+	// Out of order.
+	swap = asa[7];
+	asa[7] = asa[8];
+	asa[8] = swap;
+	errno = 0;
+	aut_assert("13 not sorted", astr_packed_create(asa, count, 4) == NULL && errno == EINVAL);
+	free_words(asa, count);
+
+	packed = astr_packed_create(NULL, 0, 0);
+	aut_assert("14 empty", packed != NULL && astr_packed_count(packed) == 0 && astr_packed_find(packed, astr_view_from_string("a")) == -1);
+	aut_assert("15 empty lower bound", astr_packed_lower_bound(packed, astr_view_from_string("a")) == 0);
+	astr_packed_free(packed);
+}
+
+void test_search(void) {
+	astr_packed *packed;
+	astr **asa;
+	size_t count;
+
+	asa = create_words(&count);
+	packed = astr_packed_create(asa, count, 4);
+
+	aut_assert("1 find first", astr_packed_find(packed, astr_view_from_string("")) == 0);
+	aut_assert("2 find first of block", astr_packed_find(packed, astr_view_from_string("abc")) == 3);
+	aut_assert("3 find duplicate finds first", astr_packed_find(packed, astr_view_from_string("abc")) == 3);
+	aut_assert("4 find in block", astr_packed_find(packed, astr_view_from_string("babble")) == 10);
+	aut_assert("5 find last", astr_packed_find(packed, astr_view_from_string("zz")) == 17);
+	aut_assert("6 find long", astr_packed_find(packed, astr_view_from_string("http://example.com/about")) == 15);
+	aut_assert("7 not found prefix of a string", astr_packed_find(packed, astr_view_from_string("bab")) == 9 && astr_packed_find(packed, astr_view_from_string("babb")) == -1);
+	aut_assert("8 not found string is prefix", astr_packed_find(packed, astr_view_from_string("abcde")) == -1);
+	aut_assert("9 not found past end", astr_packed_find(packed, astr_view_from_string("zzz")) == -1);
+
+	aut_assert("10 lower bound between", astr_packed_lower_bound(packed, astr_view_from_string("abcde")) == 6);
+	aut_assert("11 lower bound before block", astr_packed_lower_bound(packed, astr_view_from_string("bb")) == 12);
+	aut_assert("12 lower bound after all", astr_packed_lower_bound(packed, astr_view_from_string("zzz")) == count);
+	aut_assert("13 lower bound shared prefix", astr_packed_lower_bound(packed, astr_view_from_string("http://example.com/ab")) == 15);
+	aut_assert("14 lower bound high bytes", astr_packed_lower_bound(packed, astr_view_from_string("\xff")) == count);
+
+	astr_packed_free(packed);
+	free_words(asa, count);
+}
+
+void test_search_many(void) {
+	astr_packed *packed;
+	astr **asa;
+	char key[32];
+	size_t count = 3000;
+	size_t expected;
+	size_t i;
+	int ok = 1;
+	int n;
+
+	asa = (astr **)malloc(count * sizeof(astr *));
+	for (i = 0; i < count; i++) {
+		sprintf(key, "k%lu", (unsigned long)(i * 37 % 1009));
+		asa[i] = astr_create(key);
+	}
+	astr_sort(asa, count);
+	packed = astr_packed_create(asa, count, 0);
+	aut_assert("1 create default block size", packed != NULL && packed->block_size == 16);
+
+	for (n = 0; n < 1200; n++) {
+		sprintf(key, "k%d", n);
+		for (expected = 0; expected < count && strcmp(asa[expected]->string, key) < 0; expected++) {
+		}
+		ok &= (astr_packed_lower_bound(packed, astr_view_from_string(key)) == expected);
+		ok &= (astr_packed_find(packed, astr_view_from_string(key)) == (n < 1009 ? (long)expected : -1));
+	}
+	aut_assert("2 lower bound and find against a linear search", ok);
+
+	astr_packed_free(packed);
+	free_words(asa, count);
+}
+
+void test_write_map(void) {
+	char *name = "test_packed.tmp";
+	astr_packed *packed;
+	astr_packed *mapped;
+	astr **asa;
+	astr *filename;
+	astr *open_modes;
+	afile *af;
+	char buffer[64];
+	astr_view view;
+	size_t count;
+	int result;
+
+	asa = create_words(&count);
+	packed = astr_packed_create(asa, count, 3);
+
+	filename = astr_create(name);
+	open_modes = astr_create("wb");
+	af = afile_create(filename, open_modes);
+	result = afile_open(af);
+	aut_assert("1 open", result == 0);
+	result = afile_write_packed(af, packed);
+	aut_assert("2 write packed", result == 0);
+	afile_close(af);
+	aut_assert("3 write closed", afile_write_packed(af, packed) == EBADF);
+
+	mapped = afile_map_packed(af);
+	aut_assert("4 map", mapped != NULL && mapped->mapped && astr_packed_count(mapped) == count);
+	aut_assert("5 mapped image", mapped->image_length == packed->image_length && memcmp(mapped->image, packed->image, packed->image_length) == 0);
+	aut_assert("6 mapped find", astr_packed_find(mapped, astr_view_from_string("baby")) == 11);
+	view = astr_packed_view(mapped, 16, buffer, sizeof(buffer));
+	aut_assert("7 mapped view", view.length == 19 && memcmp(view.string, "http://example.org/", 19) == 0);
+	astr_packed_free(mapped);
+
+	af = afile_free(af);
+	af = afile_create(filename, open_modes);
+	afile_open(af);
+	fprintf(af->file, "this is not a packed array, just some text that is long enough to have a header\n");
+	afile_close(af);
+	errno = 0;
+	aut_assert("8 map not a packed array", afile_map_packed(af) == NULL && errno == EINVAL);
+
+	unlink(name);
+	aut_assert("9 map missing file", astr_packed_map(name) == NULL && errno == ENOENT);
+
+	afile_free(af);
+	astr_free(filename);
+	astr_free(open_modes);
+	astr_packed_free(packed);
+	free_words(asa, count);
+}
+
+// Write the image of a packed array with its blocks overwritten by a byte.
+static void write_corrupt(const char *name, const astr_packed *packed, int byte, size_t length) {
+	size_t blocks = packed->blocks - packed->image;
+	FILE *file;
+	size_t i;
+
+	file = fopen(name, "wb");
+	fwrite(packed->image, 1, blocks, file);
+	for (i = blocks; i < packed->image_length; i++) {
+		fputc(byte, file);
+	}
+	fclose(file);
+	if (length < packed->image_length) {
+		truncate(name, length);
+	}
+}
+
+void test_corrupt(void) {
+	char *name = "test_packed_corrupt.tmp";
+	astr_packed *packed;
+	astr_packed *mapped;
+	astr **asa;
+	astr *as;
+	char buffer[64];
+	astr_view view;
+	unsigned char header[64];
+	uint32_t block_size = 2;
+	uint64_t huge = UINT64_MAX;
+	uint64_t zero = 0;
+	FILE *file;
+	size_t count;
+	size_t i;
+	int bad;
+
+	asa = create_words(&count);
+	packed = astr_packed_create(asa, count, 4);
+	aut_assert("1 created", packed != NULL);
+
+	// Lengths that never end run into the end of the image.
+	write_corrupt(name, packed, 0xFF, packed->image_length);
+	mapped = astr_packed_map(name);
+	aut_assert("2 mapped", mapped != NULL);
+	bad = 0;
+	for (i = 0; i < count; i++) {
+		view = astr_packed_view(mapped, i, buffer, sizeof(buffer));
+		bad += (view.string != NULL);
+	}
+	aut_assert("3 no views", bad == 0);
+	aut_assert("4 not found", astr_packed_find(mapped, astr_view_from_string("baby")) == -1);
+	aut_assert("5 no astr", astr_packed_get(mapped, 5, NULL) == NULL);
+	astr_packed_free(mapped);
+
+	// Lengths longer than what is left of the image.
+	write_corrupt(name, packed, 0x7F, packed->image_length);
+	mapped = astr_packed_map(name);
+	bad = 0;
+	for (i = 0; i < count; i++) {
+		view = astr_packed_view(mapped, i, buffer, sizeof(buffer));
+		bad += (view.string != NULL);
+	}
+	aut_assert("6 no views", mapped != NULL && bad == 0);
+	aut_assert("7 not found", astr_packed_find(mapped, astr_view_from_string("zz")) == -1);
+	as = astr_create("kept");
+	aut_assert("8 no astr", astr_packed_get(mapped, 0, as) == NULL && strcmp(as->string, "kept") == 0);
+	astr_free(as);
+	astr_packed_free(mapped);
+
+	// A truncated file is not opened.
+	write_corrupt(name, packed, 0x01, packed->image_length - 1);
+	errno = 0;
+	aut_assert("9 truncated", astr_packed_map(name) == NULL && errno == EINVAL);
+
+	// A count so large that rounding it up to whole blocks wraps around.
+	memcpy(header, packed->image, sizeof(header));
+	memcpy(header + 12, &block_size, 4);
+	memcpy(header + 16, &huge, 8);
+	memcpy(header + 24, &zero, 8);
+	memcpy(header + 32, &zero, 8);
+	file = fopen(name, "wb");
+	fwrite(header, 1, sizeof(header), file);
+	fclose(file);
+	errno = 0;
+	aut_assert("10 count too large", astr_packed_map(name) == NULL && errno == EINVAL);
+
+	unlink(name);
+	astr_packed_free(packed);
+	free_words(asa, count);
+}
+
+// ----------
+
+int main(int argc, char *argv[]) {
+	aut_initialize_suite();
+	aut_run_test(test_create);
+	aut_run_test(test_search);
+	aut_run_test(test_search_many);
+	aut_run_test(test_write_map);
+	aut_run_test(test_corrupt);
+	aut_report();
+	aut_terminate_suite();
+	aut_return();
+}
@@ -0,0 +1,178 @@
+// test_astr_radix.c - test astr radix tree functions
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "astr.h"
+#include "astr_radix.h"
+#include "aclock.h"
+#include "adept_unit_test.h"
+
+int suite_runs;
+int suite_fails;
+aclock *suite_clock;
+int test_runs;
+int test_fails;
+astr *suite_messages;
+
+// ----------
+
+static int collect(astr_view key, void *value, void *context) {
+	astr *as = (astr *)context;
+	astr_append(as, "[");
+	astr_append_buffer(as, key.string, key.length);
+	astr_append(as, "]");
+	return 0;
+}
+
+static int stop_after_two(astr_view key, void *value, void *context) {
+	int *count = (int *)context;
+	(*count)++;
+	return *count == 2;
+}
+
+void test_put_get(void) {
+	astr_radix *radix;
+	astr *key;
+	int one = 1;
+	int two = 2;
+	int three = 3;
+
+	radix = astr_radix_create();
+	key = astr_create("/api/users");
+	aut_assert("1 empty tree", astr_radix_size(radix) == 0 && astr_radix_get(radix, key) == NULL);
+	aut_assert("2 put adds", astr_radix_put(radix, key, &one) == 1);
+	aut_assert("3 put prefix splits edge", astr_radix_put_view(radix, astr_view_from_string("/api"), &two) == 1);
+	aut_assert("4 put diverging key", astr_radix_put_view(radix, astr_view_from_string("/apps"), &three) == 1);
+	aut_assert("5 size", astr_radix_size(radix) == 3);
+	aut_assert("6 get", astr_radix_get(radix, key) == &one);
+	aut_assert("7 get prefix", astr_radix_get_view(radix, astr_view_from_string("/api")) == &two);
+	aut_assert("8 get diverging", astr_radix_get_view(radix, astr_view_from_string("/apps")) == &three);
+	aut_assert("9 get split point is not a key", astr_radix_get_view(radix, astr_view_from_string("/ap")) == NULL);
+	aut_assert("10 get longer is not a key", astr_radix_get_view(radix, astr_view_from_string("/api/users/1")) == NULL);
+	aut_assert("11 put replaces", astr_radix_put(radix, key, &three) == 0 && astr_radix_get(radix, key) == &three);
+
+	aut_assert("12 remove", astr_radix_remove_view(radix, astr_view_from_string("/api")) == 1 && astr_radix_size(radix) == 2);
+	aut_assert("13 remove again", astr_radix_remove_view(radix, astr_view_from_string("/api")) == 0);
+	aut_assert("14 others kept", astr_radix_get(radix, key) == &three && astr_radix_get_view(radix, astr_view_from_string("/apps")) == &three);
+	aut_assert("15 remove leaf", astr_radix_remove_view(radix, astr_view_from_string("/apps")) == 1);
+	aut_assert("16 last key merged back", radix->root->count == 1 && radix->root->children[0]->label_length == 10);
+	aut_assert("17 put empty key", astr_radix_put_view(radix, astr_view_from_string(""), &one) == 1 && astr_radix_get_view(radix, astr_view_from_string("")) == &one);
+
+	astr_free(key);
+	radix = astr_radix_free(radix);
+	aut_assert("18 free", radix == NULL);
+}
+
+void test_prefixes(void) {
+	astr_radix *radix;
+	const char *routes[] = { "/", "/api", "/api/", "/api/users", "/api/users/admin", "/static", NULL };
+	int lengths[8];
+	void *values[8];
+	int length;
+	void *value;
+	int i;
+
+	radix = astr_radix_create();
+	for (i = 0; routes[i] != NULL; i++) {
+		astr_radix_put_view(radix, astr_view_from_string(routes[i]), (void *)routes[i]);
+	}
+
+	aut_assert("1 longest prefix", astr_radix_longest_prefix(radix, astr_view_from_string("/api/users/42"), &length, &value) == 1 && length == 10 && value == routes[3]);
+	aut_assert("2 longest prefix exact", astr_radix_longest_prefix(radix, astr_view_from_string("/api"), &length, &value) == 1 && length == 4);
+	aut_assert("3 longest prefix part of edge", astr_radix_longest_prefix(radix, astr_view_from_string("/stat"), &length, &value) == 1 && length == 1);
+	aut_assert("4 no prefix", astr_radix_longest_prefix(radix, astr_view_from_string("api"), &length, &value) == 0);
+
+	aut_assert("5 all prefixes", astr_radix_all_prefixes(radix, astr_view_from_string("/api/users/admin/x"), lengths, values, 8) == 5);
+	aut_assert("6 all prefixes shortest first", lengths[0] == 1 && lengths[1] == 4 && lengths[2] == 5 && lengths[3] == 10 && lengths[4] == 16);
+	aut_assert("7 all prefixes values", values[0] == routes[0] && values[4] == routes[4]);
+	aut_assert("8 all prefixes past max", astr_radix_all_prefixes(radix, astr_view_from_string("/api/users"), lengths, values, 2) == 4 && lengths[1] == 4);
+
+	astr_radix_free(radix);
+}
+
+void test_range(void) {
+	astr_radix *radix;
+	const char *keys[] = { "b", "ab", "abc", "a", "ba", "c", "abd", "\xe9t\xe9", NULL };
+	astr_view none = { NULL, 0 };
+	astr *visited;
+	int count;
+	int i;
+
+	radix = astr_radix_create();
+	for (i = 0; keys[i] != NULL; i++) {
+		astr_radix_put_view(radix, astr_view_from_string(keys[i]), NULL);
+	}
+	visited = astr_create_empty();
+
+	aut_assert("1 range all", astr_radix_range(radix, none, none, collect, visited) == 8);
+	aut_assert("2 range all in order", strcmp(visited->string, "[a][ab][abc][abd][b][ba][c][\xe9t\xe9]") == 0);
+
+	astr_set(visited, "");
+	aut_assert("3 range from ab to b", astr_radix_range(radix, astr_view_from_string("ab"), astr_view_from_string("b"), collect, visited) == 3);
+	aut_assert("4 range from ab to b keys", strcmp(visited->string, "[ab][abc][abd]") == 0);
+
+	astr_set(visited, "");
+	aut_assert("5 range between keys", astr_radix_range(radix, astr_view_from_string("abca"), astr_view_from_string("bb"), collect, visited) == 3);
+	aut_assert("6 range between keys keys", strcmp(visited->string, "[abd][b][ba]") == 0);
+
+	aut_assert("7 range empty", astr_radix_range(radix, astr_view_from_string("c"), astr_view_from_string("c"), NULL, NULL) == 0);
+	aut_assert("8 range count only", astr_radix_range(radix, astr_view_from_string("b"), none, NULL, NULL) == 4);
+
+	count = 0;
+	aut_assert("9 range stopped", astr_radix_range(radix, none, none, stop_after_two, &count) == 2 && count == 2);
+
+	astr_free(visited);
+	astr_radix_free(radix);
+}
+
+void test_many_keys(void) {
+	astr_radix *radix;
+	char key[32];
+	int n = 5000;
+	int ok;
+	int i;
+
+	radix = astr_radix_create();
+	for (i = 0; i < n; i++) {
+		sprintf(key, "%d", i * 7);
+		astr_radix_put_view(radix, astr_view_from_string(key), (void *)(size_t)(i + 1));
+	}
+	aut_assert("1 put many", astr_radix_size(radix) == (size_t)n);
+
+	ok = 1;
+	for (i = 0; i < n; i++) {
+		sprintf(key, "%d", i * 7);
+		ok &= ((size_t)astr_radix_get_view(radix, astr_view_from_string(key)) == (size_t)(i + 1));
+	}
+	aut_assert("2 get many", ok);
+
+	for (i = 0; i < n; i += 2) {
+		sprintf(key, "%d", i * 7);
+		astr_radix_remove_view(radix, astr_view_from_string(key));
+	}
+	ok = 1;
+	for (i = 0; i < n; i++) {
+		sprintf(key, "%d", i * 7);
+		ok &= ((astr_radix_get_view(radix, astr_view_from_string(key)) != NULL) == (i % 2 == 1));
+	}
+	aut_assert("3 remove half", ok && astr_radix_size(radix) == (size_t)n / 2);
+	aut_assert("4 range counts the rest", astr_radix_range(radix, astr_view_from_string(""), astr_view_from_string("\xff"), NULL, NULL) == n / 2);
+
+	astr_radix_free(radix);
+}
+
+// ----------
+
+int main(int argc, char *argv[]) {
+	aut_initialize_suite();
+	aut_run_test(test_put_get);
+	aut_run_test(test_prefixes);
+	aut_run_test(test_range);
+	aut_run_test(test_many_keys);
+	aut_report();
+	aut_terminate_suite();
+	aut_return();
+}
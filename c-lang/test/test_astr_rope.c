@@ -0,0 +1,229 @@
+// test_astr_rope.c - test astr rope functions
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+
+#include "astr.h"
+#include "astr_rope.h"
+#include "afile.h"
+#include "aclock.h"
+#include "adept_unit_test.h"
+
+int suite_runs;
+int suite_fails;
+aclock *suite_clock;
+int test_runs;
+int test_fails;
+astr *suite_messages;
+
+// ----------
+
+// Check the lengths and heights of every node, and that the tree is balanced.
+int check_node(const astr_rope_node *node) {
+	int left_height;
+	int right_height;
+	size_t left_length;
+	size_t right_length;
+
+	if (node == NULL) {
+		return 1;
+	}
+	if (node->chunk != NULL) {
+		return node->left == NULL && node->right == NULL && node->height == 1 && node->length > 0;
+	}
+	if (!check_node(node->left) || !check_node(node->right)) {
+		return 0;
+	}
+	left_height = node->left == NULL ? 0 : node->left->height;
+	right_height = node->right == NULL ? 0 : node->right->height;
+	left_length = node->left == NULL ? 0 : node->left->length;
+	right_length = node->right == NULL ? 0 : node->right->length;
+	return node->length == left_length + right_length
+		&& node->height == 1 + (left_height > right_height ? left_height : right_height)
+		&& abs(left_height - right_height) <= 1;
+}
+
+// Compare a rope against a buffer.
+int rope_equals(const astr_rope *rope, const char *buffer, size_t length) {
+	astr *as;
+	int equal;
+
+	if (astr_rope_length(rope) != length || !check_node(rope->root)) {
+		return 0;
+	}
+	as = astr_rope_to_astr(rope);
+	equal = (as != NULL && as->length == length && memcmp(as->string, buffer, length) == 0);
+	astr_free(as);
+	return equal;
+}
+
+void test_create(void) {
+	astr_rope *rope;
+	astr *as;
+	char *big;
+	int i;
+
+	rope = astr_rope_create("hello");
+	aut_assert("1 create", rope_equals(rope, "hello", 5));
+	aut_assert("2 char at", astr_rope_char_at(rope, 1) == 'e' && astr_rope_char_at(rope, 5) == -1);
+	astr_rope_free(rope);
+
+	rope = astr_rope_create(NULL);
+	aut_assert("3 create empty", astr_rope_length(rope) == 0 && rope->root == NULL);
+	as = astr_rope_to_astr(rope);
+	aut_assert("4 flatten empty", as != NULL && as->length == 0 && strcmp(as->string, "") == 0);
+	astr_free(as);
+	astr_rope_free(rope);
+
+	big = (char *)malloc(100000);
+	for (i = 0; i < 100000; i++) {
+		big[i] = 'a' + i % 26;
+	}
+	rope = astr_rope_create_from_buffer(big, 100000);
+	aut_assert("5 create big", rope_equals(rope, big, 100000));
+	aut_assert("6 create big is a tree", rope->root->chunk == NULL && rope->root->height <= 6);
+	aut_assert("7 char at", astr_rope_char_at(rope, 54321) == 'a' + 54321 % 26);
+	astr_rope_free(rope);
+	free(big);
+}
+
+void test_edits(void) {
+	astr_rope *rope;
+	astr_rope *other;
+	astr *as;
+	astr *expected;
+
+	rope = astr_rope_create("the fox");
+	rope = astr_rope_insert(rope, 4, "quick ");
+	rope = astr_rope_append(rope, " jumps");
+	rope = astr_rope_insert(rope, 0, ">> ");
+	aut_assert("1 insert", rope_equals(rope, ">> the quick fox jumps", 22));
+
+	rope = astr_rope_delete(rope, 0, 3);
+	rope = astr_rope_delete(rope, 13, 100);
+	aut_assert("2 delete", rope_equals(rope, "the quick fox", 13));
+
+	other = astr_rope_create(" over the dog");
+	rope = astr_rope_concat(rope, other);
+	aut_assert("3 concat", rope_equals(rope, "the quick fox over the dog", 26));
+	aut_assert("4 concat empties", astr_rope_length(other) == 0);
+
+	as = astr_rope_to_astr(rope);
+	expected = astr_create("the quick fox over the dog");
+	aut_assert("5 flatten checksum", as->checksum == expected->checksum && as->allocated_length == 27);
+
+	astr_free(as);
+	astr_free(expected);
+	astr_rope_free(other);
+	astr_rope_free(rope);
+}
+
+void test_random_edits(void) {
+	astr_rope *rope;
+	char *reference;
+	size_t length = 0;
+	size_t position;
+	size_t count;
+	char insert[10000];
+	int failures = 0;
+	int i;
+	int j;
+
+	reference = (char *)malloc(2000000);
+	rope = astr_rope_create(NULL);
+	srand(31);
+	for (i = 0; i < 3000; i++) {
+		position = (length == 0 ? 0 : rand() % (length + 1));
+		if (length < 1000 || rand() % 3 != 0) {
+			count = (rand() % 4 == 0 ? rand() % 10000 : rand() % 20) + 1;
+			if (length + count > 2000000) {
+				continue;
+			}
+			for (j = 0; j < count; j++) {
+				insert[j] = 'A' + (i + j) % 58;
+			}
+			rope = astr_rope_insert_buffer(rope, position, insert, count);
+			memmove(reference + position + count, reference + position, length - position);
+			memcpy(reference + position, insert, count);
+			length += count;
+		}
+		else {
+			count = (rand() % 4 == 0 ? rand() % 20000 : rand() % 20) + 1;
+			rope = astr_rope_delete(rope, position, count);
+			if (count > length - position) {
+				count = length - position;
+			}
+			memmove(reference + position, reference + position + count, length - position - count);
+			length -= count;
+		}
+		if (i % 100 == 0 && !rope_equals(rope, reference, length)) {
+			failures++;
+		}
+	}
+	aut_assert("1 random edits match", failures == 0 && rope_equals(rope, reference, length));
+
+	astr_rope_free(rope);
+	free(reference);
+}
+
+void test_write(void) {
+	char *name = "test_astr_rope.tmp";
+	astr *filename;
+	astr *open_modes;
+	afile *af;
+	astr_rope *rope;
+	char *big;
+	char *back;
+	FILE *file;
+	int result;
+	int i;
+
+	big = (char *)malloc(50000);
+	back = (char *)malloc(50001);
+	for (i = 0; i < 50000; i++) {
+		big[i] = '0' + i % 10;
+	}
+	rope = astr_rope_create_from_buffer(big, 50000);
+	rope = astr_rope_insert(rope, 25000, "middle");
+
+	filename = astr_create(name);
+	open_modes = astr_create("w");
+	af = afile_create(filename, open_modes);
+	result = afile_open(af);
+	aut_assert("1 open", result == 0);
+	result = afile_write_rope(af, rope);
+	aut_assert("2 write rope", result == 0);
+	afile_close(af);
+
+	file = fopen(name, "r");
+	aut_assert("3 read back", file != NULL && fread(back, 1, 50001, file) == 50001);
+	aut_assert("4 read back matches", memcmp(back, big, 25000) == 0 && memcmp(back + 25000, "middle", 6) == 0);
+	fclose(file);
+
+	result = afile_write_rope(af, rope);
+	aut_assert("5 write closed", result != 0);
+
+	unlink(name);
+	afile_free(af);
+	astr_free(filename);
+	astr_free(open_modes);
+	astr_rope_free(rope);
+	free(big);
+	free(back);
+}
+
+// ----------
+
+int main(int argc, char *argv[]) {
+	aut_initialize_suite();
+	aut_run_test(test_create);
+	aut_run_test(test_edits);
+	aut_run_test(test_random_edits);
+	aut_run_test(test_write);
+	aut_report();
+	aut_terminate_suite();
+	aut_return();
+}
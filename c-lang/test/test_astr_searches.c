@@ -0,0 +1,135 @@
+// test_astr_searches.c - test astr search functions
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "astr.h"
+#include "aclock.h"
+#include "adept_unit_test.h"
+
+int suite_runs;
+int suite_fails;
+aclock *suite_clock;
+int test_runs;
+int test_fails;
+astr *suite_messages;
+
+// ----------
+
+// The checksum the way astr_update calculates it.
+int checksum_of(const char *s) {
+	int checksum = 0;
+	while (*s != '\0') {
+		checksum += *s++;
+	}
+	return checksum;
+}
+
+void test_search_buffer(void) {
+	const char *haystack = "the quick brown fox jumps over the lazy dog, the end";
+	int length = strlen(haystack);
+	char long_haystack[200];
+	int i;
+
+	aut_assert("1 search", astr_search_buffer(haystack, length, "the", 3) == haystack);
+	aut_assert("2 search", astr_search_buffer(haystack + 1, length - 1, "the", 3) == haystack + 31);
+	aut_assert("3 search one char", astr_search_buffer(haystack, length, "z", 1) == haystack + 37);
+	aut_assert("4 search at end", astr_search_buffer(haystack, length, "end", 3) == haystack + 49);
+	aut_assert("5 search not found", astr_search_buffer(haystack, length, "cat", 3) == NULL);
+	aut_assert("6 search too long", astr_search_buffer("ab", 2, "abc", 3) == NULL);
+	aut_assert("7 search empty", astr_search_buffer(haystack, length, "", 0) == haystack);
+
+	// Every position, including the ones just past the 16 byte blocks.
+	memset(long_haystack, 'a', sizeof(long_haystack));
+	for (i = 0; i + 3 <= sizeof(long_haystack); i++) {
+		memcpy(long_haystack + i, "xyz", 3);
+		if (astr_search_buffer(long_haystack, sizeof(long_haystack), "xyz", 3) != long_haystack + i) {
+			break;
+		}
+		memcpy(long_haystack + i, "aaa", 3);
+	}
+	aut_assert("8 search every position", i + 3 > sizeof(long_haystack));
+
+	// First and last characters match, middle does not.
+	aut_assert("9 search near miss", astr_search_buffer("xaz xbz xyz", 11, "xyz", 3) != NULL);
+	aut_assert("10 search near miss", astr_search_buffer("xaz xbz xaz xbz xaz xbz", 23, "xyz", 3) == NULL);
+}
+
+void test_find(void) {
+	astr *as;
+
+	as = astr_create("one, two, three, two");
+	aut_assert("1 find", astr_find(as, "two", 0) == 5);
+	aut_assert("2 find from start", astr_find(as, "two", 6) == 17);
+	aut_assert("3 find not found", astr_find(as, "four", 0) == -1);
+	aut_assert("4 find bad start", astr_find(as, "two", 99) == -1);
+	aut_assert("5 find NULL", astr_find(NULL, "two", 0) == -1);
+
+	astr_free(as);
+}
+
+void test_find_all(void) {
+	astr *as;
+	int *indexes;
+	int count;
+
+	as = astr_create("aaaa, ba, aa");
+	indexes = astr_find_all(as, "aa", &count);
+	aut_assert("1 find all count", count == 3);
+	aut_assert("2 find all indexes", indexes != NULL && indexes[0] == 0 && indexes[1] == 2 && indexes[2] == 10);
+	free(indexes);
+
+	indexes = astr_find_all(as, "x", &count);
+	aut_assert("3 find all none", indexes == NULL && count == 0);
+
+	indexes = astr_find_all(as, "", &count);
+	aut_assert("4 find all empty", indexes == NULL && count == 0);
+
+	astr_free(as);
+}
+
+void test_replace_all(void) {
+	astr *as;
+	char *expected;
+
+	as = astr_create("one, two, three, two");
+	as = astr_replace_all(as, "two", "2");
+	aut_assert("1 replace shorter", strcmp(as->string, "one, 2, three, 2") == 0);
+	aut_assert("2 replace shorter length", as->length == strlen(as->string));
+	aut_assert("3 replace shorter checksum", as->checksum == checksum_of(as->string));
+
+	as = astr_replace_all(as, ", ", " and ");
+	expected = "one and 2 and three and 2";
+	aut_assert("4 replace longer", strcmp(as->string, expected) == 0);
+	aut_assert("5 replace longer exact allocation", as->allocated_length == strlen(expected) + 1);
+	aut_assert("6 replace longer checksum", as->checksum == checksum_of(as->string));
+
+	as = astr_replace_all(as, " and ", "");
+	aut_assert("7 replace with empty", strcmp(as->string, "one2three2") == 0 && as->length == 10);
+
+	as = astr_replace_all(as, "four", "4");
+	aut_assert("8 replace none", strcmp(as->string, "one2three2") == 0);
+
+	as = astr_set(as, "   left trimmed x x");
+	as = astr_left_trim(as);
+	as = astr_replace_all(as, "x", "xyz");
+	aut_assert("9 replace trimmed", strcmp(as->string, "left trimmed xyz xyz") == 0);
+	aut_assert("10 replace trimmed checksum", as->checksum == checksum_of(as->string));
+
+	astr_free(as);
+}
+
+// ----------
+
+int main(int argc, char *argv[]) {
+	aut_initialize_suite();
+	aut_run_test(test_search_buffer);
+	aut_run_test(test_find);
+	aut_run_test(test_find_all);
+	aut_run_test(test_replace_all);
+	aut_report();
+	aut_terminate_suite();
+	aut_return();
+}
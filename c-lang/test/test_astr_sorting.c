@@ -0,0 +1,301 @@
+// test_astr_sorting.c - test astr sorting functions
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "astr.h"
+#include "aclock.h"
+#include "adept_unit_test.h"
+
+int suite_runs;
+int suite_fails;
+aclock *suite_clock;
+int test_runs;
+int test_fails;
+astr *suite_messages;
+
+// ----------
+
+int compare_for_qsort(const void *p1, const void *p2) {
+	return astr_compare(*(astr * const *)p1, *(astr * const *)p2);
+}
+
+// Make strings with long shared prefixes, many duplicates, and bytes above 0x7F.
+astr **make_strings(size_t count, unsigned int seed) {
+	astr **asa = (astr **)malloc(count * sizeof(astr *));
+	char buffer[64];
+	size_t i;
+	int length;
+	int j;
+
+	srand(seed);
+	for (i = 0; i < count; i++) {
+		switch (rand() % 4) {
+			case 0:
+				strcpy(buffer, "common/prefix/longer/than/eight/");
+				length = strlen(buffer) + rand() % 4;
+				break;
+			case 1:
+				strcpy(buffer, "abcdefgh");
+				length = 8;
+				break;
+			default:
+				length = rand() % 20;
+				buffer[0] = '\0';
+				break;
+		}
+		for (j = strlen(buffer); j < length; j++) {
+			buffer[j] = (rand() % 8 == 0) ? 0x80 + rand() % 0x7F : 'a' + rand() % 4;
+		}
+		buffer[length] = '\0';
+		asa[i] = astr_create(buffer);
+	}
+	return asa;
+}
+
+void free_strings(astr **asa, size_t count) {
+	size_t i;
+	for (i = 0; i < count; i++) {
+		astr_free(asa[i]);
+	}
+	free(asa);
+}
+
+// Check that a sorted array holds the same instances in the same order as qsort would put the strings.
+int same_order(astr **sorted, astr **expected, size_t count) {
+	size_t i;
+	for (i = 0; i < count; i++) {
+		if (astr_compare(sorted[i], expected[i]) != 0) {
+			return 0;
+		}
+	}
+	return 1;
+}
+
+// Check that each string is no greater than the one after it.
+int in_order(astr **sorted, size_t count) {
+	size_t i;
+	for (i = 1; i < count; i++) {
+		if (astr_compare(sorted[i - 1], sorted[i]) > 0) {
+			return 0;
+		}
+	}
+	return 1;
+}
+
+// Check that equal strings are in the order of their original positions.
+int is_stable(astr **sorted, astr **original, size_t count) {
+	size_t i;
+	size_t p1;
+	size_t p2;
+	for (i = 1; i < count; i++) {
+		if (astr_compare(sorted[i - 1], sorted[i]) == 0) {
+			for (p1 = 0; original[p1] != sorted[i - 1]; p1++);
+			for (p2 = 0; original[p2] != sorted[i]; p2++);
+			if (p1 > p2) {
+				return 0;
+			}
+		}
+	}
+	return 1;
+}
+
+void test_sort(void) {
+	size_t count = 5000;
+	astr **asa;
+	astr **expected;
+
+	asa = make_strings(count, 33);
+	expected = (astr **)malloc(count * sizeof(astr *));
+	memcpy(expected, asa, count * sizeof(astr *));
+	qsort(expected, count, sizeof(astr *), compare_for_qsort);
+
+	aut_assert("1 sort", astr_sort(asa, count) == asa);
+	aut_assert("2 sort order", same_order(asa, expected, count));
+
+	free(expected);
+	free_strings(asa, count);
+}
+
+void test_sort_stable(void) {
+	size_t count = 3000;
+	astr **asa;
+	astr **original;
+	astr **expected;
+
+	asa = make_strings(count, 34);
+	original = (astr **)malloc(count * sizeof(astr *));
+	memcpy(original, asa, count * sizeof(astr *));
+	expected = (astr **)malloc(count * sizeof(astr *));
+	memcpy(expected, asa, count * sizeof(astr *));
+	qsort(expected, count, sizeof(astr *), compare_for_qsort);
+
+	astr_sort_stable(asa, count);
+	aut_assert("1 stable sort order", same_order(asa, expected, count));
+	aut_assert("2 stable sort is stable", is_stable(asa, original, count));
+
+	free(original);
+	free(expected);
+	free_strings(asa, count);
+}
+
+void test_sort_parallel(void) {
+	size_t count = 60000;
+	astr **asa;
+	astr **expected;
+	astr **original;
+
+	asa = make_strings(count, 35);
+	expected = (astr **)malloc(count * sizeof(astr *));
+	memcpy(expected, asa, count * sizeof(astr *));
+	qsort(expected, count, sizeof(astr *), compare_for_qsort);
+
+	astr_sort_parallel(asa, count, 4, 0);
+	aut_assert("1 parallel sort order", same_order(asa, expected, count));
+	free_strings(asa, count);
+
+	asa = make_strings(20000, 36);
+	original = (astr **)malloc(20000 * sizeof(astr *));
+	memcpy(original, asa, 20000 * sizeof(astr *));
+	astr_sort_parallel(asa, 20000, 3, 1);
+	aut_assert("2 parallel stable sort is stable", is_stable(asa, original, 20000));
+	free(original);
+	free_strings(asa, 20000);
+
+	free(expected);
+}
+
+// Make numbered strings in order, in reverse, or rising then falling.
+astr **make_ordered_strings(const char *format, size_t count, int order) {
+	astr **asa = (astr **)malloc(count * sizeof(astr *));
+	char buffer[64];
+	size_t i;
+	size_t n;
+
+	for (i = 0; i < count; i++) {
+		n = (order == 0 ? i : (order == 1 ? count - 1 - i : (i < count / 2 ? 2 * i : 2 * (count - i) - 1)));
+		sprintf(buffer, format, (int)n);
+		asa[i] = astr_create(buffer);
+	}
+	return asa;
+}
+
+void test_sort_ordered(void) {
+	size_t count = 100000;
+	const char *formats[2] = { "%08d", "prefix-common-%010d" };
+	astr **asa;
+	astr **expected;
+	int sorted = 0;
+	int reversed = 0;
+	int rising_falling = 0;
+	int f;
+
+	// Already sorted, reversed, and organ pipe input, with short keys and
+	// with keys sharing a prefix longer than eight bytes.
+	for (f = 0; f < 2; f++) {
+		asa = make_ordered_strings(formats[f], count, 0);
+		astr_sort(asa, count);
+		sorted += in_order(asa, count);
+		free_strings(asa, count);
+
+		asa = make_ordered_strings(formats[f], count, 1);
+		expected = (astr **)malloc(count * sizeof(astr *));
+		memcpy(expected, asa, count * sizeof(astr *));
+		qsort(expected, count, sizeof(astr *), compare_for_qsort);
+		astr_sort(asa, count);
+		reversed += same_order(asa, expected, count);
+		free(expected);
+		free_strings(asa, count);
+
+		asa = make_ordered_strings(formats[f], count, 2);
+		astr_sort(asa, count);
+		rising_falling += in_order(asa, count);
+		free_strings(asa, count);
+	}
+	aut_assert("1 sorted", sorted == 2);
+	aut_assert("2 reversed", reversed == 2);
+	aut_assert("3 rising then falling", rising_falling == 2);
+}
+
+void test_sort_nulls(void) {
+	astr *asa[6];
+	astr *empty;
+
+	empty = astr_create_empty();
+	asa[0] = astr_create("b");
+	asa[1] = NULL;
+	asa[2] = astr_create("");
+	asa[3] = empty;
+	asa[4] = astr_create("a");
+	asa[5] = NULL;
+
+	astr_sort(asa, 6);
+	aut_assert("1 nulls first", asa[0] == NULL && asa[1] == NULL && asa[2] == empty);
+	aut_assert("2 then strings", strcmp(asa[3]->string, "") == 0 && strcmp(asa[4]->string, "a") == 0 && strcmp(asa[5]->string, "b") == 0);
+
+	aut_assert("3 sort none", astr_sort(asa, 0) == asa);
+
+	astr_free(asa[2]);
+	astr_free(asa[3]);
+	astr_free(asa[4]);
+	astr_free(asa[5]);
+}
+
+void test_sort_many_nulls(void) {
+	size_t count = 30000;
+	astr **asa = (astr **)malloc(count * sizeof(astr *));
+	astr **empties = (astr **)malloc(count * sizeof(astr *));
+	char buffer[32];
+	size_t empty_count = 0;
+	size_t null_count = 0;
+	size_t i;
+	int empties_in_order = 1;
+	int nulls_first = 1;
+
+	// NULL strings ahead of NULL instances, and both among the strings.
+	for (i = 0; i < count; i++) {
+		if (i % 3 == 0 && i < count / 2) {
+			asa[i] = astr_create_empty();
+			empties[empty_count++] = asa[i];
+		}
+		else if (i % 2 == 0) {
+			asa[i] = NULL;
+			null_count++;
+		}
+		else {
+			sprintf(buffer, "%08d", (int)((i * 7919) % count));
+			asa[i] = astr_create(buffer);
+		}
+	}
+
+	aut_assert("1 sorted", astr_sort(asa, count) == asa);
+	for (i = 0; i < null_count; i++) {
+		nulls_first &= (asa[i] == NULL);
+	}
+	for (i = 0; i < empty_count; i++) {
+		empties_in_order &= (asa[null_count + i] == empties[i]);
+	}
+	aut_assert("2 NULL instances first", nulls_first);
+	aut_assert("3 then NULL strings, in order", empties_in_order);
+	aut_assert("4 then the strings", in_order(asa + null_count + empty_count, count - null_count - empty_count) && asa[null_count + empty_count]->string != NULL);
+
+	free(empties);
+	free_strings(asa, count);
+}
+
+// ----------
+
+int main(int argc, char *argv[]) {
+	aut_initialize_suite();
+	aut_run_test(test_sort);
+	aut_run_test(test_sort_stable);
+	aut_run_test(test_sort_parallel);
+	aut_run_test(test_sort_ordered);
+	aut_run_test(test_sort_nulls);
+	aut_run_test(test_sort_many_nulls);
+	aut_report();
+	aut_terminate_suite();
+	aut_return();
+}
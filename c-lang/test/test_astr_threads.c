@@ -0,0 +1,213 @@
+// test_astr_threads.c - stress test the thread-safe mode
+//
+// Configure with --enable-tsan to run this under ThreadSanitizer.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <regex.h>
+#include <pthread.h>
+
+#include "astr.h"
+#include "astr_bloom.h"
+#include "astr_map.h"
+#include "astr_radix.h"
+#include "aclock.h"
+#include "adept_unit_test.h"
+
+int suite_runs;
+int suite_fails;
+aclock *suite_clock;
+int test_runs;
+int test_fails;
+astr *suite_messages;
+
+#define THREADS 4
+#define ITERATIONS 2000
+#define SHARED 16
+#define HANDOFFS 2000
+
+static astr *shared[SHARED];
+static uint64_t shared_hashes[SHARED];
+static int shared_codepoint_lengths[SHARED];
+static astr_map *shared_map;
+static astr_bloom *shared_bloom;
+static astr_radix *shared_radix;
+
+// ----------
+
+static void create_shared(void) {
+	char buffer[64];
+	int i;
+
+	shared_map = astr_map_create(SHARED);
+	shared_bloom = astr_bloom_create(SHARED, 0.01);
+	shared_radix = astr_radix_create();
+	for (i = 0; i < SHARED; i++) {
+		if (i % 2 == 0) {
+			sprintf(buffer, "line %d of the shared strings", i);
+		}
+		else {
+			sprintf(buffer, "\xc3\xa9l\xc3\xa8ve %d, na\xc3\xafve", i);
+		}
+		shared[i] = astr_create(buffer);
+		shared_hashes[i] = astr_hash_buffer(shared[i]->string, shared[i]->length);
+		shared_codepoint_lengths[i] = (i % 2 == 0 ? shared[i]->length : shared[i]->length - 3);
+		astr_map_put_view(shared_map, astr_view_of(shared[i]), (void *)(size_t)(i + 1));
+		astr_bloom_add_view(shared_bloom, astr_view_of(shared[i]));
+		astr_radix_put_view(shared_radix, astr_view_from_buffer(shared[i]->string, 6), (void *)(size_t)(i + 1));
+		// The shared instances start with nothing cached, so the readers race to cache it.
+		shared[i]->hash = 0;
+		shared[i]->codepoint_length = -1;
+	}
+}
+
+static void free_shared(void) {
+	int i;
+	for (i = 0; i < SHARED; i++) {
+		astr_free(shared[i]);
+	}
+	astr_map_free(shared_map);
+	astr_bloom_free(shared_bloom);
+	astr_radix_free(shared_radix);
+}
+
+// Read the shared instances and structures from several threads at once.
+static void *reader(void *arg) {
+	int *errors = (int *)arg;
+	char pattern[32];
+	astr *expression;
+	astr *copy;
+	int length;
+	int i;
+	int n;
+
+	for (n = 0; n < ITERATIONS; n++) {
+		i = n % SHARED;
+		*errors += (astr_hash(shared[i]) != shared_hashes[i]);
+		*errors += (astr_codepoint_length(shared[i]) != shared_codepoint_lengths[i]);
+		*errors += !astr_equals(shared[i], shared[i]);
+		*errors += (astr_equals(shared[i], shared[(i + 1) % SHARED]) != 0);
+		*errors += (astr_is_utf8(shared[i]) != 1);
+		*errors += ((size_t)astr_map_get(shared_map, shared[i]) != (size_t)(i + 1));
+		*errors += !astr_bloom_contains(shared_bloom, shared[i]);
+		*errors += (astr_radix_longest_prefix(shared_radix, astr_view_of(shared[i]), &length, NULL) != 1 || length != 6);
+
+		// More expressions than a regex cache holds, so entries are replaced.
+		sprintf(pattern, "^(line|\xc3\xa9l\xc3\xa8ve) %d[ ,]", n % 12);
+		expression = astr_create(pattern);
+		*errors += (astr_match(shared[i], expression, REG_EXTENDED) != (n % 12 == i));
+		astr_free(expression);
+		*errors += (astr_is_yn(shared[i]) != 0);
+
+		// Case mapping uses the UTF-8 locale.
+		copy = astr_copy(shared[i]);
+		astr_to_upper_case(copy);
+		*errors += (i % 2 == 1 && strncmp(copy->string, "\xc3\x89L\xc3\x88VE", 7) != 0);
+		astr_free(copy);
+	}
+	return NULL;
+}
+
+void test_shared_readers(void) {
+	pthread_t threads[THREADS];
+	int errors[THREADS];
+	int total = 0;
+	int t;
+
+	create_shared();
+	for (t = 0; t < THREADS; t++) {
+		errors[t] = 0;
+		pthread_create(&threads[t], NULL, reader, &errors[t]);
+	}
+	for (t = 0; t < THREADS; t++) {
+		pthread_join(threads[t], NULL);
+		total += errors[t];
+	}
+	aut_assert("1 shared readers", total == 0);
+	aut_assert("2 hashes cached", shared[0]->hash == shared_hashes[0] && shared[1]->codepoint_length == shared_codepoint_lengths[1]);
+	free_shared();
+}
+
+// ----------
+
+// A queue of one slot, to hand instances from one thread to another.
+static pthread_mutex_t handoff_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t handoff_cond = PTHREAD_COND_INITIALIZER;
+static astr *handoff_slot;
+static int handoff_errors;
+
+static void *producer(void *arg) {
+	char buffer[32];
+	astr *as;
+	int n;
+
+	for (n = 0; n < HANDOFFS; n++) {
+		sprintf(buffer, "item %d", n);
+		as = astr_create(buffer);
+		astr_hash(as);
+		astr_codepoint_length(as);
+		pthread_mutex_lock(&handoff_mutex);
+		while (handoff_slot != NULL) {
+			pthread_cond_wait(&handoff_cond, &handoff_mutex);
+		}
+		handoff_slot = as;
+		pthread_cond_signal(&handoff_cond);
+		pthread_mutex_unlock(&handoff_mutex);
+	}
+	return NULL;
+}
+
+static void *consumer(void *arg) {
+	char buffer[32];
+	astr *as;
+	astr *token;
+	int n;
+
+	for (n = 0; n < HANDOFFS; n++) {
+		pthread_mutex_lock(&handoff_mutex);
+		while (handoff_slot == NULL) {
+			pthread_cond_wait(&handoff_cond, &handoff_mutex);
+		}
+		as = handoff_slot;
+		handoff_slot = NULL;
+		pthread_cond_signal(&handoff_cond);
+		pthread_mutex_unlock(&handoff_mutex);
+
+		// The consumer owns the instance now, and changes it.
+		sprintf(buffer, "item %d", n);
+		handoff_errors += (strcmp(as->string, buffer) != 0);
+		handoff_errors += (as->hash != astr_hash_buffer(buffer, strlen(buffer)));
+		astr_append(as, " done");
+		handoff_errors += (as->hash != 0 || as->codepoint_length != -1);
+		token = astr_tok(as, " ");
+		handoff_errors += (token == NULL || strcmp(token->string, "item") != 0);
+		astr_free(token);
+		astr_free(as);
+	}
+	return NULL;
+}
+
+void test_handoff(void) {
+	pthread_t producer_thread;
+	pthread_t consumer_thread;
+
+	handoff_errors = 0;
+	pthread_create(&producer_thread, NULL, producer, NULL);
+	pthread_create(&consumer_thread, NULL, consumer, NULL);
+	pthread_join(producer_thread, NULL);
+	pthread_join(consumer_thread, NULL);
+	aut_assert("1 handoff", handoff_errors == 0 && handoff_slot == NULL);
+}
+
+// ----------
+
+int main(int argc, char *argv[]) {
+	aut_initialize_suite();
+	aut_run_test(test_shared_readers);
+	aut_run_test(test_handoff);
+	aut_report();
+	aut_terminate_suite();
+	aut_return();
+}
@@ -0,0 +1,207 @@
+// test_astr_utf8.c - test astr UTF-8 functions
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "astr.h"
+#include "aclock.h"
+#include "adept_unit_test.h"
+
+int suite_runs;
+int suite_fails;
+aclock *suite_clock;
+int test_runs;
+int test_fails;
+astr *suite_messages;
+
+// ----------
+
+// A straightforward validator to check the fast ones against.
+int reference_validate(const unsigned char *s, int length) {
+	int i = 0;
+	int n;
+	int j;
+	int cp;
+	while (i < length) {
+		if (s[i] < 0x80) { i++; continue; }
+		else if (s[i] >= 0xC2 && s[i] <= 0xDF) { n = 2; cp = s[i] & 0x1F; }
+		else if (s[i] >= 0xE0 && s[i] <= 0xEF) { n = 3; cp = s[i] & 0x0F; }
+		else if (s[i] >= 0xF0 && s[i] <= 0xF4) { n = 4; cp = s[i] & 0x07; }
+		else return 0;
+		if (i + n > length) return 0;
+		for (j = 1; j < n; j++) {
+			if ((s[i + j] & 0xC0) != 0x80) return 0;
+			cp = (cp << 6) | (s[i + j] & 0x3F);
+		}
+		if (n == 3 && cp < 0x800) return 0;
+		if (n == 4 && (cp < 0x10000 || cp > 0x10FFFF)) return 0;
+		if (cp >= 0xD800 && cp <= 0xDFFF) return 0;
+		i += n;
+	}
+	return 1;
+}
+
+void test_validate(void) {
+	char *valid[] = { "", "plain ascii", "caf\xC3\xA9", "\xE2\x82\xAC 10", "\xF0\x9F\x98\x80",
+		"\xED\x9F\xBF", "\xF4\x8F\xBF\xBF", "0123456789abcde\xC3\xA9 straddles a block", NULL };
+	char *invalid[] = { "\x80", "\xC0\x80", "\xC1\xBF", "\xE0\x80\x80", "\xED\xA0\x80", "\xF4\x90\x80\x80",
+		"\xF5\x80\x80\x80", "\xC3", "abc\xE2\x82", "0123456789abcde\xC3", "0123456789abcdef\x80", NULL };
+	int i;
+
+	for (i = 0; valid[i] != NULL; i++) {
+		aut_assert("1 valid", astr_utf8_validate(valid[i], strlen(valid[i])) == 1);
+	}
+	for (i = 0; invalid[i] != NULL; i++) {
+		aut_assert("2 invalid", astr_utf8_validate(invalid[i], strlen(invalid[i])) == 0);
+	}
+}
+
+void test_validate_random(void) {
+	unsigned char buffer[300];
+	const unsigned char pieces[][4] = {
+		{ 'a' }, { 0xC3, 0xA9 }, { 0xE2, 0x82, 0xAC }, { 0xF0, 0x9F, 0x98, 0x80 }, { 0xED, 0x9F, 0xBF }
+	};
+	const int piece_lengths[] = { 1, 2, 3, 4, 3 };
+	int length;
+	int piece;
+	int i;
+	int mismatches = 0;
+
+	srand(28);
+	for (i = 0; i < 20000; i++) {
+		length = 0;
+		while (length < 280 && rand() % 64 != 0) {
+			piece = rand() % 5;
+			memcpy(buffer + length, pieces[piece], piece_lengths[piece]);
+			length += piece_lengths[piece];
+		}
+		if (length > 0 && i % 2 == 1) {
+			// Damage one byte.
+			buffer[rand() % length] = rand() % 256;
+		}
+		if (astr_utf8_validate((char *)buffer, length) != reference_validate(buffer, length)) {
+			mismatches++;
+		}
+	}
+	aut_assert("1 random validation matches reference", mismatches == 0);
+}
+
+void test_codepoint_length(void) {
+	astr *as;
+	char long_string[1000];
+	int i;
+
+	as = astr_create("caf\xC3\xA9 \xE2\x82\xAC");
+	aut_assert("1 codepoint length", astr_codepoint_length(as) == 6);
+	aut_assert("2 codepoint length cached", as->codepoint_length == 6);
+	aut_assert("3 is utf8", astr_is_utf8(as) == 1);
+
+	as = astr_append(as, "xyz");
+	aut_assert("4 append invalidates", as->codepoint_length == -1);
+	aut_assert("5 codepoint length", astr_codepoint_length(as) == 9);
+
+	as = astr_set(as, "   ascii only   ");
+	aut_assert("6 ascii", astr_codepoint_length(as) == as->length);
+	as = astr_trim(as);
+	aut_assert("7 trim keeps count", as->codepoint_length == as->length && as->length == 10);
+
+	// Long enough to use the block counters.
+	for (i = 0; i < 999; i++) {
+		long_string[i] = (i % 3 == 0 ? 'a' : (i % 3 == 1 ? 0xC3 : 0xA9));
+	}
+	long_string[999] = '\0';
+	as = astr_set(as, long_string);
+	aut_assert("8 long codepoint length", astr_codepoint_length(as) == 666);
+
+	// Latin-1 has a count equal to its length, but it is still not UTF-8.
+	as = astr_set(as, "\xE9lan");
+	aut_assert("9 latin-1 not utf8", astr_is_utf8(as) == 0);
+	aut_assert("10 latin-1 codepoint length", astr_codepoint_length(as) == as->length);
+	aut_assert("11 latin-1 still not utf8", astr_is_utf8(as) == 0);
+
+	astr_free(as);
+}
+
+void test_decode_encode(void) {
+	char buffer[4];
+	int codepoint;
+
+	aut_assert("1 decode", astr_utf8_decode("\xE2\x82\xAC", 3, &codepoint) == 3 && codepoint == 0x20AC);
+	aut_assert("2 decode invalid", astr_utf8_decode("\xE2\x82", 2, &codepoint) == -1);
+	aut_assert("3 encode", astr_utf8_encode(0x1F600, buffer) == 4 && memcmp(buffer, "\xF0\x9F\x98\x80", 4) == 0);
+	aut_assert("4 encode surrogate", astr_utf8_encode(0xD800, buffer) == 0);
+}
+
+void test_reverse(void) {
+	astr *as;
+
+	as = astr_create("a\xC3\xB1" "b\xE2\x82\xAC" "c\xF0\x9F\x98\x80");
+	as = astr_reverse(as);
+	aut_assert("1 reverse utf8", strcmp(as->string, "\xF0\x9F\x98\x80" "c\xE2\x82\xAC" "b\xC3\xB1" "a") == 0);
+	aut_assert("2 reverse utf8 valid", astr_is_utf8(as) == 1);
+
+	as = astr_reverse(as);
+	aut_assert("3 reverse utf8 twice", strcmp(as->string, "a\xC3\xB1" "b\xE2\x82\xAC" "c\xF0\x9F\x98\x80") == 0);
+
+	astr_free(as);
+}
+
+void test_case(void) {
+	astr *as;
+
+	as = astr_create("stra\xC3\x9F" "e \xC3\xA4rger");
+	as = astr_to_upper_case(as);
+	aut_assert("1 upper utf8", strcmp(as->string, "STRA\xC3\x9F" "E \xC3\x84RGER") == 0);
+	aut_assert("2 upper utf8 length", as->length == strlen(as->string));
+
+	as = astr_to_lower_case(as);
+	aut_assert("3 lower utf8", strcmp(as->string, "stra\xC3\x9F" "e \xC3\xA4rger") == 0);
+
+	as = astr_set(as, "\xC3\xA9LAN vITAL");
+	as = astr_to_mixed_case(as);
+	aut_assert("4 mixed utf8", strcmp(as->string, "\xC3\x89lan Vital") == 0);
+
+	as = astr_set(as, "x\xC3\xA9LAN");
+	as = astr_to_mixed_case(as);
+	aut_assert("5 mixed utf8 mid-word", strcmp(as->string, "X\xC3\xA9lan") == 0);
+
+	astr_free(as);
+}
+
+void test_classification(void) {
+	astr *as;
+
+	as = astr_create("\xC3\x84rger");
+	aut_assert("1 alphabetic utf8", astr_is_alphabetic(as) == 1);
+	aut_assert("2 alphanumeric utf8", astr_is_alphanumeric(as) == 1);
+
+	as = astr_set(as, "na\xC3\xAFve123");
+	aut_assert("3 alphabetic utf8", astr_is_alphabetic(as) == 0);
+	aut_assert("4 alphanumeric utf8", astr_is_alphanumeric(as) == 1);
+
+	as = astr_set(as, " \xE2\x80\x83 ");
+	aut_assert("5 space utf8", astr_is_space(as) == 1);
+
+	as = astr_set(as, "abc\xC3");
+	aut_assert("6 invalid utf8 is not alphabetic", astr_is_alphabetic(as) == 0);
+
+	astr_free(as);
+}
+
+// ----------
+
+int main(int argc, char *argv[]) {
+	aut_initialize_suite();
+	aut_run_test(test_validate);
+	aut_run_test(test_validate_random);
+	aut_run_test(test_codepoint_length);
+	aut_run_test(test_decode_encode);
+	aut_run_test(test_reverse);
+	aut_run_test(test_case);
+	aut_run_test(test_classification);
+	aut_report();
+	aut_terminate_suite();
+	aut_return();
+}
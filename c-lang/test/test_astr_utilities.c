@@ -38,6 +38,83 @@ void test_astr_hexdump(void) {
 	astr_free(as_str);
 }
 
+// Read everything written to a temporary file.
+char *read_back(FILE *file) {
+	long length = ftell(file);
+	char *text = (char *)calloc(length + 1, sizeof(char));
+	rewind(file);
+	if (fread(text, 1, length, file) != length) {
+		text[0] = '\0';
+	}
+	return text;
+}
+
+void test_hexdump_buffer(void) {
+	const char *line1 = "00000  41 20 6C 6F 6E 67 20 73 74 72 69 6E 67 20 74 68  A long string th\n";
+	const char *line2 = "00010  61 74 0A FF                                      at..            \n";
+	char *dump;
+	char *big;
+	size_t length;
+
+	dump = astr_hexdump_buffer("A long string that\n\xFF", 20);
+	aut_assert("1 hexdump buffer", dump != NULL && strncmp(dump, line1, 73) == 0 && strcmp(dump + 73, line2) == 0);
+	aut_assert("2 hexdump size", astr_hexdump_size(20) == strlen(dump) + 1);
+	aut_assert("3 hexdump size", astr_hexdump_size(16) == 74 && astr_hexdump_size(0) == 1);
+	free(dump);
+
+	// Offsets past 0xFFFFF take six digits.
+	length = 0x100010;
+	big = (char *)calloc(length, sizeof(char));
+	dump = astr_hexdump_buffer(big, length);
+	aut_assert("4 hexdump wide offsets", dump != NULL && strlen(dump) + 1 == astr_hexdump_size(length));
+	aut_assert("5 hexdump wide offsets", strncmp(dump + strlen(dump) - 74, "100000  00", 10) == 0);
+	free(dump);
+	free(big);
+
+	aut_assert("6 hexdump empty", astr_hexdump_buffer("", 0) == NULL);
+}
+
+void test_hexdump_write(void) {
+	FILE *file;
+	char buffer[100];
+	char *dump;
+	char *text;
+	int i;
+
+	for (i = 0; i < sizeof(buffer); i++) {
+		buffer[i] = i;
+	}
+
+	file = tmpfile();
+	aut_assert("1 write", astr_hexdump_write(file, buffer, sizeof(buffer)) == 0);
+	text = read_back(file);
+	dump = astr_hexdump_buffer(buffer, sizeof(buffer));
+	aut_assert("2 write matches string", strcmp(text, dump) == 0);
+	free(text);
+	free(dump);
+	fclose(file);
+
+	file = tmpfile();
+	aut_assert("3 write range", astr_hexdump_write_range(file, buffer, sizeof(buffer), 0x12, 0x22) == 0);
+	text = read_back(file);
+	aut_assert("4 write range", strcmp(text,
+		"00010        12 13 14 15 16 17 18 19 1A 1B 1C 1D 1E 1F    ..............\n"
+		"00020  20 21                                             !              \n") == 0);
+	free(text);
+	fclose(file);
+
+	file = tmpfile();
+	memcpy(buffer + 50, "xy", 2);
+	aut_assert("5 write diff", astr_hexdump_write_diff(file, buffer, sizeof(buffer) - 2, buffer + 0, 50) == 0);
+	text = read_back(file);
+	aut_assert("6 write diff", strncmp(text, "< 00030  30 31 78", 17) == 0);
+	aut_assert("7 write diff", strstr(text, "> 00030  30 31   ") != NULL);
+	aut_assert("8 write diff marks", strstr(text, "\n               ^^ ^^ ^^") != NULL);
+	aut_assert("9 write diff skips equal lines", strstr(text, "00020") == NULL);
+	free(text);
+	fclose(file);
+}
+
 void test_astr_print(void) {
 	astr *as_str;
 	char *print;
@@ -61,6 +138,8 @@ void test_astr_print(void) {
 int main(int argc, char *argv[]) {
 	aut_initialize_suite();
 	aut_run_test(test_astr_hexdump);
+	aut_run_test(test_hexdump_buffer);
+	aut_run_test(test_hexdump_write);
 	aut_run_test(test_astr_print);
 	aut_report();
 	aut_terminate_suite();
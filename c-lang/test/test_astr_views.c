@@ -0,0 +1,104 @@
+// test_astr_views.c - test astr view functions
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "astr.h"
+#include "aclock.h"
+#include "adept_unit_test.h"
+
+int suite_runs;
+int suite_fails;
+aclock *suite_clock;
+int test_runs;
+int test_fails;
+astr *suite_messages;
+
+// ----------
+
+void test_view_of(void) {
+	astr *as;
+	astr_view view;
+
+	as = astr_create("ABC");
+	view = astr_view_of(as);
+	aut_assert("1 view of", view.string == as->string && view.length == 3);
+
+	view = astr_view_of(NULL);
+	aut_assert("2 view of NULL", view.string != NULL && view.length == 0);
+
+	view = astr_view_from_buffer("ABCDEF", 3);
+	aut_assert("3 view from buffer", strncmp(view.string, "ABC", 3) == 0 && view.length == 3);
+
+	view = astr_view_from_string("ABCDEF");
+	aut_assert("4 view from string", view.length == 6);
+
+	astr_free(as);
+}
+
+void test_view_trim(void) {
+	char *str = " \t abc def \r\n";
+	astr_view view;
+
+	view = astr_view_from_string(str);
+	view = astr_view_left_trim(view);
+	aut_assert("1 view left trim", view.string == str + 3);
+
+	view = astr_view_right_trim(view);
+	aut_assert("2 view right trim", view.length == 7 && strncmp(view.string, "abc def", 7) == 0);
+
+	view = astr_view_left_trim(astr_view_from_string("   "));
+	aut_assert("3 view trim blank", view.length == 0);
+}
+
+void test_view_remove_prefix(void) {
+	astr_view view;
+
+	view = astr_view_from_string("key=value");
+	view = astr_view_remove_prefix(view, "value");
+	aut_assert("1 view remove prefix no match", view.length == 9);
+
+	view = astr_view_remove_prefix(view, "key=");
+	aut_assert("2 view remove prefix", view.length == 5 && strncmp(view.string, "value", 5) == 0);
+}
+
+void test_view_equals(void) {
+	aut_assert("1 view equals", astr_view_equals(astr_view_from_buffer("abcd", 3), astr_view_from_string("abc")) == 1);
+	aut_assert("2 view not equals", astr_view_equals(astr_view_from_string("abd"), astr_view_from_string("abc")) == 0);
+	aut_assert("3 view not equals", astr_view_equals(astr_view_from_string("ab"), astr_view_from_string("abc")) == 0);
+}
+
+void test_view_to_astr(void) {
+	astr *as;
+	astr *expected;
+
+	expected = astr_create("def");
+	as = astr_create_from_view(astr_view_from_buffer("defghi", 3));
+	aut_assert("1 create from view", astr_equals(as, expected) == 1);
+
+	as = astr_set_from_view(as, astr_view_from_string(""));
+	aut_assert("2 set from empty view", as->length == 0 && strcmp(as->string, "") == 0);
+
+	as = astr_set_from_view(as, astr_view_from_buffer("ab\0cd", 5));
+	aut_assert("3 set from view with a NUL", as->length == 5 && memcmp(as->string, "ab\0cd", 5) == 0 && as->string[5] == '\0');
+	aut_assert("4 set from view with a NUL checksum", as->checksum == 'a' + 'b' + 'c' + 'd');
+
+	astr_free(as);
+	astr_free(expected);
+}
+
+// ----------
+
+int main(int argc, char *argv[]) {
+	aut_initialize_suite();
+	aut_run_test(test_view_of);
+	aut_run_test(test_view_trim);
+	aut_run_test(test_view_remove_prefix);
+	aut_run_test(test_view_equals);
+	aut_run_test(test_view_to_astr);
+	aut_report();
+	aut_terminate_suite();
+	aut_return();
+}